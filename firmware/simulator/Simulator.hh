@@ -21,8 +21,12 @@
 #endif
 
 #ifndef FPTYPE
+#ifdef NOFIXED
+#define FPTYPE float
+#else
 #define FPTYPE _Accum
 #endif
+#endif
 
 #ifndef FORCE_INLINE
 #define FORCE_INLINE inline
@@ -40,11 +44,20 @@
 #define CRITICAL_SECTION_START  {}
 #define CRITICAL_SECTION_END    {}
 
+// Tables in program memory are ordinary arrays
+#define PROGMEM
+#define pgm_read_word_near(addr) (*(const uint16_t *)(addr))
+
 // Seems like a good idea, eh?
 #ifndef HAS_STEPPER_ACCELERATION
 #define HAS_STEPPER_ACCELERATION
 #endif
 
+// stepsim runs the stepper interrupts against emulated ports and timers
+#if defined(STEPSIM) && defined(__cplusplus)
+#include "StepSim.hh"
+#endif
+
 extern FPTYPE ftofpS(float x, int lineno, const char *src);
 extern FPTYPE itofpS(int32_t x, int lineno, const char *src);
 extern FPTYPE fpsquareS(FPTYPE x, int lineno, const char *src);
@@ -53,6 +66,8 @@ extern FPTYPE fpmult3S(FPTYPE x, FPTYPE y, FPTYPE a, int lineno, const char *src
 extern FPTYPE fpmult4S(FPTYPE x, FPTYPE y, FPTYPE a, FPTYPE b, int lineno, const char *src);
 extern FPTYPE fpdivS(FPTYPE x, FPTYPE y, int lineno, const char *src);
 extern FPTYPE fpsqrtS(FPTYPE x, int lineno, const char *src);
+extern FPTYPE fpdivtableS(FPTYPE x, FPTYPE y, int lineno, const char *src);
+extern FPTYPE fpsqrttableS(FPTYPE x, int lineno, const char *src);
 extern FPTYPE fpabsS(FPTYPE x, int lineno, const char *src);
 extern FPTYPE fpscale2S(FPTYPE x, int lineno, const char *src);
 
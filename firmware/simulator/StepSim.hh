@@ -0,0 +1,68 @@
+// StepSim.hh
+// Emulated AVR registers for building StepperAccel.cc and StepperAxis.cc into
+// the stepsim step trace generator.  Only the registers the stepper code uses
+// are emulated: the I/O ports (at their ATmega2560 addresses) and the stepper
+// timer.  Writes to the port registers are passed to stepsim_port_write() so
+// that every step edge can be traced.
+
+#ifndef STEPSIM_HH_
+
+#define STEPSIM_HH_
+
+#include <inttypes.h>
+
+// Register file, indexed by the data memory address of the register
+#define STEPSIM_REGISTERS 0x200
+
+extern uint8_t stepsim_registers[STEPSIM_REGISTERS];
+
+// Stores the value and traces any step pins which changed
+extern void stepsim_port_write(uint16_t addr, uint8_t value);
+
+// Stands in for _SFR_MEM8(addr) so that the port macros in StepperAxis.hh
+// can be used unchanged
+class StepSimRegister {
+private:
+     uint16_t addr;
+public:
+     StepSimRegister(uint16_t addr_in) : addr(addr_in) { }
+     operator uint8_t() const { return stepsim_registers[addr]; }
+     StepSimRegister& operator=(uint8_t value)  { stepsim_port_write(addr, value); return *this; }
+     StepSimRegister& operator|=(uint8_t value) { stepsim_port_write(addr, stepsim_registers[addr] | value); return *this; }
+     StepSimRegister& operator&=(uint8_t value) { stepsim_port_write(addr, stepsim_registers[addr] & value); return *this; }
+};
+
+#define _SFR_MEM_ADDR(reg) (reg)
+#define _SFR_MEM8(addr)    (StepSimRegister(addr))
+
+// Address of PINx, followed by DDRx and PORTx
+#define STEPSIM_PINA 0x20
+#define STEPSIM_PINB 0x23
+#define STEPSIM_PINC 0x26
+#define STEPSIM_PIND 0x29
+#define STEPSIM_PINE 0x2C
+#define STEPSIM_PINF 0x2F
+#define STEPSIM_PING 0x32
+#define STEPSIM_PINH 0x100
+#define STEPSIM_PINJ 0x103
+#define STEPSIM_PINK 0x106
+#define STEPSIM_PINL 0x109
+
+// As AvrPort.hh: expand steppers into Port, Pin, PinNumber and DDR
+#define STEPPER_PORT(PLETTER, PNUMBER) { STEPSIM_PIN ## PLETTER + 2, \
+					 STEPSIM_PIN ## PLETTER,     \
+					 PNUMBER,		     \
+					 STEPSIM_PIN ## PLETTER + 1  \
+				       }
+
+// The stepper interrupt timer (see STEPPER_OCRnA, etc. in Configuration.hh)
+extern volatile uint16_t OCR3A, TCNT3;
+extern volatile uint8_t TCCR3A, TCCR3B, TCCR3C, TIMSK3;
+#define OCIE3A 1
+
+extern volatile uint8_t SREG;
+
+#define cli()
+#define sei()
+
+#endif
@@ -33,14 +33,18 @@ uint32_t z1[100000];
 uint32_t z2[100000];
 uint32_t iz = 0;
 
-// From StepperAccel.cc
+// From StepperAccel.cc, which stepsim links in
+#ifndef STEPSIM
 static bool deprime_enabled = true;
 static bool deprimed[EXTRUDERS];
 int16_t extruder_deprime_steps[EXTRUDERS];
 bool extrude_when_negative[EXTRUDERS];
+bool extruder_deprime_travel;
+float extruder_only_max_feedrate[EXTRUDERS];
+uint8_t scurve_percent;
+#endif
 
 // From Steppers.cc
-float extruder_only_max_feedrate[EXTRUDERS];
 volatile int32_t starting_e_position[2];
 
 // From time to time, StepperAccelPlanner.cc wants these for debugging
@@ -108,6 +112,39 @@ badness:
 extern volatile unsigned char block_buffer_head;           // Index of the next block to be pushed
 extern volatile unsigned char block_buffer_tail;           // Index of the block to process now
 
+// From StepperAccelPlanner.cc
+extern uint32_t planner_kernel_calls[3];
+extern uint32_t planner_kernel_calls_full[3];
+extern uint32_t planner_recalculations;
+
+#ifndef NOFIXED
+
+// Fixed point operations counted by the overflow checking macros below
+enum {
+     FPOP_FTOFP = 0,
+     FPOP_ITOFP,
+     FPOP_SQUARE,
+     FPOP_MULT2,
+     FPOP_MULT3,
+     FPOP_MULT4,
+     FPOP_DIV,
+     FPOP_SQRT,
+     FPOP_DIV_TABLE,
+     FPOP_SQRT_TABLE,
+     FPOP_SCALE2,
+     FPOP_COUNT
+};
+
+static uint32_t fpop_counts[FPOP_COUNT];
+static const char *fpop_names[FPOP_COUNT] = {
+     "FTOFP", "ITOFP", "FPSQUARE", "FPMULT2", "FPMULT3", "FPMULT4",
+     "FPDIV", "FPSQRT", "FPDIV_TABLE", "FPSQRT_TABLE", "FPSCALE2"
+};
+
+#endif
+
+
+#ifndef STEPSIM
 
 void st_set_position(const int32_t &x, const int32_t &y, const int32_t &z, const int32_t &a, const int32_t &b)
 {
@@ -136,6 +173,8 @@ void st_set_e_position(const int32_t &a, const int32_t &b)
   CRITICAL_SECTION_END;
 }
 
+#endif
+
 int32_t st_get_position(uint8_t axis)
 {
   int32_t count_pos;
@@ -145,6 +184,8 @@ int32_t st_get_position(uint8_t axis)
   return count_pos;
 }
 
+#ifndef STEPSIM
+
 void st_deprime_enable(bool enable)
 {
     deprime_enabled = enable;
@@ -154,6 +195,8 @@ void st_deprime_enable(bool enable)
     }  
 }
 
+#endif
+
 static uint16_t calc_timer(uint16_t step_rate, int *step_loops)
 {
      if (step_rate > MAX_STEP_FREQUENCY)
@@ -216,6 +259,10 @@ void plan_dump_current_block(int discard, int report)
      if (!block)
 	  return;
 
+     // Release the block's queued starting position as setup_next_block() would
+     if (discard && block->position_defined)
+	  (void)plan_take_defined_position();
+
      if (report && block->message[0] != '\0')
 	  printf("%s", block->message);
 
@@ -441,6 +488,39 @@ void plan_dump_run_data(int time_only)
 
      memset(planner_counts, 0, sizeof(planner_counts));
 
+     if (planner_recalculations)
+     {
+	  static const char *pass_names[3] = { "reverse", "forward", "trapezoid" };
+	  uint32_t calls = 0, calls_full = 0;
+
+	  printf("Planner kernel invocations per block (incremental / full replan):\n");
+	  for (i = 0; i < 3; i++)
+	  {
+	       printf("    %-9s %8.3f / %8.3f\n", pass_names[i],
+		      (float)planner_kernel_calls[i] / (float)planner_recalculations,
+		      (float)planner_kernel_calls_full[i] / (float)planner_recalculations);
+	       calls      += planner_kernel_calls[i];
+	       calls_full += planner_kernel_calls_full[i];
+	  }
+	  printf("    saved %8.3f per block (%.1f%%)\n",
+		 (float)(calls_full - calls) / (float)planner_recalculations,
+		 calls_full ? 100.0 * (float)(calls_full - calls) / (float)calls_full : 0.0);
+
+#ifndef NOFIXED
+	  printf("Fixed point operations per block:\n");
+	  for (i = 0; i < FPOP_COUNT; i++)
+	       if (fpop_counts[i])
+		    printf("    %-12s %8.3f\n", fpop_names[i],
+			   (float)fpop_counts[i] / (float)planner_recalculations);
+
+	  memset(fpop_counts, 0, sizeof(fpop_counts));
+#endif
+
+	  memset(planner_kernel_calls, 0, sizeof(planner_kernel_calls));
+	  memset(planner_kernel_calls_full, 0, sizeof(planner_kernel_calls_full));
+	  planner_recalculations = 0;
+     }
+
      ztot1 = 0.0;
      ztot2 = 0.0;
      zavg_min1 = z1[2];
@@ -484,8 +564,12 @@ void plan_block_notice(const char *fmt, ...)
      va_end(ap);
 }
 
+// Overflow checking versions of the fixed point macros, not needed by a float (NOFIXED) build
+#ifndef NOFIXED
+
 FPTYPE ftofpS(float x, int lineno, const char *src)
 {
+    fpop_counts[FPOP_FTOFP]++;
     if (x > 32767.0f || x < -32768.0f)
 	 printf(">>> OVERFLOW: FTOFP(%f) call on line %d pf %s is suspect; "
 		"the value %f is too large for an FPTYPE <<<\n",
@@ -495,6 +579,7 @@ FPTYPE ftofpS(float x, int lineno, const char *src)
 
 FPTYPE itofpS(int32_t x, int lineno, const char *src)
 {
+    fpop_counts[FPOP_ITOFP]++;
     if (x > 0x7fff || x < -0x8000)
 	 printf(">>> OVERFLOW: IPTOF(%d) call on line %d of %s is suspect; "
 		"the value %d is too large for an FPTYPE <<<\n",
@@ -504,6 +589,7 @@ FPTYPE itofpS(int32_t x, int lineno, const char *src)
 
 FPTYPE fpsquareS(FPTYPE x, int lineno, const char *src)
 {
+    fpop_counts[FPOP_SQUARE]++;
     double z = ktof(x) * ktof(x); 
     if (z > 32767.0f)
 	 printf(">>> OVERFLOW: FPSQUARE(%f) call on line %d of %s is suspect; "
@@ -514,6 +600,7 @@ FPTYPE fpsquareS(FPTYPE x, int lineno, const char *src)
 
 FPTYPE fpmult2S(FPTYPE x, FPTYPE y, int lineno, const char *src)
 {
+     fpop_counts[FPOP_MULT2]++;
      double z = ktof(x) * ktof(y);
      if (z > 32767.0f || z < -32768.0f)
 	 printf(">>> OVERFLOW: FPMULT2(%f, %f) call on line %d of %s is suspect; "
@@ -524,6 +611,7 @@ FPTYPE fpmult2S(FPTYPE x, FPTYPE y, int lineno, const char *src)
 
 FPTYPE fpmult3S(FPTYPE x, FPTYPE y, FPTYPE a, int lineno, const char *src)
 {
+     fpop_counts[FPOP_MULT3]++;
      double z = ktof(x) * ktof(y) * ktof(a);
      if (z > 32767.0f || z < -32768.0f)
 	 printf(">>> OVERFLOW: FPMULT3(%f, %f, %f) call on line %d of %s is suspect; "
@@ -534,6 +622,7 @@ FPTYPE fpmult3S(FPTYPE x, FPTYPE y, FPTYPE a, int lineno, const char *src)
 
 FPTYPE fpmult4S(FPTYPE x, FPTYPE y, FPTYPE a, FPTYPE b, int lineno, const char *src)
 {
+     fpop_counts[FPOP_MULT4]++;
      double z = ktof(x) * ktof(y) * ktof(a) * ktof(b);
      if (z > 32767.0f || z < -32768.0f)
 	 printf(">>> OVERFLOW: FPMULT4(%f, %f, %f, %f) call on line %d of %s is suspect; "
@@ -545,6 +634,7 @@ FPTYPE fpmult4S(FPTYPE x, FPTYPE y, FPTYPE a, FPTYPE b, int lineno, const char *
 
 FPTYPE fpdivS(FPTYPE x, FPTYPE y, int lineno, const char *src)
 {
+     fpop_counts[FPOP_DIV]++;
      double z = ktof(x) / ktof(y);
      if (z > 32767.0f || z < -32768.0f)
 	 printf(">>> OVERFLOW: FPDIV(%f, %f) call on line %d of %s is suspect; "
@@ -553,8 +643,42 @@ FPTYPE fpdivS(FPTYPE x, FPTYPE y, int lineno, const char *src)
      return divk(x, y);
 }
 
+FPTYPE fpsqrtS(FPTYPE x, int lineno, const char *src)
+{
+     fpop_counts[FPOP_SQRT]++;
+     if (x < 0)
+	  printf(">>> NEGATIVE: FPSQRT(%f) call on line %d of %s is suspect <<<\n",
+		 ktof(x), lineno, src ? src : "???");
+     return sqrtk(x);
+}
+
+#ifdef RECIPROCAL_TABLES
+
+FPTYPE fpdivtableS(FPTYPE x, FPTYPE y, int lineno, const char *src)
+{
+     fpop_counts[FPOP_DIV_TABLE]++;
+     double z = ktof(x) / ktof(y);
+     if (z > 32767.0f || z < -32768.0f)
+	 printf(">>> OVERFLOW: FPDIV_TABLE(%f, %f) call on line %d of %s is suspect; "
+		"%f / %f is too large for an FPTYPE <<<\n",
+		ktof(x), ktof(y), lineno, src ? src : "???", ktof(x), ktof(y));
+     return fpdiv_table(x, y);
+}
+
+FPTYPE fpsqrttableS(FPTYPE x, int lineno, const char *src)
+{
+     fpop_counts[FPOP_SQRT_TABLE]++;
+     if (x < 0)
+	  printf(">>> NEGATIVE: FPSQRT_TABLE(%f) call on line %d of %s is suspect <<<\n",
+		 ktof(x), lineno, src ? src : "???");
+     return fpsqrt_table(x);
+}
+
+#endif
+
 FPTYPE fpscale2S(FPTYPE x, int lineno, const char *src)
 {
+     fpop_counts[FPOP_SCALE2]++;
      double z = ktof(x) * 2.0;
      if (z > 32767.0f || z < -32768.0f)
 	  printf(">>> OVERFLOW: FPSCALE(%f) call on line %d of %s is suspect; "
@@ -563,6 +687,8 @@ FPTYPE fpscale2S(FPTYPE x, int lineno, const char *src)
      return x << 1;
 }
 
+#endif
+
 
 namespace eeprom {
 
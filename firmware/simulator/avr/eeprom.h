@@ -0,0 +1,53 @@
+// avr/eeprom.h
+// Host stand-in for avr-libc's EEPROM routines, keeping the EEPROM in RAM;
+// see eeprom_ram.c.  Addresses are EEPROM offsets cast to pointers, as on
+// the AVR.  After each byte is written the EEPROM reports itself busy for
+// a while, as the AVR's does while it programs the byte, so that code
+// which is meant to write only while the EEPROM is idle can be checked.
+
+#ifndef EEPROM_RAM_H_
+
+#define EEPROM_RAM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define E2END 0x0FFF
+
+typedef struct {
+     unsigned long writes;    // Bytes written
+     unsigned long stalls;    // Reads and writes made while busy, which
+                              //   the AVR would have waited on
+     unsigned long dropped;   // Writes dropped by eeprom_ram_write_limit
+     unsigned long most;      // Most bytes written to any one address,
+                              //   which is what wears the EEPROM out
+} eeprom_ram_stats_t;
+
+extern eeprom_ram_stats_t eeprom_ram_stats;
+
+// Calls to eeprom_is_ready() which return false after each write
+extern unsigned int eeprom_ram_write_wait;
+
+// Writes after this many more are dropped, as when the power fails; -1
+// for no limit
+extern long eeprom_ram_write_limit;
+
+// Fill the EEPROM with 0xFF, as an erased EEPROM is, and reset the stats
+void eeprom_ram_erase(void);
+
+int eeprom_is_ready(void);
+uint8_t eeprom_read_byte(const uint8_t *addr);
+void eeprom_write_byte(uint8_t *addr, uint8_t value);
+void eeprom_read_block(void *dst, const void *src, size_t n);
+void eeprom_write_block(const void *src, void *dst, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
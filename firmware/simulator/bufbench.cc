@@ -0,0 +1,170 @@
+// bufbench.cc
+//
+// Times pushing bytes through CircularBuffer.hh's buffers on the host,
+// CircularBufferTempl wrapping its indices with % and
+// FixedCircularBufferTempl masking them, a byte at a time and in chunks
+// the size of a command:
+//
+//     bufbench [-n mbytes]
+//
+// The bytes are checked as they come out.  The AVR has no divide
+// instruction, so % costs it far more than it costs the host, and the
+// host's ratio only hints at the bot's.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "CircularBuffer.hh"
+
+#if defined(__arm__)
+#define GETOPTS_END (char)-1
+#else
+#define GETOPTS_END -1
+#endif
+
+// Size of the buffers, as the command buffer's; kept half full
+#define BENCH_SIZE 512
+
+// Bytes pushed and popped at a time, as a command
+#define CHUNK 32
+
+static long mbytes = 64;
+
+static void usage(FILE *f, const char *prog)
+{
+     if (f == NULL)
+	  f = stderr;
+
+     fprintf(f,
+"Usage: %s [-n mbytes]\n"
+"  ?, -h  -- This help message\n"
+"     -n  -- Megabytes to push through each buffer; default 64\n",
+	     prog ? prog : "bufbench");
+}
+
+static double now_secs(void)
+{
+     struct timespec ts;
+
+     clock_gettime(CLOCK_MONOTONIC, &ts);
+     return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static void report(const char *name, double secs, long bytes)
+{
+     printf("%-26s %7.3f s, %6.2f ns/byte\n", name, secs, secs * 1e9 / bytes);
+}
+
+// Push bytes through a buffer a byte at a time; returns the number
+// which didn't come out as they went in
+
+template<typename Buffer>
+static long bytes_through(Buffer &cb, long bytes)
+{
+     long errors = 0;
+     long i;
+
+     for (i = 0; i < BENCH_SIZE / 2; i++)
+	  cb.push((uint8_t)i);
+     for (i = BENCH_SIZE / 2; i < bytes; i++)
+     {
+	  cb.push((uint8_t)i);
+	  errors += cb.pop() != (uint8_t)(i - BENCH_SIZE / 2);
+     }
+     return(errors);
+}
+
+// Push bytes through a buffer a chunk at a time; returns the number of
+// chunks which didn't come out as they went in
+
+template<typename Buffer>
+static long chunks_through(Buffer &cb, long bytes)
+{
+     uint8_t chunk[CHUNK], out[CHUNK];
+     long errors = 0;
+     long i;
+
+     for (i = 0; i < CHUNK; i++)
+	  chunk[i] = (uint8_t)i;
+     for (i = 0; i < BENCH_SIZE / 2; i += CHUNK)
+	  cb.push(chunk, CHUNK);
+     for (i = 0; i < bytes; i += CHUNK)
+     {
+	  cb.push(chunk, CHUNK);
+	  cb.pop(out, CHUNK);
+	  errors += out[i % CHUNK] != i % CHUNK;
+     }
+     return(errors);
+}
+
+int main(int argc, const char *argv[])
+{
+     long bytes, errors = 0;
+     double start;
+     char c;
+
+     while ((c = getopt(argc, (char **)argv, ":hn:?")) != GETOPTS_END)
+     {
+	  switch(c)
+	  {
+	  case 'n' :
+	       mbytes = atol(optarg);
+	       break;
+
+	  case 'h' :
+	  case '?' :
+	       usage(stdout, argv[0]);
+	       return(0);
+
+	  case ':' :
+	  default :
+	       usage(stderr, argv[0]);
+	       return(1);
+	  }
+     }
+
+     if (mbytes <= 0)
+     {
+	  usage(stderr, argv[0]);
+	  return(1);
+     }
+
+     bytes = mbytes * 1024 * 1024;
+
+     // Hide the size from the compiler, as it is in the firmware, so that
+     // it can't reduce the modulo to a mask
+     volatile BufSizeType runtime_size = BENCH_SIZE;
+     uint8_t data[BENCH_SIZE];
+     CircularBuffer cb(runtime_size, data);
+     FixedCircularBufferTempl<uint8_t, BENCH_SIZE> fixed;
+
+     start = now_secs();
+     errors += bytes_through(cb, bytes);
+     report("Byte push/pop, modulo", now_secs() - start, bytes);
+
+     start = now_secs();
+     errors += bytes_through(fixed, bytes);
+     report("Byte push/pop, masked", now_secs() - start, bytes);
+
+     cb.reset();
+     fixed.reset();
+
+     start = now_secs();
+     errors += chunks_through(cb, bytes);
+     report("32 byte push/pop, modulo", now_secs() - start, bytes);
+
+     start = now_secs();
+     errors += chunks_through(fixed, bytes);
+     report("32 byte push/pop, masked", now_secs() - start, bytes);
+
+     if (errors || cb.hasOverflow() || cb.hasUnderflow() ||
+	 fixed.hasOverflow() || fixed.hasUnderflow())
+     {
+	  fprintf(stderr, "bufbench: %ld bytes or chunks came out wrong\n", errors);
+	  return(1);
+     }
+
+     return(0);
+}
@@ -0,0 +1,165 @@
+// crcbench.cc
+//
+// Times the iButton CRC of Packet.cc on the host, bit by bit with
+// _crc_ibutton_update() and with the lookup table, and then filling and
+// receiving whole packets:
+//
+//     crcbench [-n mbytes]
+//
+// The bitwise and table CRCs of the same bytes are checked to agree.  The
+// AVR takes a cycle or two per bit for the bitwise loop and a few cycles for
+// the table's flash read, so the host's ratio only hints at the bot's.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <util/crc16.h>
+
+#include "Packet.hh"
+
+#if defined(__arm__)
+#define GETOPTS_END (char)-1
+#else
+#define GETOPTS_END -1
+#endif
+
+static long mbytes = 64;
+
+static void usage(FILE *f, const char *prog)
+{
+     if (f == NULL)
+	  f = stderr;
+
+     fprintf(f,
+"Usage: %s [-n mbytes]\n"
+"  ?, -h  -- This help message\n"
+"     -n  -- Megabytes to run through each CRC; default 64\n",
+	     prog ? prog : "crcbench");
+}
+
+static double now_secs(void)
+{
+     struct timespec ts;
+
+     clock_gettime(CLOCK_MONOTONIC, &ts);
+     return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static void report(const char *name, double secs, long bytes)
+{
+     printf("%-26s %7.3f s, %6.2f ns/byte\n", name, secs, secs * 1e9 / bytes);
+}
+
+int main(int argc, const char *argv[])
+{
+     uint8_t data[MAX_PACKET_PAYLOAD];
+     uint8_t bit_crc, table_crc, sum;
+     long bytes, packets, i;
+     double start;
+     char c;
+
+     while ((c = getopt(argc, (char **)argv, ":hn:?")) != GETOPTS_END)
+     {
+	  switch(c)
+	  {
+	  case 'n' :
+	       mbytes = atol(optarg);
+	       break;
+
+	  case 'h' :
+	  case '?' :
+	       usage(stdout, argv[0]);
+	       return(0);
+
+	  case ':' :
+	  default :
+	       usage(stderr, argv[0]);
+	       return(1);
+	  }
+     }
+
+     if (mbytes <= 0)
+     {
+	  usage(stderr, argv[0]);
+	  return(1);
+     }
+
+     bytes = mbytes * 1024 * 1024;
+     packets = bytes / MAX_PACKET_PAYLOAD;
+     for (i = 0; i < MAX_PACKET_PAYLOAD; i++)
+	  data[i] = (uint8_t)random();
+
+     // The CRC of a stream of bytes, one at a time
+
+     bit_crc = 0;
+     start = now_secs();
+     for (i = 0; i < bytes; i++)
+	  bit_crc = _crc_ibutton_update(bit_crc, (uint8_t)(i ^ (i >> 8)));
+     report("_crc_ibutton_update()", now_secs() - start, bytes);
+
+     table_crc = 0;
+     start = now_secs();
+     for (i = 0; i < bytes; i++)
+	  table_crc = crcIButtonUpdate(table_crc, (uint8_t)(i ^ (i >> 8)));
+     report("crcIButtonUpdate()", now_secs() - start, bytes);
+
+     if (bit_crc != table_crc)
+     {
+	  fprintf(stderr, "crcbench: the bitwise CRC is 0x%02x but the table's "
+		  "is 0x%02x\n", bit_crc, table_crc);
+	  return(1);
+     }
+
+     // Filling packets, as responses are
+
+     OutPacket out;
+     sum = 0;
+     start = now_secs();
+     for (i = 0; i < packets; i++)
+     {
+	  out.reset();
+	  for (int j = 0; j < MAX_PACKET_PAYLOAD; j++)
+	       out.append8(data[j]);
+	  sum += out.getLength();
+     }
+     report("OutPacket::append8()", now_secs() - start, packets * MAX_PACKET_PAYLOAD);
+
+     start = now_secs();
+     for (i = 0; i < packets; i++)
+     {
+	  out.reset();
+	  out.appendBytes(data, MAX_PACKET_PAYLOAD);
+	  sum += out.getLength();
+     }
+     report("OutPacket::appendBytes()", now_secs() - start, packets * MAX_PACKET_PAYLOAD);
+
+     // Receiving packets, as the UART's receive interrupt does
+
+     uint8_t frame[MAX_PACKET_PAYLOAD + 3];
+     out.reset();
+     out.appendBytes(data, MAX_PACKET_PAYLOAD);
+     for (i = 0; i < MAX_PACKET_PAYLOAD + 3; i++)
+	  frame[i] = out.getNextByteToSend();
+
+     InPacket in;
+     start = now_secs();
+     for (i = 0; i < packets; i++)
+     {
+	  in.reset();
+	  for (int j = 0; j < MAX_PACKET_PAYLOAD + 3; j++)
+	       in.processByte(frame[j]);
+	  sum += in.isFinished();
+     }
+     report("InPacket::processByte()", now_secs() - start, packets * (MAX_PACKET_PAYLOAD + 3));
+
+     if (in.isFinished() != 1)
+     {
+	  fprintf(stderr, "crcbench: a packet was received with error %d\n",
+		  in.getErrorCode());
+	  return(1);
+     }
+
+     // Keep the packet loops from being optimized away
+     return(sum == 1 ? 2 : 0);
+}
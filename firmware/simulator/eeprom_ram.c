@@ -0,0 +1,79 @@
+// eeprom_ram.c
+// RAM backed replacement for avr-libc's EEPROM routines; see avr/eeprom.h
+
+#include <string.h>
+
+#include "avr/eeprom.h"
+
+eeprom_ram_stats_t eeprom_ram_stats;
+
+unsigned int eeprom_ram_write_wait = 4;
+long eeprom_ram_write_limit = -1;
+
+static uint8_t eeprom[E2END + 1];
+static unsigned long writes[E2END + 1];
+static unsigned int busy = 0;
+
+void eeprom_ram_erase(void)
+{
+     memset(eeprom, 0xff, sizeof(eeprom));
+     memset(writes, 0, sizeof(writes));
+     memset(&eeprom_ram_stats, 0, sizeof(eeprom_ram_stats));
+     busy = 0;
+}
+
+int eeprom_is_ready(void)
+{
+     if (busy == 0)
+	  return(1);
+     busy--;
+     return(0);
+}
+
+// The AVR routines wait for the EEPROM to finish programming the last byte
+// written; count those waits and finish the programming
+
+static void wait_ready(void)
+{
+     if (busy)
+     {
+	  eeprom_ram_stats.stalls++;
+	  busy = 0;
+     }
+}
+
+uint8_t eeprom_read_byte(const uint8_t *addr)
+{
+     wait_ready();
+     return(eeprom[(uintptr_t)addr & E2END]);
+}
+
+void eeprom_write_byte(uint8_t *addr, uint8_t value)
+{
+     wait_ready();
+     if (eeprom_ram_write_limit == 0)
+     {
+	  eeprom_ram_stats.dropped++;
+	  return;
+     }
+     if (eeprom_ram_write_limit > 0)
+	  eeprom_ram_write_limit--;
+
+     eeprom[(uintptr_t)addr & E2END] = value;
+     eeprom_ram_stats.writes++;
+     if (++writes[(uintptr_t)addr & E2END] > eeprom_ram_stats.most)
+	  eeprom_ram_stats.most = writes[(uintptr_t)addr & E2END];
+     busy = eeprom_ram_write_wait;
+}
+
+void eeprom_read_block(void *dst, const void *src, size_t n)
+{
+     for (size_t i = 0; i < n; i++)
+	  ((uint8_t *)dst)[i] = eeprom_read_byte((const uint8_t *)src + i);
+}
+
+void eeprom_write_block(const void *src, void *dst, size_t n)
+{
+     for (size_t i = 0; i < n; i++)
+	  eeprom_write_byte((uint8_t *)dst + i, ((const uint8_t *)src)[i]);
+}
@@ -0,0 +1,222 @@
+// fatimage.c
+// FAT16 and FAT32 disk image generator; see fatimage.h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "fatimage.h"
+
+#define SECTOR_SIZE 512
+
+// FAT16 root directory entries, and FAT32 reserved sectors
+#define ROOT_ENTRIES 512
+#define FAT32_RESERVED 32
+
+// First FAT32 root directory cluster; the root directory takes as many
+// clusters as the files need, in a single run
+#define FAT32_ROOT 2
+
+uint8_t fat_image_byte(uint32_t offset)
+{
+     return (uint8_t)(offset ^ (offset >> 8) ^ (offset >> 16));
+}
+
+static void put16(uint8_t *buf, uint16_t val)
+{
+     buf[0] = (uint8_t)val;
+     buf[1] = (uint8_t)(val >> 8);
+}
+
+static void put32(uint8_t *buf, uint32_t val)
+{
+     put16(buf, (uint16_t)val);
+     put16(buf + 2, (uint16_t)(val >> 16));
+}
+
+// Set the FAT entry for a cluster
+
+static void set_fat(uint8_t *fat, fat_image_type_t type, uint32_t cluster, uint32_t val)
+{
+     if (type == FAT_IMAGE_FAT32)
+	  put32(fat + cluster * 4, val);
+     else
+	  put16(fat + cluster * 2, (uint16_t)val);
+}
+
+int fat_image_create(const char *path, fat_image_type_t type, uint8_t cluster_sectors,
+		     const fat_image_file_t *files, int nfiles)
+{
+     uint32_t cluster_size = (uint32_t)cluster_sectors * SECTOR_SIZE;
+     uint32_t eoc = (type == FAT_IMAGE_FAT32) ? 0x0fffffff : 0xffff;
+     uint32_t root_clusters = ((uint32_t)(nfiles + 1) * 32 + cluster_size - 1) / cluster_size;
+     int i;
+
+     // Clusters needed for the root directory, the files and the gaps
+     // between their runs
+     uint32_t used = (type == FAT_IMAGE_FAT32) ? FAT32_ROOT + root_clusters : 2;
+     for (i = 0; i < nfiles; i++)
+     {
+	  uint32_t n = (files[i].size + cluster_size - 1) / cluster_size;
+	  used += files[i].runs ? n + n / files[i].runs : n;
+     }
+
+     // Enough clusters for the files, and enough to be a FAT16 or a FAT32
+     uint32_t clusters = used + 16;
+     if (type == FAT_IMAGE_FAT32)
+     {
+	  if (clusters < 65600)
+	       clusters = 65600;
+     }
+     else
+     {
+	  if (clusters < 4200)
+	       clusters = 4200;
+	  if (clusters >= 65525)
+	  {
+	       fprintf(stderr, "The files are too large for a FAT16 with %u byte clusters\n",
+		       cluster_size);
+	       return(-1);
+	  }
+     }
+
+     uint32_t entry_size = (type == FAT_IMAGE_FAT32) ? 4 : 2;
+     uint32_t fat_sectors = ((clusters + 2) * entry_size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+     uint32_t reserved = (type == FAT_IMAGE_FAT32) ? FAT32_RESERVED : 1;
+     uint32_t root_size = (type == FAT_IMAGE_FAT32) ? root_clusters * cluster_size : ROOT_ENTRIES * 32;
+     uint32_t data_sector = reserved + 2 * fat_sectors +
+	  ((type == FAT_IMAGE_FAT32) ? 0 : root_size / SECTOR_SIZE);
+     uint32_t sectors = data_sector + clusters * cluster_sectors;
+
+     if ((uint32_t)nfiles >= root_size / 32)
+     {
+	  fprintf(stderr, "Too many files for the root directory\n");
+	  return(-1);
+     }
+
+     uint8_t *boot = (uint8_t *)calloc(1, SECTOR_SIZE);
+     uint8_t *fat = (uint8_t *)calloc(fat_sectors, SECTOR_SIZE);
+     uint8_t *root = (uint8_t *)calloc(1, root_size);
+     uint8_t *data = (uint8_t *)malloc(cluster_size);
+     FILE *f = NULL;
+     int ret = -1;
+
+     if (!boot || !fat || !root || !data)
+     {
+	  fprintf(stderr, "Unable to allocate memory\n");
+	  goto done;
+     }
+
+     f = fopen(path, "w+b");
+     if (!f)
+     {
+	  fprintf(stderr, "Unable to create %s; %s\n", path, strerror(errno));
+	  goto done;
+     }
+
+     // Boot sector
+     boot[0] = 0xeb;
+     boot[1] = 0x58;
+     boot[2] = 0x90;
+     memcpy(boot + 0x03, "SAILFISH", 8);
+     put16(boot + 0x0b, SECTOR_SIZE);
+     boot[0x0d] = cluster_sectors;
+     put16(boot + 0x0e, (uint16_t)reserved);
+     boot[0x10] = 2;
+     boot[0x15] = 0xf8;
+     put16(boot + 0x18, 32);
+     put16(boot + 0x1a, 64);
+     if (sectors < 0x10000)
+	  put16(boot + 0x13, (uint16_t)sectors);
+     else
+	  put32(boot + 0x20, sectors);
+     if (type == FAT_IMAGE_FAT32)
+     {
+	  put32(boot + 0x24, fat_sectors);
+	  put32(boot + 0x2c, FAT32_ROOT);
+	  put16(boot + 0x30, 1);
+	  put16(boot + 0x32, 6);
+	  boot[0x40] = 0x80;
+	  boot[0x42] = 0x29;
+	  put32(boot + 0x43, 0x12345678);
+	  memcpy(boot + 0x47, "NO NAME    FAT32   ", 19);
+     }
+     else
+     {
+	  put16(boot + 0x11, ROOT_ENTRIES);
+	  put16(boot + 0x16, (uint16_t)fat_sectors);
+	  boot[0x24] = 0x80;
+	  boot[0x26] = 0x29;
+	  put32(boot + 0x27, 0x12345678);
+	  memcpy(boot + 0x2b, "NO NAME    FAT16   ", 19);
+     }
+     boot[0x1fe] = 0x55;
+     boot[0x1ff] = 0xaa;
+
+     // Lay out the files, writing their contents as we go
+     set_fat(fat, type, 0, (type == FAT_IMAGE_FAT32) ? 0x0ffffff8 : 0xfff8);
+     set_fat(fat, type, 1, eoc);
+     uint32_t next_cluster = 2;
+     if (type == FAT_IMAGE_FAT32)
+	  for (uint32_t j = 0; j < root_clusters; j++, next_cluster++)
+	       set_fat(fat, type, next_cluster, (j + 1 < root_clusters) ? next_cluster + 1 : eoc);
+
+     for (i = 0; i < nfiles; i++)
+     {
+	  uint32_t n = (files[i].size + cluster_size - 1) / cluster_size;
+	  uint32_t first = n ? next_cluster : 0;
+	  uint32_t j;
+
+	  for (j = 0; j < n; j++)
+	  {
+	       uint32_t cluster = next_cluster++;
+	       if (files[i].runs && (j + 1) % files[i].runs == 0)
+		    next_cluster++;
+	       set_fat(fat, type, cluster, (j + 1 < n) ? next_cluster : eoc);
+
+	       for (uint32_t k = 0; k < cluster_size; k++)
+		    data[k] = fat_image_byte(j * cluster_size + k);
+	       fseeko(f, ((off_t)data_sector * SECTOR_SIZE) +
+		      (off_t)(cluster - 2) * cluster_size, SEEK_SET);
+	       fwrite(data, cluster_size, 1, f);
+	  }
+
+	  uint8_t *entry = root + i * 32;
+	  memcpy(entry, files[i].name, 11);
+	  entry[0x0b] = 0x20;  // archive
+	  put16(entry + 0x14, (uint16_t)(first >> 16));
+	  put16(entry + 0x1a, (uint16_t)first);
+	  put32(entry + 0x1c, files[i].size);
+     }
+
+     // Write the boot sector, FATs, and root directory
+     fseeko(f, 0, SEEK_SET);
+     fwrite(boot, SECTOR_SIZE, 1, f);
+     fseeko(f, (off_t)reserved * SECTOR_SIZE, SEEK_SET);
+     fwrite(fat, SECTOR_SIZE, fat_sectors, f);
+     fwrite(fat, SECTOR_SIZE, fat_sectors, f);
+     if (type == FAT_IMAGE_FAT32)
+	  fseeko(f, ((off_t)data_sector * SECTOR_SIZE) +
+		 (off_t)(FAT32_ROOT - 2) * cluster_size, SEEK_SET);
+     fwrite(root, root_size, 1, f);
+
+     if (ftruncate(fileno(f), (off_t)sectors * SECTOR_SIZE) || ferror(f))
+	  fprintf(stderr, "Error writing %s; %s\n", path, strerror(errno));
+     else
+	  ret = 0;
+
+done:
+     if (f && fclose(f) && !ret)
+     {
+	  fprintf(stderr, "Error writing %s; %s\n", path, strerror(errno));
+	  ret = -1;
+     }
+     free(boot);
+     free(fat);
+     free(root);
+     free(data);
+
+     return(ret);
+}
@@ -0,0 +1,42 @@
+// fatimage.h
+// Generate FAT16 and FAT32 disk images holding test files, for testing
+// lib_sd and sdcard:: on the host with sd_raw_file.c.  The images have no
+// partition table (they are "superfloppies"), and all the files are in
+// the root directory.
+
+#ifndef FATIMAGE_H_
+
+#define FATIMAGE_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef enum {
+     FAT_IMAGE_FAT16 = 16,
+     FAT_IMAGE_FAT32 = 32
+} fat_image_type_t;
+
+typedef struct {
+     const char *name;  // 8.3 name padded with spaces, e.g. "TEST    S3G"
+     uint32_t size;     // File size in bytes
+     uint32_t runs;     // Store the file in runs of this many clusters with a
+                        //   free cluster after each run; 0 for one run
+} fat_image_file_t;
+
+// Contents of each file at the given offset into the file
+uint8_t fat_image_byte(uint32_t offset);
+
+// Create the image file.  Returns 0 on success and -1 on error, with an
+// error message written to stderr.
+int fat_image_create(const char *path, fat_image_type_t type, uint8_t cluster_sectors,
+		     const fat_image_file_t *files, int nfiles);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -67,13 +67,13 @@ static ssize_t display(void *ctx_, unsigned char *str, size_t len)
 
 #if defined(SAILTIME)
 #define PROGNAME "sailtime"
-#define OPTIONS "[-? | -h] [-a x,y,z,a,b] [-c x,y,z,a,b]"
-#define GETOPTS ":a:c:h?"
+#define OPTIONS "[-? | -h] [-a x,y,z,a,b] [-b blocks] [-c x,y,z,a,b] [-g degrees] [-j mm]"
+#define GETOPTS ":a:b:c:g:hj:?"
 #define REPORT 0
 #else
 #define PROGNAME "planner"
-#define OPTIONS "[-? | -h] [-a x,y,z,a,b] [-c x,y,z,a,b] [-msu] [-d mask] [-r rate]"
-#define GETOPTS ":a:c:hd:mr:su?"
+#define OPTIONS "[-? | -h] [-a x,y,z,a,b] [-b blocks] [-c x,y,z,a,b] [-g degrees] [-j mm] [-msu] [-d mask] [-r rate]"
+#define GETOPTS ":a:b:c:g:hd:j:mr:su?"
 #define REPORT -1
 #endif
 
@@ -86,7 +86,11 @@ static void usage(FILE *f, const char *prog)
 "Usage: %s " OPTIONS " [file]\n"
 "         file -- The name of the .s3g or .x3g file to dump.  If not supplied then stdin is dumped\n"
 " -a x,y,z,a,b -- Maximum x, y, z, a, and b accelerations (mm/s^2)\n"
+"    -b blocks -- Simulate a planner buffer of \"blocks\" blocks (default %d)\n"
 " -c x,y,z,a,b -- Maximum x, y, z, a, and b speed changes (mm/s)\n"
+"   -g degrees -- Merge moves whose directions are within \"degrees\" (0 to 45) of each other\n"
+"        -j mm -- Limit junction speeds with a junction deviation of \"mm\" (0 to 1)\n"
+"                 rather than the maximum speed changes\n"
 #if !defined(SAILTIME)
 "      -d mask -- Selectively enable debugging with a bit mask \"mask\"\n"
 "           -m -- Display actual s3g/x3g move commands and\n"
@@ -106,6 +110,7 @@ static void usage(FILE *f, const char *prog)
 "        z = %d mm/s\n"
 "     a, b = %d mm/s\n",
 	     prog ? prog : PROGNAME,
+	     BLOCK_BUFFER_SIZE,
 	     EEPROM_DEFAULT_ACCEL_MAX_ACCELERATION_X,
 	     EEPROM_DEFAULT_ACCEL_MAX_ACCELERATION_Z,
 	     EEPROM_DEFAULT_ACCEL_MAX_ACCELERATION_A,
@@ -121,6 +126,7 @@ int main(int argc, const char *argv[])
      s3g_context_t *ctx;
      myctx_t myctx;
      int show_moves = 0;
+     int buffer_size = BLOCK_BUFFER_SIZE;
 
      steppers::init();
      steppers::reset();
@@ -215,6 +221,20 @@ int main(int argc, const char *argv[])
 	       break;
 	  }
 
+	  // Planner buffer size
+	  case 'b' :
+	  {
+	       char *ptr = NULL;
+	       buffer_size = (int)strtol(optarg, &ptr, 0);
+	       if (ptr == NULL || ptr == optarg || buffer_size < 2 || buffer_size > BLOCK_BUFFER_SIZE)
+	       {
+		    fprintf(stderr, "%s: the number of blocks, \"%s\", must be an integer between 2 and %d\n",
+			    argv[0], optarg, BLOCK_BUFFER_SIZE);
+		    return(1);
+	       }
+	  }
+	  break;
+
 	  // Debug
 	  case 'd' :
 	  {
@@ -229,6 +249,40 @@ int main(int argc, const char *argv[])
 	  }
 	  break;
 
+	  // Coalesce collinear moves
+	  case 'g' :
+	  {
+	       char *ptr = NULL;
+	       float degrees;
+
+	       degrees = strtof(optarg, &ptr);
+	       if (ptr == NULL || ptr == optarg || degrees < 0.0 || degrees > 45.0)
+	       {
+		    fprintf(stderr, "%s: the coalescing angle, \"%s\", must be between 0 and 45 degrees\n",
+			    argv[0], optarg);
+		    return(1);
+	       }
+	       steppers::setCoalesceAngle(degrees);
+	  }
+	  break;
+
+	  // Junction deviation
+	  case 'j' :
+	  {
+	       char *ptr = NULL;
+	       float mm;
+
+	       mm = strtof(optarg, &ptr);
+	       if (ptr == NULL || ptr == optarg || mm < 0.0 || mm > 1.0)
+	       {
+		    fprintf(stderr, "%s: the junction deviation, \"%s\", must be between 0 and 1 mm\n",
+			    argv[0], optarg);
+		    return(1);
+	       }
+	       junction_deviation = FTOFP(mm);
+	  }
+	  break;
+
 	  // Show moves
 	  case 'm' :
 	       show_moves = 1;
@@ -297,7 +351,7 @@ int main(int argc, const char *argv[])
 	       steppers::setTargetNew(target, cmd.t.queue_point_new.us, cmd.t.queue_point_new.rel);
 	       if (show_moves && myctx.buf[0]) pending_notice("%s\n", myctx.buf);
 	       handle_pending_notices();
-	       if (movesplanned() >= (BLOCK_BUFFER_SIZE >> 1)) plan_dump_current_block(1, REPORT);
+	       if (movesplanned() >= (buffer_size >> 1)) plan_dump_current_block(1, REPORT);
 	  }
 	  else if (cmd.cmd_id == HOST_CMD_QUEUE_POINT_NEW_EXT)
 	  {
@@ -310,7 +364,23 @@ int main(int argc, const char *argv[])
 					 cmd.t.queue_point_new_ext.feedrate_mult_64);
 	       if (show_moves && myctx.buf[0]) pending_notice("%s\n", myctx.buf);
 	       handle_pending_notices();
-	       if (movesplanned() >= (BLOCK_BUFFER_SIZE >> 1)) plan_dump_current_block(1, REPORT);
+	       if (movesplanned() >= (buffer_size >> 1)) plan_dump_current_block(1, REPORT);
+	  }
+	  else if (cmd.cmd_id == HOST_CMD_QUEUE_POINT_DELTA)
+	  {
+	       // Like Command.cc, move to an absolute target
+	       Point target = steppers::getPlannerPosition();
+	       target[0] += cmd.t.queue_point_delta.x;
+	       target[1] += cmd.t.queue_point_delta.y;
+	       target[2] += cmd.t.queue_point_delta.z;
+	       target[3] += cmd.t.queue_point_delta.a;
+	       target[4] += cmd.t.queue_point_delta.b;
+	       steppers::setTargetNewExt(target, cmd.t.queue_point_delta.dda_rate, 0,
+					 cmd.t.queue_point_delta.distance,
+					 cmd.t.queue_point_delta.feedrate_mult_64);
+	       if (show_moves && myctx.buf[0]) pending_notice("%s\n", myctx.buf);
+	       handle_pending_notices();
+	       if (movesplanned() >= (buffer_size >> 1)) plan_dump_current_block(1, REPORT);
 	  }
 	  else if (cmd.cmd_id == HOST_CMD_QUEUE_POINT_EXT)
 	  {
@@ -320,10 +390,13 @@ int main(int argc, const char *argv[])
 	       steppers::setTarget(target, cmd.t.queue_point_ext.dda);
 	       if (show_moves && myctx.buf[0]) pending_notice("%s\n", myctx.buf);
 	       handle_pending_notices();
-	       if (movesplanned() >= (BLOCK_BUFFER_SIZE >> 1)) plan_dump_current_block(1, REPORT);
+	       if (movesplanned() >= (buffer_size >> 1)) plan_dump_current_block(1, REPORT);
 	  }
 	  else if (cmd.cmd_id == HOST_CMD_SET_POSITION_EXT)
 	  {
+	       // Like Command.cc, wait for room to queue the new position
+	       while (!plan_can_define_position())
+		    plan_dump_current_block(1, REPORT);
 	       Point target = Point(cmd.t.set_position_ext.x, cmd.t.set_position_ext.y,
 				    cmd.t.set_position_ext.z, cmd.t.set_position_ext.a,
 				    cmd.t.set_position_ext.b);
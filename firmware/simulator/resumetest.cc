@@ -0,0 +1,406 @@
+// resumetest.cc
+//
+// Tests resuming an SD card build on the host: the checkpoints Resume.cc
+// writes to the EEPROM, with avr/eeprom.h's RAM backed EEPROM standing in
+// for the AVR's, the commands it queues to return to a checkpoint, and
+// SDCard.cc's startPlaybackAt() over generated FAT16 and FAT32 images
+// with sd_raw_file.c standing in for the card, which must refuse a file
+// that isn't the one checkpointed:
+//
+//     resumetest [image]
+//
+// Checkpoints must be written only while the EEPROM is idle, a byte per
+// command slice, and only once the planner has run the moves queued
+// before them.  The power is cut after each byte of a checkpoint is
+// written, and the previous checkpoint must survive until the new one is
+// complete.  The EEPROM bytes written per checkpoint are reported, and
+// the most written to any one address, which sets how long the EEPROM
+// lasts with checkpoints every RESUME_CHECKPOINT_INTERVAL seconds.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "avr/eeprom.h"
+#include "sd_raw_file.h"
+#include "fatimage.h"
+#include "Resume.hh"
+#include "SDCard.hh"
+#include "Commands.hh"
+
+#define SECTOR_SIZE 512
+
+// Command slices to run while waiting for a checkpoint to be written
+#define MAX_SLICES 10000
+
+// sdcard::initCard() reads the SD CRC setting from the EEPROM
+
+namespace eeprom {
+uint8_t getEeprom8(const uint16_t location, const uint8_t default_value) { return default_value; }
+}
+
+static int errors = 0;
+
+static void check(bool ok, const char *what)
+{
+     if (!ok)
+     {
+	  fprintf(stderr, "Failed: %s\n", what);
+	  errors++;
+     }
+}
+
+// Run command slices until the EEPROM has been idle for a while, checking
+// that at most one byte is written per slice and never while the EEPROM is
+// busy.  Returns the number of slices run.
+
+static unsigned int run_slices(uint8_t tail)
+{
+     unsigned int slices, idle = 0;
+
+     for (slices = 0; slices < MAX_SLICES && idle < 2 * eeprom_ram_write_wait + 2; slices++)
+     {
+	  unsigned long writes = eeprom_ram_stats.writes + eeprom_ram_stats.dropped;
+	  unsigned long stalls = eeprom_ram_stats.stalls;
+	  resume::runSlice(tail);
+	  writes = eeprom_ram_stats.writes + eeprom_ram_stats.dropped - writes;
+	  check(writes <= 1, "runSlice() wrote more than one byte");
+	  check(eeprom_ram_stats.stalls == stalls, "runSlice() waited on the EEPROM");
+	  idle = writes ? 0 : idle + 1;
+     }
+     return(slices);
+}
+
+static Point position(uint32_t offset)
+{
+     return(Point(offset, offset * 2, offset / 64, -(int32_t)offset * 3, offset * 5));
+}
+
+// Capture a checkpoint at offset and write it
+static void checkpoint(uint32_t offset)
+{
+     check(resume::capture(offset, 1, position(offset), 0, 0), "capture()");
+     run_slices(0);
+}
+
+static bool loaded(uint32_t offset)
+{
+     resume::checkpoint_t cp;
+
+     if (!resume::load(cp) || cp.offset != offset || cp.tool != 1)
+	  return(false);
+     Point p = position(offset);
+     for (int i = 0; i < STEPPER_COUNT; i++)
+	  if (cp.position[i] != p[i])
+	       return(false);
+     return(true);
+}
+
+static void test_checkpoints(void)
+{
+     resume::checkpoint_t cp;
+
+     eeprom_ram_erase();
+     check(!resume::load(cp), "an erased EEPROM has no checkpoint");
+
+     resume::start("BUILD.S3G", 0, 1234, 567890);
+     resume::noteTemperature(0, 220);
+     resume::noteTemperature(RESUME_PLATFORM, 110);
+     resume::noteHoming(HOST_CMD_FIND_AXES_MAXIMUM, 0x01, 500, 20);
+     resume::noteHoming(HOST_CMD_FIND_AXES_MAXIMUM, 0x02, 500, 20);
+     resume::noteHoming(HOST_CMD_FIND_AXES_MINIMUM, 0x04, 600, 30);
+     resume::notePosition(Point(1000, 2000, 0, 0, 0));
+
+     // Three moves are queued before the checkpoint, starting at the end
+     // of the planner's block buffer; none of the checkpoint may be written
+     // until the planner's tail has passed them
+     check(resume::capture(4096, 1, position(4096), BLOCK_BUFFER_SIZE - 1, 3), "capture()");
+     check(!resume::capture(8192, 1, position(8192), 0, 0),
+	   "capture() while a checkpoint waits for the planner");
+     for (uint8_t tail = BLOCK_BUFFER_SIZE - 1; tail != 2; tail = (tail + 1) & (BLOCK_BUFFER_SIZE - 1))
+	  run_slices(tail);
+     check(eeprom_ram_stats.writes == 0, "checkpoint written before its moves were run");
+
+     unsigned long writes = eeprom_ram_stats.writes;
+     unsigned int slices = run_slices(2);
+     writes = eeprom_ram_stats.writes - writes;
+     check(loaded(4096), "first checkpoint");
+     printf("First checkpoint: %lu of %u bytes written over %u slices\n",
+	    writes, (unsigned int)sizeof(cp), slices);
+
+     check(resume::load(cp) && cp.temperature[0] == 220 && cp.temperature[1] == 0 &&
+	   cp.temperature[RESUME_PLATFORM] == 110, "checkpoint temperatures");
+     check(cp.homeCommand == HOST_CMD_FIND_AXES_MAXIMUM && cp.homeFlags == 0x03 &&
+	   cp.homeFeedrate == 500 && cp.homeTimeout == 20 &&
+	   cp.homePosition[0] == 1000 && cp.homePosition[1] == 2000, "checkpoint homing");
+     check(cp.fileDir == 0 && cp.fileCluster == 1234 && cp.fileSize == 567890 &&
+	   !strcmp(cp.name, "BUILD.S3G"),
+	   "checkpoint file");
+
+     // Later checkpoints of the same build go to the following slots
+     for (int i = 0; i < 2; i++)
+     {
+	  writes = eeprom_ram_stats.writes;
+	  checkpoint(8192 + i * 4096);
+	  check(loaded(8192 + i * 4096), "later checkpoint");
+     }
+     printf("Later checkpoints: %lu bytes written\n", eeprom_ram_stats.writes - writes);
+
+     // Sequence numbers wrap
+     unsigned int count = 3;
+     for (uint32_t offset = 16384; offset < 16384 + 300 * 512; offset += 512, count++)
+     {
+	  checkpoint(offset);
+	  if (!loaded(offset))
+	  {
+	       check(false, "checkpoint after many checkpoints");
+	       break;
+	  }
+     }
+
+     // The slots take turns, and each checkpoint writes its slot's
+     // sequence number twice
+     check(eeprom_ram_stats.most <= 2 * ((count + RESUME_SLOTS - 1) / RESUME_SLOTS),
+	   "checkpoints spread over the slots");
+     printf("%u checkpoints: at most %lu writes to a byte, lasting %.0f hours of builds\n",
+	    count, eeprom_ram_stats.most,
+	    100000.0 * count / eeprom_ram_stats.most * RESUME_CHECKPOINT_INTERVAL / 3600.0);
+
+     // A resumed build keeps the checkpoint it resumed from until it
+     // writes another
+     check(resume::load(cp), "load()");
+     resume::start(cp);
+     check(loaded(cp.offset), "checkpoint resumed from");
+     checkpoint(cp.offset + 100);
+     check(loaded(cp.offset + 100), "checkpoint of a resumed build");
+
+     resume::stop();
+     check(!resume::load(cp), "no checkpoint after stop()");
+
+     // Cut the power after each byte written of a checkpoint; the last
+     // complete checkpoint must be loaded
+     int cuts = 0;
+     for (long limit = 0; ; limit++)
+     {
+	  eeprom_ram_erase();
+	  resume::start("BUILD.S3G", 0, 1234, 567890);
+	  checkpoint(4096);
+
+	  eeprom_ram_write_limit = limit;
+	  checkpoint(8192);
+	  bool complete = eeprom_ram_stats.dropped == 0;
+	  eeprom_ram_write_limit = -1;
+
+	  if (!loaded(complete ? 8192 : 4096))
+	  {
+	       fprintf(stderr, "Failed: checkpoint after a power cut at byte %ld\n", limit);
+	       errors++;
+	  }
+	  if (complete)
+	       break;
+	  cuts++;
+     }
+     printf("Power cut during each of %d checkpoint writes: previous checkpoint kept\n", cuts);
+     resume::stop();
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+     return(p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24));
+}
+
+// Check the commands queued by prologue() against those expected: each
+// command's code and the following bytes of its 32 bit arguments.
+
+typedef struct {
+     uint8_t code;
+     int length;
+     int32_t args[6];   // 32 bit arguments from the second byte, if any
+     int nargs;
+} expect_t;
+
+static void test_prologue(const resume::checkpoint_t &cp, const expect_t *expect, int n)
+{
+     uint8_t bytes[RESUME_PROLOGUE_MAX + 16];
+
+     memset(bytes, 0xAA, sizeof(bytes));
+     uint8_t length = resume::prologue(cp, 2000, 800, bytes);
+     check(length <= RESUME_PROLOGUE_MAX && bytes[RESUME_PROLOGUE_MAX] == 0xAA,
+	   "prologue() length");
+
+     int pos = 0;
+     for (int i = 0; i < n; i++)
+     {
+	  if (pos + expect[i].length > length || bytes[pos] != expect[i].code)
+	  {
+	       fprintf(stderr, "Failed: prologue() command %d is not %d\n", i, expect[i].code);
+	       errors++;
+	       return;
+	  }
+	  for (int j = 0; j < expect[i].nargs; j++)
+	       if ((int32_t)get32(bytes + pos + 1 + 4 * j) != expect[i].args[j])
+	       {
+		    fprintf(stderr, "Failed: prologue() command %d argument %d\n", i, j);
+		    errors++;
+	       }
+	  pos += expect[i].length;
+     }
+     check(pos == length, "prologue() commands");
+}
+
+static void test_prologues(void)
+{
+     resume::checkpoint_t cp;
+
+     memset(&cp, 0, sizeof(cp));
+     cp.offset = 4096;
+     cp.tool = 1;
+     for (int i = 0; i < STEPPER_COUNT; i++)
+	  cp.position[i] = 10 * (i + 1);
+     cp.temperature[1] = 230;
+     cp.temperature[RESUME_PLATFORM] = 110;
+     cp.homeCommand = HOST_CMD_FIND_AXES_MAXIMUM;
+     cp.homeFlags = 0x03;
+     cp.homeFeedrate = 500;
+     cp.homeTimeout = 20;
+     cp.homePosition[0] = 1000;
+     cp.homePosition[1] = 2000;
+
+     // Heat, wait, lower the platform, home X and Y, define their home
+     // positions, move back and raise the platform
+     const expect_t homed[] = {
+	  { HOST_CMD_CHANGE_TOOL, 2, { 0 }, 0 },
+	  { HOST_CMD_TOOL_COMMAND, 6, { 0 }, 0 },
+	  { HOST_CMD_TOOL_COMMAND, 6, { 0 }, 0 },
+	  { HOST_CMD_WAIT_FOR_TOOL, 6, { 0 }, 0 },
+	  { HOST_CMD_WAIT_FOR_PLATFORM, 6, { 0 }, 0 },
+	  { HOST_CMD_SET_POSITION_EXT, 21, { 10, 20, 30, 40, 50 }, 5 },
+	  { HOST_CMD_QUEUE_POINT_EXT, 25, { 10, 20, 2030, 40, 50, 800 }, 6 },
+	  { HOST_CMD_FIND_AXES_MAXIMUM, 8, { 0 }, 0 },
+	  { HOST_CMD_SET_POSITION_EXT, 21, { 1000, 2000, 2030, 40, 50 }, 5 },
+	  { HOST_CMD_QUEUE_POINT_EXT, 25, { 10, 20, 2030, 40, 50, 500 }, 6 },
+	  { HOST_CMD_QUEUE_POINT_EXT, 25, { 10, 20, 30, 40, 50, 800 }, 6 }
+     };
+     test_prologue(cp, homed, sizeof(homed) / sizeof(homed[0]));
+
+     // Without homing the position is simply defined
+     cp.homeCommand = 0;
+     cp.temperature[RESUME_PLATFORM] = 0;
+     const expect_t unhomed[] = {
+	  { HOST_CMD_CHANGE_TOOL, 2, { 0 }, 0 },
+	  { HOST_CMD_TOOL_COMMAND, 6, { 0 }, 0 },
+	  { HOST_CMD_WAIT_FOR_TOOL, 6, { 0 }, 0 },
+	  { HOST_CMD_SET_POSITION_EXT, 21, { 10, 20, 30, 40, 50 }, 5 }
+     };
+     test_prologue(cp, unhomed, sizeof(unhomed) / sizeof(unhomed[0]));
+}
+
+// Read up to n bytes of playback, checking them against the file's contents
+static uint32_t play(uint32_t offset, uint32_t n)
+{
+     uint8_t chunk[32];
+     uint32_t count = 0;
+
+     while (count < n && sdcard::playbackHasNext())
+     {
+	  uint8_t len = sdcard::playbackRead(chunk, (n - count < sizeof(chunk)) ? n - count : sizeof(chunk));
+	  for (uint8_t i = 0; i < len; i++)
+	       if (chunk[i] != fat_image_byte(offset + count + i) && errors++ < 10)
+		    fprintf(stderr, "Mismatch at offset %u\n", offset + count + i);
+	  count += len;
+     }
+     return(count);
+}
+
+static void test_playback(const char *path, fat_image_type_t type, uint32_t runs)
+{
+     const uint32_t file_size = 300 * 1024 + 123;
+     fat_image_file_t files[] = {
+	  { "CAL     S3G", 2048, 0 },
+	  { "BUILD   S3G", file_size, runs }
+     };
+     char build[] = "BUILD.S3G";
+
+     if (fat_image_create(path, type, 8, files, sizeof(files) / sizeof(files[0])))
+     {
+	  errors++;
+	  return;
+     }
+     if (sd_raw_file_open(path))
+     {
+	  fprintf(stderr, "Unable to open %s; %s\n", path, strerror(errno));
+	  errors++;
+	  return;
+     }
+     sdcard::forceReinit();
+
+     uint32_t dir, cluster, size;
+     if (sdcard::startPlayback(build) != sdcard::SD_SUCCESS)
+     {
+	  fprintf(stderr, "startPlayback() failed; sdAvailable = %d\n", sdcard::sdAvailable);
+	  errors++;
+	  sd_raw_file_close();
+	  return;
+     }
+     sdcard::getPlaybackFile(&dir, &cluster, &size);
+     check(dir == 0, "getPlaybackFile() directory");
+     check(size == file_size, "getPlaybackFile() size");
+     sdcard::finishPlayback();
+
+     // Resume at offsets within and at the ends of sectors and clusters
+     const uint32_t offsets[] = { 0, 1, 511, 512, 4095, 4096, 100000, 250001, file_size - 1, file_size };
+     unsigned long block_reads = 0;
+     for (size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++)
+     {
+	  unsigned long reads = sd_raw_file_stats.block_reads;
+	  if (sdcard::startPlaybackAt(build, dir, cluster, size, offsets[i]) != sdcard::SD_SUCCESS)
+	  {
+	       fprintf(stderr, "Failed: startPlaybackAt() offset %u\n", offsets[i]);
+	       errors++;
+	       continue;
+	  }
+	  block_reads += sd_raw_file_stats.block_reads - reads;
+	  uint32_t want = (file_size - offsets[i] < 2000) ? file_size - offsets[i] : 2000;
+	  check(play(offsets[i], 2000) == want, "playback after startPlaybackAt()");
+	  sdcard::finishPlayback();
+     }
+     check(sdcard::startPlaybackAt(build, dir, cluster, size, file_size + 1) != sdcard::SD_SUCCESS,
+	   "startPlaybackAt() past the end of the file");
+
+     // Another file, or the same name at another cluster or of another size
+     check(sdcard::startPlaybackAt("CAL.S3G", dir, cluster, size, 0) != sdcard::SD_SUCCESS,
+	   "startPlaybackAt() of another file");
+     check(sdcard::startPlaybackAt(build, dir, cluster + 1, size, 0) != sdcard::SD_SUCCESS,
+	   "startPlaybackAt() of a file which has moved");
+     check(sdcard::startPlaybackAt(build, dir, cluster, size - 1, 0) != sdcard::SD_SUCCESS,
+	   "startPlaybackAt() of a file which has changed size");
+
+     printf("FAT%d, file in %s: %u resumes, %lu blocks read to start them\n", (int)type,
+	    runs ? "single clusters" : "one run",
+	    (unsigned int)(sizeof(offsets) / sizeof(offsets[0])), block_reads);
+
+     sdcard::reset();
+     sd_raw_file_close();
+}
+
+int main(int argc, const char *argv[])
+{
+     const char *path = (argc > 1) ? argv[1] : "resumetest.img";
+
+     test_checkpoints();
+     test_prologues();
+     test_playback(path, FAT_IMAGE_FAT16, 0);
+     test_playback(path, FAT_IMAGE_FAT16, 1);
+     test_playback(path, FAT_IMAGE_FAT32, 0);
+     test_playback(path, FAT_IMAGE_FAT32, 1);
+
+     if (errors)
+     {
+	  printf("FAILED: %d errors\n", errors);
+	  return(1);
+     }
+     printf("PASSED\n");
+
+     return(0);
+}
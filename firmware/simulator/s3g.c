@@ -3,6 +3,7 @@
 #include <string.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <math.h>
 
 #include "Simulator.hh"
 #include "Commands.hh"
@@ -85,7 +86,9 @@ static const s3g_command_info_t command_table_raw[] = {
      /* 154 */  {HOST_CMD_BUILD_END_NOTIFICATION, 1, "build end notification"},
      /* 155 */  {HOST_CMD_QUEUE_POINT_NEW_EXT, 31, "queue point new extended"},
      /* 156 */  {HOST_CMD_SET_ACCELERATION_TOGGLE, 1, "set segment acceleration"},
-     /* 157 */  {HOST_CMD_STREAM_VERSION, 20, "stream version"}
+     /* 157 */  {HOST_CMD_STREAM_VERSION, 20, "stream version"},
+     /* 158 */  {HOST_CMD_PAUSE_AT_ZPOS, 4, "pause at z position"},
+     /* 159 */  {HOST_CMD_QUEUE_POINT_DELTA, 0xffffffff, "queue point delta"}
 };
 
 static s3g_command_info_t command_table[256];
@@ -409,6 +412,22 @@ int s3g_command_read_ext(s3g_context_t *ctx, s3g_command_t *cmd,
 	  }
 	  break;
 
+     case HOST_CMD_QUEUE_POINT_DELTA :
+	  // axes, wide, then a length which depends upon them
+	  if (maxbuf < 2) goto trunc;
+	  if ((ssize_t)2 != (*ctx->read)(ctx->r_ctx, buf, maxbuf, 2))
+	       goto io_error;
+	  bytes_expected = (ssize_t)s3g_queue_point_delta_len(buf[0], buf[1]) - 3;
+	  if (maxbuf < (size_t)bytes_expected + 2) goto trunc;
+	  if ((bytes_read = (*ctx->read)(ctx->r_ctx, buf + 2, maxbuf - 2,
+					 (size_t)bytes_expected)) != bytes_expected)
+	       goto io_error;
+	  cmd->cmd_len = (size_t)bytes_expected + 2;
+	  s3g_queue_point_delta_decode(buf - 1, cmd->cmd_len + 1, &cmd->t.queue_point_delta);
+	  buf    += cmd->cmd_len;
+	  maxbuf -= cmd->cmd_len;
+	  break;
+
      case HOST_CMD_SET_POSITION_EXT :
 	  // x4, y4, z4, a4, b4 = 20 bytes
 	  GET_INT32(set_position_ext.x);
@@ -820,6 +839,30 @@ void s3g_command_display(s3g_context_t *ctx, s3g_command_t *cmd)
 		 F(queue_point_new_ext.feedrate_mult_64));
 	  break;
 
+     case HOST_CMD_QUEUE_POINT_DELTA :
+	  if (F(queue_point_delta.distance) < 0.0)
+	       writef(ctx, "Move by (%d, %d, %d, %d, %d), DDA rate %u, "
+		      "feedrate*64 %d steps/s",
+		      F(queue_point_delta.x),
+		      F(queue_point_delta.y),
+		      F(queue_point_delta.z),
+		      F(queue_point_delta.a),
+		      F(queue_point_delta.b),
+		      F(queue_point_delta.dda_rate),
+		      F(queue_point_delta.feedrate_mult_64));
+	  else
+	       writef(ctx, "Move by (%d, %d, %d, %d, %d), DDA rate %u, "
+		      "distance %f mm, feedrate*64 %d steps/s",
+		      F(queue_point_delta.x),
+		      F(queue_point_delta.y),
+		      F(queue_point_delta.z),
+		      F(queue_point_delta.a),
+		      F(queue_point_delta.b),
+		      F(queue_point_delta.dda_rate),
+		      F(queue_point_delta.distance),
+		      F(queue_point_delta.feedrate_mult_64));
+	  break;
+
      case HOST_CMD_SET_POT_VALUE :
 	  writef(ctx, "Set %s axis potentiometer to %hhu",
 		 axes_names(F(digi_pot.axis), buf, sizeof(buf)),
@@ -910,3 +953,266 @@ void s3g_command_display(s3g_context_t *ctx, s3g_command_t *cmd)
 	  break;
      }
 }
+
+
+size_t s3g_queue_point_delta_len(uint8_t axes, uint8_t wide)
+{
+     size_t len = 3 + ((axes & QUEUE_POINT_DELTA_DDA_32) ? 4 : 2) +
+	  ((axes & QUEUE_POINT_DELTA_DISTANCE) ? 4 : 0) + 2;
+     int i;
+
+     for (i = 0; i < 5; i++)
+	  if (axes & (1 << i))
+	       len += (wide & (1 << i)) ? 2 : 1;
+
+     return(len);
+}
+
+size_t s3g_queue_point_delta_decode(const unsigned char *buf, size_t len,
+				    s3g_queue_point_delta *delta)
+{
+     const unsigned char *p;
+     int32_t d[5];
+     foo_16_t f16;
+     foo_32_t f32;
+     size_t need;
+     int i;
+
+     if (len < 3 || len < (need = s3g_queue_point_delta_len(buf[1], buf[2])))
+	  return(0);
+
+     delta->axes = buf[1];
+     delta->wide = buf[2];
+     p = buf + 3;
+
+     for (i = 0; i < 5; i++)
+     {
+	  if (!(delta->axes & (1 << i)))
+	       d[i] = 0;
+	  else if (delta->wide & (1 << i))
+	  {
+	       memcpy(&f16.u.c, p, 2);
+	       d[i] = f16.u.i;
+	       p += 2;
+	  }
+	  else
+	       d[i] = (int8_t)*p++;
+     }
+     delta->x = d[0];
+     delta->y = d[1];
+     delta->z = d[2];
+     delta->a = d[3];
+     delta->b = d[4];
+
+     if (delta->axes & QUEUE_POINT_DELTA_DDA_32)
+     {
+	  memcpy(&f32.u.c, p, 4);
+	  delta->dda_rate = f32.u.u;
+	  p += 4;
+     }
+     else
+     {
+	  memcpy(&f16.u.c, p, 2);
+	  delta->dda_rate = f16.u.u;
+	  p += 2;
+     }
+
+     if (delta->axes & QUEUE_POINT_DELTA_DISTANCE)
+     {
+	  memcpy(&f32.u.c, p, 4);
+	  delta->distance = f32.u.f;
+	  p += 4;
+     }
+     else
+	  delta->distance = -1.0;
+
+     memcpy(&f16.u.c, p, 2);
+     delta->feedrate_mult_64 = f16.u.i;
+
+     return(need);
+}
+
+void s3g_delta_encoder_init(s3g_delta_encoder_t *enc, const float *steps_per_mm)
+{
+     memset(enc, 0, sizeof(s3g_delta_encoder_t));
+     memcpy(enc->steps_per_mm, steps_per_mm, sizeof(enc->steps_per_mm));
+}
+
+// The distance the bot derives for a move; see Steppers.hh
+
+static float delta_distance(const s3g_delta_encoder_t *enc, const int32_t *d)
+{
+     float dist = 0.0, mm;
+     int i;
+
+     for (i = 0; i < 3; i++)
+     {
+	  mm = (float)d[i] / enc->steps_per_mm[i];
+	  dist += mm * mm;
+     }
+     if (dist > 0.0)
+	  return(sqrtf(dist));
+
+     for (i = 3; i < 5; i++)
+     {
+	  mm = fabsf((float)d[i] / enc->steps_per_mm[i]);
+	  if (mm > dist)
+	       dist = mm;
+     }
+     return(dist);
+}
+
+// Distances within this fraction of those in the stream are left to the bot
+#define DISTANCE_TOLERANCE 0.001
+
+size_t s3g_delta_encode(s3g_delta_encoder_t *enc, const s3g_command_t *cmd,
+			const unsigned char *raw, size_t rawlen,
+			unsigned char *buf, size_t maxbuf)
+{
+     const s3g_queue_point_new_ext *q = &cmd->t.queue_point_new_ext;
+     int32_t target[5], d[5];
+     unsigned char *p;
+     foo_16_t f16;
+     foo_32_t f32;
+     uint8_t axes, wide;
+     int i;
+
+     switch (cmd->cmd_id)
+     {
+     default :
+	  break;
+
+     case HOST_CMD_SET_POSITION_EXT :
+	  enc->position[0] = cmd->t.set_position_ext.x;
+	  enc->position[1] = cmd->t.set_position_ext.y;
+	  enc->position[2] = cmd->t.set_position_ext.z;
+	  enc->position[3] = cmd->t.set_position_ext.a;
+	  enc->position[4] = cmd->t.set_position_ext.b;
+	  enc->known = -1;
+	  break;
+
+     // The bot applies the new tool's offsets to absolute moves only
+     case HOST_CMD_CHANGE_TOOL :
+     case HOST_CMD_FIND_AXES_MINIMUM :
+     case HOST_CMD_FIND_AXES_MAXIMUM :
+     case HOST_CMD_RECALL_HOME_POSITION :
+	  enc->known = 0;
+	  break;
+
+     case HOST_CMD_QUEUE_POINT_EXT :
+	  enc->position[0] = cmd->t.queue_point_ext.x;
+	  enc->position[1] = cmd->t.queue_point_ext.y;
+	  enc->position[2] = cmd->t.queue_point_ext.z;
+	  enc->position[3] = cmd->t.queue_point_ext.a;
+	  enc->position[4] = cmd->t.queue_point_ext.b;
+	  enc->known = -1;
+	  break;
+
+     case HOST_CMD_QUEUE_POINT_NEW :
+     case HOST_CMD_QUEUE_POINT_NEW_EXT :
+	  if (cmd->cmd_id == HOST_CMD_QUEUE_POINT_NEW)
+	  {
+	       const s3g_queue_point_new *n = &cmd->t.queue_point_new;
+	       target[0] = n->x; target[1] = n->y; target[2] = n->z;
+	       target[3] = n->a; target[4] = n->b;
+	       for (i = 0; i < 5; i++)
+		    if (n->rel & (1 << i))
+			 target[i] += enc->position[i];
+	       memcpy(enc->position, target, sizeof(target));
+	       if (!(n->rel & 0x1f))
+		    enc->known = -1;
+	       break;
+	  }
+
+	  target[0] = q->x; target[1] = q->y; target[2] = q->z;
+	  target[3] = q->a; target[4] = q->b;
+	  for (i = 0; i < 5; i++)
+	  {
+	       if (q->rel & (1 << i))
+		    target[i] += enc->position[i];
+	       d[i] = target[i] - enc->position[i];
+	  }
+
+	  // The bot drops a move with no distance without moving, after
+	  // which its position isn't the one the stream expects
+	  if (q->distance == 0.0)
+	  {
+	       for (i = 0; i < 5; i++)
+		    if (d[i] != 0)
+			 enc->known = 0;
+	       memcpy(enc->position, target, sizeof(target));
+	       break;
+	  }
+
+	  // An absolute move puts the bot back where the stream expects
+	  if (!enc->known)
+	  {
+	       memcpy(enc->position, target, sizeof(target));
+	       if (!(q->rel & 0x1f))
+		    enc->known = -1;
+	       break;
+	  }
+
+	  axes = 0;
+	  wide = 0;
+	  for (i = 0; i < 5; i++)
+	  {
+	       if (d[i] == 0)
+		    continue;
+	       if (d[i] < -32768 || d[i] > 32767)
+		    break;
+	       axes |= 1 << i;
+	       if (d[i] < -128 || d[i] > 127)
+		    wide |= 1 << i;
+	  }
+	  memcpy(enc->position, target, sizeof(target));
+	  if (i < 5 || q->dda_rate < 0)
+	       break;
+
+	  if (q->dda_rate > 0xffff)
+	       axes |= QUEUE_POINT_DELTA_DDA_32;
+	  if (fabsf(delta_distance(enc, d) - q->distance) > DISTANCE_TOLERANCE * q->distance)
+	       axes |= QUEUE_POINT_DELTA_DISTANCE;
+
+	  if (maxbuf < s3g_queue_point_delta_len(axes, wide))
+	       return(0);
+
+	  p = buf;
+	  *p++ = HOST_CMD_QUEUE_POINT_DELTA;
+	  *p++ = axes;
+	  *p++ = wide;
+	  for (i = 0; i < 5; i++)
+	  {
+	       if (!(axes & (1 << i)))
+		    continue;
+	       if (wide & (1 << i))
+	       {
+		    f16.u.i = (int16_t)d[i];
+		    memcpy(p, &f16.u.c, 2);
+		    p += 2;
+	       }
+	       else
+		    *p++ = (unsigned char)(int8_t)d[i];
+	  }
+	  f32.u.i = q->dda_rate;
+	  memcpy(p, &f32.u.c, (axes & QUEUE_POINT_DELTA_DDA_32) ? 4 : 2);
+	  p += (axes & QUEUE_POINT_DELTA_DDA_32) ? 4 : 2;
+	  if (axes & QUEUE_POINT_DELTA_DISTANCE)
+	  {
+	       f32.u.f = q->distance;
+	       memcpy(p, &f32.u.c, 4);
+	       p += 4;
+	  }
+	  f16.u.u = q->feedrate_mult_64;
+	  memcpy(p, &f16.u.c, 2);
+	  p += 2;
+
+	  return((size_t)(p - buf));
+     }
+
+     if (maxbuf < rawlen)
+	  return(0);
+     memcpy(buf, raw, rawlen);
+
+     return(rawlen);
+}
@@ -63,6 +63,21 @@ typedef struct {
      uint8_t rel;
 } s3g_queue_point_new;
 
+// HOST_CMD_QUEUE_POINT_DELTA; x, y, z, a and b are the deltas, and
+// distance is negative when it isn't sent
+typedef struct {
+     uint8_t  axes;
+     uint8_t  wide;
+     int32_t  x;
+     int32_t  y;
+     int32_t  z;
+     int32_t  a;
+     int32_t  b;
+     uint32_t dda_rate;
+     float    distance;
+     int16_t  feedrate_mult_64;
+} s3g_queue_point_delta;
+
 typedef struct {
      uint8_t index;
 } s3g_change_tool;
@@ -294,6 +309,7 @@ typedef struct {
 	  s3g_queue_point_ext          queue_point_ext;
 	  s3g_queue_point_new          queue_point_new;
 	  s3g_queue_point_new_ext      queue_point_new_ext;
+	  s3g_queue_point_delta        queue_point_delta;
 	  s3g_change_tool              change_tool;
 	  s3g_enable_axes              enable_axes;
 	  s3g_set_position             set_position;
@@ -398,6 +414,86 @@ int s3g_command_read_ext(s3g_context_t *ctx, s3g_command_t *cmd,
 
 int s3g_close(s3g_context_t *ctx);
 
+// Length of a HOST_CMD_QUEUE_POINT_DELTA command, including its command id,
+// given its axes and wide bytes
+
+size_t s3g_queue_point_delta_len(uint8_t axes, uint8_t wide);
+
+
+// Decode a HOST_CMD_QUEUE_POINT_DELTA command
+//
+// Call arguments:
+//
+//   const unsigned char *buf
+//     The command, starting with its command id
+//
+//   size_t len
+//     Bytes in buf
+//
+//   s3g_queue_point_delta *delta
+//     Where to store the decoded command
+//
+//  Return values:
+//
+//    > 0 -- Success; the length of the command
+//      0 -- buf doesn't hold the whole command
+
+size_t s3g_queue_point_delta_decode(const unsigned char *buf, size_t len,
+				    s3g_queue_point_delta *delta);
+
+
+// State for re-encoding a stream of commands with HOST_CMD_QUEUE_POINT_DELTA
+
+typedef struct {
+     float    steps_per_mm[5];  // Of the bot the stream is for
+     int32_t  position[5];      // Where the commands so far leave the axes
+     int      known;            // Non-zero if position is known
+} s3g_delta_encoder_t;
+
+// Initialize a delta encoder
+//
+// Call arguments:
+//
+//   s3g_delta_encoder_t *enc
+//     The encoder
+//
+//   const float *steps_per_mm
+//     Steps per mm of the X, Y, Z, A and B axes of the bot.  Distances
+//     are left for the bot to derive when it would derive the same ones.
+
+void s3g_delta_encoder_init(s3g_delta_encoder_t *enc, const float *steps_per_mm);
+
+
+// Re-encode a command read by s3g_command_read_ext().  A
+// HOST_CMD_QUEUE_POINT_NEW_EXT from a known position is encoded as a
+// HOST_CMD_QUEUE_POINT_DELTA when its deltas fit; any other command is
+// copied.  The position is known after a HOST_CMD_SET_POSITION_EXT or an
+// absolute move, and unknown after homing, a tool change, or a move the
+// bot might not make.
+//
+// Call arguments:
+//
+//   s3g_delta_encoder_t *enc
+//     The encoder
+//
+//   const s3g_command_t *cmd
+//     The command
+//
+//   const unsigned char *raw, size_t rawlen
+//     The command's bytes, as read by s3g_command_read_ext()
+//
+//   unsigned char *buf, size_t maxbuf
+//     Where to store the command's encoding
+//
+//  Return values:
+//
+//    > 0 -- Success; the length of the encoding
+//      0 -- buf is too small
+
+size_t s3g_delta_encode(s3g_delta_encoder_t *enc, const s3g_command_t *cmd,
+			const unsigned char *raw, size_t rawlen,
+			unsigned char *buf, size_t maxbuf);
+
 #ifndef S3G_PRIVATE_H_
 typedef ssize_t s3g_write_proc_t(void *ctx, unsigned char *buf, size_t nbytes);
 #endif
@@ -5,8 +5,13 @@
 // or
 //
 //     s3gdump < filename
+//
+// With -c, report how many bytes the compact delta moves would save
+//
+//     s3gdump -c [-o compacted.s3g] [-S x,y,z,a,b] filename
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <math.h>
@@ -24,20 +29,17 @@ static void usage(FILE *f, const char *prog)
 	  f = stderr;
 
      fprintf(f,
-"Usage: %s -hE [file]\n"
+"Usage: %s -hcE [-o outfile] [-S x,y,z,a,b] [file]\n"
 "   file  -- The .s3g file to dump.  If not supplied then stdin is dumped\n"
 "  ?, -h  -- This help message\n"
-"     -E  -- Display distance moved and ratio of extruder steps to distance\n",
+"     -c  -- Report the bytes saved by re-encoding moves as queue point delta\n"
+"     -E  -- Display distance moved and ratio of extruder steps to distance\n"
+"     -o  -- With -c, write the compacted stream to outfile\n"
+"     -S  -- Steps per mm for each axis; default is 47.069852,47.069852,\n"
+"            200.0,50.2354788069,50.2354788069\n",
 	     prog ? prog : "s3gdump");
 }
 
-// For a stream of .s3g commands, cherry pick out the movement related
-// commands, displaying the distance moved in 3-space (xyz) and the
-// density of extruder steps over that distance [extruder steps / distance].
-
-// BUG: For the time being, the steps/mm for each axis is hard coded
-static void edensity(const s3g_command_t *cmd)
-{
 #define AXIS_COUNT 5
 #define X_AXIS     0
 #define Y_AXIS     1
@@ -46,21 +48,27 @@ static void edensity(const s3g_command_t *cmd)
 #define B_AXIS     4
 #define E_AXIS     (A_AXIS)
 
+// Steps per mm for each axis; -S overrides
+static float axis_steps_per_unit[AXIS_COUNT] = {
+     47.069852,     // x
+     47.069852,     // y
+     200.0,         // z
+     50.2354788069, // a
+     50.2354788069  // b
+};
+
+// For a stream of .s3g commands, cherry pick out the movement related
+// commands, displaying the distance moved in 3-space (xyz) and the
+// density of extruder steps over that distance [extruder steps / distance].
+
+static void edensity(const s3g_command_t *cmd)
+{
      // On the first call, display column headings
      static int32_t first = 1;
 
      // Track the previous position
      static int32_t last_position[AXIS_COUNT] = {0, 0, 0, 0, 0};
 
-     // Steps per mm for each axis
-     static float axis_steps_per_unit[AXIS_COUNT] = {
-	  47.069852,     // x
-	  47.069852,     // y
-	  200.0,         // z
-	  50.2354788069, // a
-	  50.2354788069  // b
-     };
-
      if (!cmd)
 	  return;
 
@@ -202,15 +210,117 @@ static void edensity(const s3g_command_t *cmd)
      return;
 }
 
+// Tally of what re-encoding moves as HOST_CMD_QUEUE_POINT_DELTA saves
+
+typedef struct {
+     unsigned long commands;
+     unsigned long moves;
+     unsigned long converted;
+     unsigned long derived;
+     unsigned long move_bytes_in;
+     unsigned long move_bytes_out;
+     unsigned long bytes_in;
+     unsigned long bytes_out;
+     unsigned long errors;
+} compact_stats_t;
+
+// Re-encode one command, checking that a delta move decodes back to
+// the target the original command asked for
+
+static void compact(s3g_delta_encoder_t *enc, compact_stats_t *stats,
+		    const s3g_command_t *cmd, const unsigned char *raw,
+		    size_t rawlen, FILE *out)
+{
+     s3g_queue_point_delta delta;
+     unsigned char buf[1024];
+     int32_t before[AXIS_COUNT], d[AXIS_COUNT];
+     size_t len;
+     int i;
+
+     memcpy(before, enc->position, sizeof(before));
+     len = s3g_delta_encode(enc, cmd, raw, rawlen, buf, sizeof(buf));
+
+     stats->commands++;
+     stats->bytes_in  += rawlen;
+     stats->bytes_out += len;
+
+     if (cmd->cmd_id == HOST_CMD_QUEUE_POINT_EXT ||
+	 cmd->cmd_id == HOST_CMD_QUEUE_POINT_NEW ||
+	 cmd->cmd_id == HOST_CMD_QUEUE_POINT_NEW_EXT)
+     {
+	  stats->moves++;
+	  stats->move_bytes_in  += rawlen;
+	  stats->move_bytes_out += len;
+     }
+
+     if (len > 0 && buf[0] == HOST_CMD_QUEUE_POINT_DELTA)
+     {
+	  stats->converted++;
+	  if (len != s3g_queue_point_delta_decode(buf, len, &delta))
+	  {
+	       stats->errors++;
+	       fprintf(stderr, "s3gdump: command %lu does not decode\n",
+		       stats->commands);
+	  }
+	  else
+	  {
+	       if (delta.distance < 0.0)
+		    stats->derived++;
+	       d[X_AXIS] = delta.x;
+	       d[Y_AXIS] = delta.y;
+	       d[Z_AXIS] = delta.z;
+	       d[A_AXIS] = delta.a;
+	       d[B_AXIS] = delta.b;
+	       for (i = 0; i < AXIS_COUNT; i++)
+		    if (before[i] + d[i] != enc->position[i])
+		    {
+			 stats->errors++;
+			 fprintf(stderr, "s3gdump: command %lu decodes to the "
+				 "wrong target on axis %d\n", stats->commands, i);
+			 break;
+		    }
+	  }
+     }
+
+     if (out && len > 0 && fwrite(buf, 1, len, out) != len)
+	  stats->errors++;
+}
+
+static void compact_report(const compact_stats_t *stats)
+{
+     printf("commands          %lu\n", stats->commands);
+     printf("moves             %lu\n", stats->moves);
+     printf("moves converted   %lu\n", stats->converted);
+     printf("distances derived %lu\n", stats->derived);
+     printf("bytes             %lu -> %lu (%.1f%%)\n",
+	    stats->bytes_in, stats->bytes_out,
+	    stats->bytes_in ?
+	    100.0 * (double)stats->bytes_out / (double)stats->bytes_in : 0.0);
+     if (stats->moves)
+	  printf("bytes per move    %.2f -> %.2f\n",
+		 (double)stats->move_bytes_in / (double)stats->moves,
+		 (double)stats->move_bytes_out / (double)stats->moves);
+     if (stats->errors)
+	  printf("errors            %lu\n", stats->errors);
+}
+
 int main(int argc, const char *argv[])
 {
      char c;
      s3g_context_t *ctx;
      s3g_command_t cmd;
-     int do_edensity;
-
+     int do_compact, do_edensity;
+     const char *outfile;
+     FILE *out;
+     s3g_delta_encoder_t enc;
+     compact_stats_t stats;
+     unsigned char raw[1024];
+     size_t rawlen;
+
+     do_compact = 0;
      do_edensity = 0;
-     while ((c = getopt(argc, (char **)argv, ":hE?")) != GETOPTS_END)
+     outfile = NULL;
+     while ((c = getopt(argc, (char **)argv, ":hcEo:S:?")) != GETOPTS_END)
      {
 	  switch(c)
 	  {
@@ -230,6 +340,30 @@ int main(int argc, const char *argv[])
 	  case 'E' :
 	       do_edensity = -1;
 	       break;
+
+	       // -c report the savings from compact delta moves
+	  case 'c' :
+	       do_compact = -1;
+	       break;
+
+	       // -o write the compacted stream
+	  case 'o' :
+	       outfile = optarg;
+	       break;
+
+	       // -S steps per mm
+	  case 'S' :
+	       if (AXIS_COUNT != sscanf(optarg, "%f,%f,%f,%f,%f",
+					&axis_steps_per_unit[X_AXIS],
+					&axis_steps_per_unit[Y_AXIS],
+					&axis_steps_per_unit[Z_AXIS],
+					&axis_steps_per_unit[A_AXIS],
+					&axis_steps_per_unit[B_AXIS]))
+	       {
+		    usage(stderr, argv[0]);
+		    return(1);
+	       }
+	       break;
 	  }
      }
 
@@ -246,6 +380,29 @@ int main(int argc, const char *argv[])
 	  // Assume that s3g_open() has complained
 	  return(1);
 
+     if (do_compact)
+     {
+	  out = NULL;
+	  if (outfile && !(out = fopen(outfile, "wb")))
+	  {
+	       perror(outfile);
+	       s3g_close(ctx);
+	       return(1);
+	  }
+
+	  memset(&stats, 0, sizeof(stats));
+	  s3g_delta_encoder_init(&enc, axis_steps_per_unit);
+	  while (!s3g_command_read_ext(ctx, &cmd, raw, sizeof(raw), &rawlen))
+	       compact(&enc, &stats, &cmd, raw, rawlen, out);
+
+	  if (out)
+	       fclose(out);
+	  s3g_close(ctx);
+	  compact_report(&stats);
+
+	  return(stats.errors ? 1 : 0);
+     }
+
      while (!s3g_command_read(ctx, &cmd))
      {
 	  if (do_edensity == 0)
@@ -0,0 +1,285 @@
+// sd_raw_file.c
+// File backed replacement for lib_sd/sd_raw.c; see sd_raw_file.h
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "sd_raw_file.h"
+
+uint8_t sd_errno;
+
+sd_raw_file_stats_t sd_raw_file_stats;
+
+unsigned int sd_raw_file_read_wait = 100;
+unsigned int sd_raw_file_stream_wait = 2;
+unsigned int sd_raw_file_write_wait = 250;
+bool sd_raw_file_streaming = true;
+
+static FILE *image = NULL;
+
+// As sd_raw.c: a one block cache, written back when another block is needed
+static uint8_t raw_block[512];
+static offset_t raw_block_address = (offset_t)-1;
+static uint8_t raw_block_written = 1;
+
+// As sd_raw.c: streaming read state
+static uint8_t raw_stream_enabled = 0;
+static uint8_t raw_stream_active = 0;
+static offset_t raw_stream_address;
+
+// SPI traffic of sd_raw_send_command(): a wait byte, the command, its
+// argument and CRC, and the response
+
+static void count_command(void)
+{
+     sd_raw_file_stats.commands++;
+     sd_raw_file_stats.spi_bytes += 1 + 6 + 1;
+}
+
+// SPI traffic of stopping a streaming read: STOP_TRANSMISSION and its
+// stuff byte, waiting for the card, and the byte after deselecting it
+
+static void stream_stop(void)
+{
+     if (!raw_stream_active)
+	  return;
+     raw_stream_active = 0;
+     count_command();
+     sd_raw_file_stats.spi_bytes += 1 + 1 + 1;
+}
+
+int sd_raw_file_open(const char *path)
+{
+     if (image)
+	  sd_raw_file_close();
+
+     image = fopen(path, "r+b");
+     if (!image)
+	  return(-1);
+
+     raw_block_address = (offset_t)-1;
+     raw_block_written = 1;
+     raw_stream_active = 0;
+     memset(&sd_raw_file_stats, 0, sizeof(sd_raw_file_stats));
+
+     return(0);
+}
+
+void sd_raw_file_close(void)
+{
+     if (!image)
+	  return;
+
+     sd_raw_sync();
+     fclose(image);
+     image = NULL;
+}
+
+uint8_t sd_raw_init(bool use_crc)
+{
+     (void)use_crc;
+
+     if (!image)
+     {
+	  sd_errno = SDR_ERR_NOCARD;
+	  return(0);
+     }
+     raw_block_address = (offset_t)-1;
+     raw_stream_active = 0;
+     return(1);
+}
+
+uint8_t sd_raw_available()
+{
+     return(image != NULL);
+}
+
+uint8_t sd_raw_locked()
+{
+     return(0);
+}
+
+// Make the block at block_address the cached block, reading it from the image
+
+static uint8_t load_block(offset_t block_address)
+{
+     if (block_address == raw_block_address)
+	  return(1);
+
+     if (!sd_raw_sync())
+	  return(0);
+
+     if (!image ||
+	 fseeko(image, (off_t)block_address, SEEK_SET) ||
+	 fread(raw_block, sizeof(raw_block), 1, image) != 1)
+     {
+	  raw_block_address = (offset_t)-1;
+	  sd_errno = image ? SDR_ERR_COMMS : SDR_ERR_NOCARD;
+	  return(0);
+     }
+
+     raw_block_address = block_address;
+     sd_raw_file_stats.block_reads++;
+
+     // A block other than the next one the card is sending ends the
+     // transfer; otherwise a read command is needed unless streaming
+     if (raw_stream_active && block_address != raw_stream_address)
+	  stream_stop();
+     if (raw_stream_active)
+	  sd_raw_file_stats.spi_bytes += sd_raw_file_stream_wait;
+     else
+     {
+	  count_command();
+	  sd_raw_file_stats.spi_bytes += sd_raw_file_read_wait;
+	  raw_stream_active = raw_stream_enabled;
+     }
+     raw_stream_address = block_address + 512;
+
+     // The start token, the block, and its CRC; then, unless streaming,
+     // the byte after deselecting the card
+     sd_raw_file_stats.spi_bytes += 1 + 512 + 2;
+     if (!raw_stream_active)
+	  sd_raw_file_stats.spi_bytes += 1;
+
+     return(1);
+}
+
+uint8_t sd_raw_read(offset_t offset, uint8_t* buffer, uintptr_t length)
+{
+     while (length > 0)
+     {
+	  uint16_t block_offset = offset & 0x01ff;
+	  uint16_t read_length = 512 - block_offset;
+	  if (read_length > length)
+	       read_length = length;
+
+	  if (!load_block(offset - block_offset))
+	       return(0);
+	  memcpy(buffer, raw_block + block_offset, read_length);
+
+	  buffer += read_length;
+	  offset += read_length;
+	  length -= read_length;
+     }
+
+     return(1);
+}
+
+uint8_t sd_raw_read_interval(offset_t offset, uint8_t* buffer, uintptr_t interval,
+			     uintptr_t length, sd_raw_read_interval_handler_t callback, void* p)
+{
+     if (!buffer || interval == 0 || length < interval || !callback)
+	  return(0);
+
+     while (length >= interval)
+     {
+	  if (!sd_raw_read(offset, buffer, interval))
+	       return(0);
+	  if (!callback(buffer, offset, p))
+	       break;
+	  offset += interval;
+	  length -= interval;
+     }
+
+     return(1);
+}
+
+uint8_t sd_raw_write(offset_t offset, const uint8_t* buffer, uintptr_t length)
+{
+     while (length > 0)
+     {
+	  uint16_t block_offset = offset & 0x01ff;
+	  uint16_t write_length = 512 - block_offset;
+	  if (write_length > length)
+	       write_length = length;
+
+	  // Whole blocks need not be read before they are overwritten
+	  if (write_length == 512 && offset != raw_block_address)
+	  {
+	       if (!sd_raw_sync())
+		    return(0);
+	       raw_block_address = offset;
+	  }
+	  else if (!load_block(offset - block_offset))
+	       return(0);
+
+	  memcpy(raw_block + block_offset, buffer, write_length);
+	  raw_block_written = 0;
+
+	  buffer += write_length;
+	  offset += write_length;
+	  length -= write_length;
+     }
+
+     return(1);
+}
+
+uint8_t sd_raw_write_interval(offset_t offset, uint8_t* buffer, uintptr_t length,
+			      sd_raw_write_interval_handler_t callback, void* p)
+{
+     if (!buffer || !callback)
+	  return(0);
+
+     uint8_t endless = (length == 0);
+     while (endless || length > 0)
+     {
+	  uint16_t bytes_to_write = callback(buffer, offset, p);
+	  if (!bytes_to_write)
+	       break;
+	  if (!endless && bytes_to_write > length)
+	       return(0);
+	  if (!sd_raw_write(offset, buffer, bytes_to_write))
+	       return(0);
+	  offset += bytes_to_write;
+	  length -= bytes_to_write;
+     }
+
+     return(1);
+}
+
+uint8_t sd_raw_sync()
+{
+     if (raw_block_written)
+	  return(1);
+
+     if (!image ||
+	 fseeko(image, (off_t)raw_block_address, SEEK_SET) ||
+	 fwrite(raw_block, sizeof(raw_block), 1, image) != 1)
+     {
+	  sd_errno = image ? SDR_ERR_COMMS : SDR_ERR_NOCARD;
+	  return(0);
+     }
+
+     raw_block_written = 1;
+     sd_raw_file_stats.block_writes++;
+
+     // WRITE_SINGLE_BLOCK, the start byte, the block and its CRC, waiting
+     // for the card to program the block, and the byte after that
+     stream_stop();
+     count_command();
+     sd_raw_file_stats.spi_bytes += 1 + 512 + 2 + sd_raw_file_write_wait + 1;
+
+     return(1);
+}
+
+uint8_t sd_raw_set_streaming(uint8_t enable)
+{
+     raw_stream_enabled = enable && sd_raw_file_streaming;
+     if (!raw_stream_enabled)
+	  stream_stop();
+     return(1);
+}
+
+uint8_t sd_raw_get_info(struct sd_raw_info* info)
+{
+     if (!info || !image)
+	  return(0);
+
+     memset(info, 0, sizeof(*info));
+     if (!fseeko(image, 0, SEEK_END))
+	  info->capacity = (offset_t)ftello(image);
+     info->format = SD_RAW_FORMAT_SUPERFLOPPY;
+
+     return(1);
+}
@@ -0,0 +1,53 @@
+// sd_raw_file.h
+// A stand in for lib_sd/sd_raw.c which keeps the "card" in a disk image
+// file.  The sd_raw_* calls behave as sd_raw.c's do, including its one
+// block cache and streaming reads, and count the blocks moved to and from
+// the image so that changes to lib_sd's access patterns can be measured
+// on the host.  The commands and SPI bytes sd_raw.c would exchange with
+// a card are counted too, with the card's access and programming times
+// counted as the bytes sd_raw.c polls while it waits.
+
+#ifndef SD_RAW_FILE_H_
+
+#define SD_RAW_FILE_H_
+
+#include <stdbool.h>
+#include "sd_raw.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct {
+     unsigned long block_reads;   // Blocks read from the image (cache misses)
+     unsigned long block_writes;  // Blocks written to the image
+     unsigned long commands;      // Commands sent to the card
+     unsigned long spi_bytes;     // Bytes sent and received over SPI
+} sd_raw_file_stats_t;
+
+extern sd_raw_file_stats_t sd_raw_file_stats;
+
+// Bytes polled waiting for the first block of a read, for each following
+// block of a streaming read, and for a written block to be programmed.
+// They may be changed to model slower or faster cards.
+extern unsigned int sd_raw_file_read_wait;
+extern unsigned int sd_raw_file_stream_wait;
+extern unsigned int sd_raw_file_write_wait;
+
+// When false, sd_raw_set_streaming() is ignored and every block is read
+// with READ_SINGLE_BLOCK, as with SD_RAW_STREAMING 0
+extern bool sd_raw_file_streaming;
+
+// Use the named image file as the card.  Returns 0 on success and -1 on
+// error, with errno set.
+int sd_raw_file_open(const char *path);
+
+// Flush any buffered block and close the image
+void sd_raw_file_close(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
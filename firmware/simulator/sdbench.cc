@@ -0,0 +1,444 @@
+// sdbench.cc
+//
+// Runs the firmware's SD card code, SDCard.cc and lib_sd, on the host with
+// sd_raw_file.c standing in for the card, over generated FAT16 and FAT32
+// images:
+//
+//     sdbench [-c sectors] [-k kbytes] [-n files] [-s] [-u usecs] [image]
+//
+// Each image holds a build file and a few other files.  The directory is
+// listed with directoryNextEntry(), the build file is played back with
+// playbackNext() and again with playbackRead(), and a build file is
+// captured with capturePacket() and then played back.  Then more files
+// are added and browsed as the LCD's file browser does, reading each
+// entry in turn with directoryIndexEntry(), and by reading through the
+// directory to each entry.  Everything read is checked.  For each phase
+// the SD commands and SPI bytes the card would see are reported per KB
+// (of directory entries, for the listings), along with the bytes/second
+// those SPI bytes allow.  The SPI clock on the bot is F_CPU/2, 8MHz, but
+// sd_raw.c moves a byte only every 1.5us or so as it waits for each SPI
+// transfer to complete before starting the next.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "sd_raw_file.h"
+#include "fatimage.h"
+#include "SDCard.hh"
+#include "Packet.hh"
+#include "Eeprom.hh"
+
+#if defined(__arm__)
+#define GETOPTS_END (char)-1
+#else
+#define GETOPTS_END -1
+#endif
+
+#define SECTOR_SIZE 512
+
+// Bytes of playback data read at a time by playbackRead(), as
+// Command.cc's runCommandSlice() does
+#define PLAYBACK_CHUNK 32
+
+// sdcard::initCard() reads the SD CRC setting from the EEPROM
+
+namespace eeprom {
+uint8_t getEeprom8(const uint16_t location, const uint8_t default_value) { return default_value; }
+}
+
+static double usecs_per_byte = 1.5;
+static int errors = 0;
+
+static void usage(FILE *f, const char *prog)
+{
+     if (f == NULL)
+	  f = stderr;
+
+     fprintf(f,
+"Usage: %s [-c sectors] [-k kbytes] [-n files] [-s] [-u usecs] [image]\n"
+"  image  -- Name of the disk image to generate; defaults to sdbench.img\n"
+"  ?, -h  -- This help message\n"
+"     -c  -- Sectors per cluster; default 8\n"
+"     -k  -- Size of the build file in kilobytes; default 256\n"
+"     -n  -- Number of files to browse; default 200\n"
+"     -s  -- Read each block with its own command rather than streaming\n"
+"     -u  -- Microseconds per SPI byte; default 1.5\n",
+	     prog ? prog : "sdbench");
+}
+
+// Report the SD traffic since the stats were last reset
+
+static void report(const char *phase, uint32_t bytes)
+{
+     double kbytes = bytes / 1024.0;
+     double secs = sd_raw_file_stats.spi_bytes * usecs_per_byte / 1000000.0;
+
+     printf("  %-18s %8u bytes  %6lu blocks read  %6lu written  "
+	    "%6.2f commands/KB  %7.1f SPI bytes/KB  %8.0f bytes/sec\n",
+	    phase, bytes, sd_raw_file_stats.block_reads, sd_raw_file_stats.block_writes,
+	    kbytes > 0 ? sd_raw_file_stats.commands / kbytes : 0.0,
+	    kbytes > 0 ? sd_raw_file_stats.spi_bytes / kbytes : 0.0,
+	    secs > 0 ? bytes / secs : 0.0);
+
+     memset(&sd_raw_file_stats, 0, sizeof(sd_raw_file_stats));
+}
+
+static void check(const char *phase, uint32_t offset, uint8_t got)
+{
+     if (got != fat_image_byte(offset) && errors++ < 10)
+	  fprintf(stderr, "%s: mismatch at offset %u\n", phase, offset);
+}
+
+static void check_size(const char *phase, uint32_t got, uint32_t want)
+{
+     if (got == want)
+	  return;
+     fprintf(stderr, "%s: %u bytes rather than %u\n", phase, got, want);
+     errors++;
+}
+
+// List the root directory, returning the number of files seen
+
+static uint32_t list_files(void)
+{
+     char name[64];
+     uint32_t n = 0;
+
+     if (sdcard::directoryReset() != sdcard::SD_SUCCESS)
+     {
+	  fprintf(stderr, "directoryReset() failed; sdAvailable = %d\n",
+		  sdcard::sdAvailable);
+	  errors++;
+	  return(0);
+     }
+     for (;;)
+     {
+	  sdcard::directoryNextEntry(name, sizeof(name));
+	  if (!name[0])
+	       break;
+	  n++;
+     }
+
+     return(n);
+}
+
+// Play the open build file back a byte at a time
+
+static uint32_t play_bytes(void)
+{
+     uint32_t offset = 0;
+
+     while (sdcard::playbackHasNext())
+     {
+	  check("playbackNext", offset, sdcard::playbackNext());
+	  offset++;
+     }
+
+     return(offset);
+}
+
+// Play the open build file back PLAYBACK_CHUNK bytes at a time
+
+static uint32_t play_chunks(const char *phase)
+{
+     uint8_t chunk[PLAYBACK_CHUNK];
+     uint32_t offset = 0;
+
+     while (sdcard::playbackHasNext())
+     {
+	  uint8_t n = sdcard::playbackRead(chunk, sizeof(chunk));
+	  for (uint8_t i = 0; i < n; i++)
+	       check(phase, offset + i, chunk[i]);
+	  offset += n;
+     }
+
+     return(offset);
+}
+
+// Capture file_size bytes in packets of 1 to MAX_PACKET_PAYLOAD bytes, as
+// a host sending commands to be captured would
+
+static uint32_t capture(char *filename, uint32_t file_size)
+{
+     OutPacket packet;
+     uint32_t offset = 0;
+     uint8_t len = 1;
+
+     if (sdcard::startCapture(filename) != sdcard::SD_SUCCESS)
+     {
+	  fprintf(stderr, "startCapture() failed\n");
+	  errors++;
+	  return(0);
+     }
+     while (offset < file_size)
+     {
+	  packet.reset();
+	  for (uint8_t i = 0; i < len && offset < file_size; i++)
+	       packet.append8(fat_image_byte(offset++));
+	  sdcard::capturePacket(packet);
+	  len = (len % MAX_PACKET_PAYLOAD) + 1;
+     }
+
+     return(sdcard::finishCapture());
+}
+
+// Browse the directory's n files as the LCD does: index them, sorted by
+// name, and read each in turn.  The cost of indexing them unsorted is
+// reported too.
+
+static void browse_indexed(uint32_t n)
+{
+     char name[64], last[64];
+     bool isdir;
+
+     uint32_t count = sdcard::directoryIndex(false);
+     check_size("directoryIndex", count, n);
+     report("directory index", count * 32);
+
+     count = sdcard::directoryIndex(true);
+     check_size("directoryIndex", count, n);
+     report("sorted index", count * 32);
+
+     last[0] = 0;
+     for (uint32_t i = 0; i < count; i++)
+     {
+	  if (!sdcard::directoryIndexEntry((uint8_t)i, name, sizeof(name), &isdir))
+	  {
+	       fprintf(stderr, "directoryIndexEntry(%u) failed\n", i);
+	       errors++;
+	       break;
+	  }
+	  if (strcasecmp(last, name) > 0 && errors++ < 10)
+	       fprintf(stderr, "%s is listed after %s\n", name, last);
+	  strcpy(last, name);
+     }
+     report("indexed browse", count * 32);
+}
+
+// Browse the directory's n files by reading through the directory to each
+// one, as the LCD did before the index
+
+static void browse_scanned(uint32_t n)
+{
+     char name[64];
+     uint32_t i;
+
+     for (i = 0; i < n; i++)
+     {
+	  if (sdcard::directoryReset() != sdcard::SD_SUCCESS)
+	       break;
+	  for (uint32_t j = 0; j <= i; j++)
+	  {
+	       sdcard::directoryNextEntry(name, sizeof(name));
+	       if (!name[0])
+		    break;
+	  }
+	  if (!name[0])
+	       break;
+     }
+     check_size("directoryNextEntry", i, n);
+     report("rescanning browse", n * 32);
+}
+
+static void bench(const char *path, fat_image_type_t type, uint8_t cluster_sectors,
+		  uint32_t file_size, uint32_t nfiles)
+{
+     static const fat_image_file_t files[] = {
+	  { "CAL     S3G", 2048, 0 },
+	  { "BOX     S3G", 4096, 0 },
+	  { "BUILD   S3G", 0, 0 },
+	  { "README  TXT", 100, 0 }
+     };
+     fat_image_file_t image_files[sizeof(files) / sizeof(files[0])];
+     char build[] = "BUILD.S3G";
+     char captured[] = "capture.s3g";
+
+     memcpy(image_files, files, sizeof(files));
+     image_files[2].size = file_size;
+     if (fat_image_create(path, type, cluster_sectors, image_files,
+			  sizeof(image_files) / sizeof(image_files[0])))
+     {
+	  errors++;
+	  return;
+     }
+     if (sd_raw_file_open(path))
+     {
+	  fprintf(stderr, "Unable to open %s; %s\n", path, strerror(errno));
+	  errors++;
+	  return;
+     }
+
+     printf("FAT%d, %u byte clusters:\n", (int)type, cluster_sectors * SECTOR_SIZE);
+
+     // Mounting the card is counted with the directory listing
+     sdcard::forceReinit();
+     uint32_t n = list_files();
+     if (n != sizeof(files) / sizeof(files[0]))
+     {
+	  fprintf(stderr, "Listed %u files rather than %u\n", n,
+		  (uint32_t)(sizeof(files) / sizeof(files[0])));
+	  errors++;
+     }
+     report("directory listing", n * 32);
+
+     if (sdcard::startPlayback(build) != sdcard::SD_SUCCESS)
+     {
+	  fprintf(stderr, "startPlayback() failed; sdAvailable = %d\n", sdcard::sdAvailable);
+	  errors++;
+	  sd_raw_file_close();
+	  return;
+     }
+     n = play_bytes();
+     check_size("playbackNext", n, file_size);
+     report("playbackNext", n);
+
+     sdcard::playbackRestart();
+     n = play_chunks("playbackRead");
+     check_size("playbackRead", n, file_size);
+     sdcard::finishPlayback();
+     report("playbackRead", n);
+
+     n = capture(captured, file_size);
+     check_size("capturePacket", n, file_size);
+     report("capturePacket", n);
+
+     if (sdcard::startPlayback(captured) != sdcard::SD_SUCCESS)
+     {
+	  fprintf(stderr, "startPlayback() of the capture failed\n");
+	  errors++;
+     }
+     else
+     {
+	  n = play_chunks("captured playback");
+	  check_size("captured playback", n, file_size);
+	  sdcard::finishPlayback();
+	  report("captured playback", n);
+     }
+
+     sdcard::reset();
+     sd_raw_file_close();
+
+     // Browse a directory of many small files, created in the reverse of
+     // their name order
+
+     fat_image_file_t *many = (fat_image_file_t *)calloc(nfiles, sizeof(fat_image_file_t));
+     char *names = (char *)malloc(nfiles * 12 + 1);
+     if (!many || !names)
+     {
+	  fprintf(stderr, "Unable to allocate memory\n");
+	  errors++;
+	  free(many);
+	  free(names);
+	  return;
+     }
+     for (uint32_t i = 0; i < nfiles; i++)
+     {
+	  sprintf(names + i * 12, "F%07u", nfiles - i);
+	  memcpy(names + i * 12 + 8, "S3G", 4);
+	  many[i].name = names + i * 12;
+	  many[i].size = 100;
+	  many[i].runs = 0;
+     }
+     if (fat_image_create(path, type, cluster_sectors, many, (int)nfiles) ||
+	 sd_raw_file_open(path))
+     {
+	  errors++;
+     }
+     else
+     {
+	  sdcard::forceReinit();
+	  if (sdcard::directoryReset() != sdcard::SD_SUCCESS)
+	  {
+	       fprintf(stderr, "directoryReset() failed; sdAvailable = %d\n",
+		       sdcard::sdAvailable);
+	       errors++;
+	  }
+	  memset(&sd_raw_file_stats, 0, sizeof(sd_raw_file_stats));
+	  browse_indexed(nfiles);
+	  browse_scanned(nfiles);
+	  sdcard::reset();
+	  sd_raw_file_close();
+     }
+     free(many);
+     free(names);
+}
+
+int main(int argc, const char *argv[])
+{
+     char c;
+     uint8_t cluster_sectors = 8;
+     uint32_t file_size = 256 * 1024;
+     uint32_t nfiles = 200;
+     const char *path = "sdbench.img";
+
+     while ((c = getopt(argc, (char **)argv, ":hc:k:n:su:?")) != GETOPTS_END)
+     {
+	  switch(c)
+	  {
+	  case 'c' :
+	       cluster_sectors = (uint8_t)atoi(optarg);
+	       if (cluster_sectors == 0 || (cluster_sectors & (cluster_sectors - 1)) ||
+		   cluster_sectors > 64)
+	       {
+		    fprintf(stderr, "Sectors per cluster must be a power of 2 no larger than 64\n");
+		    return(1);
+	       }
+	       break;
+
+	  case 'k' :
+	       file_size = (uint32_t)atoi(optarg) * 1024;
+	       break;
+
+	  case 'n' :
+	       nfiles = (uint32_t)atoi(optarg);
+	       if (nfiles == 0 || nfiles > 255)
+	       {
+		    fprintf(stderr, "The number of files must be between 1 and 255\n");
+		    return(1);
+	       }
+	       break;
+
+	  case 's' :
+	       sd_raw_file_streaming = false;
+	       break;
+
+	  case 'u' :
+	       usecs_per_byte = atof(optarg);
+	       if (usecs_per_byte <= 0.0)
+	       {
+		    fprintf(stderr, "The time per SPI byte must be positive\n");
+		    return(1);
+	       }
+	       break;
+
+	  case 'h' :
+	  case '?' :
+	       usage(stdout, argv[0]);
+	       return(0);
+
+	  default :
+	       usage(stderr, argv[0]);
+	       return(1);
+	  }
+     }
+     argc -= optind;
+     argv += optind;
+     if (argc > 0)
+	  path = argv[0];
+
+     bench(path, FAT_IMAGE_FAT16, cluster_sectors, file_size, nfiles);
+     bench(path, FAT_IMAGE_FAT32, cluster_sectors, file_size, nfiles);
+
+     if (errors)
+     {
+	  printf("FAILED: %d errors\n", errors);
+	  return(1);
+     }
+     printf("PASSED\n");
+
+     return(0);
+}
@@ -0,0 +1,225 @@
+// Test lib_sd's file reads against a FAT16 disk image
+//
+//     sdtest [-c sectors] [-f clusters] [-k kbytes] [-r bytes] [image]
+//
+// A FAT16 image holding a single file is generated, the file is read
+// back through lib_sd with sd_raw_file.c standing in for the SD card,
+// and the contents checked.  The number of blocks read from the image
+// is reported, which is what an SD card read costs on the bot.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdbool.h>
+
+#include "sd_raw_file.h"
+#include "fatimage.h"
+#include "partition.h"
+#include "fat.h"
+
+#if defined(__arm__)
+#define GETOPTS_END (char)-1
+#else
+#define GETOPTS_END -1
+#endif
+
+#define SECTOR_SIZE 512
+
+static void usage(FILE *f, const char *prog)
+{
+     if (f == NULL)
+	  f = stderr;
+
+     fprintf(f,
+"Usage: %s [-c sectors] [-f clusters] [-k kbytes] [-r bytes] [image]\n"
+"  image  -- Name of the disk image to generate; defaults to sdtest.img\n"
+"  ?, -h  -- This help message\n"
+"     -c  -- Sectors per cluster; default 8\n"
+"     -f  -- Fragment the file into runs of this many clusters; default 0\n"
+"            which stores the file in a single contiguous run of clusters\n"
+"     -k  -- Size of the file in kilobytes; default 1024\n"
+"     -r  -- Number of bytes to read from the file at a time; default 512\n",
+	     prog ? prog : "sdtest");
+}
+
+int main(int argc, const char *argv[])
+{
+     char c;
+     uint8_t cluster_sectors = 8;
+     uint32_t runs = 0;
+     uint32_t file_size = 1024 * 1024;
+     uint32_t read_size = 512;
+     const char *path = "sdtest.img";
+
+     while ((c = getopt(argc, (char **)argv, ":hc:f:k:r:?")) != GETOPTS_END)
+     {
+	  switch(c)
+	  {
+	  case 'c' :
+	       cluster_sectors = (uint8_t)atoi(optarg);
+	       if (cluster_sectors == 0 || (cluster_sectors & (cluster_sectors - 1)) ||
+		   cluster_sectors > 64)
+	       {
+		    fprintf(stderr, "Sectors per cluster must be a power of 2 no larger than 64\n");
+		    return(1);
+	       }
+	       break;
+
+	  case 'f' :
+	       runs = (uint32_t)atoi(optarg);
+	       break;
+
+	  case 'k' :
+	       file_size = (uint32_t)atoi(optarg) * 1024;
+	       break;
+
+	  case 'r' :
+	       read_size = (uint32_t)atoi(optarg);
+	       if (read_size == 0 || read_size > 0x7fff)
+	       {
+		    fprintf(stderr, "The read size must be between 1 and 32767 bytes\n");
+		    return(1);
+	       }
+	       break;
+
+	  case 'h' :
+	  case '?' :
+	       usage(stdout, argv[0]);
+	       return(0);
+
+	  default :
+	       usage(stderr, argv[0]);
+	       return(1);
+	  }
+     }
+     argc -= optind;
+     argv += optind;
+     if (argc > 0)
+	  path = argv[0];
+
+     fat_image_file_t file = { "TEST    S3G", file_size, runs };
+     if (fat_image_create(path, FAT_IMAGE_FAT16, cluster_sectors, &file, 1))
+	  return(1);
+
+     if (sd_raw_file_open(path) || !sd_raw_init(false))
+     {
+	  fprintf(stderr, "Unable to open %s; %s\n", path, strerror(errno));
+	  return(1);
+     }
+
+     struct partition_struct *partition =
+	  partition_open(sd_raw_read, sd_raw_read_interval, sd_raw_write, sd_raw_write_interval, 0);
+     if (!partition)
+	  partition = partition_open(sd_raw_read, sd_raw_read_interval,
+				     sd_raw_write, sd_raw_write_interval, -1);
+     struct fat_fs_struct *fs = partition ? fat_open(partition) : NULL;
+     if (!fs)
+     {
+	  fprintf(stderr, "Unable to open the FAT filesystem; fat_errno = %d\n", fat_errno);
+	  return(1);
+     }
+
+     struct fat_dir_entry_struct entry;
+     struct fat_dir_struct *dd = NULL;
+     if (fat_get_dir_entry_of_path(fs, "/", &entry))
+	  dd = fat_open_dir(fs, &entry);
+     bool found = false;
+     while (dd && fat_read_dir(dd, &entry))
+	  if (!(entry.attributes & (FAT_ATTRIB_DIR | FAT_ATTRIB_VOLUME)))
+	  {
+	       found = true;
+	       break;
+	  }
+     if (dd)
+	  fat_close_dir(dd);
+     struct fat_file_struct *fd = found ? fat_open_file(fs, &entry) : NULL;
+     if (!fd)
+     {
+	  fprintf(stderr, "Unable to open the test file\n");
+	  return(1);
+     }
+
+     printf("Image %s: FAT16, %u byte clusters, %u byte file ",
+	    path, cluster_sectors * SECTOR_SIZE, file_size);
+     if (runs)
+	  printf("in runs of %u clusters\n", runs);
+     else
+	  printf("in one run of clusters\n");
+
+     // Read the file sequentially, as a build is played back
+
+     uint8_t *buf = (uint8_t *)malloc(read_size);
+     if (!buf)
+     {
+	  fprintf(stderr, "Unable to allocate memory\n");
+	  return(1);
+     }
+
+     int errors = 0;
+     uint32_t offset = 0;
+     unsigned long block_reads = sd_raw_file_stats.block_reads;
+     for (;;)
+     {
+	  intptr_t n = fat_read_file(fd, buf, read_size);
+	  if (n < 0)
+	  {
+	       fprintf(stderr, "Read error at offset %u; fat_errno = %d\n", offset, fat_errno);
+	       return(1);
+	  }
+	  if (n == 0)
+	       break;
+	  for (intptr_t i = 0; i < n; i++)
+	       if (buf[i] != fat_image_byte(offset + i) && errors++ < 10)
+		    fprintf(stderr, "Mismatch at offset %u\n", offset + (uint32_t)i);
+	  offset += n;
+     }
+     block_reads = sd_raw_file_stats.block_reads - block_reads;
+     if (offset != file_size)
+     {
+	  fprintf(stderr, "Read %u bytes of a %u byte file\n", offset, file_size);
+	  errors++;
+     }
+
+     printf("Sequential reads of %u bytes: %lu blocks read, %.2f per KB\n",
+	    read_size, block_reads, file_size ? (double)block_reads * 1024 / file_size : 0.0);
+
+     // Seek about the file, as a build restarted part way through would
+
+     block_reads = sd_raw_file_stats.block_reads;
+     srandom(1);
+     for (int i = 0; file_size && i < 100; i++)
+     {
+	  int32_t pos = (int32_t)(random() % file_size);
+	  uint32_t want = (file_size - pos < read_size) ? file_size - pos : read_size;
+	  if (!fat_seek_file(fd, &pos, FAT_SEEK_SET) ||
+	      fat_read_file(fd, buf, read_size) != (intptr_t)want)
+	  {
+	       fprintf(stderr, "Seek and read at offset %d failed\n", pos);
+	       errors++;
+	       continue;
+	  }
+	  for (uint32_t j = 0; j < want; j++)
+	       if (buf[j] != fat_image_byte(pos + j) && errors++ < 10)
+		    fprintf(stderr, "Mismatch at offset %u after seeking\n", pos + j);
+     }
+     block_reads = sd_raw_file_stats.block_reads - block_reads;
+
+     printf("100 seeks and reads: %lu blocks read\n", block_reads);
+
+     free(buf);
+     fat_close_file(fd);
+     fat_close(fs);
+     partition_close(partition);
+     sd_raw_file_close();
+
+     if (errors)
+     {
+	  printf("FAILED: %d errors\n", errors);
+	  return(1);
+     }
+     printf("PASSED\n");
+
+     return(0);
+}
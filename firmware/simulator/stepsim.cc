@@ -0,0 +1,487 @@
+// stepsim.cc
+//
+// Runs the firmware's stepper interrupt code, StepperAccel.cc, against an
+// emulated stepper timer and emulated I/O ports, feeding the planner from an
+// .s3g or .x3g file.  Every rising edge of a step pin is written to a binary
+// trace file along with its time, for checking step rate smoothness, the
+// maximum instantaneous step frequency and JKN Advance offline.
+//
+// Trace file layout (host byte order):
+//
+//    stepsim_header_t  header;
+//    stepsim_edge_t    edges[];   // one per step, in time order
+//
+// Time is in ticks of the 2MHz stepper timer.  The interrupts are treated as
+// taking no time, so all the steps made by one interrupt share a time.
+//
+// With -c, rather than run a file, stepsim runs single moves with S-curve
+// ramps and checks that the peak acceleration keeps to the max. acceleration.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <math.h>
+
+#include "Simulator.hh"
+#include "StepperAccelPlannerExtras.hh"
+#include "StepperAccel.hh"
+#include "StepperAxis.hh"
+#include "Point.hh"
+#include "Steppers.hh"
+#include "s3g.h"
+
+#define STEPSIM_MAGIC "STEPSIM1"
+
+// Stepper timer frequency (Motherboard::setupAccelStepperTimer)
+#define STEPPER_TIMER_HZ 2000000
+
+// The extruder interrupt runs at 10KHz (ADVANCE_INTERRUPT_FREQUENCY)
+#define EXTRUDER_INTERRUPT_TICKS (STEPPER_TIMER_HZ / 10000)
+
+#define STEPSIM_STEPPER_INTERRUPT  0
+#define STEPSIM_EXTRUDER_INTERRUPT 1
+
+typedef struct {
+     char     magic[8];    // STEPSIM_MAGIC
+     uint32_t tick_hz;     // STEPPER_TIMER_HZ
+     uint8_t  axes;        // STEPPER_COUNT
+     uint8_t  reserved[3];
+} stepsim_header_t;
+
+typedef struct {
+     uint32_t ticks;       // Ticks since the previous edge
+     uint8_t  axis;        // X_AXIS, Y_AXIS, ...
+     int8_t   direction;   // +1 or -1, from the direction pin at the time of the edge
+     uint8_t  source;      // STEPSIM_STEPPER_INTERRUPT or STEPSIM_EXTRUDER_INTERRUPT
+     uint8_t  reserved;
+} stepsim_edge_t;
+
+// Emulated registers
+uint8_t stepsim_registers[STEPSIM_REGISTERS];
+volatile uint16_t OCR3A, TCNT3;
+volatile uint8_t TCCR3A, TCCR3B, TCCR3C, TIMSK3;
+volatile uint8_t SREG;
+
+static FILE *trace;
+static uint64_t now;               // Current time in ticks
+static uint64_t last_edge;         // Time of the last edge written to the trace
+static uint8_t source;             // The interrupt being run
+
+static uint64_t next_stepper_interrupt;
+static uint64_t next_extruder_interrupt;
+static uint32_t main_loop_ticks = 1000;
+
+// Per axis statistics
+static uint64_t edges[STEPPER_COUNT];
+static int64_t  net_steps[STEPPER_COUNT];
+static uint64_t axis_last_edge[STEPPER_COUNT];
+static uint8_t  burst[STEPPER_COUNT];         // Steps made by the interrupt at axis_last_edge
+static float    max_rate[STEPPER_COUNT];
+
+// The acceleration is the change in the average rate from one window of at
+// least ACCEL_WINDOW_TICKS to the next, over the time between their middles.
+// Over a window the timer's quantization of each step's time averages out.
+#define ACCEL_WINDOW_TICKS (STEPPER_TIMER_HZ / 25)
+
+static uint64_t window_start[STEPPER_COUNT];  // Interrupt which began the window, 0 for none
+static uint64_t window_edges[STEPPER_COUNT];  // edges[] before that interrupt
+static float    window_rate[STEPPER_COUNT];   // Average rate of the last window, 0 for none
+static uint64_t window_middle[STEPPER_COUNT]; // Middle of the last window
+static float    max_accel[STEPPER_COUNT];
+
+void stepsim_port_write(uint16_t addr, uint8_t value)
+{
+     uint8_t rising = value & ~stepsim_registers[addr];
+
+     stepsim_registers[addr] = value;
+     if (!rising)
+	  return;
+
+     for (uint8_t i = 0; i < STEPPER_COUNT; i++)
+     {
+	  StepperIOPort *step = &stepperAxisPorts[i].step;
+
+	  if (step->port != addr || !(rising & _BV(step->pin)))
+	       continue;
+
+	  StepperIOPort *dir = &stepperAxisPorts[i].dir;
+	  bool forward = ((stepsim_registers[dir->port] & _BV(dir->pin)) != 0) ^ stepperAxis[i].invert_axis;
+
+	  stepsim_edge_t edge;
+	  edge.ticks     = (uint32_t)(now - last_edge);
+	  edge.axis      = i;
+	  edge.direction = forward ? 1 : -1;
+	  edge.source    = source;
+	  edge.reserved  = 0;
+	  fwrite(&edge, sizeof(edge), 1, trace);
+	  last_edge = now;
+
+	  // The instantaneous rate is the steps made by an interrupt over the
+	  // time until the next interrupt which steps the axis
+	  if (edges[i] && now == axis_last_edge[i])
+	       burst[i]++;
+	  else
+	  {
+	       if (edges[i])
+	       {
+		    float rate = (float)burst[i] * (float)STEPPER_TIMER_HZ / (float)(now - axis_last_edge[i]);
+		    if (rate > max_rate[i])
+			 max_rate[i] = rate;
+	       }
+
+	       // Windows run from one interrupt which steps the axis to another
+	       if (window_start[i] == 0)
+	       {
+		    window_start[i] = now;
+		    window_edges[i] = edges[i];
+	       }
+	       else if (now - window_start[i] >= ACCEL_WINDOW_TICKS)
+	       {
+		    float rate = (float)(edges[i] - window_edges[i]) * (float)STEPPER_TIMER_HZ /
+			 (float)(now - window_start[i]);
+		    uint64_t middle = (window_start[i] + now) / 2;
+		    if (window_rate[i] != 0)
+		    {
+			 float accel = fabsf(rate - window_rate[i]) * (float)STEPPER_TIMER_HZ /
+			      (float)(middle - window_middle[i]);
+			 if (accel > max_accel[i])
+			      max_accel[i] = accel;
+		    }
+		    window_rate[i]   = rate;
+		    window_middle[i] = middle;
+		    window_start[i]  = now;
+		    window_edges[i]  = edges[i];
+	       }
+	       axis_last_edge[i] = now;
+	       burst[i] = 1;
+	  }
+	  edges[i]++;
+	  net_steps[i] += edge.direction;
+     }
+}
+
+// Run the interrupts which fall due in the next "ticks" ticks, followed by
+// a main loop slice
+
+static void run_main_loop_slice(uint32_t ticks)
+{
+     uint64_t until = now + ticks;
+
+     for (;;)
+     {
+	  uint64_t next = (next_stepper_interrupt <= next_extruder_interrupt) ?
+	       next_stepper_interrupt : next_extruder_interrupt;
+	  if (next > until)
+	       break;
+	  now = next;
+
+	  if (next == next_stepper_interrupt)
+	  {
+	       // CTC mode: the counter restarts on the compare match, and the
+	       // next match is OCR3A + 1 ticks later
+	       TCNT3 = 0;
+	       source = STEPSIM_STEPPER_INTERRUPT;
+	       if (TIMSK3 & _BV(OCIE3A))
+		    steppers::doStepperInterrupt();
+	       next_stepper_interrupt = now + OCR3A + 1;
+	  }
+	  else
+	  {
+	       source = STEPSIM_EXTRUDER_INTERRUPT;
+	       steppers::doExtruderInterrupt();
+	       next_extruder_interrupt = now + EXTRUDER_INTERRUPT_TICKS;
+	  }
+     }
+     now = until;
+
+     steppers::runSteppersSlice();
+}
+
+static bool extruders_idle(void)
+{
+     for (uint8_t i = 0; i < EXTRUDERS; i++)
+	  if (e_steps[i])
+	       return(false);
+     return(true);
+}
+
+// Step out everything which is queued
+
+static void drain(void)
+{
+     while (movesplanned() != 0 || !extruders_idle())
+	  run_main_loop_slice(main_loop_ticks);
+}
+
+// Run a move along X from rest at each S-curve percentage, and check that
+// its peak acceleration keeps to the max. acceleration.  Returns non-zero if
+// it doesn't.
+
+static int check_scurves(void)
+{
+     static const uint8_t percents[] = { 0, 10, 25, 50 };
+     const float feedrate = 100.0;    // mm/s
+     const float distance = 60.0;     // mm
+     float limit = (float)max_acceleration_units_per_sq_second[X_AXIS] * stepperAxisStepsPerMM(X_AXIS);
+     int iret = 0;
+
+     printf("S-curve  peak X acceleration (steps/s^2), limit %.0f\n", limit);
+     for (uint8_t i = 0; i < sizeof(percents); i++)
+     {
+	  steppers::setSCurvePercent(percents[i]);
+	  window_start[X_AXIS] = 0;
+	  window_rate[X_AXIS]  = 0;
+	  max_accel[X_AXIS]    = 0;
+
+	  // Out and back, each from rest
+	  Point target = steppers::getPlannerPosition();
+	  target[X_AXIS] += ((i & 1) ? -1 : 1) * (int32_t)(distance * stepperAxisStepsPerMM(X_AXIS));
+	  steppers::setTargetNewExt(target, (int32_t)(feedrate * stepperAxisStepsPerMM(X_AXIS)), 0,
+				    distance, (int16_t)(feedrate * 64.0));
+	  drain();
+
+	  printf("    %3u%%  %10.0f  %s\n", percents[i], max_accel[X_AXIS],
+		 (max_accel[X_AXIS] <= limit) ? "ok" : "OVER THE LIMIT");
+	  if (max_accel[X_AXIS] > limit)
+	       iret = 1;
+     }
+     return(iret);
+}
+
+#if defined(__arm__)
+#define GETOPTS_END (char)-1
+#else
+#define GETOPTS_END -1
+#endif
+
+static void usage(FILE *f, const char *prog)
+{
+     if (f == NULL)
+	  f = stderr;
+
+     fprintf(f,
+"Usage: %s [-? | -h] [-c] [-l us] [-o trace] [-s percent] [file]\n"
+"         file -- The name of the .s3g or .x3g file to run.  If not supplied then stdin is run\n"
+"           -c -- Check that S-curve ramps keep to the max. acceleration, rather than run a file\n"
+"        -l us -- Main loop period in microseconds (default %u)\n"
+"     -o trace -- Write the step trace to \"trace\" (default stepsim.trace)\n"
+"   -s percent -- S-curve jerk phase as a percentage of each ramp, 0 to 50 (default 0, trapezoids)\n"
+"        ?, -h -- This help message\n",
+	     prog ? prog : "stepsim",
+	     main_loop_ticks / (STEPPER_TIMER_HZ / 1000000));
+}
+
+int main(int argc, const char *argv[])
+{
+     char c;
+     s3g_command_t cmd;
+     s3g_context_t *ctx;
+     const char *trace_file = "stepsim.trace";
+     long scurve = 0;
+     bool check = false;
+
+     while ((c = getopt(argc, (char **)argv, ":cl:o:s:h?")) != GETOPTS_END)
+     {
+	  switch(c)
+	  {
+	  // Unknown switch
+	  case ':' :
+	  default :
+	       usage(stderr, argv[0]);
+	       return(1);
+
+	  // Explicit help request
+	  case 'h' :
+	  case '?' :
+	       usage(stdout, argv[0]);
+	       return(1);
+
+	  // S-curve check
+	  case 'c' :
+	       check = true;
+	       break;
+
+	  // Main loop period
+	  case 'l' :
+	  {
+	       char *ptr = NULL;
+	       long us = strtol(optarg, &ptr, 0);
+	       if (ptr == NULL || ptr == optarg || us < 1 || us > 100000)
+	       {
+		    fprintf(stderr, "%s: the main loop period, \"%s\", must be an integer between 1 and 100000\n",
+			    argv[0], optarg);
+		    return(1);
+	       }
+	       main_loop_ticks = (uint32_t)us * (STEPPER_TIMER_HZ / 1000000);
+	  }
+	  break;
+
+	  // Trace file
+	  case 'o' :
+	       trace_file = optarg;
+	       break;
+
+	  // S-curve acceleration
+	  case 's' :
+	  {
+	       char *ptr = NULL;
+	       scurve = strtol(optarg, &ptr, 0);
+	       if (ptr == NULL || ptr == optarg || scurve < 0 || scurve > 50)
+	       {
+		    fprintf(stderr, "%s: the S-curve percentage, \"%s\", must be an integer between 0 and 50\n",
+			    argv[0], optarg);
+		    return(1);
+	       }
+	  }
+	  break;
+	  }
+     }
+
+     argc -= optind;
+     argv += optind;
+     if (check)
+	  ctx = NULL;
+     else if (argc == 0)
+	  // Open stdin
+	  ctx = s3g_open(0, NULL);
+     else
+	  // Open the specified file
+	  ctx = s3g_open(0, (void *)argv[0]);
+
+     if (!ctx && !check)
+	  // Assume that s3g_open() has complained
+	  return(1);
+
+     trace = fopen(trace_file, "wb");
+     if (!trace)
+     {
+	  perror(trace_file);
+	  return(1);
+     }
+
+     stepsim_header_t header;
+     memset(&header, 0, sizeof(header));
+     memcpy(header.magic, STEPSIM_MAGIC, sizeof(header.magic));
+     header.tick_hz = STEPPER_TIMER_HZ;
+     header.axes    = STEPPER_COUNT;
+     fwrite(&header, sizeof(header), 1, trace);
+
+     // As Motherboard::setupAccelStepperTimer()
+     OCR3A  = 0x2000;
+     TIMSK3 = _BV(OCIE3A);
+
+     steppers::init();
+     steppers::reset();
+     steppers::setSCurvePercent((uint8_t)scurve);
+
+     // Enable acceleration: it's off by default
+     init_extras(true);
+
+     // Leave the endstops open
+     for (uint8_t i = 0; i < STEPPER_COUNT; i++)
+     {
+	  StepperIOPort *endstop[2] = { &stepperAxisPorts[i].minimum, &stepperAxisPorts[i].maximum };
+	  for (uint8_t j = 0; j < 2; j++)
+	  {
+	       if (STEPPER_IOPORT_NULL((*endstop[j])))
+		    continue;
+	       if (stepperAxis[i].invert_endstop)
+		    stepsim_registers[endstop[j]->iport] |= _BV(endstop[j]->pin);
+	       else
+		    stepsim_registers[endstop[j]->iport] &= ~_BV(endstop[j]->pin);
+	  }
+     }
+
+     next_stepper_interrupt  = OCR3A + 1;
+     next_extruder_interrupt = EXTRUDER_INTERRUPT_TICKS;
+
+     if (check)
+     {
+	  int iret = check_scurves();
+	  fclose(trace);
+	  return(iret);
+     }
+
+     while (!s3g_command_read(ctx, &cmd))
+     {
+	  if (cmd.cmd_id == HOST_CMD_QUEUE_POINT_NEW ||
+	      cmd.cmd_id == HOST_CMD_QUEUE_POINT_NEW_EXT ||
+	      cmd.cmd_id == HOST_CMD_QUEUE_POINT_DELTA ||
+	      cmd.cmd_id == HOST_CMD_QUEUE_POINT_EXT)
+	  {
+	       // Like Command.cc, wait for room in the planner
+	       while (movesplanned() >= BLOCK_BUFFER_SIZE - 1)
+		    run_main_loop_slice(main_loop_ticks);
+
+	       if (cmd.cmd_id == HOST_CMD_QUEUE_POINT_NEW)
+	       {
+		    Point target = Point(cmd.t.queue_point_new.x, cmd.t.queue_point_new.y,
+					 cmd.t.queue_point_new.z, cmd.t.queue_point_new.a,
+					 cmd.t.queue_point_new.b);
+		    steppers::setTargetNew(target, cmd.t.queue_point_new.us, cmd.t.queue_point_new.rel);
+	       }
+	       else if (cmd.cmd_id == HOST_CMD_QUEUE_POINT_NEW_EXT)
+	       {
+		    Point target = Point(cmd.t.queue_point_new_ext.x, cmd.t.queue_point_new_ext.y,
+					 cmd.t.queue_point_new_ext.z, cmd.t.queue_point_new_ext.a,
+					 cmd.t.queue_point_new_ext.b);
+		    steppers::setTargetNewExt(target, cmd.t.queue_point_new_ext.dda_rate,
+					      cmd.t.queue_point_new_ext.rel,
+					      cmd.t.queue_point_new_ext.distance,
+					      cmd.t.queue_point_new_ext.feedrate_mult_64);
+	       }
+	       else if (cmd.cmd_id == HOST_CMD_QUEUE_POINT_DELTA)
+	       {
+		    // Like Command.cc, move to an absolute target
+		    Point target = steppers::getPlannerPosition();
+		    target[0] += cmd.t.queue_point_delta.x;
+		    target[1] += cmd.t.queue_point_delta.y;
+		    target[2] += cmd.t.queue_point_delta.z;
+		    target[3] += cmd.t.queue_point_delta.a;
+		    target[4] += cmd.t.queue_point_delta.b;
+		    steppers::setTargetNewExt(target, cmd.t.queue_point_delta.dda_rate, 0,
+					      cmd.t.queue_point_delta.distance,
+					      cmd.t.queue_point_delta.feedrate_mult_64);
+	       }
+	       else
+	       {
+		    Point target = Point(cmd.t.queue_point_ext.x, cmd.t.queue_point_ext.y,
+					 cmd.t.queue_point_ext.z, cmd.t.queue_point_ext.a,
+					 cmd.t.queue_point_ext.b);
+		    steppers::setTarget(target, cmd.t.queue_point_ext.dda);
+	       }
+	  }
+	  else if (cmd.cmd_id == HOST_CMD_SET_POSITION_EXT)
+	  {
+	       // Like Command.cc, wait for room to queue the new position
+	       while (!plan_can_define_position())
+		    run_main_loop_slice(main_loop_ticks);
+	       Point target = Point(cmd.t.set_position_ext.x, cmd.t.set_position_ext.y,
+				    cmd.t.set_position_ext.z, cmd.t.set_position_ext.a,
+				    cmd.t.set_position_ext.b);
+	       steppers::definePosition(target, false);
+	  }
+	  else if (cmd.cmd_id == HOST_CMD_SET_ACCELERATION_TOGGLE)
+	       steppers::setSegmentAccelState((cmd.t.set_segment_acceleration.s != 0) ? true : false);
+	  else if (cmd.cmd_id != HOST_CMD_TOOL_COMMAND &&
+		   cmd.cmd_id != HOST_CMD_ENABLE_AXES &&
+		   cmd.cmd_id != HOST_CMD_SET_BUILD_PERCENT &&
+		   cmd.cmd_id != HOST_CMD_CHANGE_TOOL)
+	       // As planner, anything else waits for the moves to finish
+	       drain();
+     }
+
+     drain();
+
+     s3g_close(ctx);
+     fclose(trace);
+
+     printf("%.4f seconds\n", (double)now / (double)STEPPER_TIMER_HZ);
+     printf("axis      steps  net steps   max rate (Hz)\n");
+     for (uint8_t i = 0; i < STEPPER_COUNT; i++)
+	  printf("   %c %10llu %10lld %15.1f\n", "XYZAB"[i],
+		 (unsigned long long)edges[i], (long long)net_steps[i], max_rate[i]);
+
+     return(0);
+}
@@ -0,0 +1,706 @@
+// windowtest.cc
+//
+// Measures how many moves per second a host can send the bot over a pty,
+// waiting for each response (stop-and-wait), and then with the receive
+// window of PacketWindow.cc:
+//
+//     windowtest [-b baud] [-e bytes] [-k] [-l usecs] [-n moves] [-r moves/sec] [-s bytes]
+//
+// A child process plays the bot.  It runs the firmware's Packet.cc and
+// PacketWindow.cc over the pty's master, responding as Host.cc does, and
+// queues the moves into a command buffer the size of the bot's, from which
+// they are planned at most -r per second.  The parent plays the host over
+// the pty's slave.  Each side paces what it sends at the baud rate, and sees
+// what it receives only after the latency of the USB serial link.  With -e,
+// each side corrupts one in so many of the bytes it receives, to exercise
+// retransmission.  With -k, the host sends as many moves as fit in each
+// packet as a HOST_CMD_BATCH.  The bot checks that it queued every move once,
+// in order.  First, a window is filled and sent one packet more, which must
+// be NAKed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+
+#include "Packet.hh"
+#include "PacketWindow.hh"
+#include "Commands.hh"
+#include "Command.hh"
+
+#if defined(__arm__)
+#define GETOPTS_END (char)-1
+#else
+#define GETOPTS_END -1
+#endif
+
+// How long the host waits for a response before resending
+#define RESPONSE_TIMEOUT_US 50000
+
+static long baud = 115200;
+static long corrupt_every = 0;
+static long latency_us = 1000;
+static long moves = 2000;
+static long moves_per_sec = 0;
+static int move_size = 32;
+static int moves_per_packet = 1;
+
+static void usage(FILE *f, const char *prog)
+{
+     if (f == NULL)
+	  f = stderr;
+
+     fprintf(f,
+"Usage: %s [-b baud] [-e bytes] [-k] [-l usecs] [-n moves] [-r moves/sec] [-s bytes]\n"
+"  ?, -h  -- This help message\n"
+"     -b  -- Baud rate; default 115200\n"
+"     -e  -- Corrupt one in this many bytes received; default 0, none\n"
+"     -k  -- Batch as many moves as fit in each packet\n"
+"     -l  -- Latency in microseconds of each direction; default 1000\n"
+"     -n  -- Number of moves to send; default 2000\n"
+"     -r  -- Moves the bot plans per second; default 0, as many as arrive\n"
+"     -s  -- Bytes per move command, 6 to %d; default 32, a queue point new\n"
+"            extended.  A queue point delta is 10 to 13 bytes.\n",
+	     prog ? prog : "windowtest", MAX_PACKET_PAYLOAD);
+}
+
+static uint64_t now_us(void)
+{
+     struct timespec ts;
+
+     clock_gettime(CLOCK_MONOTONIC, &ts);
+     return((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+// One end of the serial link: bytes to send, paced at the baud rate, and
+// bytes received, held back for the latency
+
+#define LINK_FIFO 4096
+
+typedef struct {
+     int            fd;
+     uint64_t       tx_next;            // When the next byte may be sent
+     unsigned char  rx[LINK_FIFO];
+     uint64_t       rx_due[LINK_FIFO];  // When each byte may be seen
+     unsigned       rx_head, rx_tail;
+     unsigned long  rx_count;
+     bool           hungup;             // The other end has closed the pty
+} link_t;
+
+static void link_init(link_t *link, int fd)
+{
+     memset(link, 0, sizeof(link_t));
+     link->fd = fd;
+     fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+static uint64_t byte_us(void)
+{
+     // 8 data bits, a start bit and a stop bit
+     return((uint64_t)(10000000 / baud));
+}
+
+// True if a byte may be sent now
+
+static bool link_can_send(link_t *link)
+{
+     return(now_us() >= link->tx_next);
+}
+
+static void link_send(link_t *link, uint8_t b)
+{
+     uint64_t now = now_us();
+
+     if (write(link->fd, &b, 1) != 1)
+     {
+	  perror("windowtest: write");
+	  exit(1);
+     }
+     // Catch up when woken late, so that the rate averages out to the baud
+     // rate, unless the line has been idle
+     if (link->tx_next + 1000 < now)
+	  link->tx_next = now;
+     link->tx_next += byte_us();
+}
+
+// Read what has arrived, and return the next byte whose latency has passed
+
+static bool link_receive(link_t *link, uint8_t *b)
+{
+     unsigned char buf[256];
+     ssize_t i, n;
+
+     while ((n = read(link->fd, buf, sizeof(buf))) > 0)
+	  for (i = 0; i < n; i++)
+	  {
+	       link->rx_count++;
+	       if (corrupt_every && (link->rx_count % corrupt_every) == 0)
+		    buf[i] ^= 0x10;
+	       link->rx[link->rx_tail % LINK_FIFO] = buf[i];
+	       link->rx_due[link->rx_tail % LINK_FIFO] = now_us() + latency_us;
+	       link->rx_tail++;
+	  }
+     if (n == 0 || (n < 0 && errno != EAGAIN))
+	  link->hungup = true;
+
+     if (link->rx_head == link->rx_tail ||
+	 link->rx_due[link->rx_head % LINK_FIFO] > now_us())
+	  return(false);
+     *b = link->rx[link->rx_head % LINK_FIFO];
+     link->rx_head++;
+     return(true);
+}
+
+// Sleep until there may be something to do, at most usecs
+
+static void link_wait(link_t *link, uint64_t usecs)
+{
+     struct pollfd pfd;
+     struct timespec ts;
+     uint64_t now = now_us();
+
+     if (link->rx_head != link->rx_tail)
+     {
+	  uint64_t due = link->rx_due[link->rx_head % LINK_FIFO];
+	  usecs = (due > now) ? ((due - now < usecs) ? due - now : usecs) : 0;
+     }
+     if (link->tx_next > now && link->tx_next - now < usecs)
+	  usecs = link->tx_next - now;
+
+     pfd.fd = link->fd;
+     pfd.events = POLLIN;
+     ts.tv_sec = usecs / 1000000;
+     ts.tv_nsec = (usecs % 1000000) * 1000;
+     ppoll(&pfd, 1, &ts, NULL);
+}
+
+// Start sending an OutPacket, as UART::beginSend() does
+
+static void begin_send(link_t *link, OutPacket& out)
+{
+     while (!link_can_send(link))
+	  link_wait(link, byte_us());
+     link_send(link, out.getNextByteToSend());
+}
+
+// Send what the baud rate allows of the rest, as the transmit interrupt does
+
+static void send_more(link_t *link, OutPacket& out)
+{
+     while (out.isSending() && link_can_send(link))
+	  link_send(link, out.getNextByteToSend());
+}
+
+//
+// The bot
+//
+
+static PacketWindow window;
+static uint16_t buffer_free = COMMAND_BUFFER_SIZE;
+static long queued, duplicates, lost;
+static uint64_t last_planned;
+
+// Plan moves at the requested rate, freeing their room in the buffer
+
+static void plan_moves(void)
+{
+     uint64_t now = now_us();
+
+     if (moves_per_sec == 0)
+     {
+	  buffer_free = COMMAND_BUFFER_SIZE;
+	  return;
+     }
+     while (buffer_free + move_size <= COMMAND_BUFFER_SIZE &&
+	    now - last_planned >= (uint64_t)(1000000 / moves_per_sec))
+     {
+	  buffer_free += move_size;
+	  last_planned += 1000000 / moves_per_sec;
+     }
+     if (buffer_free == COMMAND_BUFFER_SIZE)
+	  last_planned = now;
+}
+
+// Queue a packet's moves if there is room for all of them, as
+// processCommandPacket() does
+
+static bool queue_move(const InPacket& packet)
+{
+     int offset = (packet.read8(0) == HOST_CMD_BATCH) ? 1 : 0;
+
+     if (buffer_free < packet.getLength() - offset)
+	  return(false);
+     buffer_free -= packet.getLength() - offset;
+
+     for (; offset < packet.getLength(); offset += move_size)
+     {
+	  long index = (long)packet.read32(offset + 1);
+	  if (index < queued)
+	       duplicates++;
+	  else
+	  {
+	       lost += index - queued;
+	       queued = index + 1;
+	  }
+     }
+     return(true);
+}
+
+static void respond(const InPacket& packet, OutPacket& out)
+{
+     if (packet.read8(0) & 0x80)
+	  out.append8(queue_move(packet) ? RC_OK : RC_BUFFER_OVERFLOW);
+     else if (packet.read8(0) == HOST_CMD_OPEN_WINDOW)
+     {
+	  window.open();
+	  out.append8(RC_OK);
+	  out.append8(HOST_WINDOW_SIZE);
+     }
+     else
+	  out.append8(RC_OK);
+}
+
+static int bot(int fd, int report)
+{
+     InPacket in;
+     OutPacket out;
+     link_t link;
+     uint8_t b;
+
+     in.acceptSequenced(true);
+     link_init(&link, fd);
+     last_planned = now_us();
+
+     for (;;)
+     {
+	  // The receive interrupt
+	  while (link_receive(&link, &b))
+	  {
+	       in.processByte(b);
+	       window.receive(in);
+	  }
+
+	  // The host slice: drainWindow()
+	  plan_moves();
+	  while (!window.isEmpty() && (window.front().read8(0) & 0x80) &&
+		 queue_move(window.front()))
+	       window.pop(false);
+
+	  if (out.isSending())
+	       send_more(&link, out);
+	  else
+	  {
+	       // processWindow(), and then the stop-and-wait packets
+	       if (in.hasError() && window.isOpen())
+	       {
+		    window.lost();
+		    in.reset();
+	       }
+	       out.reset();
+	       if (window.respond(out))
+		    begin_send(&link, out);
+	       else if (!window.isEmpty() && !(window.front().read8(0) & 0x80))
+	       {
+		    out.setSequence(window.front().getSequence());
+		    respond(window.front(), out);
+		    window.pop(true);
+		    begin_send(&link, out);
+	       }
+	       else if (in.hasError())
+	       {
+		    out.append8(in.getErrorCode() == PacketError::BAD_CRC ?
+				RC_CRC_MISMATCH : RC_PACKET_ERROR);
+		    in.reset();
+		    begin_send(&link, out);
+	       }
+	       else if (in.isFinished() == 1)
+	       {
+		    respond(in, out);
+		    in.reset();
+		    begin_send(&link, out);
+	       }
+	  }
+
+	  // Keep answering until the host hangs up, as it may yet resend
+	  if (link.hungup)
+	       break;
+	  link_wait(&link, 1000);
+     }
+
+     // Tell the host what was queued
+     long counts[3] = { queued, duplicates, lost };
+     return(write(report, counts, sizeof(counts)) == sizeof(counts) ? 0 : 1);
+}
+
+//
+// The host
+//
+
+typedef struct {
+     long    sent;         // Packets sent, including resends
+     long    timeouts;
+     long    naks;
+     long    overflows;
+} host_stats_t;
+
+// Build the packet carrying the moves from index * moves_per_packet on
+
+static void build_move(OutPacket& out, long index)
+{
+     long first = index * moves_per_packet;
+     long last = first + moves_per_packet;
+
+     if (last > moves)
+	  last = moves;
+     if (moves_per_packet > 1)
+	  out.append8(HOST_CMD_BATCH);
+     for (long move = first; move < last; move++)
+     {
+	  out.append8(HOST_CMD_QUEUE_POINT_NEW_EXT);
+	  out.append32((uint32_t)move);
+	  for (int i = 5; i < move_size; i++)
+	       out.append8((uint8_t)i);
+     }
+}
+
+static long packets(void)
+{
+     return((moves + moves_per_packet - 1) / moves_per_packet);
+}
+
+// Wait for a response, for at most timeout usecs.  Returns false on timeout.
+
+static bool get_response(link_t *link, InPacket& in, uint64_t timeout)
+{
+     uint64_t start = now_us();
+     uint8_t b;
+
+     in.reset();
+     while (now_us() - start < timeout)
+     {
+	  while (link_receive(link, &b))
+	  {
+	       in.processByte(b);
+	       if (in.isFinished() == 1)
+		    return(true);
+	       if (in.hasError())
+		    in.reset();
+	  }
+	  link_wait(link, start + timeout - now_us());
+     }
+     return(false);
+}
+
+static void send_all(link_t *link, OutPacket& out)
+{
+     begin_send(link, out);
+     while (out.isSending())
+     {
+	  send_more(link, out);
+	  link_wait(link, byte_us());
+     }
+}
+
+static void stop_and_wait(link_t *link, host_stats_t *stats)
+{
+     InPacket in;
+     OutPacket out;
+     long i;
+
+     for (i = 0; i < packets(); )
+     {
+	  out.reset();
+	  build_move(out, i);
+	  send_all(link, out);
+	  stats->sent++;
+	  if (!get_response(link, in, RESPONSE_TIMEOUT_US))
+	       stats->timeouts++;
+	  else if (rcCompare(in.read8(0), RC_OK))
+	       i++;
+	  else if (rcCompare(in.read8(0), RC_BUFFER_OVERFLOW))
+	       stats->overflows++;
+	  else
+	       stats->naks++;
+     }
+}
+
+// Returns the window size, or 0 if the bot has no window
+
+static int open_window(link_t *link)
+{
+     InPacket in;
+     OutPacket out;
+
+     // A sequenced response left over from an earlier window is skipped
+     in.acceptSequenced(true);
+     for (int tries = 0; tries < 10; tries++)
+     {
+	  out.reset();
+	  out.append8(HOST_CMD_OPEN_WINDOW);
+	  send_all(link, out);
+	  if (get_response(link, in, RESPONSE_TIMEOUT_US) && !in.isSequenced())
+	       return(rcCompare(in.read8(0), RC_OK) ? in.read8(1) : 0);
+     }
+     return(0);
+}
+
+static void sliding_window(link_t *link, int size, host_stats_t *stats)
+{
+     InPacket in;
+     OutPacket out;
+     long base = 0;       // Oldest packet not yet acknowledged
+     long next = 0;       // Next packet to send
+     uint64_t last_progress = now_us();
+     uint8_t b;
+
+     in.acceptSequenced(true);
+     in.reset();
+     out.reset();
+     while (base < packets())
+     {
+	  // Send more while the window has room
+	  if (!out.isSending() && next < packets() && next - base < size)
+	  {
+	       out.reset();
+	       out.setSequence((uint8_t)next);
+	       build_move(out, next);
+	       begin_send(link, out);
+	       next++;
+	       stats->sent++;
+	  }
+	  send_more(link, out);
+
+	  while (link_receive(link, &b))
+	  {
+	       in.processByte(b);
+	       if (in.hasError())
+		    in.reset();
+	       if (in.isFinished() != 1)
+		    continue;
+
+	       // Which packet the response's sequence number refers to
+	       long seq = base - 1 + (uint8_t)(in.getSequence() - (uint8_t)(base - 1));
+	       if (rcCompare(in.read8(0), RC_OK))
+	       {
+		    if (seq >= base && seq < next)
+		    {
+			 base = seq + 1;
+			 last_progress = now_us();
+		    }
+	       }
+	       else if (seq + 1 >= base && seq < next)
+	       {
+		    // Go back to the first packet the bot didn't get
+		    stats->naks++;
+		    next = seq + 1;
+		    last_progress = now_us();
+	       }
+	       in.reset();
+	  }
+
+	  if (base < next && now_us() - last_progress > RESPONSE_TIMEOUT_US)
+	  {
+	       stats->timeouts++;
+	       next = base;
+	       last_progress = now_us();
+	  }
+	  link_wait(link, 1000);
+     }
+}
+
+// Fill a window which isn't drained and send it one packet more.  The
+// window must ask for that packet again, rather than take it for one it
+// already has.  Returns non-zero if it doesn't.
+
+static int overrun(void)
+{
+     PacketWindow win;
+     InPacket in;
+     OutPacket out;
+
+     in.acceptSequenced(true);
+     win.open();
+     for (int seq = 0; seq <= HOST_WINDOW_SIZE; seq++)
+     {
+	  out.reset();
+	  out.setSequence((uint8_t)seq);
+	  build_move(out, seq);
+	  while (!out.isFinished())
+	       in.processByte(out.getNextByteToSend());
+	  win.receive(in);
+     }
+
+     out.reset();
+     if (!win.respond(out) || !rcCompare(out.read8(0), RC_PACKET_ERROR) ||
+	 out.getSequence() != HOST_WINDOW_SIZE - 1)
+     {
+	  fprintf(stderr, "windowtest: packet %d overran a window of %d without "
+		  "a NAK\n", HOST_WINDOW_SIZE, HOST_WINDOW_SIZE);
+	  return(1);
+     }
+     printf("overrun:        packet %d NAKed by a full window of %d\n",
+	    HOST_WINDOW_SIZE, HOST_WINDOW_SIZE);
+     return(0);
+}
+
+// Run the bot and a host over a pty.  Returns non-zero if the window lets
+// the bot miss any moves or queue any twice.  Without sequence numbers,
+// stop-and-wait can't tell which packet a late or lost response was for,
+// so on a noisy line it does both.
+
+static int run(const char *name, bool windowed)
+{
+     int master, slave, status, size, report[2];
+     struct termios tio;
+     host_stats_t stats;
+     link_t link;
+     uint64_t start, elapsed;
+     long counts[3];
+     pid_t pid;
+
+     if (openpty(&master, &slave, NULL, NULL, NULL) < 0 || pipe(report) < 0)
+     {
+	  perror("windowtest: openpty");
+	  return(1);
+     }
+     tcgetattr(slave, &tio);
+     cfmakeraw(&tio);
+     tcsetattr(slave, TCSANOW, &tio);
+
+     fflush(stdout);
+     if ((pid = fork()) == 0)
+     {
+	  close(slave);
+	  close(report[0]);
+	  exit(bot(master, report[1]));
+     }
+     close(master);
+     close(report[1]);
+     link_init(&link, slave);
+     memset(&stats, 0, sizeof(stats));
+
+     start = now_us();
+     size = 0;
+     if (windowed)
+     {
+	  if ((size = open_window(&link)) == 0)
+	  {
+	       fprintf(stderr, "windowtest: the bot did not open a window\n");
+	       kill(pid, SIGTERM);
+	       waitpid(pid, &status, 0);
+	       close(slave);
+	       close(report[0]);
+	       return(1);
+	  }
+	  sliding_window(&link, size, &stats);
+     }
+     else
+	  stop_and_wait(&link, &stats);
+     elapsed = now_us() - start;
+     close(slave);
+     waitpid(pid, &status, 0);
+
+     if (read(report[0], counts, sizeof(counts)) != sizeof(counts))
+     {
+	  fprintf(stderr, "windowtest: no report from the bot\n");
+	  close(report[0]);
+	  return(1);
+     }
+     close(report[0]);
+
+     if (windowed)
+	  printf("window of %d:   ", size);
+     else
+	  printf("%-15s ", name);
+     printf("%ld moves in %6.3f s, %6.1f moves/s; %ld sent, %ld timeouts, "
+	    "%ld NAKs, %ld overflows",
+	    moves, elapsed / 1000000.0, moves * 1000000.0 / elapsed,
+	    stats.sent, stats.timeouts, stats.naks, stats.overflows);
+     if (counts[1] || counts[2])
+	  printf("; %ld moves queued twice, %ld missed", counts[1], counts[2]);
+     printf("\n");
+
+     return((windowed && (counts[0] != moves || counts[1] || counts[2])) ? 1 : 0);
+}
+
+int main(int argc, const char *argv[])
+{
+     char c;
+     int iret;
+
+     while ((c = getopt(argc, (char **)argv, ":hb:e:kl:n:r:s:?")) != GETOPTS_END)
+     {
+	  switch(c)
+	  {
+	  case 'b' :
+	       baud = atol(optarg);
+	       break;
+
+	  case 'e' :
+	       corrupt_every = atol(optarg);
+	       break;
+
+	  case 'k' :
+	       moves_per_packet = 0;
+	       break;
+
+	  case 'l' :
+	       latency_us = atol(optarg);
+	       break;
+
+	  case 'n' :
+	       moves = atol(optarg);
+	       break;
+
+	  case 'r' :
+	       moves_per_sec = atol(optarg);
+	       break;
+
+	  case 's' :
+	       move_size = atoi(optarg);
+	       break;
+
+	  case 'h' :
+	  case '?' :
+	       usage(stdout, argv[0]);
+	       return(0);
+
+	  case ':' :
+	  default :
+	       usage(stderr, argv[0]);
+	       return(1);
+	  }
+     }
+
+     if (baud <= 0 || moves <= 0 || move_size < 6 || move_size > MAX_PACKET_PAYLOAD)
+     {
+	  usage(stderr, argv[0]);
+	  return(1);
+     }
+
+     if (moves_per_packet == 0)
+	  moves_per_packet = (MAX_PACKET_PAYLOAD - 1) / move_size;
+     if (moves_per_packet == 0)
+     {
+	  fprintf(stderr, "windowtest: a %d byte move is too long to batch\n", move_size);
+	  return(1);
+     }
+
+     // Wake from poll() as close as possible to when each byte is due
+     prctl(PR_SET_TIMERSLACK, 1);
+
+     iret  = overrun();
+     iret |= run("stop-and-wait:", false);
+     iret |= run("window", true);
+
+     return(iret);
+}
@@ -33,18 +33,13 @@
 #include "ExtruderControl.hh"
 #include "StepperAccel.hh"
 #include "Errors.hh"
+#include "Resume.hh"
 
 extern int8_t autoPause;  // from Menu.cc
 
 namespace command {
 
-#ifdef SMALL_4K_RAM
-	#define COMMAND_BUFFER_SIZE 256
-#else
-	#define COMMAND_BUFFER_SIZE 512
-#endif
-uint8_t buffer_data[COMMAND_BUFFER_SIZE];
-CircularBuffer command_buffer(COMMAND_BUFFER_SIZE, buffer_data);
+CommandBuffer command_buffer;
 uint8_t currentToolIndex = 0;
 
 uint32_t line_number;
@@ -57,6 +52,11 @@ static const prog_uchar *pauseErrorMessage;
 static bool sdCardError;
 #endif
 uint32_t sd_count = 0;
+#ifdef RESUME_BUILD
+// File offset the playback started from; sd_count counts on from it
+static uint32_t sd_start = 0;
+Timeout checkpoint_timeout;
+#endif
 
 #ifdef PSTOP_SUPPORT
 // When non-zero, a P-Stop has been requested
@@ -115,6 +115,14 @@ bool deleteAfterUse = true;
 uint16_t altTemp[EXTRUDERS];
 #endif
 
+uint8_t queuePointDeltaLength(uint8_t axes, uint8_t wide) {
+	uint8_t length = 3 + 2 + (( axes & QUEUE_POINT_DELTA_DDA_32 ) ? 4 : 2) +
+		(( axes & QUEUE_POINT_DELTA_DISTANCE ) ? 4 : 0);
+	for ( uint8_t i = 0; i < 5; i ++ )
+		if ( axes & (1 << i) )	length += ( wide & (1 << i) ) ? 2 : 1;
+	return length;
+}
+
 uint16_t getRemainingCapacity() {
 	uint16_t sz;
 	ATOMIC_BLOCK(ATOMIC_FORCEON) {
@@ -247,37 +255,21 @@ uint8_t pop8() {
 }
 
 int16_t pop16() {
-	union {
-		// AVR is little-endian
-		int16_t a;
-		struct {
-			uint8_t data[2];
-		} b;
-	} shared;
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Winline"
-	shared.b.data[0] = command_buffer.pop();
-	shared.b.data[1] = command_buffer.pop();
+	int16_t v = command_buffer.peekValue<int16_t>(0);
+	command_buffer.pop(2);
 #pragma GCC diagnostic pop
-	return shared.a;
+	return v;
 }
 
 int32_t pop32() {
-	union {
-		// AVR is little-endian
-		int32_t a;
-		struct {
-			uint8_t data[4];
-		} b;
-	} shared;
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Winline"
-	shared.b.data[0] = command_buffer.pop();
-	shared.b.data[1] = command_buffer.pop();
-	shared.b.data[2] = command_buffer.pop();
-	shared.b.data[3] = command_buffer.pop();
+	int32_t v = command_buffer.peekValue<int32_t>(0);
+	command_buffer.pop(4);
 #pragma GCC diagnostic pop
-	return shared.a;
+	return v;
 }
 
 enum ModeState {
@@ -338,6 +330,10 @@ void reset() {
 	sdCardError = false;
 #endif
 	sd_count = 0;
+#ifdef RESUME_BUILD
+	sd_start = 0;
+	checkpoint_timeout.start(RESUME_CHECKPOINT_INTERVAL * 1000000L);
+#endif
 #ifdef HAS_FILAMENT_COUNTER
         filamentLength[0] = filamentLength[1] = 0;
         lastFilamentLength[0] = lastFilamentLength[1] = 0;
@@ -602,10 +598,32 @@ void buildAnotherCopy() {
 	addFilamentUsed();
 	lastFilamentLength[0] = 0;
 	lastFilamentLength[1] = 0;
+#endif
+	sd_count = 0;
+#ifdef RESUME_BUILD
+	sd_start = 0;
 #endif
 	sdcard::playbackRestart();
 }
 
+#ifdef RESUME_BUILD
+
+void resumeBuild(const resume::checkpoint_t &cp) {
+	// Lower the platform by RESUME_Z_LIFT, but not past the end of Z
+	int32_t zLift = (int32_t)(RESUME_Z_LIFT * stepperAxisStepsPerMM(Z_AXIS));
+	if ( zLift > stepperAxis[Z_AXIS].max_axis_steps_limit - cp.position[Z_AXIS] )
+		zLift = stepperAxis[Z_AXIS].max_axis_steps_limit - cp.position[Z_AXIS];
+	if ( zLift < 0 )	zLift = 0;
+	uint32_t zFeedrate = (uint32_t)(1000000.0 / (FPTOF(stepperAxis[Z_AXIS].max_feedrate) * stepperAxisStepsPerMM(Z_AXIS)));
+
+	// Return to the checkpoint before running the rest of the file
+	uint8_t prologue[RESUME_PROLOGUE_MAX];
+	command_buffer.push(prologue, resume::prologue(cp, zLift, zFeedrate, prologue));
+	sd_count = sd_start = cp.offset;
+}
+
+#endif
+
 
 //Store the current heater set points for restoration later
 void storeHeaterTemperatures(void) {
@@ -688,20 +706,47 @@ bool areHeatersAtTemperature(void) {
 }
 
 
+// Movement commands as they're laid out in the command buffer, so that each
+// can be decoded with a single length check and without popping it a byte
+// at a time.  AVR is little-endian, as are the commands.
+struct __attribute__ ((packed)) QueuePointExt {	// 25 bytes
+	uint8_t command;
+	int32_t x, y, z, a, b;
+	int32_t dda;
+};
+
+struct __attribute__ ((packed)) QueuePointNew {	// 26 bytes
+	uint8_t command;
+	int32_t x, y, z, a, b;
+	int32_t us;
+	uint8_t relative;
+};
+
+struct __attribute__ ((packed)) QueuePointNewExt {	// 32 bytes
+	uint8_t command;
+	int32_t x, y, z, a, b;
+	int32_t dda_rate;
+	uint8_t relative;
+	float distance;
+	int16_t feedrateMult64;
+};
+
 // Handle movement comands -- called from a few places
 static void handleMovementCommand(const uint8_t &command) {
 	if (command == HOST_CMD_QUEUE_POINT_EXT) {
 		// check for completion
-		if (command_buffer.getLength() >= 25) {
-			pop8(); // remove the command code
+		if (command_buffer.getLength() >= sizeof(QueuePointExt)) {
+			QueuePointExt scratch;
+			const QueuePointExt *cmd = command_buffer.view(scratch);
 			mode = MOVING;
 
-			int32_t x = pop32();
-			int32_t y = pop32();
-			int32_t z = pop32();
-			int32_t a = pop32();
-			int32_t b = pop32();
-			int32_t dda = pop32();
+			int32_t x = cmd->x;
+			int32_t y = cmd->y;
+			int32_t z = cmd->z;
+			int32_t a = cmd->a;
+			int32_t b = cmd->b;
+			int32_t dda = cmd->dda;
+			command_buffer.pop(sizeof(QueuePointExt));
 
 #ifdef DITTO_PRINT
    			if ( dittoPrinting ) {
@@ -726,17 +771,19 @@ static void handleMovementCommand(const uint8_t &command) {
 	}
 	 else if (command == HOST_CMD_QUEUE_POINT_NEW) {
 		// check for completion
-		if (command_buffer.getLength() >= 26) {
-			pop8(); // remove the command code
+		if (command_buffer.getLength() >= sizeof(QueuePointNew)) {
+			QueuePointNew scratch;
+			const QueuePointNew *cmd = command_buffer.view(scratch);
 			mode = MOVING;
 
-			int32_t x = pop32();
-			int32_t y = pop32();
-			int32_t z = pop32();
-			int32_t a = pop32();
-			int32_t b = pop32();
-			int32_t us = pop32();
-			uint8_t relative = pop8();
+			int32_t x = cmd->x;
+			int32_t y = cmd->y;
+			int32_t z = cmd->z;
+			int32_t a = cmd->a;
+			int32_t b = cmd->b;
+			int32_t us = cmd->us;
+			uint8_t relative = cmd->relative;
+			command_buffer.pop(sizeof(QueuePointNew));
 
 #ifdef DITTO_PRINT
    			if ( dittoPrinting ) {
@@ -779,20 +826,21 @@ static void handleMovementCommand(const uint8_t &command) {
 	}
 	else if (command == HOST_CMD_QUEUE_POINT_NEW_EXT ) {
 		// check for completion
-		if (command_buffer.getLength() >= 32) {
-			pop8(); // remove the command code
+		if (command_buffer.getLength() >= sizeof(QueuePointNewExt)) {
+			QueuePointNewExt scratch;
+			const QueuePointNewExt *cmd = command_buffer.view(scratch);
 			mode = MOVING;
 
-			int32_t x = pop32();
-			int32_t y = pop32();
-			int32_t z = pop32();
-			int32_t a = pop32();
-			int32_t b = pop32();
-			int32_t dda_rate = pop32();
-			uint8_t relative = pop8() & 0x7F; // make sure that the high bit is clear
-			int32_t distanceInt32 = pop32();
-			float *distance = (float *)&distanceInt32;
-			int16_t feedrateMult64 = pop16();
+			int32_t x = cmd->x;
+			int32_t y = cmd->y;
+			int32_t z = cmd->z;
+			int32_t a = cmd->a;
+			int32_t b = cmd->b;
+			int32_t dda_rate = cmd->dda_rate;
+			uint8_t relative = cmd->relative & 0x7F; // make sure that the high bit is clear
+			float distance = cmd->distance;
+			int16_t feedrateMult64 = cmd->feedrateMult64;
+			command_buffer.pop(sizeof(QueuePointNewExt));
 
 #ifdef DITTO_PRINT
    			if ( dittoPrinting ) {
@@ -837,7 +885,65 @@ static void handleMovementCommand(const uint8_t &command) {
 #else
 						  relative,
 #endif
-						  *distance, feedrateMult64);
+						  distance, feedrateMult64);
+		}
+	}
+	else if (command == HOST_CMD_QUEUE_POINT_DELTA) {
+		// check for the axes and their widths, and then for completion
+		if (command_buffer.getLength() >= 3) {
+			uint8_t axes = command_buffer[1];
+			uint8_t wide = command_buffer[2];
+
+			if (command_buffer.getLength() < queuePointDeltaLength(axes, wide))
+				return;
+
+			command_buffer.pop(3); // remove the command code, axes and widths
+			mode = MOVING;
+
+			int32_t delta[5];
+			for ( uint8_t i = 0; i < 5; i ++ ) {
+				if ( ! ( axes & (1 << i) ) )	delta[i] = 0;
+				else if ( wide & (1 << i) )	delta[i] = pop16();
+				else				delta[i] = (int8_t)pop8();
+			}
+			int32_t dda_rate = ( axes & QUEUE_POINT_DELTA_DDA_32 ) ? pop32() : (uint16_t)pop16();
+			float distance = -1.0;	// derived by the planner
+			if ( axes & QUEUE_POINT_DELTA_DISTANCE ) {
+				int32_t distanceInt32 = pop32();
+				distance = *(float *)&distanceInt32;
+			}
+			int16_t feedrateMult64 = pop16();
+
+			// Relative moves would have the tool offsets added again, so
+			// build an absolute target from where the planner is
+			Point target = steppers::getPlannerPosition();
+			for ( uint8_t i = 0; i < 5; i ++ )
+				target[i] += delta[i];
+
+#ifdef DITTO_PRINT
+   			if ( dittoPrinting ) {
+				if ( currentToolIndex == 0 )	target[B_AXIS] = target[A_AXIS];
+				else				target[A_AXIS] = target[B_AXIS];
+			}
+#endif
+
+#ifdef HAS_FILAMENT_COUNTER
+			for ( int i = 0; i < 2; i ++ ) {
+				filamentLength[i] += (int64_t)(target[A_AXIS + i] - lastFilamentPosition[i]);
+				lastFilamentPosition[i] = target[A_AXIS + i];
+			}
+#endif
+			line_number++;
+#ifdef PSTOP_SUPPORT
+			if ( !pstop_okay && ++pstop_move_count > 4 ) pstop_okay = true;
+#endif
+			steppers::setTargetNewExt(target, dda_rate,
+#ifdef HAS_INTERFACE_BOARD
+						  steppers::alterSpeed,
+#else
+						  0,
+#endif
+						  distance, feedrateMult64);
 		}
 	}
 }
@@ -931,6 +1037,12 @@ bool processExtruderCommandPacket(bool deleteAfterUse, int8_t overrideToolIndex)
 		}
 #endif
 
+#ifdef RESUME_BUILD
+		if (( commandCode == SLAVE_CMD_SET_TEMP ) || ( commandCode == SLAVE_CMD_SET_PLATFORM_TEMP ))
+			resume::noteTemperature(( commandCode == SLAVE_CMD_SET_TEMP ) ? toolIndex : RESUME_PLATFORM,
+						command_buffer.peekValue<int16_t>(4));
+#endif
+
 		for ( uint8_t i = 0; i < payload_len; i ++ )
 			out.append8(command_buffer[4U + i]);
 
@@ -1092,11 +1204,19 @@ void runCommandSlice() {
 	// get command from SD card if building from SD
 	if ( sdcard::isPlaying() ) {
 
+	    // Move the file into the command buffer in chunks rather than a byte at a time
+	    uint8_t chunk[32];
 	    while (command_buffer.getRemainingCapacity() > 0 && sdcard::playbackHasNext()) {
-		sd_count++;
-		command_buffer.push(sdcard::playbackNext());
+		BufSizeType remaining = command_buffer.getRemainingCapacity();
+		uint8_t n = sdcard::playbackRead(chunk, (remaining < sizeof(chunk)) ? (uint8_t)remaining : sizeof(chunk));
+		sd_count += n;
+		command_buffer.push(chunk, n);
 	    }
 
+#ifdef RESUME_BUILD
+	    resume::runSlice(block_buffer_tail);
+#endif
+
 	    // Deal with any end of file conditions
 	    if ( !sdcard::playbackHasNext() ) {
 
@@ -1261,6 +1381,15 @@ void runCommandSlice() {
 	if (mode == READY) {
 		// process next command on the queue.
 		if (command_buffer.getLength() > 0) {
+#ifdef RESUME_BUILD
+			// Checkpoint the build at this command boundary.  While commands
+			// queued by resumeBuild() remain, the boundary isn't in the file.
+			if ( sdcard::isPlaying() && checkpoint_timeout.hasElapsed() &&
+			     command_buffer.getLength() <= sd_count - sd_start &&
+			     resume::capture(sd_count - command_buffer.getLength(), currentToolIndex,
+					     steppers::getPlannerPosition(), block_buffer_tail, movesplanned()) )
+				checkpoint_timeout.start(RESUME_CHECKPOINT_INTERVAL * 1000000L);
+#endif
 			uint8_t command = command_buffer[0];
 
 			//If we're running acceleration, we want to populate the pipeline buffer,
@@ -1271,6 +1400,7 @@ void runCommandSlice() {
 			if ((command != HOST_CMD_QUEUE_POINT_EXT) &&
  			    (command != HOST_CMD_QUEUE_POINT_NEW) &&
 			    (command != HOST_CMD_QUEUE_POINT_NEW_EXT ) &&
+			    (command != HOST_CMD_QUEUE_POINT_DELTA ) &&
 			    (command != HOST_CMD_ENABLE_AXES ) &&
 			    (command != HOST_CMD_CHANGE_TOOL ) &&
 			    (command != HOST_CMD_SET_POSITION_EXT) &&
@@ -1285,7 +1415,7 @@ void runCommandSlice() {
        	                 }
 
 			if (command == HOST_CMD_QUEUE_POINT_EXT || command == HOST_CMD_QUEUE_POINT_NEW ||
-			    command == HOST_CMD_QUEUE_POINT_NEW_EXT ) {
+			    command == HOST_CMD_QUEUE_POINT_NEW_EXT || command == HOST_CMD_QUEUE_POINT_DELTA ) {
 				handleMovementCommand(command);
 			} else if (command == HOST_CMD_CHANGE_TOOL) {
 				if (command_buffer.getLength() >= 2) {
@@ -1325,8 +1455,9 @@ void runCommandSlice() {
 					}
 				}
 			} else if (command == HOST_CMD_SET_POSITION_EXT) {
-				// check for completion
-				if (command_buffer.getLength() >= 21) {
+				// check for completion, and that the planner can queue the
+				// new position without waiting on the stepper interrupt
+				if (command_buffer.getLength() >= 21 && plan_can_define_position()) {
 					pop8(); // remove the command code
 					int32_t x = pop32();
 					int32_t y = pop32();
@@ -1348,6 +1479,9 @@ void runCommandSlice() {
 					line_number++;
 					
 					steppers::definePosition(Point(x,y,z,a,b), false);
+#ifdef RESUME_BUILD
+					resume::notePosition(steppers::getPlannerPosition());
+#endif
 				}
 			} else if (command == HOST_CMD_DELAY) {
 				if (command_buffer.getLength() >= 5) {
@@ -1456,6 +1590,9 @@ void runCommandSlice() {
 					steppers::startHoming(direction,
 							      flags,
 							      feedrate);
+#ifdef RESUME_BUILD
+					resume::noteHoming(command, flags, feedrate, timeout_s);
+#endif
 				}
 			} else if (command == HOST_CMD_WAIT_FOR_TOOL) {
 				if (command_buffer.getLength() >= 6) {
@@ -1542,6 +1679,9 @@ void runCommandSlice() {
 					lastFilamentPosition[1] = newPoint[4];
 #endif
 					steppers::definePosition(newPoint, true);
+#ifdef RESUME_BUILD
+					resume::notePosition(steppers::getPlannerPosition());
+#endif
 				}
 			}else if (command == HOST_CMD_SET_RGB_LED){
 				//Not currently implemented in RepG as an MCode, although the driver supports the command
@@ -26,6 +26,8 @@ typedef unsigned char prog_uchar;
 #endif
 #include "Configuration.hh"
 #include "Point.hh"
+#include "CircularBuffer.hh"
+#include "Resume.hh"
 
 
 //Pause states are used internally to determine various scenarios, so the 
@@ -72,6 +74,15 @@ enum PauseState {
 /// queue, for both SD and serial jobs.
 namespace command {
 
+#ifdef SMALL_4K_RAM
+	#define COMMAND_BUFFER_SIZE 256
+#else
+	#define COMMAND_BUFFER_SIZE 512
+#endif
+
+/// The command queue; its size must be a power of two
+typedef FixedCircularBufferTempl<uint8_t, COMMAND_BUFFER_SIZE> CommandBuffer;
+
 extern uint8_t copiesToPrint, copiesPrinted;
 
 #ifdef DITTO_PRINT
@@ -164,6 +175,19 @@ int64_t getLastFilamentLength(uint8_t extruder);
 //Build another copy
 void buildAnotherCopy();
 
+#ifdef RESUME_BUILD
+/// Queue the commands which return the machine to a checkpoint, and take
+/// the playback to have started at the checkpoint's file offset.  Call
+/// after reset() and once sdcard::startPlaybackAt() has succeeded.
+void resumeBuild(const resume::checkpoint_t &cp);
+#endif
+
+/// Length of a HOST_CMD_QUEUE_POINT_DELTA command
+/// \param[in] axes Its axes byte
+/// \param[in] wide Its widths byte
+/// \return Length of the command, including the command code
+uint8_t queuePointDeltaLength(uint8_t axes, uint8_t wide);
+
 /// Check the remaining capacity of the command buffer
 /// \return Amount of space left in the buffer, in bytes
 uint16_t getRemainingCapacity();
@@ -125,6 +125,7 @@ void setJettyFirmwareDefaults() {
     putEepromUInt32(eeprom::ACCEL_EXTRUDER_DEPRIME_B,			EEPROM_DEFAULT_ACCEL_EXTRUDER_DEPRIME_B);
     eeprom_write_byte((uint8_t *)eeprom::EXTRUDER_DEPRIME_ON_TRAVEL,    EEPROM_DEFAULT_DEPRIME_ON_TRAVEL);
     eeprom_write_byte((uint8_t *)eeprom::ACCEL_SLOWDOWN_FLAG,		EEPROM_DEFAULT_ACCEL_SLOWDOWN_FLAG);
+    eeprom_write_byte((uint8_t *)eeprom::ACCEL_S_CURVE_PERCENT,		EEPROM_DEFAULT_ACCEL_S_CURVE_PERCENT);
 
     putEepromUInt32(eeprom::ACCEL_MAX_SPEED_CHANGE_X,			EEPROM_DEFAULT_ACCEL_MAX_SPEED_CHANGE_X);
     putEepromUInt32(eeprom::ACCEL_MAX_SPEED_CHANGE_Y,			EEPROM_DEFAULT_ACCEL_MAX_SPEED_CHANGE_Y);
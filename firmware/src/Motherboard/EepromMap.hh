@@ -302,8 +302,11 @@ const static uint16_t ACCEL_EXTRUDER_DEPRIME_A	= 0x0185;
 //$type:B $constraints:l,0,1 $tooltip:Check or set to 1 to enable automatic print slowdown when the queue of planned segments is running low.  Uncheck or set to 0 to disable automatic slowdown.
 const static uint16_t ACCEL_SLOWDOWN_FLAG	= 0x0189;
 //$BEGIN_ENTRY
-//$type:BBB $ignore:True
-const static uint16_t UNUSED9			= 0x018A;
+//$type:B $constraints:l,0,50 $tooltip:Set to 0 for trapezoidal acceleration.  Set to 1 to 50 for S-curve acceleration, where the acceleration ramps up and down over that percentage of the time taken to accelerate or decelerate at each end of the ramp.  The peak acceleration is kept to the maximum accelerations, so the average acceleration is (100 - percentage)% of them and ramps take 100 / (100 - percentage) times as long.
+const static uint16_t ACCEL_S_CURVE_PERCENT	= 0x018A;
+//$BEGIN_ENTRY
+//$type:BB $ignore:True
+const static uint16_t UNUSED9			= 0x018B;
 //$BEGIN_ENTRY
 //$type:I $ignore:True
 const static uint16_t UNUSED10			= 0x018D;
@@ -440,6 +443,12 @@ const static uint16_t ALEVEL_P2                = 0x0202;
 //$type:iii $ignore:True $unit:steps
 const static uint16_t ALEVEL_P3                = 0x020E;
 
+//Build resume checkpoints: RESUME_SLOTS slots of sizeof(resume::checkpoint_t) bytes (see Resume.hh),
+//up to 0x07EF with 16 slots
+//$BEGIN_ENTRY
+//$type:B $ignore:True
+const static uint16_t RESUME_CHECKPOINTS       = 0x0220;
+
 /// Reset Jetty Firmware defaults only
 void setJettyFirmwareDefaults();
 
@@ -37,6 +37,8 @@
 #include "Eeprom.hh"
 #include "EepromMap.hh"
 #include "EepromDefaults.hh"
+#include "Resume.hh"
+#include "Telemetry.hh"
 #include "stdio.h"
 
 namespace host {
@@ -47,6 +49,11 @@ namespace host {
 /// should drop through to the next processing level.
 bool processCommandPacket(const InPacket& from_host, OutPacket& to_host);
 bool processQueryPacket(const InPacket& from_host, OutPacket& to_host);
+void processPacket(const InPacket& from_host, OutPacket& to_host);
+#ifdef HOST_WINDOW
+void drainWindow();
+bool processWindow(OutPacket& to_host);
+#endif
 
 // Timeout from time first bit recieved until we abort packet reception
 Timeout packet_in_timeout;
@@ -100,7 +107,14 @@ void runHostSlice() {
 
         InPacket& in = UART::getHostUART().in;
         OutPacket& out = UART::getHostUART().out;
-	if (out.isSending() &&
+#ifdef HOST_WINDOW
+	// Keep queueing windowed commands while a response is sent
+	drainWindow();
+#endif
+#ifdef HOST_TELEMETRY
+	telemetry::runTelemetrySlice();
+#endif
+	if (UART::getHostUART().isSending() &&
 	    (( ! do_host_reset) || (do_host_reset && (! do_host_reset_timeout.hasElapsed())))) {
 		return;
 	}
@@ -120,6 +134,12 @@ void runHostSlice() {
         // a hard reset calls the start up sound and resets heater errors
 		hard_reset = false;
 		packet_in_timeout.abort();
+#ifdef HOST_WINDOW
+		UART::getHostWindow().close();
+#endif
+#ifdef HOST_TELEMETRY
+		telemetry::stop();
+#endif
 
 		// Clear the machine and build names
 		machineName[0] = 0;
@@ -138,6 +158,19 @@ void runHostSlice() {
 		}
 
 	}
+#ifdef HOST_WINDOW
+	if (in.hasError() && UART::getHostWindow().isOpen()) {
+		// Ask for this packet and those after it again
+		packet_in_timeout.abort();
+		UART::getHostWindow().lost();
+		in.reset();
+		Motherboard::getBoard().indicateError(ERR_HOST_PACKET_MISC);
+	}
+	if (processWindow(out)) {
+		UART::getHostUART().beginSend();
+	}
+	else
+#endif
 	if (in.hasError()) {
 		// Reset packet quickly and start handling the next packet.
 		packet_in_timeout.abort();
@@ -168,37 +201,154 @@ void runHostSlice() {
 	else if (in.isFinished() == 1) {
 		packet_in_timeout.abort();
 		out.reset();
-		if(cancelBuild){
-			out.append8(RC_CANCEL_BUILD);
-			cancelBuild = false;
-			Motherboard::getBoard().indicateError(ERR_CANCEL_BUILD);
-		} else
-#if defined(HONOR_DEBUG_PACKETS) && (HONOR_DEBUG_PACKETS == 1)
-		if (processDebugPacket(in, out)) {
-			// okay, processed
-		} else
-#endif
-		if (processCommandPacket(in, out)) {
-			// okay, processed
-		} else if (processQueryPacket(in, out)) {
-			// okay, processed
-		} else {
-			// Unrecognized command
-			out.append8(RC_CMD_UNSUPPORTED);
-		}
+		processPacket(in, out);
 		in.reset();
                 UART::getHostUART().beginSend();
 	}
 	/// mark new state as ready if done building from SD
 	if(currentState==HOST_STATE_BUILDING_FROM_SD)
 	{
-		if(!sdcard::isPlaying())
+		if(!sdcard::isPlaying()) {
 			currentState = HOST_STATE_READY;
+#ifdef RESUME_BUILD
+			resume::stop();
+#endif
+		}
 	}
 	// mark new state as ready if done buiding onboard script
 	managePrintTime();
 }
 
+/// Respond to a packet from the host
+void processPacket(const InPacket& from_host, OutPacket& to_host) {
+	if(cancelBuild){
+		to_host.append8(RC_CANCEL_BUILD);
+		cancelBuild = false;
+		Motherboard::getBoard().indicateError(ERR_CANCEL_BUILD);
+	} else
+#if defined(HONOR_DEBUG_PACKETS) && (HONOR_DEBUG_PACKETS == 1)
+	if (processDebugPacket(from_host, to_host)) {
+		// okay, processed
+	} else
+#endif
+	if (processCommandPacket(from_host, to_host)) {
+		// okay, processed
+	} else if (processQueryPacket(from_host, to_host)) {
+		// okay, processed
+	} else {
+		// Unrecognized command
+		to_host.append8(RC_CMD_UNSUPPORTED);
+	}
+}
+
+/// Length of the command at offset in a batch, or 0 if it isn't a movement
+/// or tool command and so may not be batched.  A command whose length can't
+/// be read from the packet is reported as longer than what's left of it.
+static uint8_t batchedCommandLength(const InPacket& packet, uint8_t offset) {
+	const uint8_t available = packet.getLength() - offset;
+	switch (packet.read8(offset)) {
+	case HOST_CMD_CHANGE_TOOL:		return 2;
+	case HOST_CMD_QUEUE_POINT_EXT:		return 25;
+	case HOST_CMD_SET_POSITION_EXT:		return 21;
+	case HOST_CMD_QUEUE_POINT_NEW:		return 26;
+	case HOST_CMD_QUEUE_POINT_NEW_EXT:	return 32;
+	case HOST_CMD_TOOL_COMMAND:
+		// tool, command and payload length, then the payload
+		if (available < 4 || packet.read8(offset + 3) > available - 4)
+			return available + 1;
+		return 4 + packet.read8(offset + 3);
+	case HOST_CMD_QUEUE_POINT_DELTA:
+		if (available < 3) return available + 1;
+		return command::queuePointDeltaLength(packet.read8(offset + 1),
+						      packet.read8(offset + 2));
+	default:
+		return 0;
+	}
+}
+
+/// Check that a HOST_CMD_BATCH packet holds nothing but whole commands which
+/// may be batched
+/// \return RC_OK, RC_CMD_UNSUPPORTED for a command which may not be batched
+///         or RC_PACKET_LENGTH if the last command is cut short
+static uint8_t checkBatch(const InPacket& packet) {
+	uint8_t offset = 1;
+	while (offset < packet.getLength()) {
+		const uint8_t length = batchedCommandLength(packet, offset);
+		if (length == 0) return RC_CMD_UNSUPPORTED;
+		if (length > packet.getLength() - offset) return RC_PACKET_LENGTH;
+		offset += length;
+	}
+	return RC_OK;
+}
+
+/// Offset of the first command in an action packet: a batch is queued
+/// without its HOST_CMD_BATCH byte
+static uint8_t commandsOffset(const InPacket& packet) {
+	return (packet.read8(0) == HOST_CMD_BATCH) ? 1 : 0;
+}
+
+/// Push every command in an action packet into the command buffer, or none
+/// of them if they don't all fit
+/// \return false if there wasn't room
+static bool queueCommands(const InPacket& packet) {
+	const uint8_t offset = commandsOffset(packet);
+	const uint8_t command_length = packet.getLength() - offset;
+	bool queued = false;
+
+	// Turn off interrupts while querying or manipulating the queue!
+	ATOMIC_BLOCK(ATOMIC_FORCEON) {
+		if (command::getRemainingCapacity() >= command_length) {
+			for (uint8_t i = 0; i < command_length; i++) {
+				command::push(packet.read8(offset + i));
+			}
+			queued = true;
+		}
+	}
+	return queued;
+}
+
+#ifdef HOST_WINDOW
+
+/// True if packet is an action command which processCommandPacket() would
+/// simply queue
+static bool isQueueable(const InPacket& packet) {
+	return packet.getLength() >= 1 && (packet.read8(0) & 0x80) != 0 &&
+		!cancelBuild && !sdcard::isCapturing() && !sdcard::isPlaying() &&
+		(packet.read8(0) != HOST_CMD_BATCH || checkBatch(packet) == RC_OK);
+}
+
+/// Move action commands from the front of the receive window into the
+/// command buffer for as long as they fit.  Rather than a response each,
+/// they get one cumulative ack from processWindow().
+void drainWindow() {
+	PacketWindow& window = UART::getHostWindow();
+
+	while (!window.isEmpty() && isQueueable(window.front())) {
+		// When the command buffer is full, the packet waits in the
+		// window and the host waits for its ack
+		if (!queueCommands(window.front())) return;
+		window.pop(false);
+	}
+}
+
+/// Build the next response owed for the receive window: a NAK, a cumulative
+/// ack, or the response to a query.  Returns true if there is one to send.
+bool processWindow(OutPacket& to_host) {
+	PacketWindow& window = UART::getHostWindow();
+
+	drainWindow();
+	to_host.reset();
+	if (window.respond(to_host)) return true;
+	if (window.isEmpty() || isQueueable(window.front())) return false;
+
+	to_host.setSequence(window.front().getSequence());
+	processPacket(window.front(), to_host);
+	window.pop(true);
+	return true;
+}
+
+#endif // HOST_WINDOW
+
 /** Identify a command packet, and process it.  If the packet is a command
  * packet, return true, indicating that the packet has been queued and no
  * other processing needs to be done. Otherwise, processing of this packet
@@ -208,10 +358,19 @@ bool processCommandPacket(const InPacket& from_host, OutPacket& to_host) {
 	if (from_host.getLength() >= 1) {
 		uint8_t command = from_host.read8(0);
 		if ((command & 0x80) != 0) {
+			// A batch is taken whole or not at all, so it must hold
+			// only whole commands
+			if (command == HOST_CMD_BATCH) {
+				const uint8_t rc = checkBatch(from_host);
+				if (rc != RC_OK) {
+					to_host.append8(rc);
+					return true;
+				}
+			}
 			// If we're capturing a file to an SD card, we send it to the sdcard module
 			// for processing.
 			if (sdcard::isCapturing()) {
-				sdcard::capturePacket(from_host);
+				sdcard::capturePacket(from_host, commandsOffset(from_host));
 				to_host.append8(RC_OK);
 				return true;
                         }
@@ -221,19 +380,7 @@ bool processCommandPacket(const InPacket& from_host, OutPacket& to_host) {
 				return true;
 			}
 			// Queue command, if there's room.
-			// Turn off interrupts while querying or manipulating the queue!
-			ATOMIC_BLOCK(ATOMIC_FORCEON) {
-				const uint8_t command_length = from_host.getLength();
-				if (command::getRemainingCapacity() >= command_length) {
-					// Append command to buffer
-					for (int i = 0; i < command_length; i++) {
-						command::push(from_host.read8(i));
-					}
-					to_host.append8(RC_OK);
-				} else {
-					to_host.append8(RC_BUFFER_OVERFLOW);
-				}
-			}
+			to_host.append8(queueCommands(from_host) ? RC_OK : RC_BUFFER_OVERFLOW);
 			return true;
 		}
 	}
@@ -416,9 +563,7 @@ void doToolPause(OutPacket& to_host) {
 		to_host.append8(RC_DOWNSTREAM_TIMEOUT);
 	} else {
 		// Copy payload back. Start from 0-- we need the response code.
-		for (int i = 0; i < in.getLength(); i++) {
-			to_host.append8(in.read8(i));
-		}
+		to_host.appendBytes((const uint8_t*)in.getData(), in.getLength());
 	}
 }
 
@@ -442,9 +587,7 @@ void handleToolQuery(const InPacket& from_host, OutPacket& to_host) {
 	OutPacket& out = tool::getOutPacket();
 	InPacket& in = tool::getInPacket();
 	out.reset();
-	for (int i = 1; i < from_host.getLength(); i++) {
-		out.append8(from_host.read8(i));
-	}
+	out.appendBytes((const uint8_t*)from_host.getData() + 1, from_host.getLength() - 1);
 	// Timeouts are handled inside the toolslice code; there's no need
 	// to check for timeouts on this loop.
 	tool::startTransaction();
@@ -457,9 +600,7 @@ void handleToolQuery(const InPacket& from_host, OutPacket& to_host) {
 		to_host.append8(RC_DOWNSTREAM_TIMEOUT);
 	} else {
 		// Copy payload back. Start from 0-- we need the response code.
-		for (int i = 0; i < in.getLength(); i++) {
-			to_host.append8(in.read8(i));
-		}
+		to_host.appendBytes((const uint8_t*)in.getData(), in.getLength());
 	}
 }
 
@@ -492,9 +633,7 @@ void handleReadEeprom(const InPacket& from_host, OutPacket& to_host) {
     uint8_t data[length];
     eeprom_read_block(data, (const void*) offset, length);
     to_host.append8(RC_OK);
-    for (int i = 0; i < length; i++) {
-        to_host.append8(data[i]);
-    }
+    to_host.appendBytes(data, length);
 }
 
 /**
@@ -535,7 +674,7 @@ inline void handleExtendedStop(const InPacket& from_host, OutPacket& to_host) {
 }
 
     //set build name and build state
-void handleBuildStartNotification(CircularBuffer& buf) {
+void handleBuildStartNotification(command::CommandBuffer& buf) {
 
 	uint8_t idx = 0;
 	switch (currentState){
@@ -570,6 +709,9 @@ void handleBuildStopNotification(uint8_t stopFlags) {
 		command::pauseHeaters(PAUSE_EXT_OFF | PAUSE_HBP_OFF);
 		buildState = BUILD_FINISHED_NORMALLY;
 		currentState = HOST_STATE_READY;
+#ifdef RESUME_BUILD
+		resume::stop();
+#endif
 	}
 }
 
@@ -591,7 +733,49 @@ inline void handleGetBuildStats(OutPacket& to_host) {
 			to_host.append32(last_print_line);
 		}
         to_host.append32(0);// open spot for filament detect info
+        // bytes written to the SD card per second by the current or last capture
+        to_host.append32(sdcard::getCaptureRate());
 }
+/// get the cycle counts (calls, min, avg, max) for one of st_interrupt, st_extruder_interrupt,
+/// setup_next_block or plan_buffer_line, followed by the stepper interrupt overruns.
+/// Payload: site index, and optional flags; if bit 0 is set, all the counters are reset after reading.
+inline void handleGetIsrProfile(const InPacket& from_host, OutPacket& to_host) {
+	isr_profile_t profile[PROFILE_SITES];
+	uint32_t overruns;
+
+	if ( from_host.getLength() < 2 ) {
+		to_host.append8(RC_PACKET_LENGTH);
+		return;
+	}
+
+	uint8_t site = from_host.read8(1);
+	bool reset = ( from_host.getLength() >= 3 ) && ( from_host.read8(2) & 0x01 );
+
+	if (( site >= PROFILE_SITES ) || ( ! st_get_isr_profile(profile, &overruns, reset) )) {
+		to_host.append8(RC_CMD_UNSUPPORTED);
+		return;
+	}
+
+	to_host.append8(RC_OK);
+	to_host.append32(profile[site].calls);
+	to_host.append16(( profile[site].samples ) ? profile[site].min : 0);
+	to_host.append16(( profile[site].samples ) ? (uint16_t)(profile[site].cycles / profile[site].samples) : 0);
+	to_host.append16(profile[site].max);
+	to_host.append32(overruns);
+}
+
+#ifdef HOST_TELEMETRY
+/// Subscribe to telemetry frames.  Payload: uint16 period in ms, uint8 fields.
+inline void handleSetTelemetry(const InPacket& from_host, OutPacket& to_host) {
+	if ( from_host.getLength() < 4 ) {
+		to_host.append8(RC_PACKET_LENGTH);
+		return;
+	}
+	to_host.append8(RC_OK);
+	to_host.append8(telemetry::start(from_host.read16(1), from_host.read8(3)));
+}
+#endif
+
 /// get current print stats if printing, or last print stats if not printing
 inline void handleGetBoardStatus(OutPacket& to_host) {
 	to_host.append8(RC_OK);
@@ -691,10 +875,25 @@ bool processQueryPacket(const InPacket& from_host, OutPacket& to_host) {
 			case HOST_CMD_GET_BUILD_STATS:
 				handleGetBuildStats(to_host);
 				return true;
+			case HOST_CMD_GET_ISR_PROFILE:
+				handleGetIsrProfile(from_host, to_host);
+				return true;
 #pragma GCC diagnostic pop
 			case HOST_CMD_ADVANCED_VERSION:
 				handleGetAdvancedVersion(from_host, to_host);
 				return true;
+#ifdef HOST_WINDOW
+			case HOST_CMD_OPEN_WINDOW:
+				UART::getHostWindow().open();
+				to_host.append8(RC_OK);
+				to_host.append8(HOST_WINDOW_SIZE);
+				return true;
+#endif
+#ifdef HOST_TELEMETRY
+			case HOST_CMD_SET_TELEMETRY:
+				handleSetTelemetry(from_host, to_host);
+				return true;
+#endif
 			}
 		}
 	}
@@ -777,9 +976,52 @@ sdcard::SdErrorCode startBuildFromSD(char *fname) {
 	command::copiesToPrint = eeprom::getEeprom8(eeprom::ABP_COPIES, EEPROM_DEFAULT_ABP_COPIES);
 	currentState = HOST_STATE_BUILDING_FROM_SD;
 
+#ifdef RESUME_BUILD
+	// The file's name rather than the build name, which may be truncated
+	uint32_t dir, cluster, size;
+	sdcard::getPlaybackFile(&dir, &cluster, &size);
+	resume::start(fname, dir, cluster, size);
+#endif
+
+	return e;
+}
+
+#ifdef RESUME_BUILD
+
+sdcard::SdErrorCode resumeBuildFromSD() {
+	resume::checkpoint_t cp;
+
+	if ( !resume::load(cp) )
+		return sdcard::SD_ERR_FILE_NOT_FOUND;
+
+	cp.name[RESUME_NAME_LEN - 1] = 0;
+	sdcard::SdErrorCode e = sdcard::startPlaybackAt(cp.name, cp.fileDir, cp.fileCluster,
+							 cp.fileSize, cp.offset);
+	if ( e != sdcard::SD_SUCCESS )
+		return e;
+
+	strncpy(buildName, cp.name, sizeof(buildName) - 1);
+	buildName[sizeof(buildName) - 1] = 0;
+
+	command::reset();
+	steppers::reset();
+	steppers::abort();
+
+	// Must be done after command::reset();
+	command::resumeBuild(cp);
+	command::copiesToPrint = eeprom::getEeprom8(eeprom::ABP_COPIES, EEPROM_DEFAULT_ABP_COPIES);
+	currentState = HOST_STATE_BUILDING_FROM_SD;
+	resume::start(cp);
+
+	// The build start notification at the start of the file isn't played back
+	startPrintTime();
+	buildState = BUILD_RUNNING;
+
 	return e;
 }
 
+#endif
+
 // Stop the current build, if any
 void stopBuildNow() {
     // if building from repG, try to send a cancel msg to repG before reseting
@@ -791,6 +1033,9 @@ void stopBuildNow() {
 	}
 	last_print_line = command::getLineNumber();
 	stopPrintTime();
+#ifdef RESUME_BUILD
+	resume::stop();
+#endif
 	do_host_reset = true; // indicate reset after response has been sent
 	do_host_reset_timeout.start(200000);	//Protection against the firmware sending to a down host
 	buildState = BUILD_CANCELED;
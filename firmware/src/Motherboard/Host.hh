@@ -20,7 +20,8 @@
 
 #include "Packet.hh"
 #include "SDCard.hh"
-#include "CircularBuffer.hh"
+#include "Command.hh"
+#include "Configuration.hh"
 
 // TODO: Make this a class.
 /// Functions in the host namespace deal with communications to the host
@@ -74,6 +75,14 @@ BuildState getBuildState();
 /// \return True if build started successfully.
 sdcard::SdErrorCode startBuildFromSD(char *filename);
 
+#ifdef RESUME_BUILD
+/// Resume an SD card build from the checkpoint saved in EEPROM: reheat,
+/// home X and Y, and continue from the checkpoint's place in the file.
+/// \return SD_SUCCESS if the build resumed, or SD_ERR_FILE_NOT_FOUND if
+///  there's no checkpoint or its file is no longer on the card.
+sdcard::SdErrorCode resumeBuildFromSD();
+#endif
+
 /// Stop the current build immediately
 void stopBuildNow();
 
@@ -81,7 +90,7 @@ void stopBuildNow();
 void stopBuild();
 
 /// set build state and build name
-void handleBuildStartNotification(CircularBuffer& buf);
+void handleBuildStartNotification(command::CommandBuffer& buf);
 
 /// set build state
 void handleBuildStopNotification(uint8_t stopFlags);
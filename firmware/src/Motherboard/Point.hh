@@ -48,7 +48,12 @@ public:
         /// \return Reference to the variable containing the axis' position.
         int32_t& operator[](unsigned int index);
 
-} __attribute__ ((__packed__));
+}
+#ifndef SIMULATOR
+// The simulator's host compiler won't bind references to members of a packed struct
+__attribute__ ((__packed__))
+#endif
+;
 
 
 #endif // POINT_HH
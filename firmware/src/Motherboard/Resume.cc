@@ -0,0 +1,332 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "Resume.hh"
+
+#ifdef RESUME_BUILD
+
+#include <stddef.h>
+#include <string.h>
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+#include "Commands.hh"
+#include "EepromMap.hh"
+
+#ifndef BLOCK_BUFFER_SIZE
+#error RESUME_BUILD needs BLOCK_BUFFER_SIZE, the planner block buffer size, from Configuration.hh
+#endif
+
+// Point indices and homing flag bits of the axes, as StepperAxis.hh numbers them
+#define AXIS_X 0
+#define AXIS_Y 1
+#define AXIS_Z 2
+
+// Seconds a resumed build waits for each heater
+#define RESUME_HEAT_TIMEOUT 1200
+
+// Position of the sequence number within a checkpoint; it's written first as
+// 0xFF, marking the slot invalid, and last with its new value
+#define SEQUENCE_INDEX offsetof(checkpoint_t, sequence)
+#define SEQUENCE_WRITING 0xFF
+
+#define SLOT_ADDRESS(s) (eeprom::RESUME_CHECKPOINTS + (uint16_t)(s) * sizeof(checkpoint_t))
+
+namespace resume {
+
+enum {
+	IDLE,		// No checkpoint captured
+	WAITING,	// Waiting for the planner to run the moves before the checkpoint
+	WRITING		// Writing the checkpoint to EEPROM
+};
+
+static checkpoint_t live;	// The build's state as of the last command run
+static checkpoint_t record;	// The checkpoint being written
+static bool active = false;
+static bool homeAwaiting = false; // X or Y homed, but their position not yet defined
+static uint8_t state = IDLE;
+static uint8_t waitTail, waitMoves;
+static uint8_t slot = 0;	// Slot the next checkpoint is written to
+static uint8_t sequence;	// Sequence number of the last checkpoint written
+static uint8_t writeStep;
+
+static uint8_t checksum(const checkpoint_t &cp) {
+	const uint8_t *p = (const uint8_t *)&cp;
+	uint8_t crc = 0;
+
+	for ( uint8_t i = 0; i < offsetof(checkpoint_t, checksum); i++ )
+		crc = _crc_ibutton_update(crc, p[i]);
+	return _crc_ibutton_update(crc, cp.sequence);
+}
+
+static bool readSlot(uint8_t s, checkpoint_t &cp) {
+	eeprom_read_block(&cp, (const void *)SLOT_ADDRESS(s), sizeof(cp));
+	return ( cp.sequence != SEQUENCE_WRITING ) && !( cp.sequence & 0x80 ) &&
+		( cp.checksum == checksum(cp) );
+}
+
+// Read the newest valid checkpoint; returns its slot, or -1 if none is valid
+static int8_t readNewest(checkpoint_t &cp) {
+	checkpoint_t other;
+	int8_t newest = -1;
+
+	// Sequence numbers count modulo 0x80; a newer one is less than half the
+	// range ahead of an older one
+	for ( uint8_t s = 0; s < RESUME_SLOTS; s++ ) {
+		if ( !readSlot(s, other) )
+			continue;
+		if ( newest < 0 || ((other.sequence - cp.sequence) & 0x7F) < 0x40 ) {
+			memcpy(&cp, &other, sizeof(cp));
+			newest = (int8_t)s;
+		}
+	}
+	return newest;
+}
+
+// Mark every slot invalid
+static void invalidate() {
+	for ( uint8_t s = 0; s < RESUME_SLOTS; s++ ) {
+		uint8_t *addr = (uint8_t *)(SLOT_ADDRESS(s) + SEQUENCE_INDEX);
+		if ( eeprom_read_byte(addr) != SEQUENCE_WRITING )
+			eeprom_write_byte(addr, SEQUENCE_WRITING);
+	}
+}
+
+void start(const char *name, uint32_t dir, uint32_t cluster, uint32_t size) {
+	invalidate();
+
+	memset(&live, 0, sizeof(live));
+	strncpy(live.name, name, RESUME_NAME_LEN - 1);
+	live.fileDir = dir;
+	live.fileCluster = cluster;
+	live.fileSize = size;
+
+	// The slots keep turning from one build to the next
+	homeAwaiting = false;
+	state = IDLE;
+	sequence = 0x7F;
+	active = true;
+}
+
+void start(const checkpoint_t &from) {
+	memcpy(&live, &from, sizeof(live));
+
+	// Leave the checkpoint we resumed from in place until the next one is written
+	checkpoint_t cp;
+	int8_t s = readNewest(cp);
+	slot = (uint8_t)(s + 1) % RESUME_SLOTS;
+	sequence = from.sequence;
+
+	homeAwaiting = false;
+	state = IDLE;
+	active = true;
+}
+
+void stop() {
+	if ( !active )
+		return;
+	active = false;
+	state = IDLE;
+	invalidate();
+}
+
+void noteTemperature(uint8_t heater, int16_t temp) {
+	if ( heater < RESUME_HEATERS )
+		live.temperature[heater] = temp;
+}
+
+void noteHoming(uint8_t command, uint8_t flags, uint32_t feedrate, uint16_t timeout) {
+	flags &= (1 << AXIS_X) | (1 << AXIS_Y);
+	if ( !flags )
+		return;
+
+	// X and Y homed by separate commands are homed together when resuming
+	if ( homeAwaiting && command == live.homeCommand )
+		flags |= live.homeFlags;
+
+	live.homeCommand = command;
+	live.homeFlags = flags;
+	live.homeFeedrate = feedrate;
+	live.homeTimeout = timeout;
+	homeAwaiting = true;
+}
+
+void notePosition(const Point &position) {
+	if ( !homeAwaiting )
+		return;
+	live.homePosition[0] = position[AXIS_X];
+	live.homePosition[1] = position[AXIS_Y];
+	homeAwaiting = false;
+}
+
+bool capture(uint32_t offset, uint8_t tool, const Point &position,
+	     uint8_t tail, uint8_t moves) {
+	if ( !active || state != IDLE )
+		return false;
+
+	live.offset = offset;
+	live.tool = tool;
+	for ( uint8_t i = 0; i < STEPPER_COUNT; i++ )
+		live.position[i] = position[i];
+	memcpy(&record, &live, sizeof(record));
+
+	// Without its home position a resumed build can't use the homing
+	if ( homeAwaiting )
+		record.homeCommand = 0;
+
+	waitTail = tail;
+	waitMoves = moves;
+	state = WAITING;
+	return true;
+}
+
+void runSlice(uint8_t tail) {
+	if ( state == WAITING ) {
+		// Every move queued before the checkpoint must have been run;
+		// otherwise a resumed build would skip them
+		if ( (uint8_t)((tail - waitTail) & (BLOCK_BUFFER_SIZE - 1)) < waitMoves )
+			return;
+
+		record.sequence = (sequence + 1) & 0x7F;
+		record.checksum = checksum(record);
+		writeStep = 0;
+		state = WRITING;
+	}
+
+	if ( state != WRITING )
+		return;
+
+	// Write at most one byte, and only when the EEPROM is idle, so that
+	// the command slice never waits on it.  Bytes the slot already holds
+	// are skipped.
+	const uint8_t *p = (const uint8_t *)&record;
+	while ( eeprom_is_ready() ) {
+		uint8_t index, value;
+		if ( writeStep == 0 ) {
+			index = SEQUENCE_INDEX;
+			value = SEQUENCE_WRITING;
+		}
+		else {
+			index = writeStep - 1;
+			if ( writeStep == sizeof(checkpoint_t) )
+				index = SEQUENCE_INDEX;
+			else if ( index >= SEQUENCE_INDEX )
+				index++;
+			value = p[index];
+		}
+
+		uint8_t *addr = (uint8_t *)(SLOT_ADDRESS(slot) + index);
+		bool written = false;
+		if ( eeprom_read_byte(addr) != value ) {
+			eeprom_write_byte(addr, value);
+			written = true;
+		}
+
+		if ( writeStep++ == sizeof(checkpoint_t) ) {
+			sequence = record.sequence;
+			if ( ++slot == RESUME_SLOTS )
+				slot = 0;
+			state = IDLE;
+			return;
+		}
+		if ( written )
+			return;
+	}
+}
+
+bool load(checkpoint_t &cp) {
+	return readNewest(cp) >= 0;
+}
+
+static uint8_t *put16(uint8_t *p, uint16_t v) {
+	*p++ = (uint8_t)v;
+	*p++ = (uint8_t)(v >> 8);
+	return p;
+}
+
+static uint8_t *put32(uint8_t *p, uint32_t v) {
+	p = put16(p, (uint16_t)v);
+	return put16(p, (uint16_t)(v >> 16));
+}
+
+static uint8_t *putPosition(uint8_t *p, uint8_t command, int32_t x, int32_t y, int32_t z,
+			    const checkpoint_t &cp) {
+	*p++ = command;
+	p = put32(p, (uint32_t)x);
+	p = put32(p, (uint32_t)y);
+	p = put32(p, (uint32_t)z);
+	for ( uint8_t i = AXIS_Z + 1; i < 5; i++ )
+		p = put32(p, (uint32_t)(( i < STEPPER_COUNT ) ? cp.position[i] : 0));
+	return p;
+}
+
+static uint8_t *putMove(uint8_t *p, int32_t x, int32_t y, int32_t z, uint32_t feedrate,
+			const checkpoint_t &cp) {
+	p = putPosition(p, HOST_CMD_QUEUE_POINT_EXT, x, y, z, cp);
+	return put32(p, feedrate);
+}
+
+uint8_t prologue(const checkpoint_t &cp, int32_t zLift, uint32_t zFeedrate, uint8_t *buf) {
+	uint8_t *p = buf;
+
+	*p++ = HOST_CMD_CHANGE_TOOL;
+	*p++ = cp.tool;
+
+	// Turn all the heaters on, then wait for each of them
+	for ( uint8_t h = 0; h < RESUME_HEATERS; h++ ) {
+		if ( cp.temperature[h] <= 0 )
+			continue;
+		*p++ = HOST_CMD_TOOL_COMMAND;
+		*p++ = ( h == RESUME_PLATFORM ) ? 0 : h;
+		*p++ = ( h == RESUME_PLATFORM ) ? SLAVE_CMD_SET_PLATFORM_TEMP : SLAVE_CMD_SET_TEMP;
+		*p++ = 2;
+		p = put16(p, (uint16_t)cp.temperature[h]);
+	}
+	for ( uint8_t h = 0; h < RESUME_HEATERS; h++ ) {
+		if ( cp.temperature[h] <= 0 )
+			continue;
+		*p++ = ( h == RESUME_PLATFORM ) ? HOST_CMD_WAIT_FOR_PLATFORM : HOST_CMD_WAIT_FOR_TOOL;
+		*p++ = ( h == RESUME_PLATFORM ) ? 0 : h;
+		p = put16(p, 100);
+		p = put16(p, RESUME_HEAT_TIMEOUT);
+	}
+
+	// Z is where the build left it
+	const int32_t x = cp.position[AXIS_X], y = cp.position[AXIS_Y], z = cp.position[AXIS_Z];
+	p = putPosition(p, HOST_CMD_SET_POSITION_EXT, x, y, z, cp);
+
+	if ( cp.homeCommand ) {
+		// Lower the platform clear of the build, home X and Y as the
+		// build did, move back to where the build was and raise the
+		// platform again
+		p = putMove(p, x, y, z + zLift, zFeedrate, cp);
+
+		*p++ = cp.homeCommand;
+		*p++ = cp.homeFlags;
+		p = put32(p, cp.homeFeedrate);
+		p = put16(p, cp.homeTimeout);
+
+		p = putPosition(p, HOST_CMD_SET_POSITION_EXT,
+				( cp.homeFlags & (1 << AXIS_X) ) ? cp.homePosition[0] : x,
+				( cp.homeFlags & (1 << AXIS_Y) ) ? cp.homePosition[1] : y, z + zLift, cp);
+		p = putMove(p, x, y, z + zLift, cp.homeFeedrate, cp);
+		p = putMove(p, x, y, z, zFeedrate, cp);
+	}
+
+	return (uint8_t)(p - buf);
+}
+
+} // namespace resume
+
+#endif // RESUME_BUILD
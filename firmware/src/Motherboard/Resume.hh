@@ -0,0 +1,147 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef RESUME_HH_
+#define RESUME_HH_
+
+#include <stdint.h>
+#include "Configuration.hh"
+#include "Point.hh"
+
+#ifdef RESUME_BUILD
+
+// Seconds between checkpoints of an SD card build
+#ifndef RESUME_CHECKPOINT_INTERVAL
+#define RESUME_CHECKPOINT_INTERVAL 120
+#endif
+
+// EEPROM slots the checkpoints are written to in turn.  Each checkpoint
+// writes its slot's sequence number twice, so a byte lasts 100,000 / 2
+// checkpoints of its slot, or RESUME_SLOTS times that many of the build.
+#ifndef RESUME_SLOTS
+#define RESUME_SLOTS 16
+#endif
+
+// Characters of the build name kept in a checkpoint, including the NUL;
+// enough for the SD card's long file names
+#define RESUME_NAME_LEN 32
+
+// mm the platform is lowered by before X and Y are homed and moved back
+#ifndef RESUME_Z_LIFT
+#define RESUME_Z_LIFT 5.0
+#endif
+
+// Heaters whose set points are kept: extruder 0, extruder 1, and the platform
+#define RESUME_HEATERS 3
+#define RESUME_PLATFORM 2
+
+// Bytes prologue() may write: tool change, heater set points and waits,
+// two positions defined, homing, and three moves
+#define RESUME_PROLOGUE_MAX (2 + 2 * 6 * RESUME_HEATERS + 2 * 21 + 8 + 3 * 25)
+
+/// Checkpoints of an SD card build, from which the build can be resumed after
+/// a power failure.  At a command boundary the file offset of the next command
+/// and the planner position before it are captured, and once the planner has
+/// run every move queued before that boundary the checkpoint is written to
+/// EEPROM.  The write is spread over the following command slices, a byte at
+/// a time and only when the EEPROM is idle.  Checkpoints go to RESUME_SLOTS
+/// slots in turn, which spreads the wear, and a write cut short leaves the
+/// previous checkpoint intact.
+namespace resume {
+
+    /// A checkpoint as stored in EEPROM
+    typedef struct {
+	uint32_t offset;                         ///< File offset of the next command
+	int32_t  position[STEPPER_COUNT];        ///< Planner position before it, in steps
+	int16_t  temperature[RESUME_HEATERS];    ///< Heater set points
+	uint8_t  tool;                           ///< Current tool index
+	uint8_t  homeCommand;                    ///< Command which homed X and Y, or 0 if none did
+	uint8_t  homeFlags;                      ///< Its axes
+	uint16_t homeTimeout;                    ///< Its timeout in seconds
+	uint32_t homeFeedrate;                   ///< Its feedrate in microseconds per step
+	int32_t  homePosition[2];                ///< X and Y as defined after homing
+	uint32_t fileDir;                        ///< First cluster of its directory
+	uint32_t fileCluster;                    ///< First cluster of the build file
+	uint32_t fileSize;                       ///< Size of the build file
+	char     name[RESUME_NAME_LEN];          ///< Build name
+	uint8_t  sequence;                       ///< Write count, or 0xFF while being written
+	uint8_t  checksum;                       ///< CRC of the preceding bytes
+    } checkpoint_t;
+
+    /// Start checkpointing a build from the start of its file.
+    /// \param[in] name Build name, which is the file's name
+    /// \param[in] dir First cluster of the file's directory
+    /// \param[in] cluster First cluster of the build file
+    /// \param[in] size Size of the build file
+    void start(const char *name, uint32_t dir, uint32_t cluster, uint32_t size);
+
+    /// Continue checkpointing a build resumed from a checkpoint
+    /// \param[in] from The checkpoint the build was resumed from
+    void start(const checkpoint_t &from);
+
+    /// Stop checkpointing and discard the stored checkpoint; called when
+    /// a build finishes or is cancelled.
+    void stop();
+
+    /// Record a heater set point sent by the build
+    /// \param[in] heater Extruder index, or RESUME_PLATFORM
+    /// \param[in] temp Set point in degrees C
+    void noteTemperature(uint8_t heater, int16_t temp);
+
+    /// Record a homing command run by the build.  Commands which home
+    /// X or Y are kept so that a resumed build can home the same way.
+    void noteHoming(uint8_t command, uint8_t flags, uint32_t feedrate, uint16_t timeout);
+
+    /// Record a position defined by the build.  The first one after X and
+    /// Y are homed is what the build takes their home positions to be.
+    void notePosition(const Point &position);
+
+    /// Capture a checkpoint at a command boundary.  Nothing is captured
+    /// while the previous checkpoint is still waiting or being written.
+    /// \param[in] offset File offset of the next command
+    /// \param[in] tool Current tool index
+    /// \param[in] position Planner position before the next command
+    /// \param[in] tail Planner block buffer tail
+    /// \param[in] moves Number of moves in the planner
+    /// \return True if a checkpoint was captured
+    bool capture(uint32_t offset, uint8_t tool, const Point &position,
+		 uint8_t tail, uint8_t moves);
+
+    /// Write the captured checkpoint once the planner has run the moves
+    /// queued before it, a byte per call.  Call from every command slice.
+    /// \param[in] tail Planner block buffer tail
+    void runSlice(uint8_t tail);
+
+    /// Read the newest valid checkpoint from EEPROM
+    /// \param[out] cp The checkpoint
+    /// \return True if there is a valid checkpoint
+    bool load(checkpoint_t &cp);
+
+    /// Queue the commands which return the machine to a checkpoint: select
+    /// the tool, heat and wait for the heaters, lower the platform, home X
+    /// and Y as the build did, move back to the checkpoint's position and
+    /// raise the platform again.
+    /// \param[in] cp The checkpoint
+    /// \param[in] zLift Steps to lower the platform by, from the checkpoint's Z
+    /// \param[in] zFeedrate Feedrate for Z, in microseconds per step
+    /// \param[out] buf The commands, at most RESUME_PROLOGUE_MAX bytes
+    /// \return The number of bytes written to buf
+    uint8_t prologue(const checkpoint_t &cp, int32_t zLift, uint32_t zFeedrate, uint8_t *buf);
+
+} // namespace resume
+
+#endif // RESUME_BUILD
+
+#endif // RESUME_HH_
@@ -17,13 +17,17 @@
 
 #include "SDCard.hh"
 
+#ifndef SIMULATOR
 #include <avr/io.h>
+#endif
 #include <string.h>
 #include "lib_sd/sd-reader_config.h"
 #include "lib_sd/fat.h"
 #include "lib_sd/sd_raw.h"
 #include "lib_sd/partition.h"
+#ifndef SIMULATOR
 #include "Motherboard.hh"
+#endif
 #include "Eeprom.hh"
 #include "EepromMap.hh"
 #include "EepromDefaults.hh"
@@ -51,6 +55,10 @@ static struct partition_struct *partition = 0;
 static struct fat_fs_struct *fs = 0;
 static struct fat_dir_struct *cwd = 0; // current working directory
 static struct fat_file_struct *file = 0;
+static uint32_t fileCluster = 0; // first cluster of file
+static uint32_t fileDir = 0; // first cluster of its directory
+static uint32_t cwdCluster = 0; // first cluster of cwd, 0 for the root
+static bool dirIndexed = false; // the file buffer holds an index of cwd
 
 void forceReinit() {
 #ifndef BROKEN_SD
@@ -96,6 +104,8 @@ static SdErrorCode changeWorkingDir(struct fat_dir_entry_struct *newDir)
 		struct fat_dir_entry_struct rootdirectory;
 		fat_get_dir_entry_of_path(fs, "/", &rootdirectory);
 		cwd = fat_open_dir(fs, &rootdirectory);
+		cwdCluster = 0;
+		dirIndexed = false;
 		return cwd ? SD_SUCCESS : SD_ERR_NO_ROOT;
 	}
 
@@ -105,6 +115,8 @@ static SdErrorCode changeWorkingDir(struct fat_dir_entry_struct *newDir)
 
 	fat_close_dir(cwd);
 	cwd = tmp;
+	cwdCluster = newDir->cluster;
+	dirIndexed = false;
 
 	return SD_SUCCESS;
 }
@@ -265,6 +277,8 @@ static int8_t openFile(const char* name)
 
 	finishFile();
 	file = fat_open_file(fs, &fileEntry);
+	fileCluster = fileEntry.cluster;
+	fileDir = cwdCluster;
 	return (file != 0) ? 1 : 0;
 }
 
@@ -289,6 +303,188 @@ static int32_t fileSizeBytes = 0L;
 static int32_t playedBytes = 0L;
 static uint32_t capturedBytes = 0L;
 
+// Playback reads the file a sector at a time rather than a byte at a
+// time: each fat_read_file() call walks the cluster chain and goes through
+// sd_raw_read(), so single byte reads spend most of their time in overhead.
+// Capture likewise stages packets and writes them out a sector at a time,
+// which also spares sd_raw_write() reading in each block before the first
+// packet is merged into it.  Playback and capture never run at once, so
+// they share the buffer, which also holds the directory index when
+// neither is running.  The buffer size divides the sector size so that
+// reads and writes stay sector aligned.
+#ifdef SMALL_4K_RAM
+	#define FILE_BUFFER_SIZE 128
+#else
+	#define FILE_BUFFER_SIZE 512
+#endif
+
+static union {
+	uint8_t data[FILE_BUFFER_SIZE];
+	uint16_t dirIndex[FILE_BUFFER_SIZE / 2];
+} file_buffer;
+static uint16_t playback_index = 0;
+static uint16_t playback_length = 0;
+static bool has_more = false;
+static uint16_t capture_length = 0;
+static bool capture_failed = false;
+static uint32_t captureMicros = 0L;
+
+#ifndef SIMULATOR
+	#define CURRENT_MICROS() Motherboard::getBoard().getCurrentMicros()
+#else
+	#define CURRENT_MICROS() 0
+#endif
+
+// The directory index holds the position in cwd, from fat_tell_dir(), of
+// each entry the LCD's file browser lists, so that any entry can be read
+// without reading the entries before it.  Directories with more entries
+// than the index holds have the rest read from the end of the index.
+#define DIR_INDEX_SIZE (FILE_BUFFER_SIZE / 2)
+
+static uint8_t dirIndexCount = 0;
+static uint16_t dirIndexTail = 0;
+
+// Whether the file browser lists an entry: files and directories other
+// than hidden, system and dot files, plus ".." to move up
+
+static bool isListed(const struct fat_dir_entry_struct *entry)
+{
+	if ( entry->attributes & (FAT_ATTRIB_HIDDEN | FAT_ATTRIB_SYSTEM | FAT_ATTRIB_VOLUME) )
+		return false;
+	if ( entry->long_name[0] != '.' )
+		return entry->long_name[0] != 0;
+	return ( entry->attributes & FAT_ATTRIB_DIR ) &&
+		entry->long_name[1] == '.' && entry->long_name[2] == 0;
+}
+
+// Read the next listed entry from cwd, along with its position
+
+static bool readListed(struct fat_dir_entry_struct *entry, uint16_t *pos)
+{
+	do {
+		if ( pos )
+			*pos = fat_tell_dir(cwd);
+		if ( !fat_read_dir(cwd, entry) )
+			return false;
+	} while ( !isListed(entry) );
+	return true;
+}
+
+static bool readListedAt(uint16_t pos, struct fat_dir_entry_struct *entry)
+{
+	return fat_seek_dir(cwd, pos) && readListed(entry, 0);
+}
+
+// Case insensitive name comparison for sorting
+
+static bool nameBefore(const char *a, const char *b)
+{
+	for ( ;; a++, b++ ) {
+		char ca = *a, cb = *b;
+		if ( ca >= 'A' && ca <= 'Z' ) ca += 'a' - 'A';
+		if ( cb >= 'A' && cb <= 'Z' ) cb += 'a' - 'A';
+		if ( ca != cb || ca == 0 )
+			return ca < cb;
+	}
+}
+
+// Sort the index by name with a binary insertion sort, which reads each
+// entry's name about log2(n) times.  A read error leaves the rest of the
+// index unsorted, but still valid.
+
+static void sortDirIndex()
+{
+	struct fat_dir_entry_struct entry;
+	char name[sizeof(entry.long_name)];
+	uint16_t *index = file_buffer.dirIndex;
+
+	for ( uint8_t i = 1; i < dirIndexCount; i++ ) {
+		uint16_t pos = index[i];
+		if ( !readListedAt(pos, &entry) )
+			return;
+		memcpy(name, entry.long_name, sizeof(name));
+
+		uint8_t lo = 0, hi = i;
+		while ( lo < hi ) {
+			uint8_t mid = lo + (hi - lo) / 2;
+			if ( !readListedAt(index[mid], &entry) )
+				return;
+			if ( nameBefore(name, entry.long_name) )
+				hi = mid;
+			else
+				lo = mid + 1;
+		}
+		memmove(index + lo + 1, index + lo, (i - lo) * sizeof(uint16_t));
+		index[lo] = pos;
+	}
+}
+
+uint8_t directoryIndex(bool sort)
+{
+	struct fat_dir_entry_struct entry;
+	uint16_t pos;
+	uint8_t count = 0;
+
+	dirIndexed = false;
+	dirIndexCount = 0;
+	if ( directoryReset() != SD_SUCCESS )
+		return 0;
+
+	// Without the file buffer, the entries are counted but not indexed
+	bool useIndex = !playing && !capturing;
+
+	while ( count < 255 && readListed(&entry, &pos) ) {
+		if ( useIndex && dirIndexCount < DIR_INDEX_SIZE ) {
+			file_buffer.dirIndex[dirIndexCount++] = pos;
+			dirIndexTail = fat_tell_dir(cwd);
+		}
+		count++;
+	}
+
+	dirIndexed = useIndex;
+	if ( dirIndexed && sort )
+		sortDirIndex();
+	return count;
+}
+
+bool directoryIndexEntry(uint8_t index, char* buffer, uint8_t bufsize, bool *isDir)
+{
+	struct fat_dir_entry_struct entry;
+	bool found;
+
+	buffer[0] = 0; // assumes buffer != 0 && bufsize > 0
+	*isDir = false;
+
+	if ( mustReinit && initCard() != SD_SUCCESS )
+		return false;
+
+	if ( dirIndexed && index < dirIndexCount )
+		found = readListedAt(file_buffer.dirIndex[index], &entry);
+	else {
+		// Read on from the end of the index, or from the start of cwd
+		uint8_t skip = index;
+		if ( dirIndexed ) {
+			found = fat_seek_dir(cwd, dirIndexTail);
+			skip -= dirIndexCount;
+		}
+		else
+			found = fat_reset_dir(cwd);
+		while ( found && skip-- )
+			found = readListed(&entry, 0);
+		if ( found )
+			found = readListed(&entry, 0);
+	}
+	if ( !found )
+		return false;
+
+	uint8_t i;
+	for ( i = 0; i < bufsize - 1 && entry.long_name[i] != 0; i++ )
+		buffer[i] = entry.long_name[i];
+	buffer[i] = 0;
+	*isDir = ( entry.attributes & FAT_ATTRIB_DIR ) != 0;
+	return true;
+}
+
 bool isPlaying() {
 	return playing;
 }
@@ -314,8 +510,16 @@ SdErrorCode startCapture(char* filename)
     if ( sd_raw_locked() )
 	return SD_ERR_CARD_LOCKED;
 
+    // The capture takes over the file buffer
+    finishPlayback();
+    finishCapture();
+    dirIndexed = false;
+
     capturedBytes = 0L;
     playedBytes = 0L;
+    capture_length = 0;
+    capture_failed = false;
+    captureMicros = 0L;
 
     // Always operate in truncation mode.
     deleteFile(filename);
@@ -329,20 +533,60 @@ SdErrorCode startCapture(char* filename)
     return SD_SUCCESS;
 }
 
-void capturePacket(const Packet& packet)
+// Write the staged capture data to the file.  After a write error the
+// rest of the capture is discarded, so that the file holds only what
+// preceded the error and finishCapture() reports how much that was.
+
+static bool flushCapture()
+{
+	if ( capture_length == 0 )
+		return !capture_failed;
+
+	if ( !capture_failed ) {
+		uint32_t start = CURRENT_MICROS();
+		if ( fat_write_file(file, file_buffer.data, capture_length) == (intptr_t)capture_length )
+			capturedBytes += capture_length;
+		else {
+			capture_failed = true;
+			sdAvailable = sd_raw_available() ? SD_ERR_GENERIC : SD_ERR_NO_CARD_PRESENT;
+		}
+		captureMicros += CURRENT_MICROS() - start;
+	}
+	capture_length = 0;
+	return !capture_failed;
+}
+
+// Stage bytes for the capture file, writing them out a buffer at a time
+
+static bool stageCapture(const volatile uint8_t* data, uint8_t len)
+{
+	if ( file == 0 || !capturing || capture_failed )
+		return false;
+	while ( len > 0 ) {
+		uint16_t room = FILE_BUFFER_SIZE - capture_length;
+		uint8_t n = ( room < len ) ? (uint8_t)room : len;
+		// Casting away volatile is OK in this instance; we know where the
+		// data is located and that nothing else writes it while we copy
+		memcpy(file_buffer.data + capture_length, (const uint8_t*)data, n);
+		capture_length += n;
+		data += n;
+		len -= n;
+		if ( capture_length == FILE_BUFFER_SIZE && !flushCapture() )
+			return false;
+	}
+	return !capture_failed;
+}
+
+void capturePacket(const Packet& packet, uint8_t offset)
 {
-	if (file == 0) return;
-	// Casting away volatile is OK in this instance; we know where the
-	// data is located and that fat_write_file isn't caching
-	fat_write_file(file, (uint8_t*)packet.getData(), packet.getLength());
-	capturedBytes += packet.getLength();
+	stageCapture(packet.getData() + offset, packet.getLength() - offset);
 }
 
 #ifdef EEPROM_MENU_ENABLE
 
 /// Writes b to the open file
 bool writeByte(uint8_t b) {
-    return ( (intptr_t)1 == fat_write_file(file, (uint8_t *)&b, (uintptr_t)1) );
+    return stageCapture(&b, 1);
 }
 
 #endif
@@ -350,26 +594,36 @@ bool writeByte(uint8_t b) {
 uint32_t finishCapture()
 {
 	if ( capturing ) {
+		flushCapture();
 		finishFile();
 		capturing = false;
 	}
 	return capturedBytes;
 }
 
-static uint8_t next_byte;
-static bool has_more = false;
+uint32_t getCaptureRate()
+{
+	uint32_t millis = captureMicros / 1000L;
+	if ( millis == 0 )
+		return 0L;
+	// Split the division so that capturedBytes * 1000 cannot overflow
+	return (capturedBytes / millis) * 1000L + ((capturedBytes % millis) * 1000L) / millis;
+}
 
-void fetchNextByte() {
+static void fillPlaybackBuffer() {
 
     // BE WARNED: fat_read_file() only returns an error on the first
     //   call which encounters the error.  The next call after the error
     //   return will merely return 0 (no bytes read).
 
-    int16_t read = fat_read_file(file, &next_byte, 1);
-    playedBytes++;
-    if ( read > 0 )
+    int16_t read = fat_read_file(file, file_buffer.data, FILE_BUFFER_SIZE);
+    playback_index = 0;
+    if ( read > 0 ) {
+	playback_length = (uint16_t)read;
 	return;
+    }
     else {
+	playback_length = 0;
 	has_more = false;
 	if ( read < 0 ) {
 	    if ( !sd_raw_available() )
@@ -385,12 +639,32 @@ bool playbackHasNext() {
 }
 
 uint8_t playbackNext() {
-    uint8_t rv = next_byte;
-    fetchNextByte();
+    if ( !has_more ) return 0;
+    uint8_t rv = file_buffer.data[playback_index++];
+    playedBytes++;
+    // Refill as soon as the buffer empties so that has_more stays accurate
+    if ( playback_index >= playback_length )
+	fillPlaybackBuffer();
     return rv;
 }
 
-SdErrorCode startPlayback(char* filename) {
+uint8_t playbackRead(uint8_t* dst, uint8_t n) {
+    uint8_t count = 0;
+    while ( count < n && has_more ) {
+	uint16_t avail = playback_length - playback_index;
+	uint8_t len = ( avail < (uint16_t)(n - count) ) ? (uint8_t)avail : n - count;
+	memcpy(dst + count, file_buffer.data + playback_index, len);
+	playback_index += len;
+	count += len;
+	if ( playback_index >= playback_length )
+	    fillPlaybackBuffer();
+    }
+    playedBytes += count;
+    return count;
+}
+
+// Ready the card and the file buffer for a playback
+static SdErrorCode preparePlayback() {
 #ifndef BROKEN_SD
     if ( mustReinit ) {
 	SdErrorCode rsp = initCard();
@@ -403,9 +677,47 @@ SdErrorCode startPlayback(char* filename) {
 	return result;
 #endif
 
+    // The playback takes over the file buffer
+    finishCapture();
+    dirIndexed = false;
+
     capturedBytes = 0L;
+    captureMicros = 0L;
     playedBytes = 0L;
 
+    return SD_SUCCESS;
+}
+
+// Play the open file back from offset
+static SdErrorCode beginPlayback(int32_t offset) {
+    int32_t off = 0L;
+    fat_seek_file(file, &off, FAT_SEEK_END);
+    fileSizeBytes = off;
+    if ( offset > fileSizeBytes || !fat_seek_file(file, &offset, FAT_SEEK_SET) ) {
+	finishFile();
+	return SD_ERR_READ;
+    }
+    playedBytes = offset;
+
+    playing = true;
+
+#ifndef SIMULATOR
+    Motherboard::getBoard().resetCurrentSeconds();
+#endif
+    has_more = true;
+
+    // Playback reads the file sequentially, so have the card keep sending
+    // blocks rather than requesting each one
+    sd_raw_set_streaming(1);
+    fillPlaybackBuffer();
+    return SD_SUCCESS;
+}
+
+SdErrorCode startPlayback(char* filename) {
+    SdErrorCode rsp = preparePlayback();
+    if ( rsp != SD_SUCCESS )
+	return rsp;
+
     int8_t res = openFile(filename);
     if ( res == 0 )
 	return SD_ERR_FILE_NOT_FOUND;
@@ -413,18 +725,44 @@ SdErrorCode startPlayback(char* filename) {
 	// The file was a directory and we successfully moved into it
 	return SD_CWD;
 
-    playing = true;
+    return beginPlayback(0L);
+}
 
-    int32_t off = 0L;
-    fat_seek_file(file, &off, FAT_SEEK_END);
-    fileSizeBytes = off;
-    off = 0L;
-    fat_seek_file(file, &off, FAT_SEEK_SET);
+SdErrorCode startPlaybackAt(const char *filename, uint32_t dir, uint32_t cluster,
+			    uint32_t size, uint32_t offset) {
+    SdErrorCode rsp = preparePlayback();
+    if ( rsp != SD_SUCCESS )
+	return rsp;
 
-    Motherboard::getBoard().resetCurrentSeconds();
-    has_more = true;
-    fetchNextByte();
-    return SD_SUCCESS;
+    // Open the file's directory from its first cluster, as its entry in
+    // the parent directory would; cluster 0 is the root
+    struct fat_dir_entry_struct entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.cluster = dir;
+    entry.attributes = FAT_ATTRIB_DIR;
+    if ( changeWorkingDir(&entry) != SD_SUCCESS )
+	return SD_ERR_FILE_NOT_FOUND;
+
+    // A file of that name which has since been replaced or edited won't
+    // start at the same cluster or have the same size
+    if ( !findFileInDir(filename, &entry) || ( entry.attributes & FAT_ATTRIB_DIR ) ||
+	 entry.cluster != cluster || entry.file_size != size )
+	return SD_ERR_FILE_NOT_FOUND;
+
+    finishFile();
+    file = fat_open_file(fs, &entry);
+    if ( !file )
+	return SD_ERR_FILE_NOT_FOUND;
+    fileCluster = cluster;
+    fileDir = dir;
+
+    return beginPlayback((int32_t)offset);
+}
+
+void getPlaybackFile(uint32_t *dir, uint32_t *cluster, uint32_t *size) {
+    *dir = fileDir;
+    *cluster = fileCluster;
+    *size = (uint32_t)fileSizeBytes;
 }
 
 void playbackRestart() {
@@ -432,11 +770,13 @@ void playbackRestart() {
 	fat_seek_file(file, &offset, FAT_SEEK_SET);
 
 	capturedBytes = 0L;
+	captureMicros = 0L;
 	playedBytes = 0L;
 	playing = true;
 	has_more = true;
 
-	fetchNextByte();
+	sd_raw_set_streaming(1);
+	fillPlaybackBuffer();
 }
 
 float getPercentPlayed() {
@@ -450,6 +790,7 @@ float getPercentPlayed() {
 
 void finishPlayback() {
 	if ( !playing ) return;
+	sd_raw_set_streaming(0);
 	finishFile();
 	playing = false;
 	has_more = false;
@@ -475,6 +816,7 @@ void reset() {
 #ifndef BROKEN_SD
 	mustReinit = true;
 #endif
+	dirIndexed = false;
 	sdAvailable = SD_ERR_NO_CARD_PRESENT;
 }
 
@@ -68,6 +68,26 @@ namespace sdcard {
     void directoryNextEntry(char* buffer, uint8_t bufsize, bool *isDir = 0);
 
 
+    /// Index the current directory's entries for the LCD's file browser:
+    /// files and directories, other than hidden and dot files, and "..".
+    /// Afterwards directoryIndexEntry() reads any one entry without
+    /// reading the entries before it.  The index shares the playback and
+    /// capture buffer, so while either runs the entries are only counted.
+    /// \param[in] sort True to order the entries by name rather than
+    ///  directory order, which costs more card reads here but none later
+    /// \return The number of entries, at most 255
+    uint8_t directoryIndex(bool sort);
+
+
+    /// Get the name of an entry indexed by directoryIndex().
+    /// \param[in] index Entry number, from 0
+    /// \param[in] buffer Character buffer to store name in
+    /// \param[in] bufsize Size of buffer
+    /// \param[out] isDir Set to whether the entry is a directory
+    /// \return True if the entry was read
+    bool directoryIndexEntry(uint8_t index, char* buffer, uint8_t bufsize, bool *isDir);
+
+
     /// Begin capturing bufffered commands to a new file with the given filename.
     /// Returns an SD card error/success code.
     /// \param[in] filename Name of file to write to
@@ -75,9 +95,11 @@ namespace sdcard {
     SdErrorCode startCapture(char* filename);
 
 
-    /// Capture the contents of a packet to the currently open file.
+    /// Capture the contents of a packet to the currently open file.  The
+    /// data is staged in RAM and written to the card a sector at a time.
     /// \param[in] packet Packet to write to file.
-    void capturePacket(const Packet& packet);
+    /// \param[in] offset Index of the first byte of the packet to write.
+    void capturePacket(const Packet& packet, uint8_t offset = 0);
 
 #ifdef EEPROM_MENU_ENABLE
     /// Writes b to the open file
@@ -85,10 +107,17 @@ namespace sdcard {
 #endif
 
     /// Complete the capture, and flush buffers.  Return the number of bytes
-    /// written to the card.
+    /// written to the card.  After a write error, nothing more is written
+    /// and the bytes written before the error are returned.
     /// \return Number of bytes written to the card.
     uint32_t finishCapture();
 
+    /// Return the rate at which the current or last capture was written to
+    /// the card, counting only the time spent writing.
+    /// \return Bytes written per second, or 0 if nothing has been written
+    ///  since the last capture or playback started.
+    uint32_t getCaptureRate();
+
 
     /// Check whether a job is being captured to SD card
     /// \return True if we're capturing buffered commands to a file, false otherwise
@@ -102,6 +131,27 @@ namespace sdcard {
     SdErrorCode startPlayback(char* filename);
 
 
+    /// Begin playing back commands part way through a file, as when a build
+    /// is resumed.  The file is looked up by name in its directory, which
+    /// becomes the working directory, and must still have the first cluster
+    /// and size returned by getPlaybackFile(); otherwise it's not the file
+    /// that was played back then.
+    /// \param[in] filename Name of the file
+    /// \param[in] dir First cluster of its directory
+    /// \param[in] cluster First cluster of the file
+    /// \param[in] size Size of the file in bytes
+    /// \param[in] offset Offset to start playing back from
+    /// \return SD_SUCCESS if successful
+    SdErrorCode startPlaybackAt(const char *filename, uint32_t dir, uint32_t cluster,
+				uint32_t size, uint32_t offset);
+
+    /// Get where the file being played back is
+    /// \param[out] dir First cluster of its directory, 0 for the root
+    /// \param[out] cluster First cluster of the file
+    /// \param[out] size Size of the file in bytes
+    void getPlaybackFile(uint32_t *dir, uint32_t *cluster, uint32_t *size);
+
+
     /// Return the percentage of the file printed.
     float getPercentPlayed();
 
@@ -114,6 +164,14 @@ namespace sdcard {
     /// \return The next byre in the file.
     uint8_t playbackNext();
 
+    /// Copy up to n bytes from the currently open file into dst.  Fewer
+    /// bytes are copied only when the end of the file is reached or a
+    /// read error occurs, after which playbackHasNext() returns false.
+    /// \param[out] dst Buffer to copy the bytes into
+    /// \param[in] n Maximum number of bytes to copy
+    /// \return The number of bytes copied
+    uint8_t playbackRead(uint8_t* dst, uint8_t n);
+
     /// Rewinds a play back to the beginning
     void playbackRestart();
 
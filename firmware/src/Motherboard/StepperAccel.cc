@@ -27,6 +27,12 @@
 */
 
 
+#ifdef SIMULATOR
+	#include <math.h>
+	#include <string.h>
+	#include "Simulator.hh"
+#endif
+
 #include "Configuration.hh"
 #include "StepperAccel.hh"
 
@@ -36,7 +42,9 @@
 
 #include "Motherboard.hh"
 
-#include <avr/interrupt.h>
+#ifndef SIMULATOR
+	#include <avr/interrupt.h>
+#endif
 #include <string.h>
 #include <math.h>
 #include "StepperAxis.hh"
@@ -49,12 +57,14 @@ int16_t		extruder_deprime_steps[EXTRUDERS];	// Positive number of steps to prime
 float		extruder_only_max_feedrate[EXTRUDERS];
 
 #ifdef JKN_ADVANCE
-	enum AdvanceState {
-		ADVANCE_STATE_ACCEL = 0,
-		ADVANCE_STATE_PLATEAU,
-		ADVANCE_STATE_DECEL
-	};
-	static enum AdvanceState	advance_state;
+	#ifndef STEP_SEGMENT_BUFFER
+		enum AdvanceState {
+			ADVANCE_STATE_ACCEL = 0,
+			ADVANCE_STATE_PLATEAU,
+			ADVANCE_STATE_DECEL
+		};
+		static enum AdvanceState	advance_state;
+	#endif
 	static int32_t			advance_pressure_relax_accumulator;
 	#ifdef JKN_ADVANCE_LEAD_DE_PRIME
 		static int16_t		lastAdvanceDeprime[EXTRUDERS];
@@ -68,12 +78,67 @@ float		extruder_only_max_feedrate[EXTRUDERS];
 #endif
 
 static unsigned char		out_bits;		// The next stepping-bits to be output
-volatile static uint32_t	step_events_completed;	// The number of step events executed in the current block
-
-static int32_t		acceleration_time, deceleration_time;
-static uint16_t		acc_step_rate, step_rate;
-static char		step_loops, step_loops_nominal;
-static uint16_t		OCRnA_nominal;
+static char		step_loops;
+
+#ifdef STEP_SEGMENT_BUFFER
+	// The main loop (st_prep_buffer) slices the blocks into short segments, each at a constant
+	// step rate, and the stepper interrupt only has to step the dda's and load the next segment.
+	// The length of a segment in 2MHz timer ticks.  Segments in the nominal (cruise) phase are
+	// 4 times longer, as the rate doesn't change.
+	#define STEP_SEGMENT_TICKS	5000	// 2.5ms
+
+	#define SEGMENT_BLOCK_START	0x01	// First segment of a block, the interrupt sets up the block
+	#define SEGMENT_BLOCK_END	0x02	// Last segment of a block, the interrupt discards the block after it
+	#define SEGMENT_ACCEL		0x04	// Segment is in the acceleration phase
+	#define SEGMENT_DECEL		0x08	// Segment is in the deceleration phase
+	#define SEGMENT_RELAX_RESET	0x10	// First deceleration segment, resets the advance pressure relax
+
+	typedef struct {
+		uint16_t	step_events;		// The number of step events in this segment
+		uint16_t	timer;			// STEPPER_OCRnA for the segment
+		uint8_t		step_loops;		// Step events per interrupt
+		uint8_t		flags;
+	} st_segment_t;
+
+	static st_segment_t		segment_buffer[STEP_SEGMENT_BUFFER];
+	static volatile uint8_t		segment_buffer_head;	// Written by st_prep_buffer only
+	static volatile uint8_t		segment_buffer_tail;	// Written by the stepper interrupt / quickStop only
+	static st_segment_t		*current_segment;	// The segment being executed by the interrupt
+	static uint16_t			segment_steps_remaining;
+
+	// Slicing state, used by st_prep_buffer in the main loop, or by the stepper interrupt when
+	// the segments have run out and the main loop isn't slicing
+	static volatile bool		prep_reset;		// Set by quickStop, the block being sliced has gone
+	static volatile bool		prep_active;		// st_prep_buffer is slicing in the main loop
+	static block_t			*prep_block;		// The block being sliced, NULL if none
+	static uint8_t			prep_block_index;	// Index of the block being / next to be sliced
+	static uint32_t			prep_step_events;	// Step events of prep_block sliced so far
+	static uint32_t			prep_acceleration_time, prep_deceleration_time;
+	static uint16_t			prep_acc_step_rate;
+	static uint8_t			prep_flags;
+
+	// S-curve acceleration.  The planner's trapezoid is kept, but each ramp of it is followed with
+	// the acceleration rising and falling linearly (constant jerk) over the first and last
+	// scurve_percent of the ramp's time.  The ramp takes the same time and the same number of steps
+	// as the trapezoid's, at a peak acceleration 100 / (100 - scurve_percent) times higher.  The
+	// planner's accelerations are lowered to match (steppers::setSCurvePercent), so the peak is at
+	// most the max. acceleration.
+	uint8_t				scurve_percent;
+	static uint16_t			prep_scurve_start_rate;
+	static uint16_t			prep_scurve_delta_rate;	// Change in rate over the ramp being followed, 0 for trapezoids
+	static bool			prep_scurve_rising;
+	static uint8_t			prep_scurve_percent;	// scurve_percent that the constants below are for
+	static FPTYPE			prep_scurve_jerk;	// scurve_percent / 100
+	static FPTYPE			prep_scurve_k;		// 1 / 2p(1-p)
+	static FPTYPE			prep_scurve_linear;	// 1 / (1-p)
+#else
+	volatile static uint32_t	step_events_completed;	// The number of step events executed in the current block
+
+	static int32_t		acceleration_time, deceleration_time;
+	static uint16_t		acc_step_rate, step_rate;
+	static char		step_loops_nominal;
+	static uint16_t		OCRnA_nominal;
+#endif
 
 static bool		deprimed[EXTRUDERS];
 
@@ -85,11 +150,18 @@ static uint8_t		last_active_toolhead = 0;
 	uint16_t debugTimer;
 #endif
 
+#if defined(ISR_PROFILING) && ! defined(SIMULATOR)
+	isr_profile_t	isr_profile[PROFILE_SITES];
+	uint32_t	isr_profile_overruns;
+#endif
+
 #ifdef OVERSAMPLED_DDA
 	uint8_t oversampledCount = 0;
 #endif
 
 
+#ifndef SIMULATOR
+
 // intRes = intIn1 * intIn2 >> 16
 // uses:
 // r26 to store 0
@@ -160,6 +232,39 @@ static uint8_t		last_active_toolhead = 0;
 		"r26" , "r27"				\
 	)
 
+#else
+
+// C versions of the above for the simulator, giving the same results as the assembler
+
+#define MultiU16X8toH16(intRes, charIn1, intIn2)	\
+	intRes = (uint16_t)(((uint32_t)(uint8_t)(charIn1) * (uint32_t)(uint16_t)(intIn2) + 0x80) >> 8)
+
+// The assembler only keeps the high byte of the partial products landing in byte 2 of the
+// 48 bit result, rounds on bit 0 of byte 2, and truncates the result to 16 bits
+FORCE_INLINE uint16_t multiU24X24toH16(uint32_t longIn1, uint32_t longIn2)
+{
+	uint8_t  a1 = longIn1, b1 = longIn1 >> 8, c1 = longIn1 >> 16;
+	uint8_t  a2 = longIn2, b2 = longIn2 >> 8, c2 = longIn2 >> 16;
+	uint16_t res, r27, t;
+
+	r27  = (uint16_t)(a1 * b2) >> 8;
+	res  = b1 * c2;
+	res += (uint16_t)(c1 * c2) << 8;
+	res += c1 * b2;
+
+	t = a1 * c2;	r27 += t & 0xFF;	res += (t >> 8) + (r27 >> 8);	r27 &= 0xFF;
+	t = b1 * b2;	r27 += t & 0xFF;	res += (t >> 8) + (r27 >> 8);	r27 &= 0xFF;
+	t = c1 * a2;	r27 += t & 0xFF;	res += (t >> 8) + (r27 >> 8);	r27 &= 0xFF;
+	t = b1 * a2;	r27 += t >> 8;		res += (r27 >> 8);		r27 &= 0xFF;
+
+	return res + (r27 & 0x01);
+}
+
+#define MultiU24X24toH16(intRes, longIn1, longIn2)	\
+	intRes = multiU24X24toH16(longIn1, longIn2)
+
+#endif
+
 // Some useful constants
 
 #define ENABLE_STEPPER_DRIVER_INTERRUPT()	STEPPER_TIMSKn |= (1<<STEPPER_OCIEnA)
@@ -196,7 +301,6 @@ struct lookup_table_entry {
 
 
 FORCE_INLINE uint16_t calc_timer(uint16_t step_rate) {
-	uint16_t timer;
 	uint8_t step_rate_high = SHIFT1(step_rate);
 
 	if (step_rate_high > SHIFT1(19968)) { // If steprate > 19.968 kHz >> step 8 times
@@ -219,10 +323,11 @@ FORCE_INLINE uint16_t calc_timer(uint16_t step_rate) {
 	}
 
 	#ifdef LOOKUP_TABLE_TIMER
+		uint16_t timer;
 		step_rate -= 32; // Correct for minimal speed
 
 		if(step_rate >= (8*256)) { // higher step rate 
-			uint16_t table_address		= (uint16_t)&speed_lookuptable_fast[(unsigned char)(step_rate>>8)][0];
+			const uint16_t *table_address	= &speed_lookuptable_fast[(unsigned char)(step_rate>>8)][0];
 			unsigned char tmp_step_rate	= (step_rate & 0x00ff);
 
 			struct lookup_table_entry	table_entry;
@@ -234,9 +339,7 @@ FORCE_INLINE uint16_t calc_timer(uint16_t step_rate) {
 
 			timer = table_entry.word_entry[0] - timer;
 		} else { // lower step rates
-			uint16_t table_address		= (uint16_t)&speed_lookuptable_slow[0][0];
-
-			table_address += ((step_rate)>>1) & 0xfffc;
+			const uint16_t *table_address	= &speed_lookuptable_slow[(unsigned char)(step_rate>>3)][0];
 
 			struct lookup_table_entry	table_entry;
 			table_entry.dword_entry		= (uint32_t)pgm_read_dword_near(table_address);
@@ -255,17 +358,38 @@ FORCE_INLINE uint16_t calc_timer(uint16_t step_rate) {
 
 
 
+// Called when a block ends.  Steps an endstop held back outside of homing are added to
+// dda_position, so the next block carries on from where the planner thinks the last one
+// finished, as it did when each block carried its starting position.  Homing doesn't get
+// here, quickStop syncs the planner to the position the endstop stopped at instead.
+
+FORCE_INLINE void resync_suppressed_steps() {
+	if ( ! dda_suppressed_axes )	return;
+
+	for ( uint8_t i = 0; i < STEPPER_COUNT; i ++ ) {
+		dda_position[i] += dda_steps_suppressed[i];
+		dda_steps_suppressed[i] = 0;
+	}
+	dda_suppressed_axes = 0;
+}
+
+
+
 // Sets up the next block from the buffer
 
 FORCE_INLINE void setup_next_block() {
-	//DEBUG_TIMER_START;
+	ISR_PROFILE_START(profile_start);
 
+	// Blocks usually start where the previous one finished, so dda_position carries on.
+	// When "definePosition" in Steppers.cc was called with blocks in the plan, the new position
+	// is queued in the planner and this block is flagged to start there.  This keeps
+	// definePosition asynchronous without storing a starting position in every block.
 	// Using this instead of memcpy saves 64 cycles
-	// starting_position is needed so that "definePosition" in Steppers.cc doesn't require a buffer drain before
-	// setting the position.  By including the starting_position in the block, we can make definePosition
-	// asynchronous
-	for ( uint8_t i = 0; i < STEPPER_COUNT; i ++ ) {
-		dda_position[i] = current_block->starting_position[i];
+	if ( current_block->position_defined ) {
+		int32_t *starting_position = plan_take_defined_position();
+		for ( uint8_t i = 0; i < STEPPER_COUNT; i ++ ) {
+			dda_position[i] = starting_position[i];
+		}
 	}
 
 	last_active_toolhead = current_block->active_toolhead;
@@ -294,23 +418,26 @@ FORCE_INLINE void setup_next_block() {
 		}
 	#endif
 
-	deceleration_time = 0;
-
-	OCRnA_nominal = calc_timer(current_block->nominal_rate);
-	step_loops_nominal = step_loops;
-  
-	if ( current_block->use_accel ) {
-		// step_rate to timer interval
-		acc_step_rate = current_block->initial_rate;
-		acceleration_time = calc_timer(acc_step_rate);
-		#ifdef OVERSAMPLED_DDA
-			STEPPER_OCRnA = acceleration_time >> OVERSAMPLED_DDA;
-		#else
-			STEPPER_OCRnA = acceleration_time;
-		#endif
-	} else {
-		STEPPER_OCRnA = OCRnA_nominal;
-	}
+	#ifndef STEP_SEGMENT_BUFFER
+		// With the segment buffer, the step rates have already been calculated by st_prep_buffer
+		deceleration_time = 0;
+
+		OCRnA_nominal = calc_timer(current_block->nominal_rate);
+		step_loops_nominal = step_loops;
+	  
+		if ( current_block->use_accel ) {
+			// step_rate to timer interval
+			acc_step_rate = current_block->initial_rate;
+			acceleration_time = calc_timer(acc_step_rate);
+			#ifdef OVERSAMPLED_DDA
+				STEPPER_OCRnA = acceleration_time >> OVERSAMPLED_DDA;
+			#else
+				STEPPER_OCRnA = acceleration_time;
+			#endif
+		} else {
+			STEPPER_OCRnA = OCRnA_nominal;
+		}
+	#endif
 
 	// Setup the next dda's and enabled axis
 	out_bits = current_block->direction_bits;
@@ -338,10 +465,17 @@ FORCE_INLINE void setup_next_block() {
 				(out_bits & (1 << B_AXIS)), current_block->steps[B_AXIS]);
 #endif
 
-	#ifdef JKN_ADVANCE
-		advance_state = ADVANCE_STATE_ACCEL;
+	#ifdef BATCHED_STEP_PORTS
+		// The direction pins are set once per block, rather than on every step
+		stepperAxisSetDirections();
+	#endif
+
+	#ifndef STEP_SEGMENT_BUFFER
+		#ifdef JKN_ADVANCE
+			advance_state = ADVANCE_STATE_ACCEL;
+		#endif
+		step_events_completed = 0;
 	#endif
-	step_events_completed = 0;
 
 	#ifdef DEBUG_BLOCK_BY_MOVE_INDEX
 		if ( current_block->move_index == 4 ) {
@@ -350,12 +484,411 @@ FORCE_INLINE void setup_next_block() {
 		}
 	#endif
 
-	//DEBUG_TIMER_FINISH;
-	//debug_onscreen1 = DEBUG_TIMER_TCTIMER_CYCLES;
+	ISR_PROFILE_END(PROFILE_SETUP_NEXT_BLOCK, profile_start);
+}
+
+
+
+#ifdef STEP_SEGMENT_BUFFER
+
+// Sets up an S-curve ramp from start_rate to end_rate, at the block's acceleration on average
+// and at most 100 / (100 - scurve_percent) times it.
+// If S-curves are disabled, or there's no ramp, the trapezoid is followed instead.
+
+static void prep_scurve_setup(block_t *block, uint16_t start_rate, uint16_t end_rate) {
+	prep_scurve_start_rate	= start_rate;
+	prep_scurve_rising	= end_rate > start_rate;
+	prep_scurve_delta_rate	= ( prep_scurve_rising ) ? end_rate - start_rate : start_rate - end_rate;
+
+	// prep_scurve_rate halves the change in rate, so it must be at least 2
+	if ( scurve_percent == 0 || prep_scurve_delta_rate < 2 || block->acceleration_rate == 0 ) {
+		prep_scurve_delta_rate = 0;
+		return;
+	}
+
+	if ( prep_scurve_percent != scurve_percent ) {
+		prep_scurve_percent	= scurve_percent;
+		prep_scurve_jerk	= FPDIV_TABLE(ITOFP((int32_t)scurve_percent), KCONSTANT_100);
+		prep_scurve_k		= FPDIV_TABLE(KCONSTANT_0_5, FPMULT2(prep_scurve_jerk, KCONSTANT_1 - prep_scurve_jerk));
+		prep_scurve_linear	= FPDIV_TABLE(KCONSTANT_1, KCONSTANT_1 - prep_scurve_jerk);
+	}
+}
+
+
+
+// The step rate of the S-curve ramp, time ticks into it.  With u the fraction of the ramp's
+// time and p the jerk fraction, the normalized rate is u^2 / 2p(1-p) in the rising jerk phase,
+// (u - p/2) / (1-p) in the constant acceleration phase and 1 - (1-u)^2 / 2p(1-p) in the falling
+// jerk phase.
+//
+// The ramp takes as long as the trapezoid's, so u is the change in rate the trapezoid would
+// have made by now over the ramp's change in rate.  The rates are halved to fit in FPTYPE.
+
+static uint16_t prep_scurve_rate(block_t *block, uint32_t time) {
+	uint16_t linear;
+	MultiU24X24toH16(linear, time, block->acceleration_rate);
+
+	uint16_t change;
+	if ( linear >= prep_scurve_delta_rate )	change = prep_scurve_delta_rate;
+	else {
+		FPTYPE u = FPDIV_TABLE(ITOFP((int32_t)(linear >> 1)), ITOFP((int32_t)(prep_scurve_delta_rate >> 1)));
+		FPTYPE f;
+
+		if ( u < prep_scurve_jerk )				f = FPMULT3(u, u, prep_scurve_k);
+		else if ( u > KCONSTANT_1 - prep_scurve_jerk ) {
+			FPTYPE v = KCONSTANT_1 - u;
+			f = KCONSTANT_1 - FPMULT3(v, v, prep_scurve_k);
+		}
+		else	f = FPMULT2(u - FPSHR(prep_scurve_jerk, 1), prep_scurve_linear);
+
+		change = (uint16_t)FPTOI(FPMULT2(ITOFP((int32_t)(prep_scurve_delta_rate >> 1)), f) + KCONSTANT_0_5) << 1;
+		if ( change > prep_scurve_delta_rate )	change = prep_scurve_delta_rate;
+	}
+
+	return ( prep_scurve_rising ) ? prep_scurve_start_rate + change : prep_scurve_start_rate - change;
+}
+
+
+
+// The rate at the end of the block's acceleration, where the S-curve up to it ends.  That's
+// the nominal rate if the block cruises, otherwise v^2 = u^2 + 2as.  Rates are below 46341
+// steps/s (calculate_trapezoid_for_block), so v^2 fits in 32 bits.  For the square root it's
+// scaled down by 4^n to fit in FPTYPE, and the root scaled up by 2^n, the last doubling after
+// converting back to an integer as the rate needn't fit in FPTYPE.
+
+static uint16_t prep_accelerated_rate(block_t *block) {
+	if ( block->decelerate_after > block->accelerate_until )	return block->nominal_rate;
+
+	uint32_t v2 = (uint32_t)block->initial_rate * block->initial_rate +
+		      (((uint32_t)block->acceleration_st * (uint32_t)block->accelerate_until) << 1);
+	if ( v2 >= (uint32_t)block->nominal_rate * block->nominal_rate )	return block->nominal_rate;
+
+	uint8_t n = 0;
+	while ( v2 > 0x7fff ) {
+		v2 >>= 2;
+		n ++;
+	}
+
+	FPTYPE root = FPSQRT_TABLE(ITOFP((int32_t)v2));
+	if ( n == 0 )	return (uint16_t)FPTOI(root);
+	return (uint16_t)FPTOI(FPSHL(root, n - 1)) << 1;
 }
 
 
 
+// The step rate of the ramp the segment is in, offset ticks into the segment
+
+FORCE_INLINE uint16_t prep_ramp_rate(block_t *block, uint8_t flags, uint32_t offset) {
+	uint16_t rate;
+
+	if (( flags & (SEGMENT_ACCEL | SEGMENT_DECEL) ) && ( prep_scurve_delta_rate != 0 )) {
+		rate = prep_scurve_rate(block, (( flags & SEGMENT_ACCEL ) ? prep_acceleration_time : prep_deceleration_time) + offset);
+	}
+	else if ( flags & SEGMENT_ACCEL ) {
+		// block->acceleration_rate is prescaled by 8.388608 (2^24 / 2MHz), so that
+		// time in timer ticks * acceleration_rate >> 24 is the change in step rate
+		MultiU24X24toH16(rate, prep_acceleration_time + offset, block->acceleration_rate);
+		rate += block->initial_rate;
+		if ( rate > block->nominal_rate )	rate = block->nominal_rate;
+	}
+	else if ( flags & SEGMENT_DECEL ) {
+		uint16_t rate_decrease;
+		MultiU24X24toH16(rate_decrease, prep_deceleration_time + offset, block->acceleration_rate);
+
+		if ( rate_decrease > prep_acc_step_rate ) {	// Check step rate stays positive
+			rate = block->final_rate;
+		} else {
+			rate = prep_acc_step_rate - rate_decrease;	// Decelerate from acceleration end point
+			if ( rate < block->final_rate )	rate = block->final_rate;
+		}
+	}
+	else	rate = block->nominal_rate;
+
+	return rate;
+}
+
+
+
+// Slices the next segment into segment_buffer[segment_buffer_head], next_head being the index
+// after it.  Returns false if there's nothing to slice.  A new block is only started when
+// take_block is true.
+//
+// Within a segment the step rate is constant, in the acceleration and deceleration phases
+// it's the rate halfway through the segment.  The time of the acceleration / deceleration
+// is accumulated from the timer values as the interrupt would have done, so the rates
+// follow the same ramps as when they're calculated in the interrupt.
+//
+// With S-curves, the ramps are followed as set up by prep_scurve_setup at the start of the
+// acceleration and deceleration phases.
+//
+// Once a block is being sliced, it's trapezoid can't change.  It's marked busy to stop
+// calculate_trapezoid_for_block altering it, and block_buffer_planned is moved past it
+// so the planner leaves the entry speed of the following block alone too.
+
+static bool prep_segment(uint8_t next_head, bool take_block) {
+	if ( prep_reset ) {
+		prep_reset = false;
+		prep_block = NULL;
+		prep_block_index = block_buffer_tail;
+	}
+
+	if ( prep_block == NULL ) {
+		if (( ! take_block ) || ( prep_block_index == block_buffer_head ))	return false;	// Nothing to slice
+
+		prep_block = &block_buffer[prep_block_index];
+		prep_block->busy = true;
+
+		uint8_t tail	= block_buffer_tail;
+		uint8_t planned = (block_buffer_planned - tail) & (BLOCK_BUFFER_SIZE - 1);
+		if (( planned <= ((prep_block_index - tail) & (BLOCK_BUFFER_SIZE - 1)) ) ||
+		    ( planned >  ((block_buffer_head - tail) & (BLOCK_BUFFER_SIZE - 1)) ))
+			block_buffer_planned = (prep_block_index + 1) & (BLOCK_BUFFER_SIZE - 1);
+
+		prep_step_events	= 0;
+		prep_acceleration_time	= 0;
+		prep_deceleration_time	= 0;
+		prep_acc_step_rate	= prep_block->initial_rate;
+		prep_flags		= SEGMENT_BLOCK_START;
+
+		if ( prep_block->use_accel && prep_block->accelerate_until > 0 )
+			prep_scurve_setup(prep_block, prep_block->initial_rate, prep_accelerated_rate(prep_block));
+		else	prep_scurve_delta_rate = 0;
+	}
+
+	block_t		*block		= prep_block;
+	uint8_t		flags		= prep_flags;
+	uint16_t	segment_ticks	= STEP_SEGMENT_TICKS;
+	uint32_t	phase_end;
+
+	if ( block->use_accel && prep_step_events < (uint32_t)block->accelerate_until ) {
+		phase_end = block->accelerate_until;
+		flags |= SEGMENT_ACCEL;
+	}
+	else if ( block->use_accel && prep_step_events >= (uint32_t)block->decelerate_after ) {
+		phase_end = block->step_event_count;
+		if ( prep_deceleration_time == 0 ) {
+			flags |= SEGMENT_RELAX_RESET;
+			prep_scurve_setup(block, prep_acc_step_rate, block->final_rate);
+		}
+		flags |= SEGMENT_DECEL;
+	} else {
+		phase_end = ( block->use_accel ) ? (uint32_t)block->decelerate_after : block->step_event_count;
+		segment_ticks = STEP_SEGMENT_TICKS << 2;
+	}
+	if ( phase_end > block->step_event_count )	phase_end = block->step_event_count;
+
+	// The rate is taken halfway through the segment.  At low rates a single step can
+	// take longer than a segment, then it's taken halfway through that step instead.
+	uint16_t timer = calc_timer(prep_ramp_rate(block, flags, STEP_SEGMENT_TICKS >> 1));
+	if (( timer > STEP_SEGMENT_TICKS ) && ( flags & (SEGMENT_ACCEL | SEGMENT_DECEL) ))
+		timer = calc_timer(prep_ramp_rate(block, flags, timer >> 1));
+
+	// Whole interrupts that fit in the segment, at least 1, without going past the end of the phase
+	uint16_t interrupts	= segment_ticks / timer;
+	if ( interrupts == 0 )	interrupts = 1;
+
+	uint32_t step_events	= (uint32_t)interrupts * step_loops;
+	if ( step_events > phase_end - prep_step_events ) {
+		step_events = phase_end - prep_step_events;
+		interrupts  = (uint16_t)((step_events + step_loops - 1) / step_loops);
+	}
+
+	if	( flags & SEGMENT_ACCEL ) {
+		prep_acceleration_time += (uint32_t)interrupts * timer;
+		prep_acc_step_rate = prep_ramp_rate(block, SEGMENT_ACCEL, 0);
+	}
+	else if ( flags & SEGMENT_DECEL )	prep_deceleration_time += (uint32_t)interrupts * timer;
+
+	prep_step_events += step_events;
+	prep_flags = 0;
+	if ( prep_step_events >= block->step_event_count ) {
+		flags |= SEGMENT_BLOCK_END;
+		prep_block = NULL;
+		prep_block_index = (prep_block_index + 1) & (BLOCK_BUFFER_SIZE - 1);
+	}
+
+	st_segment_t *segment = &segment_buffer[segment_buffer_head];
+	segment->step_events	= (uint16_t)step_events;
+	#ifdef OVERSAMPLED_DDA
+		segment->timer	= timer >> OVERSAMPLED_DDA;
+	#else
+		segment->timer	= timer;
+	#endif
+	segment->step_loops	= step_loops;
+	segment->flags		= flags;
+
+	// If quickStop ran whilst we were slicing, the block has been discarded, so the segment is dropped
+	CRITICAL_SECTION_START;
+		if ( ! prep_reset )	segment_buffer_head = next_head;
+	CRITICAL_SECTION_END;
+
+	return true;
+}
+
+
+
+// Slices the blocks in the planner into segments for the stepper interrupt, until the
+// segment buffer is full or there's nothing left to slice.  Called from the main loop.
+
+void st_prep_buffer() {
+	uint8_t next_head;
+
+	prep_active = true;
+	while ( (next_head = ((segment_buffer_head + 1) & (STEP_SEGMENT_BUFFER - 1))) != segment_buffer_tail ) {
+		if ( ! prep_segment(next_head, true) )	break;
+	}
+	prep_active = false;
+}
+
+
+
+// "The Stepper Driver Interrupt" - This timer interrupt is the workhorse.  
+// It pops segments from the segment buffer and executes them by pulsing the stepper pins appropriately.
+// Blocks are set up on their first segment and discarded after their last.
+// Returns true if we deleted an item in the pipeline buffer 
+
+bool st_interrupt() {    
+	bool block_deleted = false;
+
+	#ifdef OVERSAMPLED_DDA
+		if ( current_segment != NULL ) {
+			oversampledCount ++;
+
+			if ( oversampledCount < (1 << OVERSAMPLED_DDA) ) {
+				//Step the dda for each axis
+				stepperAxis_dda_step_all();
+
+				return block_deleted;
+			}
+		}
+	#endif
+
+	// If there is no current segment, attempt to pop one from the buffer
+	if ( current_segment == NULL ) {
+		// The main loop has been held up for longer than the buffered segments last (SD card,
+		// LCD, EEPROM writes, talking to the tools), so slice the next segment here rather than
+		// stopping the axes mid move.  A new block isn't started whilst plan_buffer_line is
+		// replanning, as it's trapezoid and the entry speed of the block after it can still change.
+		if (( segment_buffer_head == segment_buffer_tail ) && ( ! prep_active ))
+			prep_segment((segment_buffer_head + 1) & (STEP_SEGMENT_BUFFER - 1), ! planner_busy);
+
+		if ( segment_buffer_head != segment_buffer_tail ) {
+			current_segment = &segment_buffer[segment_buffer_tail];
+			segment_steps_remaining = current_segment->step_events;
+
+			if ( current_segment->flags & SEGMENT_BLOCK_START ) {
+				current_block = plan_get_current_block();
+				setup_next_block();
+			}
+
+			#ifdef JKN_ADVANCE
+				if ( current_segment->flags & SEGMENT_RELAX_RESET )	advance_pressure_relax_accumulator = 0;
+			#endif
+		} else {
+			STEPPER_OCRnA=2000; // 1kHz.
+
+			// Buffer is empty, because enabling/disabling axes doesn't require a block to be 
+			// present, we better set the hardware to match the last enable/disable in software
+			// The segments can also run out between blocks if the main loop hasn't sliced the next
+			// block yet, that isn't idle, so the plan must be empty too.
+			// If we're running JKN_ADVANCE, the e_steps are on a seperate interrupt so we need to wait for those to be
+			// empty too
+			if (( current_block == NULL ) && ( ! blocks_queued() )
+			#ifdef JKN_ADVANCE
+				&& ( e_steps[0] == 0 ) 
+				#if EXTRUDERS > 1
+				&& ( e_steps[1] == 0 )
+				#endif
+			#endif
+			   )
+			        stepperAxisSetHardwareEnabledToMatch(axesEnabled);
+		}
+	} 
+
+	#ifdef JKN_ADVANCE
+		// Nothing in the buffer or we have no e steps, deprime
+		if ( deprime_enabled ) {
+			bool plan_empty = ( current_block == NULL ) && ( ! blocks_queued() );
+			for ( uint8_t e = 0; e < EXTRUDERS; e ++ ) {
+			     if ( ( ! deprimed[e] ) && ( plan_empty || ( current_block != NULL && extruder_deprime_travel && (! (current_block->axesEnabled & _BV(A_AXIS + e))))) ) {
+					if ( extrude_when_negative[e] ) {
+						e_steps[e] += extruder_deprime_steps[e];
+						#ifdef JKN_ADVANCE_LEAD_DE_PRIME
+							e_steps[e] += lastAdvanceDeprime[e];
+						#endif
+					} else {
+						e_steps[e] -= extruder_deprime_steps[e];
+						#ifdef JKN_ADVANCE_LEAD_DE_PRIME
+							e_steps[e] -= lastAdvanceDeprime[e];
+						#endif
+					}
+
+					deprimed[e] = true;
+				}    
+			}
+		}
+	#endif
+
+	if ( current_segment != NULL ) {
+		STEPPER_OCRnA = current_segment->timer;
+
+		// Take multiple steps per interrupt (For high speed moves) 
+		for ( int8_t i = 0; i < (int8_t)current_segment->step_loops; i ++ ) {
+			#ifdef JKN_ADVANCE
+				if ( current_block->use_accel ) {
+					for ( uint8_t e = 0; e < EXTRUDERS; e ++ ) {
+						if ( current_segment->flags & SEGMENT_ACCEL ) {
+							stepperAxis_dda_shift_phase16(A_AXIS + e, current_block->advance_lead_entry);
+						}
+						if ( current_segment->flags & SEGMENT_DECEL ) {
+							stepperAxis_dda_shift_phase16(A_AXIS + e, - current_block->advance_lead_exit);
+							stepperAxis_dda_shift_phase32(A_AXIS + e, - advance_pressure_relax_accumulator >> 8);
+						}
+					}
+				}
+			#endif
+
+			//Step the dda for each axis
+			stepperAxis_dda_step_all();
+
+			#ifdef OVERSAMPLED_DDA
+				oversampledCount = 0;
+			#endif
+
+			if ( -- segment_steps_remaining == 0 )	break;
+		}
+
+		#ifdef JKN_ADVANCE
+			if ( current_segment->flags & SEGMENT_DECEL )
+				advance_pressure_relax_accumulator += current_block->advance_pressure_relax;
+		#endif
+
+		// If the segment is finished, move onto the next one, and if it was the last segment
+		// of the block, discard the block
+		if ( segment_steps_remaining == 0 ) {
+			if ( current_segment->flags & SEGMENT_BLOCK_END ) {
+				#ifdef JKN_ADVANCE_LEAD_DE_PRIME
+					for ( uint8_t e = 0; e < EXTRUDERS; e ++ ) {	
+						lastAdvanceDeprime[e] = current_block->advance_lead_deprime;
+					}
+				#endif
+
+				resync_suppressed_steps();
+				current_block = NULL;
+				plan_discard_current_block();
+				block_deleted = true;
+			}
+
+			current_segment = NULL;
+			segment_buffer_tail = (segment_buffer_tail + 1) & (STEP_SEGMENT_BUFFER - 1);
+		}
+	}
+
+	return block_deleted;
+}
+
+#else
+
 // "The Stepper Driver Interrupt" - This timer interrupt is the workhorse.  
 // It pops blocks from the block_buffer and executes them by pulsing the stepper pins appropriately.
 // Returns true if we deleted an item in the pipeline buffer 
@@ -370,13 +903,7 @@ bool st_interrupt() {
 
 			if ( oversampledCount < (1 << OVERSAMPLED_DDA) ) {
 				//Step the dda for each axis
-				stepperAxis_dda_step(X_AXIS);
-				stepperAxis_dda_step(Y_AXIS);
-				stepperAxis_dda_step(Z_AXIS);
-				stepperAxis_dda_step(A_AXIS);
-#if EXTRUDERS > 1
-				stepperAxis_dda_step(B_AXIS);
-#endif
+				stepperAxis_dda_step_all();
 
 				return block_deleted;
 			}
@@ -449,13 +976,7 @@ bool st_interrupt() {
 			#endif
       
 			//Step the dda for each axis
-			stepperAxis_dda_step(X_AXIS);
-			stepperAxis_dda_step(Y_AXIS);
-			stepperAxis_dda_step(Z_AXIS);
-			stepperAxis_dda_step(A_AXIS);
-			#if EXTRUDERS > 1
-			stepperAxis_dda_step(B_AXIS);
-			#endif
+			stepperAxis_dda_step_all();
 
 			#ifdef OVERSAMPLED_DDA
 				oversampledCount = 0;
@@ -557,6 +1078,7 @@ bool st_interrupt() {
 				}
 			#endif
 
+			resync_suppressed_steps();
 			current_block = NULL;
 			plan_discard_current_block();
 			block_deleted = true;
@@ -575,6 +1097,8 @@ bool st_interrupt() {
 	return block_deleted;
 }
 
+#endif // STEP_SEGMENT_BUFFER
+
 
 
 #ifdef JKN_ADVANCE
@@ -634,12 +1158,83 @@ void st_extruder_interrupt()
 
 
 
+#ifdef STEP_SEGMENT_BUFFER
+
+// Discards the segments waiting for the stepper interrupt, and has st_prep_buffer
+// restart slicing from the block at the tail of the planner
+
+static void st_discard_segments()
+{
+	CRITICAL_SECTION_START;
+		current_segment		= NULL;
+		segment_buffer_tail	= segment_buffer_head;
+		prep_reset		= true;
+	CRITICAL_SECTION_END;
+}
+
+#endif
+
+
+
+#if defined(ISR_PROFILING) && ! defined(SIMULATOR)
+
+// Starts timer 5 free running at the cpu clock and clears the profile counters
+
+static void st_isr_profile_reset()
+{
+	CRITICAL_SECTION_START;
+		TCCR5A = 0x00;
+		TCCR5B = 0x01;	// Normal mode, no prescaler = 16MHz
+		TCCR5C = 0x00;
+		TIMSK5 = 0x00;
+
+		for ( uint8_t i = 0; i < PROFILE_SITES; i ++ ) {
+			isr_profile[i].calls	= 0;
+			isr_profile[i].cycles	= 0;
+			isr_profile[i].samples	= 0;
+			isr_profile[i].min	= 0xFFFF;
+			isr_profile[i].max	= 0;
+		}
+		isr_profile_overruns = 0;
+	CRITICAL_SECTION_END;
+}
+
+#endif
+
+
+
+bool st_get_isr_profile(isr_profile_t *profile, uint32_t *overruns, bool reset)
+{
+#if defined(ISR_PROFILING) && ! defined(SIMULATOR)
+	CRITICAL_SECTION_START;
+		memcpy(profile, isr_profile, sizeof(isr_profile));
+		*overruns = isr_profile_overruns;
+	CRITICAL_SECTION_END;
+
+	if ( reset )	st_isr_profile_reset();
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+
+
 void st_init()
 {
+	#if defined(ISR_PROFILING) && ! defined(SIMULATOR)
+		st_isr_profile_reset();
+	#endif
+
 	#ifdef OVERSAMPLED_DDA
 		oversampledCount = 0;
 	#endif
 
+	#ifdef STEP_SEGMENT_BUFFER
+		st_discard_segments();
+	#endif
+
 	last_active_toolhead = 0;
 
 	#ifdef JKN_ADVANCE
@@ -725,8 +1320,17 @@ void quickStop()
 	DISABLE_STEPPER_DRIVER_INTERRUPT();
 
 		while(blocks_queued())	plan_discard_current_block();
+		plan_clear_defined_positions();
 
 		current_block = NULL;
+		#ifdef STEP_SEGMENT_BUFFER
+			st_discard_segments();
+		#endif
+
+		// The planner takes the position the steppers reached, so steps held back by an
+		// endstop are dropped rather than added back
+		for ( uint8_t i = 0; i < STEPPER_COUNT; i ++ )	dda_steps_suppressed[i] = 0;
+		dda_suppressed_axes = 0;
 
 		CRITICAL_SECTION_START;
 			planner_position[X_AXIS] = dda_position[X_AXIS];
@@ -28,6 +28,10 @@
 
 #include <inttypes.h>
 
+#ifndef SIMULATOR
+	#include <avr/io.h>	// Timer 5 for DEBUG_TIMER and ISR_PROFILING
+#endif
+
 #include "Motherboard.hh" // StepperAxis.hh needs EXTRUDERS def
 #include "StepperAxis.hh"
 #include "StepperAccelPlanner.hh"
@@ -44,8 +48,14 @@
 #define DEBUG_TIMER
 
 #if  defined(DEBUG_TIMER) && defined(TCCR5A)
-	#define DEBUG_TIMER_START TCCR5A = 0x00;TCCR5B=0x01;TCNT5 = 0
-	#define DEBUG_TIMER_FINISH debugTimer = TCNT5
+	#ifdef ISR_PROFILING
+		//Timer 5 is already free running for the profiler, so don't reset it
+		#define DEBUG_TIMER_START debugTimer = TCNT5
+		#define DEBUG_TIMER_FINISH debugTimer = TCNT5 - debugTimer
+	#else
+		#define DEBUG_TIMER_START TCCR5A = 0x00;TCCR5B=0x01;TCNT5 = 0
+		#define DEBUG_TIMER_FINISH debugTimer = TCNT5
+	#endif
 	#define DEBUG_TIMER_TCTIMER_CYCLES ((float)debugTimer)
 	#define DEBUG_TIMER_TCTIMER_US ((float)debugTimer / 16.0)	//16 = cpu frequency / 1000000
 	#define DEBUG_TIMER_TCTIMER_USI (debugTimer / 16)   		//16 = cpu frequency / 1000000
@@ -58,13 +68,73 @@
 	#define DEBUG_TIMER_TCTIMER_USI 0
 #endif
 
+//Profiles the time taken by the interrupts and the planner, enabled with ISR_PROFILING in Configuration.hh.
+//Timer 5 is free running at the cpu clock, so each sample is in cycles and wraps at 65536 cycles (4ms).
+//plan_buffer_line runs in the main loop, so its samples include time spent in interrupts.
+//Example usage:
+//	ISR_PROFILE_START(start);
+//	**** DO SOMETHING ****
+//	ISR_PROFILE_END(PROFILE_SETUP_NEXT_BLOCK, start);
+
+enum {
+	PROFILE_ST_INTERRUPT = 0,
+	PROFILE_ST_EXTRUDER_INTERRUPT,
+	PROFILE_SETUP_NEXT_BLOCK,
+	PROFILE_PLAN_BUFFER_LINE,
+	PROFILE_SITES
+};
+
+typedef struct {
+	uint32_t calls;		// Number of samples since the counters were reset
+	uint32_t cycles;	// Sum of the last "samples" samples, halved with samples to avoid overflow
+	uint16_t samples;
+	uint16_t min;
+	uint16_t max;
+} isr_profile_t;
+
+#if defined(ISR_PROFILING) && ! defined(SIMULATOR)
+	#ifndef TCCR5A
+		#error "ISR_PROFILING requires Timer 5"
+	#endif
+
+	extern isr_profile_t	isr_profile[PROFILE_SITES];
+	extern uint32_t		isr_profile_overruns;
+
+	FORCE_INLINE void isr_profile_record(uint8_t site, uint16_t start) {
+		uint16_t cycles = TCNT5 - start;
+		isr_profile_t *p = &isr_profile[site];
+
+		p->calls ++;
+		if ( p->samples & 0x8000 ) {
+			p->samples >>= 1;
+			p->cycles >>= 1;
+		}
+		p->samples ++;
+		p->cycles += cycles;
+		if ( cycles < p->min )	p->min = cycles;
+		if ( cycles > p->max )	p->max = cycles;
+	}
+
+	#define ISR_PROFILE_START(var)		uint16_t var = TCNT5
+	#define ISR_PROFILE_END(site, var)	isr_profile_record(site, var)
+	#define ISR_PROFILE_OVERRUN		isr_profile_overruns ++
+#else
+	#define ISR_PROFILE_START(var)
+	#define ISR_PROFILE_END(site, var)
+	#define ISR_PROFILE_OVERRUN
+#endif
+
+//Copies the profile counters and overrun count, optionally resetting them.
+//Returns false if ISR_PROFILING is not enabled.
+bool st_get_isr_profile(isr_profile_t *profile, uint32_t *overruns, bool reset);
 
 //If defined, the speed lookup table is used to calculate the timer
 //otherwise, the timer is calculated with a divide.
 
-// Don't use the lookup table when simulating -- simulator doesn't
-// bother to provide a pgm mem library emulator
-#ifndef SIMULATOR
+// Don't use the lookup table when simulating the planner alone; stepsim
+// uses it, with the <avr/pgmspace.h> from src/test, so its step timing is
+// quantized as the bot's is
+#if !defined(SIMULATOR) || defined(STEPSIM)
 	#define LOOKUP_TABLE_TIMER
 #endif
 
@@ -89,6 +159,13 @@ void st_get_position(int32_t *x, int32_t *y, int32_t *z, int32_t *a, int32_t *b,
 // Returns true if we deleted an item in the pipeline buffer
 bool st_interrupt();
 
+// Slices planned blocks into segments for st_interrupt, called from the main loop
+#ifdef STEP_SEGMENT_BUFFER
+	void st_prep_buffer();
+#else
+	FORCE_INLINE void st_prep_buffer() {}
+#endif
+
 void st_extruder_interrupt();
 
 void quickStop();
@@ -99,6 +176,9 @@ extern bool     extruder_deprime_travel;
 extern int16_t	extruder_deprime_steps[EXTRUDERS];
 extern bool	extrude_when_negative[EXTRUDERS];
 extern float	extruder_only_max_feedrate[EXTRUDERS];
+#ifdef STEP_SEGMENT_BUFFER
+	extern uint8_t	scurve_percent;		// S-curve jerk phase, % of each ramp, 0 for trapezoids
+#endif
 
 //Enables and disables deprime
 extern void st_deprime_enable(bool enable);
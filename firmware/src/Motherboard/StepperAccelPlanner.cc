@@ -67,6 +67,9 @@
 #include "StepperAccel.hh"
 #include "StepperAccelPlanner.hh"
 #include "Steppers.hh"
+#if defined(FIXED) && defined(RECIPROCAL_TABLES)
+	#include "StepperAccelReciprocalTable.hh"
+#endif
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
@@ -137,6 +140,25 @@ int32_t		planner_target[STEPPER_COUNT];
 static FPTYPE	prev_speed[STEPPER_COUNT];
 static FPTYPE   prev_nominal = 0;
 
+#ifdef ACCELERATION_JUNCTION_DEVIATION
+	FPTYPE		junction_deviation;				// mm, 0 to use max_speed_change
+	static FPTYPE	prev_unit_vec[3];				// X, Y and Z unit vector of the previous block
+	static FPTYPE	prev_nominal_speed;
+	static bool	prev_unit_vec_valid = false;
+#endif
+
+#ifdef ACCELERATION_COALESCE_ANGLE
+	// The junction state from before the last block was added, for plan_remove_last_block
+	static bool	last_block_removable = false;
+	static FPTYPE	last_prev_speed[STEPPER_COUNT];
+	static FPTYPE	last_prev_nominal;
+	#ifdef ACCELERATION_JUNCTION_DEVIATION
+		static FPTYPE	last_prev_unit_vec[3];
+		static FPTYPE	last_prev_nominal_speed;
+		static bool	last_prev_unit_vec_valid;
+	#endif
+#endif
+
 #ifdef SIMULATOR
 	static block_t	*sblock = NULL;
 #endif
@@ -194,10 +216,125 @@ bool		acceleration_zhold = false;
 
 #endif
 
+#if defined(FIXED) && defined(RECIPROCAL_TABLES)
+
+	// x / y without divk()'s 32 bit divide.  y is scaled by 2^e to a mantissa m
+	// in [1, 2), 1 / m is interpolated from reciprocal_table[], and then
+	// x / y = x * (1 / m) / 2^e.  Multiplying x by 1 / m in (0.5, 1] rather than by
+	// 1 / y keeps the precision x * (1 / y) would lose when y is large.
+	//
+	// Like divk(), the result is rounded towards zero.  Yet Another Jerk depends on
+	// that: prev_speed[i] = current_speed[i] * s must not exceed the max speed change
+	// that s was computed from, or the next block may see a speed change and stop.
+
+	FPTYPE fpdiv_table(FPTYPE x, FPTYPE y) {
+		bool negative = false;
+		if ( x < 0 ) {
+			x = -x;
+			negative = true;
+		}
+		if ( y < 0 ) {
+			y = -y;
+			negative = ! negative;
+		}
+		if ( y == 0 )	return negative ? -ACCUM_INFINITY : ACCUM_INFINITY;
+
+		// 0x10000 <= m < 0x20000.  Round m up if any bits are shifted out
+		uint32_t m = (uint32_t)y;
+		int8_t e = 0;
+		bool inexact = false;
+		while ( m >= 0x20000 ) {
+			if ( m & 1 )	inexact = true;
+			m >>= 1;
+			e++;
+		}
+		while ( m < 0x10000 ) {
+			m <<= 1;
+			e--;
+		}
+		if ( inexact && ( ++m == 0x20000 ) ) {
+			m = 0x10000;
+			e++;
+		}
+
+		// Table entries are 0x200 apart.  Round the interpolation down too
+		uint8_t i = (uint8_t)(m >> 9) & 0x7f;
+		uint16_t r0 = pgm_read_word_near(&reciprocal_table[i]);
+		uint16_t r1 = pgm_read_word_near(&reciprocal_table[i + 1]);
+		FPTYPE r = KCONSTANT_0_5 + r0 - (FPTYPE)(((uint32_t)(r0 - r1) * ((uint16_t)m & 0x1ff) + 0x1ff) >> 9);
+
+		// For small y, shift x up before multiplying rather than the quotient after,
+		// so that the low bits of the quotient aren't lost
+		while ( ( e < 0 ) && ( x < 0x40000000 ) ) {
+			x <<= 1;
+			e++;
+		}
+
+		FPTYPE q = mulk(x, r);
+		if ( e > 0 )	q >>= e;
+		else if ( e < 0 ) {
+			e = -e;
+			if ( q > (ACCUM_MAX >> e) )	q = ACCUM_MAX;
+			else				q <<= e;
+		}
+
+		return negative ? -q : q;
+	}
+
+	// sqrt(x) without sqrtk().  x is scaled by 4^k to a mantissa m in [1, 4),
+	// 1 / sqrt(m) is interpolated from inverse_sqrt_table[], and then
+	// sqrt(x) = m * (1 / sqrt(m)) * 2^k.
+
+	FPTYPE fpsqrt_table(FPTYPE x) {
+		if ( x <= 0 )	return 0;
+
+		// 0x10000 <= m < 0x40000
+		uint32_t m = (uint32_t)x;
+		int8_t k = 0;
+		while ( m >= 0x40000 ) {
+			m >>= 2;
+			k++;
+		}
+		while ( m < 0x10000 ) {
+			m <<= 2;
+			k--;
+		}
+
+		// Table entries are 0x400 apart, from m = 0x10000
+		uint8_t i = (uint8_t)((m - 0x10000) >> 10);
+		uint16_t r0 = pgm_read_word_near(&inverse_sqrt_table[i]);
+		uint16_t r1 = pgm_read_word_near(&inverse_sqrt_table[i + 1]);
+		FPTYPE r = KCONSTANT_0_5 + r0 - (FPTYPE)(((uint32_t)(r0 - r1) * ((uint16_t)m & 0x3ff)) >> 10);
+
+		FPTYPE s = mulk((FPTYPE)m, r);
+		if ( k > 0 )		s <<= k;
+		else if ( k < 0 )	s >>= -k;
+
+		return s;
+	}
+
+#endif
+
 
 block_t			block_buffer[BLOCK_BUFFER_SIZE];	// A ring buffer for motion instfructions
 volatile unsigned char	block_buffer_head;			// Index of the next block to be pushed
 volatile unsigned char	block_buffer_tail;			// Index of the block to process now
+unsigned char		block_buffer_planned;			// Index of the first block whose entry speed can still change
+volatile bool		planner_busy;				// plan_buffer_line is replanning, st_interrupt mustn't start a block
+
+int32_t			defined_position[DEFINED_POSITION_SIZE][STEPPER_COUNT];	// Positions redefined whilst blocks are queued
+volatile unsigned char	defined_position_head;			// Index of the next defined position to be pushed
+volatile unsigned char	defined_position_tail;			// Index of the defined position the next flagged block starts at
+static bool		defined_position_pending;		// defined_position[defined_position_head] is for the next block queued
+
+#ifdef SIMULATOR
+	// Kernel invocations made by each pass of planner_recalculate(), and the number
+	// a full replan from tail to head would have made.  [0] = reverse, [1] = forward,
+	// [2] = trapezoids
+	uint32_t		planner_kernel_calls[3];
+	uint32_t		planner_kernel_calls_full[3];
+	uint32_t		planner_recalculations;
+#endif
 
 
 // Returns the index of the next block in the ring buffer
@@ -373,9 +510,9 @@ FORCE_INLINE int32_t intersection_distance(int32_t initial_rate_sq, int32_t fina
 			}
 
 			#ifndef SIMULATOR
-				return ITOFP(isqrt1((int16_t)v2)) << n;
+				return FPSHL(ITOFP(isqrt1((int16_t)v2)), n);
 			#else
-				result = ITOFP(isqrt1((int16_t)v2)) << n;
+				result = FPSHL(ITOFP(isqrt1((int16_t)v2)), n);
 			#endif
 		}
 
@@ -430,14 +567,16 @@ void calculate_trapezoid_for_block(block_t *block, FPTYPE entry_factor, FPTYPE e
 
 	int32_t initial_rate_sq = (int32_t)(initial_rate * initial_rate);
 	int32_t final_rate_sq   = (int32_t)(final_rate   * final_rate);
+	// Max rate is sqrt(0x7fffffff) = 46,340.95 steps/s
+	int32_t nominal_rate_sq = (int32_t)(block->nominal_rate * block->nominal_rate);
   
 	int32_t acceleration = block->acceleration_st;
 	int32_t acceleration_doubled = acceleration << 1;
 	int32_t accelerate_steps = 0;
 	int32_t decelerate_steps = 0;
 	if ( block->use_accel ) {
-		accelerate_steps = estimate_acceleration_distance(initial_rate_sq, block->nominal_rate_sq, acceleration_doubled);
-		decelerate_steps = estimate_acceleration_distance(block->nominal_rate_sq, final_rate_sq, -acceleration_doubled);
+		accelerate_steps = estimate_acceleration_distance(initial_rate_sq, nominal_rate_sq, acceleration_doubled);
+		decelerate_steps = estimate_acceleration_distance(nominal_rate_sq, final_rate_sq, -acceleration_doubled);
 	}
 
 	// accelerate_steps = max(accelerate_steps,0); // Check limits due to numerical round-off
@@ -568,8 +707,8 @@ void calculate_trapezoid_for_block(block_t *block, FPTYPE entry_factor, FPTYPE e
 					// Acceleration limit to prevent overflow is 0xFFFFF / axis-steps-per-mm
 					advance_pressure_relax =
 						FPTOI(FPMULT3(extruder_advance_k2, KCONSTANT_100,
-							      FPDIV(ITOFP((int32_t)block->acceleration_st >> (1+microstepping)),
-								    ITOFP((int32_t)decelerate_steps))));
+							      FPDIV_TABLE(ITOFP((int32_t)block->acceleration_st >> (1+microstepping)),
+									  ITOFP((int32_t)decelerate_steps))));
 				}
 	
 				#ifndef SIMULATOR
@@ -592,7 +731,7 @@ void calculate_trapezoid_for_block(block_t *block, FPTYPE entry_factor, FPTYPE e
 						 "i/n/f/a=%d/%d/%d/%d !!!\n",
 						 advance_lead_entry, advance_lead_exit, advance_pressure_relax,initial_rate, block->nominal_rate,
 						 maximum_rate, final_rate, accelerate_steps, decelerate_after, block->step_event_count,
-						 plateau_steps, initial_rate_sq, block->nominal_rate_sq, final_rate_sq, acceleration_doubled);
+						 plateau_steps, initial_rate_sq, nominal_rate_sq, final_rate_sq, acceleration_doubled);
 					strlcat(block->message, buf, sizeof(block->message));
 				}
 			#endif
@@ -906,30 +1045,34 @@ void planner_reverse_pass_kernel(block_t *current, block_t *next) {
 
 // planner_recalculate() needs to go over the current plan twice. Once in reverse and once forward. This 
 // implements the reverse pass.
+// The reverse pass stops at block_buffer_planned, as the entry speed of that block can no longer
+// be raised and so the blocks before it are already optimally planned.
 
 void planner_reverse_pass() {
 	uint8_t block_index	= block_buffer_head;
 	block_t *block[2]	= { NULL, NULL};
 
-	//Make a local copy of block_buffer_tail, because the interrupt can alter it
-	CRITICAL_SECTION_START;
-  		unsigned char tail = block_buffer_tail;
-	CRITICAL_SECTION_END;
-
-	while(block_index != tail) { 
+	do {
 		block_index = prev_block_index(block_index); 
+		if ( block_index == block_buffer_planned )	break;
 		block[1]= block[0];
 		block[0] = &block_buffer[block_index];
 		planner_reverse_pass_kernel(block[0], block[1]);
-	}
+		#ifdef SIMULATOR
+			planner_kernel_calls[0]++;
+		#endif
+	} while ( true );
 }
 
 
 
 // The kernel called by planner_recalculate() when scanning the plan from first to last entry.
 
-void planner_forward_pass_kernel(block_t *previous, block_t *current) {
-	if (!previous || !current->use_accel) { return; }
+// Returns true if the entry speed of current was lowered to the speed reachable by accelerating
+// over the whole of the previous block
+
+bool planner_forward_pass_kernel(block_t *previous, block_t *current) {
+	if (!previous || !current->use_accel) { return false; }
   
 	// If the previous block is an acceleration block, but it is not long enough to complete the
 	// full speed change within the block, we need to adjust the entry speed accordingly. Entry
@@ -955,24 +1098,35 @@ void planner_forward_pass_kernel(block_t *previous, block_t *current) {
 				current->entry_speed = entry_speed;
 				current->recalculate_flag = true;
 				current->speed_changed = true;
+				return true;
 			}
 		}
 	}
+	return false;
 }
 
 
 
 // planner_recalculate() needs to go over the current plan twice. Once in reverse and once forward. This 
 // implements the forward pass.
+// Whilst scanning forward, block_buffer_planned is advanced to any block whose entry speed is now
+// optimal.  That is when the block is at it's maximum entry speed, or when it's entry speed is limited
+// by accelerating over the whole of the previous (already planned) block.  Later blocks can't raise
+// the entry speed of such a block, so the next reverse pass doesn't need to go beyond it.
 
 void planner_forward_pass() {
-	uint8_t block_index	= block_buffer_tail;
+	uint8_t block_index	= block_buffer_planned;
 	block_t *block[2]	= { NULL, NULL };
 
 	while(block_index != block_buffer_head) {
 		block[0] = block[1];
 		block[1] = &block_buffer[block_index];
-		planner_forward_pass_kernel(block[0],block[1]);
+		if ( planner_forward_pass_kernel(block[0],block[1]) ||
+		     ( block[1]->use_accel && ((block[1]->max_entry_speed - block[1]->entry_speed) <= KCONSTANT_3 )) )
+			block_buffer_planned = block_index;
+		#ifdef SIMULATOR
+			planner_kernel_calls[1]++;
+		#endif
 		block_index = next_block_index(block_index);
 	}
 }
@@ -981,22 +1135,25 @@ void planner_forward_pass() {
 
 // Recalculates the trapezoid speed profiles for all blocks in the plan according to the 
 // entry_factor for each junction. Must be called by planner_recalculate() after 
-// updating the blocks.
+// updating the blocks.  block_index is the value block_buffer_planned had before the
+// reverse and forward passes; the trapezoids of earlier blocks haven't changed.
 
-void planner_recalculate_trapezoids() {
-	uint8_t block_index	= block_buffer_tail;
+void planner_recalculate_trapezoids(uint8_t block_index) {
 	block_t *current;
 	block_t *next		= NULL;
   
 	while(block_index != block_buffer_head) {
 		current = next;
 		next = &block_buffer[block_index];
+		#ifdef SIMULATOR
+			planner_kernel_calls[2]++;
+		#endif
 		if (current && current->use_accel && next->use_accel) {
 			// Recalculate if current block entry or exit junction speed has changed.
 			if (current->recalculate_flag || next->recalculate_flag) {
 				// NOTE: Entry and exit factors always > 0 by all previous logic operations.
-				calculate_trapezoid_for_block(current, FPDIV(current->entry_speed,current->nominal_speed),
-							      FPDIV(next->entry_speed,current->nominal_speed));
+				calculate_trapezoid_for_block(current, FPDIV_TABLE(current->entry_speed,current->nominal_speed),
+							      FPDIV_TABLE(next->entry_speed,current->nominal_speed));
 				current->recalculate_flag = false; // Reset current only to ensure next trapezoid is computed
 			}
 		}
@@ -1005,7 +1162,7 @@ void planner_recalculate_trapezoids() {
 
 	// Last/newest block in buffer. Exit speed is set with minimumPlannerSpeed. Always recalculated.
 	if(next != NULL) {
-		FPTYPE scaling = FPDIV(next->entry_speed,next->nominal_speed);
+		FPTYPE scaling = FPDIV_TABLE(next->entry_speed,next->nominal_speed);
 		calculate_trapezoid_for_block(next, scaling, scaling);
 
 		// calculate_trapezoid_for_block(next,
@@ -1034,15 +1191,89 @@ void planner_recalculate_trapezoids() {
 // the set limit. Finally it will:
 //
 //   3. Recalculate trapezoids for all blocks.
+//
+// Only the blocks from block_buffer_planned onwards are considered, as the entry speeds
+// of the blocks before it can no longer change.
 
 void planner_recalculate() {   
+	//Make a local copy of block_buffer_tail, because the interrupt can alter it
+	CRITICAL_SECTION_START;
+  		unsigned char tail = block_buffer_tail;
+	CRITICAL_SECTION_END;
+
+	//If the stepper interrupt has discarded the planned block, then planning
+	//restarts at the tail as it's entry speed has been committed to
+	if ( ((block_buffer_planned - tail) & (BLOCK_BUFFER_SIZE - 1)) >=
+	     ((block_buffer_head    - tail) & (BLOCK_BUFFER_SIZE - 1)) )
+		block_buffer_planned = tail;
+
+	#ifdef SIMULATOR
+		uint8_t queued = (block_buffer_head - tail) & (BLOCK_BUFFER_SIZE - 1);
+		planner_kernel_calls_full[0] += queued;
+		planner_kernel_calls_full[1] += queued;
+		planner_kernel_calls_full[2] += queued;
+		planner_recalculations ++;
+	#endif
+
+	uint8_t planned = block_buffer_planned;
+
 	planner_reverse_pass();
 	planner_forward_pass();
-	planner_recalculate_trapezoids();
+	planner_recalculate_trapezoids(planned);
 }
 
 
 
+#ifdef ACCELERATION_JUNCTION_DEVIATION
+
+// The max. junction speed with the junction deviation model: the speed at which the block's
+// acceleration would follow a circular arc, tangent to both moves, whose closest approach to
+// the corner is junction_deviation mm.  With theta the angle between the moves,
+//	v^2 = acceleration * junction_deviation * sin(theta/2) / (1 - sin(theta/2))
+// where sin(theta/2) = sqrt((1 - cos(theta)) / 2) and cos(theta) comes from the unit vectors.
+
+FORCE_INLINE FPTYPE junction_deviation_speed(block_t *block, FPTYPE *unit_vec) {
+	// Minus the dot product, so -1 is straight on and 1 is a reversal
+	FPTYPE cos_theta = - FPMULT2(prev_unit_vec[X_AXIS], unit_vec[X_AXIS])
+			   - FPMULT2(prev_unit_vec[Y_AXIS], unit_vec[Y_AXIS])
+			   - FPMULT2(prev_unit_vec[Z_AXIS], unit_vec[Z_AXIS]);
+
+	if ( cos_theta >= KCONSTANT_0_95 )	return minimumPlannerSpeed;
+
+	// Only moves that are straight on to within fixed point precision (about 2.5 degrees)
+	// skip the model, as v grows without limit as theta goes to 0
+	FPTYPE vmax = min(block->nominal_speed, prev_nominal_speed);
+	if ( cos_theta <= KCONSTANT_MINUS_0_999 )	return vmax;
+
+	FPTYPE sin_theta_d2 = FPSQRT_TABLE(FPMULT2(KCONSTANT_0_5, KCONSTANT_1 - cos_theta));
+
+	// Two square roots rather than one, so that the product stays within range in fixed point
+	FPTYPE v = FPMULT2(FPSQRT_TABLE(FPMULT2(block->acceleration, junction_deviation)),
+			   FPSQRT_TABLE(FPDIV_TABLE(sin_theta_d2, KCONSTANT_1 - sin_theta_d2)));
+
+	return min(v, vmax);
+}
+
+
+
+// Junction deviation only covers X, Y and Z, so the extruders are still held to max_speed_change.
+// At a junction both blocks move at the junction speed v, the extruder at v times its mm per mm
+// of travel in each block, so the change in extruder speed is v times the difference of those.
+
+FORCE_INLINE FPTYPE junction_extruder_speed(block_t *block, FPTYPE *current_speed, FPTYPE vmax_junction) {
+	for ( uint8_t i = A_AXIS; i < STEPPER_COUNT; i ++ ) {
+		FPTYPE e_per_mm = FPABS(FPDIV_TABLE(current_speed[i], block->nominal_speed) -
+					FPDIV_TABLE(prev_speed[i], prev_nominal_speed));
+		if ( FPMULT2(vmax_junction, e_per_mm) > max_speed_change[i] )
+			vmax_junction = FPDIV_TABLE(max_speed_change[i], e_per_mm);
+	}
+	return vmax_junction;
+}
+
+#endif
+
+
+
 void plan_init(FPTYPE extruderAdvanceK, FPTYPE extruderAdvanceK2, bool zhold) {
 	#ifdef SIMULATOR
 		if ( (B_AXIS+1) != STEPPER_COUNT ) abort();
@@ -1053,9 +1284,18 @@ void plan_init(FPTYPE extruderAdvanceK, FPTYPE extruderAdvanceK2, bool zhold) {
 		     (B_AXIS >= STEPPER_COUNT)) abort();
 	#endif
 
-	block_buffer_head = 0;
-	block_buffer_tail = 0;
-	prev_nominal      = 0;
+	block_buffer_head    = 0;
+	block_buffer_tail    = 0;
+	block_buffer_planned = 0;
+	prev_nominal         = 0;
+	#ifdef ACCELERATION_JUNCTION_DEVIATION
+		prev_unit_vec_valid = false;
+	#endif
+	#ifdef ACCELERATION_COALESCE_ANGLE
+		last_block_removable = false;
+	#endif
+
+	plan_clear_defined_positions();
 
 	// clear planner_position
 	for ( uint8_t i = 0; i < STEPPER_COUNT; i ++ )
@@ -1085,6 +1325,22 @@ void plan_init(FPTYPE extruderAdvanceK, FPTYPE extruderAdvanceK2, bool zhold) {
 
 void plan_buffer_line(FPTYPE feed_rate, const uint32_t &dda_rate, const uint8_t &extruder, bool use_accel, uint8_t active_toolhead)
 {
+	ISR_PROFILE_START(profile_start);
+
+	#ifdef ACCELERATION_COALESCE_ANGLE
+		// Keep the junction state, so that plan_remove_last_block can put it back
+		for ( uint8_t i = 0; i < STEPPER_COUNT; i ++ )
+			last_prev_speed[i] = prev_speed[i];
+		last_prev_nominal = prev_nominal;
+		#ifdef ACCELERATION_JUNCTION_DEVIATION
+			for ( uint8_t i = X_AXIS; i <= Z_AXIS; i ++ )
+				last_prev_unit_vec[i] = prev_unit_vec[i];
+			last_prev_nominal_speed  = prev_nominal_speed;
+			last_prev_unit_vec_valid = prev_unit_vec_valid;
+		#endif
+		last_block_removable = use_accel;
+	#endif
+
 	//If we have an empty buffer, then disable slowdown until the buffer has become at least 1/2 full
 	//This prevents slow start and gradual speedup at the beginning of a print, due to the SLOWDOWN algorithm
 	if ( slowdown_limit && block_buffer_head == block_buffer_tail ) disable_slowdown = true;
@@ -1104,10 +1360,13 @@ void plan_buffer_line(FPTYPE feed_rate, const uint32_t &dda_rate, const uint8_t
 	// Note the active toolhead
 	block->active_toolhead = active_toolhead;
 
-	CRITICAL_SECTION_START;
-	for ( uint8_t i = 0; i < STEPPER_COUNT; i ++ )
-		block->starting_position[i] = planner_position[i];
-	CRITICAL_SECTION_END;
+	// If the position was redefined since the last block was queued, this block starts there.
+	// Otherwise it starts where the previous block finished.
+	block->position_defined = defined_position_pending;
+	if ( defined_position_pending ) {
+		defined_position_head = (defined_position_head + 1) & (DEFINED_POSITION_SIZE - 1);
+		defined_position_pending = false;
+	}
 
 	#ifdef SIMULATOR
 		// Track how many times this block is worked on by the planner
@@ -1214,7 +1473,7 @@ void plan_buffer_line(FPTYPE feed_rate, const uint32_t &dda_rate, const uint8_t
 			//If the buffer is less than half full, start slowing down the feed_rate
 			//according to how little we have left in the buffer
 			if ( moves_queued < slowdown_limit && (! disable_slowdown ) && moves_queued > 1) {
-				FPTYPE slowdownScaling = FPDIV(ITOFP(moves_queued), ITOFP((int32_t)slowdown_limit));
+				FPTYPE slowdownScaling = FPDIV_TABLE(ITOFP(moves_queued), ITOFP((int32_t)slowdown_limit));
 				feed_rate = FPMULT2(feed_rate, slowdownScaling);
 				block->nominal_rate = (uint32_t)FPTOI(FPMULT2(ITOFP((int32_t)block->nominal_rate), slowdownScaling));
 			}
@@ -1231,7 +1490,7 @@ void plan_buffer_line(FPTYPE feed_rate, const uint32_t &dda_rate, const uint8_t
 		if ( extruder_only_move )	block->millimeters = FPABS(delta_mm[A_AXIS + block->active_extruder]);
 		else				block->millimeters = planner_distance;
 
-		inverse_millimeters = FPDIV(KCONSTANT_1, block->millimeters);  // Inverse millimeters to remove multiple divides 
+		inverse_millimeters = FPDIV_TABLE(KCONSTANT_1, block->millimeters);  // Inverse millimeters to remove multiple divides 
 
 		// Calculate speed in mm/second for each axis. No divide by zero due to previous checks.
 		FPTYPE inverse_second = FPMULT2(feed_rate, inverse_millimeters);
@@ -1246,7 +1505,7 @@ void plan_buffer_line(FPTYPE feed_rate, const uint32_t &dda_rate, const uint8_t
 			FPTYPE speed_factor = KCONSTANT_1;
 			for (unsigned char i=0; i < STEPPER_COUNT; i++)
 				if ( FPABS(current_speed[i]) > stepperAxis[i].max_feedrate )
-					speed_factor = min(speed_factor, FPDIV(stepperAxis[i].max_feedrate, FPABS(current_speed[i])));
+					speed_factor = min(speed_factor, FPDIV_TABLE(stepperAxis[i].max_feedrate, FPABS(current_speed[i])));
 			if ( speed_factor < KCONSTANT_1 ) {
 				for (unsigned char i=0; i < STEPPER_COUNT; i++)
 					current_speed[i] = FPMULT2(current_speed[i], speed_factor);
@@ -1271,7 +1530,7 @@ void plan_buffer_line(FPTYPE feed_rate, const uint32_t &dda_rate, const uint8_t
 			FPTYPE speed_factor = KCONSTANT_1; //factor <=1 do decrease speed
 			for(unsigned char i=0; i < STEPPER_COUNT; i++) {
 				if(FPABS(current_speed[i]) > max_speed_change[i])
-					speed_factor = min(speed_factor, FPDIV(max_speed_change[i], FPABS(current_speed[i])));
+					speed_factor = min(speed_factor, FPDIV_TABLE(max_speed_change[i], FPABS(current_speed[i])));
 			}
 
 			if ( dda_rate > (uint32_t)FPTYPE_MAX ) {
@@ -1299,14 +1558,15 @@ void plan_buffer_line(FPTYPE feed_rate, const uint32_t &dda_rate, const uint8_t
 				prev_speed[i] = current_speed[i];
 		}
 
+		#ifdef ACCELERATION_JUNCTION_DEVIATION
+			prev_unit_vec_valid = false;
+		#endif
+
 		#ifdef SIMULATOR
 			block->nominal_speed = feed_rate;
 			block->entry_speed   = feed_rate;
 		#endif
 
-		// Max rate is sqrt(0x7fffffff) = 46,340.95 steps/s
-		block->nominal_rate_sq	= (int32_t)(block->nominal_rate * block->nominal_rate);
-
 		// Add to the buffer
 		block_buffer_head = next_buffer_head;
 
@@ -1319,6 +1579,7 @@ void plan_buffer_line(FPTYPE feed_rate, const uint32_t &dda_rate, const uint8_t
 			sblock = NULL;
 		#endif
 
+		ISR_PROFILE_END(PROFILE_PLAN_BUFFER_LINE, profile_start);
 		return;
 	}
 
@@ -1341,7 +1602,6 @@ void plan_buffer_line(FPTYPE feed_rate, const uint32_t &dda_rate, const uint8_t
 		}
 	}
 
-	block->nominal_rate_sq	= (int32_t)(block->nominal_rate * block->nominal_rate);
 	block->nominal_speed	= feed_rate; // (mm/sec) Always > 0
 
 	// Compute and limit the acceleration rate for the trapezoid generator.
@@ -1354,10 +1614,10 @@ void plan_buffer_line(FPTYPE feed_rate, const uint32_t &dda_rate, const uint8_t
 	if (block->step_event_count < 0x7fff)
 		steps_per_mm = FPMULT2(ITOFP((int32_t)block->step_event_count), inverse_millimeters);
 	else if (block->step_event_count < 0xffff)
-		steps_per_mm = FPMULT2(ITOFP((int32_t)block->step_event_count >> 1), inverse_millimeters << 1);
+		steps_per_mm = FPMULT2(ITOFP((int32_t)block->step_event_count >> 1), FPSHL(inverse_millimeters, 1));
 	else if (block->step_event_count < 0x1ffff)
 		// Someone had a Z resolution of 630 steps/mm which made a 115.5 mm Z travel exceed 0xffff steps
-		steps_per_mm = FPMULT2(ITOFP((int32_t)block->step_event_count >> 2), inverse_millimeters << 2);
+		steps_per_mm = FPMULT2(ITOFP((int32_t)block->step_event_count >> 2), FPSHL(inverse_millimeters, 2));
 	else
 		// Switch to floating point.  But if someone has this high of resolution for X | Y
 		// then they have bigger problems: not enough CPU cycles to run the stepper interrupt
@@ -1400,20 +1660,20 @@ void plan_buffer_line(FPTYPE feed_rate, const uint32_t &dda_rate, const uint8_t
 	if	(block->acceleration_st <= 0x7FFF)
 		// Acceleration limit to prevent overflow is 0x7FFF / axis-steps-per-mm
 		// good up to about 163.835 mm/s^2 @ 200 steps/mm || 697.17 mm/s^2 @ 47 steps/mm
-		block->acceleration = FPDIV(ITOFP((int32_t)block->acceleration_st), steps_per_mm);
+		block->acceleration = FPDIV_TABLE(ITOFP((int32_t)block->acceleration_st), steps_per_mm);
 	else if (block->acceleration_st <= 0x1FFFF)
 		// Acceleration limit to prevent overflow is 0x1FFFF / axis-steps-per-mm
 		// good up to about 655.355 mm/s^2 @ 200 steps/mm || 2,789 mm/s^2 @ 47 steps/mm
-		block->acceleration = FPDIV(ITOFP(((int32_t)block->acceleration_st)>>2), (steps_per_mm>>2));
+		block->acceleration = FPDIV_TABLE(ITOFP(((int32_t)block->acceleration_st)>>2), FPSHR(steps_per_mm, 2));
 	else if (block->acceleration_st <= 0x7FFFF)
 		// Acceleration limit to prevent overflow is 0x7FFFF / axis-steps-per-mm
 		// good up to 2,621 mm/s^2 @ 200 steps/mm || 11,153 mm/s^2 @ 47 steps/mm
-		block->acceleration = FPDIV(ITOFP(((int32_t)block->acceleration_st)>>4), (steps_per_mm>>4));
+		block->acceleration = FPDIV_TABLE(ITOFP(((int32_t)block->acceleration_st)>>4), FPSHR(steps_per_mm, 4));
 	else
 		// Acceleration limit to prevent overflow is 0xFFFFF / axis-steps-per-mm
 		// good up to 5,242 mm/s^2 @ 200 steps/mm || 22,306 mm/s^2 @ 47 steps/mm (20,867 @ 50.25 steps/mm)
 		// STOP HERE SINCE JKN Advance K2 calculations limit accel to 0xFFFFF / axis-steps-per-mm
-		block->acceleration = FPDIV(ITOFP(((int32_t)block->acceleration_st)>>5), (steps_per_mm>>5));
+		block->acceleration = FPDIV_TABLE(ITOFP(((int32_t)block->acceleration_st)>>5), FPSHR(steps_per_mm, 5));
 
 	#if 0
 		else if (block->acceleration_st <= 0x1FFFFF)
@@ -1445,14 +1705,32 @@ void plan_buffer_line(FPTYPE feed_rate, const uint32_t &dda_rate, const uint8_t
 		block->acceleration_rate = (int32_t)((FPTYPE)block->acceleration_st * 8.388608);
 	#endif
   
+	#ifdef ACCELERATION_JUNCTION_DEVIATION
+		// Junction deviation needs the direction of travel, which extruder only moves don't have
+		FPTYPE unit_vec[3];
+		bool use_junction_deviation = ( junction_deviation != 0 ) && ( ! extruder_only_move );
+		if ( use_junction_deviation ) {
+			for ( uint8_t i = X_AXIS; i <= Z_AXIS; i ++ )
+				unit_vec[i] = FPMULT2(delta_mm[i], inverse_millimeters);
+		}
+	#endif
+
 	//START OF YET_ANOTHER_JERK
 
 	FPTYPE scaling = KCONSTANT_1;
 	bool docopy = true;
 	if ( moves_queued == 0 ) {
 		vmax_junction = minimumPlannerSpeed;
-		scaling = FPDIV(vmax_junction, block->nominal_speed);
-	} else if (block->nominal_speed <= smallest_max_speed_change) {
+		scaling = FPDIV_TABLE(vmax_junction, block->nominal_speed);
+	}
+	#ifdef ACCELERATION_JUNCTION_DEVIATION
+	else if ( use_junction_deviation && prev_unit_vec_valid ) {
+		vmax_junction = junction_deviation_speed(block, unit_vec);
+		vmax_junction = junction_extruder_speed(block, current_speed, vmax_junction);
+		scaling = FPDIV_TABLE(vmax_junction, block->nominal_speed);
+	}
+	#endif
+	else if (block->nominal_speed <= smallest_max_speed_change) {
 		vmax_junction = block->nominal_speed;
 		// scaling remains KCONSTANT_1
 	} else {
@@ -1472,9 +1750,9 @@ void plan_buffer_line(FPTYPE feed_rate, const uint32_t &dda_rate, const uint8_t
 					s = 0;
 				}
 				else if ( current_speed[i] > prev_speed[i] ) {
-					s = FPDIV(prev_speed[i] + max_speed_change[i], current_speed[i]);
+					s = FPDIV_TABLE(prev_speed[i] + max_speed_change[i], current_speed[i]);
 				} else {
-					s = FPDIV(prev_speed[i] - max_speed_change[i], current_speed[i]);
+					s = FPDIV_TABLE(prev_speed[i] - max_speed_change[i], current_speed[i]);
 				}
 				if ( s <= 0 ) {
 					scaling = 0;
@@ -1500,6 +1778,15 @@ void plan_buffer_line(FPTYPE feed_rate, const uint32_t &dda_rate, const uint8_t
 
 	//END OF YET ANOTHER JERK
 
+	#ifdef ACCELERATION_JUNCTION_DEVIATION
+		if ( use_junction_deviation ) {
+			for ( uint8_t i = X_AXIS; i <= Z_AXIS; i ++ )
+				prev_unit_vec[i] = unit_vec[i];
+			prev_nominal_speed = block->nominal_speed;
+		}
+		prev_unit_vec_valid = use_junction_deviation;
+	#endif
+
 	//#ifdef DEBUG_ONSCREEN
 	//	if ( block->steps[Z_AXIS] != 0 )
 	//		debug_onscreen2 = FPTOF(vmax_junction);
@@ -1565,7 +1852,9 @@ void plan_buffer_line(FPTYPE feed_rate, const uint32_t &dda_rate, const uint8_t
 	//	debug_onscreen2 = block->advance_pressure_relax;
 	//#endif
     
-	// Move buffer head
+	// Move buffer head.  Until the plan has been recalculated, the stepper interrupt can't start
+	// slicing blocks when it's run out of segments
+	planner_busy = true;
 	block_buffer_head = next_buffer_head;
   
 	// Update planner_position
@@ -1584,18 +1873,127 @@ void plan_buffer_line(FPTYPE feed_rate, const uint32_t &dda_rate, const uint8_t
 	//#endif
 
 	planner_recalculate();
+	planner_busy = false;
 
 	#ifdef SIMULATOR
 		sblock = NULL;
 	#endif
 
+	ISR_PROFILE_END(PROFILE_PLAN_BUFFER_LINE, profile_start);
 	return;
 }
 
 
 
+#ifdef ACCELERATION_COALESCE_ANGLE
+
+// Takes the last block added by plan_buffer_line back out of the plan, so that it can be
+// replaced by a longer one (see steppers::setTargetNewExt).  planner_position and the
+// junction state go back to how they were before the block was added.
+//
+// Only an accelerated block that is not the only block in the plan, hasn't been started by
+// st_prep_buffer / the stepper interrupt and doesn't start at a defined position can be
+// removed, and only once.  Its entry speed must also still be free to change, i.e. it comes
+// after block_buffer_planned, otherwise the block replacing it could enter faster than
+// the one before it (which may already be sliced) leaves.  Returns false if the block
+// can't be removed.
+
+bool plan_remove_last_block()
+{
+	if ( ! last_block_removable || defined_position_pending )	return false;
+
+	bool	removed = false;
+	uint8_t	last;
+	block_t	*block;
+
+	CRITICAL_SECTION_START;
+		last  = prev_block_index(block_buffer_head);
+		block = &block_buffer[last];
+		uint8_t tail = block_buffer_tail;
+		if (( block_buffer_head != tail ) && ( last != tail ) &&
+		    ( ! block->busy ) && ( ! block->position_defined ) &&
+		    ( ((last - tail) & (BLOCK_BUFFER_SIZE - 1)) > ((block_buffer_planned - tail) & (BLOCK_BUFFER_SIZE - 1)) )) {
+			block_buffer_head = last;
+			removed = true;
+		}
+	CRITICAL_SECTION_END;
+
+	if ( ! removed )	return false;
+
+	last_block_removable = false;
+
+	CRITICAL_SECTION_START;
+		for ( uint8_t i = 0; i < STEPPER_COUNT; i ++ ) {
+			if ( block->direction_bits & (1 << i) )	planner_position[i] += block->steps[i];
+			else					planner_position[i] -= block->steps[i];
+		}
+	CRITICAL_SECTION_END;
+
+	for ( uint8_t i = 0; i < STEPPER_COUNT; i ++ )
+		prev_speed[i] = last_prev_speed[i];
+	prev_nominal = last_prev_nominal;
+	#ifdef ACCELERATION_JUNCTION_DEVIATION
+		for ( uint8_t i = X_AXIS; i <= Z_AXIS; i ++ )
+			prev_unit_vec[i] = last_prev_unit_vec[i];
+		prev_nominal_speed  = last_prev_nominal_speed;
+		prev_unit_vec_valid = last_prev_unit_vec_valid;
+	#endif
+
+	return true;
+}
+
+#endif
+
+
+
+// Queues planner_position as the starting position of the next block added to the plan.
+// Must be called from within a critical section, with blocks in the plan.
+
+static void plan_queue_defined_position() {
+	for ( uint8_t i = 0; i < STEPPER_COUNT; i ++ )
+		defined_position[defined_position_head][i] = planner_position[i];
+	defined_position_pending = true;
+}
+
+
+
+// If every defined_position[] entry is in use by queued blocks, we have to wait for the
+// stepper interrupt to reach the oldest of them.  Command.cc checks plan_can_define_position()
+// before defining the position, so this only happens for position changes made internally.
+
+static void plan_wait_for_defined_position() {
+	if ( defined_position_pending )	return;	// Overwrites the pending entry
+
+	#ifdef SIMULATOR
+		// There's no stepper interrupt to wait on, the caller needs to drain the plan
+		if ( ! plan_can_define_position() ) abort();
+	#else
+		// The stepper interrupt only reaches the blocks once they've been sliced into segments
+		while ( ! plan_can_define_position() )	st_prep_buffer();
+	#endif
+}
+
+
+
+void plan_clear_defined_positions()
+{
+	CRITICAL_SECTION_START;
+		defined_position_head    = 0;
+		defined_position_tail    = 0;
+		defined_position_pending = false;
+	CRITICAL_SECTION_END;
+}
+
+
+
 void plan_set_position(const int32_t &x, const int32_t &y, const int32_t &z, const int32_t &a, const int32_t &b)
 {
+	plan_wait_for_defined_position();
+
+	#ifdef ACCELERATION_COALESCE_ANGLE
+		last_block_removable = false;
+	#endif
+
 	CRITICAL_SECTION_START;  // Fill variables used by the stepper in a critical section
 		planner_position[X_AXIS] = x;
 		planner_position[Y_AXIS] = y;
@@ -1605,7 +2003,8 @@ void plan_set_position(const int32_t &x, const int32_t &y, const int32_t &z, con
 		planner_position[B_AXIS] = b;
 		#endif
 
-		//If the buffer is empty, we set the stepper position to match
+		//If the buffer is empty, we set the stepper position to match,
+		//otherwise the next block queued starts at the new position
 		if ( movesplanned() == 0 ) {
 			st_set_position( planner_position[X_AXIS],
 					 planner_position[Y_AXIS],
@@ -1616,7 +2015,9 @@ void plan_set_position(const int32_t &x, const int32_t &y, const int32_t &z, con
 #else
 			                 0 );
 #endif
+			defined_position_pending = false;
 		}
+		else	plan_queue_defined_position();
 
 	CRITICAL_SECTION_END;  // Fill variables used by the stepper in a critical section
 }
@@ -1625,13 +2026,20 @@ void plan_set_position(const int32_t &x, const int32_t &y, const int32_t &z, con
 
 void plan_set_e_position(const int32_t &a, const int32_t &b)
 {
+	plan_wait_for_defined_position();
+
+	#ifdef ACCELERATION_COALESCE_ANGLE
+		last_block_removable = false;
+	#endif
+
 	CRITICAL_SECTION_START;  // Fill variables used by the stepper in a critical section
 		planner_position[A_AXIS] = (int32_t)a;
 		#if EXTRUDERS > 1
 		planner_position[B_AXIS] = (int32_t)b;
 		#endif
 
-		//If the buffer is empty, we set the stepper position to match
+		//If the buffer is empty, we set the stepper position to match,
+		//otherwise the next block queued starts at the new position
 		if ( movesplanned() == 0 ) {
 			st_set_e_position( planner_position[A_AXIS], 
 #if EXTRUDERS > 1
@@ -1639,7 +2047,9 @@ void plan_set_e_position(const int32_t &a, const int32_t &b)
 #else
 			                   0 );
 #endif
+			defined_position_pending = false;
 		}
+		else	plan_queue_defined_position();
 
 	CRITICAL_SECTION_END;  // Fill variables used by the stepper in a critical section
 }
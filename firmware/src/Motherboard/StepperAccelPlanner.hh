@@ -56,12 +56,20 @@
 //Drop ceil/floor calculations.  Making this available as a #define so we can test timing later
 #define NO_CEIL
 
+//Divide and take square roots in the planner with the lookup tables in StepperAccelReciprocalTable.hh
+//rather than divk() and sqrtk().  Define NO_RECIPROCAL_TABLES to compare op counts in the simulator
+#ifndef NO_RECIPROCAL_TABLES
+	#define RECIPROCAL_TABLES
+#endif
+
 #ifdef FIXED
 	#define FPTYPE			_Accum
 
 	//Various constants we need, we preconvert these to fixed point to save time later
 	#define KCONSTANT_MINUS_0_95	-62259		//ftok(-0.95)   
+	#define KCONSTANT_MINUS_0_999	-65470		//ftok(-0.999)
         #define KCONSTANT_0_001         65              //ftok(0.001)
+	#define KCONSTANT_0_03		1966		//ftok(0.03)
 	#define KCONSTANT_0_05          3276            //ftok(0.05)
 	#define KCONSTANT_0_1		6553		//ftok(0.1)
 	#define KCONSTANT_0_25		16384		//ftok(0.25)
@@ -95,6 +103,8 @@
 		#define FPSQRT(x)		sqrtk(x)
 		#define FPABS(x)		absk(x)
 		#define FPSCALE2(x)		((x) << 1)
+		#define FPSHL(x,n)		((x) << (n))
+		#define FPSHR(x,n)		((x) >> (n))
 	#else
 		//Type Conversions
 		#define FPTOI(x)		ktoli(x)	//FPTYPE  -> int32_t
@@ -109,9 +119,11 @@
 		#define FPMULT3(x,y,a)		fpmult3S((x),(y),(a),__LINE__,__FILE__)
 		#define FPMULT4(x,y,a,b)	fpmult4S((x),(y),(a),(b),__LINE__,__FILE__)
 		#define FPDIV(x,y)		fpdivS((x),(y),__LINE__,__FILE__)
-		#define FPSQRT(x)		sqrtk(x)
+		#define FPSQRT(x)		fpsqrtS((x),__LINE__,__FILE__)
 		#define FPABS(x)		absk(x)
 		#define FPSCALE2(x)		fpscale2S((x),,__LINE__,__FILE__)
+		#define FPSHL(x,n)		((x) << (n))
+		#define FPSHR(x,n)		((x) >> (n))
 	#endif		
 
 	#ifndef NO_CEIL
@@ -123,7 +135,9 @@
 
 	//Various constants we need, we preconvert these to fixed point to save time later
 	#define KCONSTANT_MINUS_0_95	-0.95   
+	#define KCONSTANT_MINUS_0_999	-0.999
         #define KCONSTANT_0_001         0.001
+	#define KCONSTANT_0_03		0.03
 	#define KCONSTANT_0_05		0.05
 	#define KCONSTANT_0_1		0.1
 	#define KCONSTANT_0_25		0.25
@@ -153,8 +167,10 @@
 	#define FPMULT4(x,y,a,b)	((x) * (y) * (a) * (b))
 	#define FPDIV(x,y)		((x) / (y))
 	#define FPSQRT(x)		sqrt(x)
-	#define FPABS(x)		abs(x)
+	#define FPABS(x)		fabs(x)
 	#define FPSCALE2(x)		((x) * 2.0)
+	#define FPSHL(x,n)		((x) * (float)(1 << (n)))
+	#define FPSHR(x,n)		((x) / (float)(1 << (n)))
 
 	#ifndef NO_CEIL
 		#define FPCEIL(x)	ceil(x)
@@ -165,6 +181,24 @@
 	#define FPCEIL(x)		(KCONSTANT_0_5 + (x))
 #endif
 
+//Table based divide and square root, accurate to about 1 part in 2^14 of the result.
+//Without the tables (or in floating point), they're just FPDIV and FPSQRT
+#if defined(FIXED) && defined(RECIPROCAL_TABLES)
+	extern FPTYPE fpdiv_table(FPTYPE x, FPTYPE y);
+	extern FPTYPE fpsqrt_table(FPTYPE x);
+
+	#ifndef SIMULATOR
+		#define FPDIV_TABLE(x,y)	fpdiv_table(x,y)
+		#define FPSQRT_TABLE(x)		fpsqrt_table(x)
+	#else
+		#define FPDIV_TABLE(x,y)	fpdivtableS((x),(y),__LINE__,__FILE__)
+		#define FPSQRT_TABLE(x)		fpsqrttableS((x),__LINE__,__FILE__)
+	#endif
+#else
+	#define FPDIV_TABLE(x,y)		FPDIV(x,y)
+	#define FPSQRT_TABLE(x)			FPSQRT(x)
+#endif
+
 //Limits
 //The largest / smallest values that can be stored in FPTYPE 
 //(which is s15.16, where s is sign and 15 bits = 0x7FFF)
@@ -185,12 +219,19 @@
 // The number of linear motions that can be in the plan at any give time.
 // THE BLOCK_BUFFER_SIZE NEEDS TO BE A POWER OF 2, i.g. 8,16,32 because shifts and ors are used to do the ringbuffering.
 // Values less than 16 would not be wise
-#ifdef SMALL_4K_RAM
-	#define BLOCK_BUFFER_SIZE 8  // maximize block buffer
-#else
-	#define BLOCK_BUFFER_SIZE 16 // maximize block buffer
+// Boards with the RAM for a deeper lookahead define BLOCK_BUFFER_SIZE in Configuration.hh
+#ifndef BLOCK_BUFFER_SIZE
+	#ifdef SMALL_4K_RAM
+		#define BLOCK_BUFFER_SIZE 8  // maximize block buffer
+	#else
+		#define BLOCK_BUFFER_SIZE 16 // maximize block buffer
+	#endif
 #endif
 
+// The number of position redefinitions (plan_set_position) that can be waiting in the
+// plan for the stepper interrupt to reach them.  Power of 2, 1 less is usable.
+#define DEFINED_POSITION_SIZE 4
+
 // When SAVE_SPACE is defined, the code doesn't take some optimizations which
 // which lead to additional program space usage.
 //#define SAVE_SPACE
@@ -201,7 +242,6 @@ typedef struct {
 	// Fields used by the bresenham algorithm for tracing the line
 	int32_t		steps[STEPPER_COUNT];			// Step count along each axis
 	uint32_t	step_event_count;			// The number of step events required to complete this block
-	int32_t		starting_position[STEPPER_COUNT];
 	int32_t		accelerate_until;			// The index of the step event on which to stop acceleration
 	int32_t		decelerate_after;			// The index of the step event on which to start decelerating
 	int32_t		acceleration_rate;			// The acceleration rate used for acceleration calculation
@@ -209,7 +249,6 @@ typedef struct {
 	unsigned char	active_extruder;			// Selects the active extruder
 	uint8_t		active_toolhead;			// The toolhead currently active.  Note this isn't the same as active extruder
 	#ifdef JKN_ADVANCE
-		bool	use_advance_lead;
 		int16_t	advance_lead_entry;
 		int16_t	advance_lead_exit;
 		int32_t	advance_pressure_relax;			//Decel phase only
@@ -223,17 +262,23 @@ typedef struct {
 	FPTYPE		max_entry_speed;			// Maximum allowable junction entry speed in mm/min
 	FPTYPE		millimeters;				// The total travel of this block in mm
 	FPTYPE		acceleration;				// acceleration mm/sec^2
-	unsigned char	recalculate_flag;			// Planner flag to recalculate trapezoids on entry junction
-	unsigned char	nominal_length_flag;			// Planner flag for nominal speed always reached
 
 	// Settings for the trapezoid generator
 	uint32_t	nominal_rate;				// The nominal step rate for this block in step_events/sec 
-	int32_t		nominal_rate_sq;			// nominal_rate * nominal_rate
 	uint32_t	initial_rate;				// The jerk-adjusted step rate at start of block  
 	uint32_t	final_rate;				// The minimal rate at exit
 	uint32_t	acceleration_st;			// acceleration steps/sec^2
-	char		use_accel;				// Use acceleration when true
-	char		speed_changed;				// Entry speed has changed
+
+	// Flags, only written outside of the stepper interrupt.  busy is kept out of the
+	// bitfield as it's set by the interrupt and a read-modify-write here would race it
+	unsigned char	recalculate_flag	: 1;		// Planner flag to recalculate trapezoids on entry junction
+	unsigned char	nominal_length_flag	: 1;		// Planner flag for nominal speed always reached
+	unsigned char	use_accel		: 1;		// Use acceleration when true
+	unsigned char	speed_changed		: 1;		// Entry speed has changed
+	unsigned char	position_defined	: 1;		// Block starts at the next entry in defined_position[]
+	#ifdef JKN_ADVANCE
+		unsigned char	use_advance_lead : 1;
+	#endif
 	volatile char	busy;
 
 	#ifdef SIMULATOR
@@ -256,10 +301,18 @@ void plan_init(FPTYPE extruderAdvanceK, FPTYPE extruderAdvanceK2, bool zhold);
 // Add a new linear movement to the buffer.
 void plan_buffer_line(FPTYPE feed_rate, const uint32_t &dda_rate, const uint8_t &extruder, bool use_accel, uint8_t active_toolhead);
 
+#ifdef ACCELERATION_COALESCE_ANGLE
+// Takes the last block back out of the plan, so it can be replaced by a longer one
+bool plan_remove_last_block();
+#endif
+
 // Set position. Used for G92 instructions.
 void plan_set_position(const int32_t &x, const int32_t &y, const int32_t &z, const int32_t &a, const int32_t &b);
 void plan_set_e_position(const int32_t &a, const int32_t &b);
 
+// Discards any queued position redefinitions, used when the plan is emptied
+void plan_clear_defined_positions();
+
 
 #ifndef SIMULATOR
 	#define SIMULATOR_RECORD(x...)
@@ -287,6 +340,9 @@ extern bool		acceleration_zhold;
 extern FPTYPE		delta_mm[STEPPER_COUNT];
 extern FPTYPE		planner_distance;
 extern FPTYPE		minimumPlannerSpeed;
+#ifdef ACCELERATION_JUNCTION_DEVIATION
+extern FPTYPE		junction_deviation;
+#endif
 extern uint32_t		planner_master_steps;
 extern uint8_t		planner_master_steps_index;
 extern uint8_t          planner_axes;
@@ -300,6 +356,15 @@ extern block_t		block_buffer[BLOCK_BUFFER_SIZE];			// A ring buffer for motion i
 
 extern volatile unsigned char	block_buffer_head;				// Index of the next block to be pushed
 extern volatile unsigned char	block_buffer_tail; 
+extern unsigned char		block_buffer_planned;				// Index of the first block whose entry speed can still change
+extern volatile bool		planner_busy;					// plan_buffer_line is replanning
+
+// Blocks don't carry their starting position, the stepper interrupt's dda_position simply continues
+// from the previous block.  When the position is redefined with blocks in the plan, the new position
+// is queued here and the first block queued after it is flagged with position_defined.
+extern int32_t			defined_position[DEFINED_POSITION_SIZE][STEPPER_COUNT];
+extern volatile unsigned char	defined_position_head;
+extern volatile unsigned char	defined_position_tail;
 
 #ifdef ACCEL_STATS
 	extern void accelStatsGet(float *minSpeed, float *avgSpeed, float *maxSpeed);
@@ -345,4 +410,20 @@ FORCE_INLINE uint8_t movesplanned()
 	return (block_buffer_head-block_buffer_tail + BLOCK_BUFFER_SIZE) & (BLOCK_BUFFER_SIZE - 1);
 }
 
+//Returns true if a position redefinition can be queued without waiting
+//for the stepper interrupt to free up a defined_position[] entry
+FORCE_INLINE bool plan_can_define_position()
+{
+	return ((defined_position_head + 1) & (DEFINED_POSITION_SIZE - 1)) != defined_position_tail;
+}
+
+//Called by the stepper interrupt when it starts a block flagged with position_defined
+//Returns the position the block starts at, and frees the entry
+FORCE_INLINE int32_t *plan_take_defined_position()
+{
+	int32_t *position = defined_position[defined_position_tail];
+	defined_position_tail = (defined_position_tail + 1) & (DEFINED_POSITION_SIZE - 1);
+	return position;
+}
+
 #endif
@@ -0,0 +1,65 @@
+#ifndef STEPPERACCELRECIPROCALTABLE_HH
+#define STEPPERACCELRECIPROCALTABLE_HH
+
+// Tables for fpdiv_table() and fpsqrt_table() in StepperAccelPlanner.cc
+//
+// Both tables hold 65536 * f(m) - 32768 for evenly spaced m, so that each
+// entry fits in 16 bits.  Values between entries are linearly interpolated.
+
+#include <inttypes.h>
+#ifndef SIMULATOR
+	#include <avr/pgmspace.h>
+#endif
+
+// 1 / m for m = 1 + i / 128, 0 <= i <= 128.  Entries are rounded down, some by
+// a further 1, so that the interpolated values never exceed 1 / m
+const uint16_t reciprocal_table[129] PROGMEM = {
+	32767, 32258, 31758, 31266, 30781, 30303, 29832, 29369,
+	28912, 28461, 28018, 27580, 27149, 26724, 26305, 25892,
+	25485, 25083, 24687, 24296, 23910, 23530, 23155, 22784,
+	22419, 22058, 21702, 21351, 21004, 20662, 20323, 19990,
+	19659, 19334, 19013, 18694, 18381, 18071, 17764, 17462,
+	17163, 16868, 16576, 16288, 16001, 15720, 15442, 15166,
+	14894, 14624, 14358, 14095, 13835, 13577, 13322, 13070,
+	12822, 12574, 12332, 12090, 11851, 11616, 11382, 11151,
+	10922, 10695, 10472, 10249, 10031,  9813,  9598,  9385,
+	 9174,  8966,  8759,  8555,  8352,  8151,  7953,  7756,
+	 7561,  7368,  7177,  6988,  6800,  6614,  6431,  6248,
+	 6067,  5889,  5711,  5535,  5362,  5189,  5018,  4848,
+	 4681,  4514,  4349,  4186,  4024,  3863,  3704,  3546,
+	 3389,  3234,  3080,  2928,  2776,  2626,  2478,  2330,
+	 2184,  2039,  1895,  1753,  1611,  1470,  1332,  1193,
+	 1056,   921,   786,   652,   520,   388,   258,   128,
+	    0
+};
+
+// 1 / sqrt(m) for m = 1 + i / 64, 0 <= i <= 192
+const uint16_t inverse_sqrt_table[193] PROGMEM = {
+	32768, 32262, 31767, 31284, 30811, 30349, 29896, 29454,
+	29020, 28595, 28179, 27772, 27372, 26980, 26596, 26219,
+	25849, 25486, 25130, 24780, 24437, 24099, 23767, 23442,
+	23121, 22806, 22497, 22192, 21893, 21598, 21308, 21023,
+	20742, 20465, 20193, 19925, 19661, 19401, 19144, 18892,
+	18643, 18397, 18155, 17917, 17682, 17450, 17221, 16995,
+	16773, 16553, 16336, 16122, 15911, 15702, 15497, 15293,
+	15093, 14895, 14699, 14505, 14314, 14126, 13939, 13755,
+	13573, 13393, 13215, 13039, 12865, 12694, 12524, 12356,
+	12189, 12025, 11862, 11702, 11542, 11385, 11229, 11075,
+	10923, 10772, 10622, 10475, 10328, 10183, 10040,  9898,
+	 9757,  9618,  9480,  9344,  9209,  9075,  8942,  8811,
+	 8681,  8552,  8424,  8297,  8172,  8048,  7925,  7803,
+	 7682,  7562,  7443,  7325,  7209,  7093,  6978,  6864,
+	 6752,  6640,  6529,  6419,  6310,  6202,  6095,  5988,
+	 5883,  5778,  5675,  5572,  5470,  5368,  5268,  5168,
+	 5069,  4971,  4874,  4777,  4681,  4586,  4492,  4398,
+	 4305,  4212,  4121,  4030,  3940,  3850,  3761,  3673,
+	 3585,  3498,  3411,  3325,  3240,  3156,  3072,  2988,
+	 2905,  2823,  2741,  2660,  2579,  2499,  2420,  2341,
+	 2262,  2185,  2107,  2030,  1954,  1878,  1803,  1728,
+	 1653,  1579,  1506,  1433,  1360,  1288,  1217,  1145,
+	 1075,  1004,   935,   865,   796,   728,   659,   592,
+	  524,   457,   391,   325,   259,   194,   129,    64,
+	    0
+};
+
+#endif
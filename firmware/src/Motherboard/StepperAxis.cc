@@ -31,7 +31,7 @@
 #include "Eeprom.hh"
 #include "EepromDefaults.hh"
 
-#ifndef SIMULATOR
+#if !defined(SIMULATOR) || defined(STEPSIM)
 //Optimize this better, maybe load defaults from progmem, x_min/max could combine invert_endstop/invert_axis into 1
 //110 bytes
 StepperIOPort xMax = X_STEPPER_MAX;
@@ -58,6 +58,8 @@ volatile bool z_min_endstop = true;
 struct StepperAxis stepperAxis[STEPPER_COUNT];
 
 volatile int32_t dda_position[STEPPER_COUNT];
+volatile int32_t dda_steps_suppressed[STEPPER_COUNT];
+volatile uint8_t dda_suppressed_axes;
 volatile bool    axis_homing[STEPPER_COUNT];
 volatile int16_t e_steps[EXTRUDERS];
 volatile uint8_t axesEnabled;			//Planner axis enabled
@@ -67,6 +69,79 @@ volatile uint8_t axesHardwareEnabled;		//Hardware axis enabled
 static uint8_t pstop_enable = 0;
 #endif
 
+#ifdef BATCHED_STEP_PORTS
+struct StepperPortGroup	stepperStepPorts[STEPPER_COUNT];
+uint8_t			stepperStepPortCount;
+struct StepperStepPin	stepperStepPins[STEPPER_COUNT];
+
+/// Groups the step pins of the axes stepped by the stepper interrupt by port.
+/// With JKN_ADVANCE, the extruders are stepped by the extruder interrupt instead.
+static void stepperAxisGroupStepPorts() {
+	stepperStepPortCount = 0;
+
+#if !defined(SIMULATOR) || defined(STEPSIM)
+	for (uint8_t i = 0; i < STEPPER_COUNT; i ++ ) {
+		stepperStepPins[i].group = 0;
+		stepperStepPins[i].mask  = 0;
+
+#ifdef JKN_ADVANCE
+		if ( i >= A_AXIS )	continue;
+#endif
+		if ( STEPPER_IOPORT_NULL(stepperAxisPorts[i].step) )	continue;
+
+		uint8_t g;
+		for ( g = 0; g < stepperStepPortCount; g ++ )
+			if ( stepperStepPorts[g].port == stepperAxisPorts[i].step.port )	break;
+
+		if ( g == stepperStepPortCount ) {
+			stepperStepPorts[g].port = stepperAxisPorts[i].step.port;
+			stepperStepPorts[g].pins = 0;
+			stepperStepPortCount ++;
+		}
+
+		stepperStepPins[i].group = g;
+		stepperStepPins[i].mask  = _BV(stepperAxisPorts[i].step.pin);
+	}
+#endif
+}
+
+/// Sets the direction pins for the block about to be stepped, called when the stepper
+/// interrupt starts a block.  Axes sharing a port are written together.
+void stepperAxisSetDirections() {
+#if !defined(SIMULATOR) || defined(STEPSIM)
+	uint16_t port[STEPPER_COUNT];
+	uint8_t  set[STEPPER_COUNT], clear[STEPPER_COUNT];
+	uint8_t  count = 0;
+
+	for (uint8_t i = 0; i < STEPPER_COUNT; i ++ ) {
+		//Only axes moving on this block, the extruder interrupt handles the extruder directions
+		if ( ! stepperAxis[i].dda.enabled )	continue;
+#ifdef JKN_ADVANCE
+		if ( stepperAxis[i].dda.eAxis )		continue;
+#endif
+
+		uint8_t g;
+		for ( g = 0; g < count; g ++ )
+			if ( port[g] == stepperAxisPorts[i].dir.port )	break;
+
+		if ( g == count ) {
+			port[g]  = stepperAxisPorts[i].dir.port;
+			set[g]   = 0;
+			clear[g] = 0;
+			count ++;
+		}
+
+		if ( stepperAxis[i].dda.stepperDir ^ stepperAxis[i].invert_axis )
+			set[g]   |= _BV(stepperAxisPorts[i].dir.pin);
+		else	clear[g] |= _BV(stepperAxisPorts[i].dir.pin);
+	}
+
+	for (uint8_t g = 0; g < count; g ++ )
+		_SFR_MEM8(port[g]) = (_SFR_MEM8(port[g]) & ~clear[g]) | set[g];
+#endif
+}
+#endif
+
 /// Initialize a stepper axis
 void stepperAxisInit(bool hard_reset) {
 	uint8_t axes_invert = 0, endstops_invert = 0;
@@ -159,6 +234,7 @@ void stepperAxisInit(bool hard_reset) {
 
 			//We reset this here because we don't want an abort to lose track of positioning
 			dda_position[i]	= 0;
+			dda_steps_suppressed[i] = 0;
 
 			stepperAxis[i].hasHomed		 = false;
         		stepperAxis[i].hasDefinePosition = false;
@@ -190,6 +266,10 @@ void stepperAxisInit(bool hard_reset) {
 
 	for (uint8_t i = 0; i < EXTRUDERS; i ++ )
 		e_steps[i] = 0;
+
+#ifdef BATCHED_STEP_PORTS
+	stepperAxisGroupStepPorts();
+#endif
 }
 
 /// Returns the steps per mm for the given axis
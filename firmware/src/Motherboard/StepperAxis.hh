@@ -43,11 +43,13 @@ enum AxisEnum {
         B_AXIS
 };
 
-#ifndef SIMULATOR
+#if !defined(SIMULATOR) || defined(STEPSIM)
 
+#ifndef SIMULATOR
 #define  FORCE_INLINE __attribute__((always_inline)) inline
 
 #include "Motherboard.hh"
+#endif
 
 /// write a pin
 #define STEPPER_IOPORT_WRITE(IOPORT, v)		do {								\
@@ -77,6 +79,10 @@ enum AxisEnum {
 /// True if port is not defined
 #define STEPPER_IOPORT_NULL(IOPORT)		(IOPORT.port == 0)
 
+/// set / clear several pins on the same port, PORT is the address of the port register
+#define STEPPER_PORT_SET_PINS(PORT, MASK)	_SFR_MEM8(PORT) |=  (MASK)
+#define STEPPER_PORT_CLEAR_PINS(PORT, MASK)	_SFR_MEM8(PORT) &= ~(MASK)
+
 #else
 
 #define STEPPER_IOPORT_WRITE(IOPORT, v)
@@ -85,6 +91,8 @@ enum AxisEnum {
 #define	STEPPER_IOPORT_SET_INPUT(IOPORT)
 #define	STEPPER_IOPORT_SET_OUTPUT(IOPORT)
 #define STEPPER_IOPORT_NULL(IOPORT) (true)
+#define STEPPER_PORT_SET_PINS(PORT, MASK)
+#define STEPPER_PORT_CLEAR_PINS(PORT, MASK)
 
 #endif
 
@@ -134,8 +142,32 @@ struct StepperAxis {
 extern struct StepperAxisPorts	stepperAxisPorts[STEPPER_COUNT];
 extern struct StepperAxis 	stepperAxis[STEPPER_COUNT];
 
+#ifdef BATCHED_STEP_PORTS
+
+/// The step pins of the axes stepped by the stepper interrupt, grouped by port, so that
+/// all the axes stepping on a port are pulsed with a single write for each edge.
+struct StepperPortGroup {
+	uint16_t port;		//Address of the port register
+	uint8_t  pins;		//The pins to pulse on this step event
+};
+
+struct StepperStepPin {
+	uint8_t group;		//Index into stepperStepPorts
+	uint8_t mask;		//The pin on the port, as a bit mask
+};
+
+extern struct StepperPortGroup	stepperStepPorts[STEPPER_COUNT];
+extern uint8_t			stepperStepPortCount;
+extern struct StepperStepPin	stepperStepPins[STEPPER_COUNT];
+
+extern void stepperAxisSetDirections();
+
+#endif
+
 
 extern volatile int32_t dda_position[STEPPER_COUNT];
+extern volatile int32_t dda_steps_suppressed[STEPPER_COUNT];	// Steps held back by an endstop in the current block
+extern volatile uint8_t dda_suppressed_axes;			// Axes with dda_steps_suppressed != 0
 extern volatile int16_t e_steps[EXTRUDERS];
 extern volatile bool    axis_homing[STEPPER_COUNT];
 extern volatile uint8_t axesEnabled;			//Planner axis enabled
@@ -198,9 +230,9 @@ FORCE_INLINE bool stepperAxisIsAtMinimum(uint8_t axis) {
 	return (STEPPER_IOPORT_NULL(stepperAxisPorts[axis].minimum)) ? false : (STEPPER_IOPORT_READ(stepperAxisPorts[axis].minimum) ^ stepperAxis[axis].invert_endstop);
 }
 
-/// Makes a step, but checks if an endstop is triggered first, if it is, the
-/// step is abandoned and "true" is returned.
-FORCE_INLINE bool stepperAxisStepWithEndstopCheck(uint8_t axis, bool direction) {
+/// Returns true if the axis can step in direction, false if an endstop is triggered,
+/// in which case homing on the axis is finished.
+FORCE_INLINE bool stepperAxisEndstopClear(uint8_t axis, bool direction) {
 	//Cupcakes with a 3G5D Shield or Ugly Cable repurpose the Zmax, Xmax an Ymax endstop
 	//pins to drive the extruder, there's there's no "max" endstops
 	//Users can either use only min endstops, or there's an option to tie the min and max
@@ -213,7 +245,6 @@ FORCE_INLINE bool stepperAxisStepWithEndstopCheck(uint8_t axis, bool direction)
 		// All endstops are MIN endstops
 		if ( direction ||
 		     (!direction && !stepperAxisIsAtMinimum(axis)) ) {
-			stepperAxisStep(axis, true);
 			return true;
 		}
 		else {
@@ -227,7 +258,6 @@ FORCE_INLINE bool stepperAxisStepWithEndstopCheck(uint8_t axis, bool direction)
 		// X, Y endstops are MIN endstops
 		if ( ((axis == Z_AXIS) && (!direction || ( direction && !stepperAxisIsAtMaximum(axis)))) ||
 		     ((axis != Z_AXIS) && ( direction || (!direction && !stepperAxisIsAtMinimum(axis)))) ) {
-			stepperAxisStep(axis, true);
 			return true;
 		}
 		else {
@@ -238,7 +268,6 @@ FORCE_INLINE bool stepperAxisStepWithEndstopCheck(uint8_t axis, bool direction)
 #else
 	if ( ( direction && !stepperAxisIsAtMaximum(axis)) ||
 	     (!direction && !stepperAxisIsAtMinimum(axis)) ) {
-		stepperAxisStep(axis, true);
 		return true;
 	}
 	else {
@@ -248,6 +277,14 @@ FORCE_INLINE bool stepperAxisStepWithEndstopCheck(uint8_t axis, bool direction)
 #endif
 }
 
+/// Makes a step, but checks if an endstop is triggered first, if it is, the
+/// step is abandoned and "false" is returned.
+FORCE_INLINE bool stepperAxisStepWithEndstopCheck(uint8_t axis, bool direction) {
+	if ( ! stepperAxisEndstopClear(axis, direction) )	return false;
+	stepperAxisStep(axis, true);
+	return true;
+}
+
 /// DDA
 
 #define DDA_IND stepperAxis[ind].dda
@@ -327,6 +364,10 @@ FORCE_INLINE void stepperAxis_dda_step(uint8_t ind)
 			stepperAxisSetDirection(ind, DDA_IND.stepperDir );
 			if ( stepperAxisStepWithEndstopCheck(ind, DDA_IND.stepperDir) )
 				dda_position[ind] += DDA_IND.direction;
+			else {
+				dda_steps_suppressed[ind] += DDA_IND.direction;
+				dda_suppressed_axes |= _BV(ind);
+			}
 			stepperAxisStep(ind, false);
 #ifdef JKN_ADVANCE
 		}
@@ -336,6 +377,101 @@ FORCE_INLINE void stepperAxis_dda_step(uint8_t ind)
 	}
 }
 
+#ifdef BATCHED_STEP_PORTS
+
+/// As stepperAxis_dda_step, but instead of pulsing the step pin, it's added to the
+/// pins for it's port.  Returns the axis as a bit mask if the step pin needs pulsing,
+/// the pulse and dda_position are then done by stepperAxis_dda_step_all.
+FORCE_INLINE uint8_t stepperAxis_dda_step_batched(uint8_t ind)
+{
+	if ( ! DDA_IND.enabled )	return 0;
+
+	uint8_t stepped = 0;
+
+	DDA_IND.counter += DDA_IND.steps;
+	if (( DDA_IND.counter > 0 ) && ( DDA_IND.steps_completed < DDA_IND.steps ))
+	{
+		DDA_IND.counter -= DDA_IND.master_steps;
+
+#ifdef JKN_ADVANCE
+               	if ( DDA_IND.eAxis ) {
+#ifndef SIMULATOR
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Warray-bounds"
+#endif
+			e_steps[ind-A_AXIS] += DDA_IND.direction;
+			dda_position[ind] += DDA_IND.direction;
+#ifndef SIMULATOR
+#pragma GCC diagnostic pop
+#endif
+		}
+		else
+#endif
+		if ( stepperAxisEndstopClear(ind, DDA_IND.stepperDir) ) {
+			stepperStepPorts[stepperStepPins[ind].group].pins |= stepperStepPins[ind].mask;
+			stepped = _BV(ind);
+		} else {
+			dda_steps_suppressed[ind] += DDA_IND.direction;
+			dda_suppressed_axes |= _BV(ind);
+		}
+
+		DDA_IND.steps_completed ++;
+	}
+
+	return stepped;
+}
+
+#endif
+
+/// Steps the dda for each axis.  With BATCHED_STEP_PORTS, the step pins for all the axes
+/// are raised together, one write per port, and dropped together after dda_position is updated,
+/// which also gives the drivers their minimum step pulse width.  The direction pins are
+/// set once for the block by stepperAxisSetDirections.
+FORCE_INLINE void stepperAxis_dda_step_all()
+{
+#ifdef BATCHED_STEP_PORTS
+	uint8_t stepped;
+
+	stepped  = stepperAxis_dda_step_batched(X_AXIS);
+	stepped |= stepperAxis_dda_step_batched(Y_AXIS);
+	stepped |= stepperAxis_dda_step_batched(Z_AXIS);
+	stepped |= stepperAxis_dda_step_batched(A_AXIS);
+#if EXTRUDERS > 1
+	stepped |= stepperAxis_dda_step_batched(B_AXIS);
+#endif
+
+	if ( ! stepped )	return;
+
+	uint8_t g;
+	for ( g = 0; g < stepperStepPortCount; g ++ ) {
+		if ( stepperStepPorts[g].pins )	STEPPER_PORT_SET_PINS(stepperStepPorts[g].port, stepperStepPorts[g].pins);
+	}
+
+	if ( stepped & _BV(X_AXIS) )	dda_position[X_AXIS] += stepperAxis[X_AXIS].dda.direction;
+	if ( stepped & _BV(Y_AXIS) )	dda_position[Y_AXIS] += stepperAxis[Y_AXIS].dda.direction;
+	if ( stepped & _BV(Z_AXIS) )	dda_position[Z_AXIS] += stepperAxis[Z_AXIS].dda.direction;
+	if ( stepped & _BV(A_AXIS) )	dda_position[A_AXIS] += stepperAxis[A_AXIS].dda.direction;
+#if EXTRUDERS > 1
+	if ( stepped & _BV(B_AXIS) )	dda_position[B_AXIS] += stepperAxis[B_AXIS].dda.direction;
+#endif
+
+	for ( g = 0; g < stepperStepPortCount; g ++ ) {
+		if ( stepperStepPorts[g].pins ) {
+			STEPPER_PORT_CLEAR_PINS(stepperStepPorts[g].port, stepperStepPorts[g].pins);
+			stepperStepPorts[g].pins = 0;
+		}
+	}
+#else
+	stepperAxis_dda_step(X_AXIS);
+	stepperAxis_dda_step(Y_AXIS);
+	stepperAxis_dda_step(Z_AXIS);
+	stepperAxis_dda_step(A_AXIS);
+#if EXTRUDERS > 1
+	stepperAxis_dda_step(B_AXIS);
+#endif
+#endif
+}
+
 /// Clips an axis to the minimum step limit.  It returns target if it doesn't require clipping,
 /// and min_axis_steps_limit if it does
 FORCE_INLINE int32_t stepperAxis_clip_to_min(uint8_t axis, int32_t target)
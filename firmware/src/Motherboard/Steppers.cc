@@ -23,6 +23,7 @@
 #include "Steppers.hh"
 #include "StepperAxis.hh"
 #include <stdint.h>
+#include <math.h>
 #include <util/delay.h>
 #include <util/atomic.h>
 #include "Eeprom.hh"
@@ -33,6 +34,7 @@
 #else
 
 #define __STDC_LIMIT_MACROS
+#include <math.h>		// Before Simulator.hh redefines double
 #include "Steppers.hh"
 #include "StepperAxis.hh"
 #include <stdint.h>
@@ -50,10 +52,14 @@
 #endif
 #define labs(x) abs(x)
 
+// stepsim links in the real StepperAccel.cc
+#ifndef STEPSIM
 #define st_init()
 #define st_interrupt() false
+#define st_prep_buffer()
 #define st_extruder_interrupt()
 #define quickStop()
+#endif
 #define DEBUG_TIMER_TCTIMER_USI 0
 #define DEBUG_TIMER_START
 #define DEBUG_TIMER_FINISH
@@ -102,6 +108,18 @@ uint8_t toolIndex = 0;
 uint16_t debugTimer = 0;
 #endif
 
+#ifdef ACCELERATION_COALESCE_ANGLE
+// Coalescing of collinear moves, see setTargetNewExt
+static FPTYPE	coalesce_cos2;				// cos^2 of the max. angle between merged moves, 0 if disabled
+static bool	coalesce_valid;				// True if the next move may extend the last block
+static int32_t	coalesce_start[STEPPER_COUNT];		// Where the last block starts, in steps
+static FPTYPE	coalesce_per_mm[STEPPER_COUNT];		// Each axis's mm per mm of XYZ travel in the last block
+static FPTYPE	coalesce_distance;			// Length of the last block in mm
+static int32_t	coalesce_max_delta;			// Master axis steps of the last block
+static int32_t	coalesce_dda_rate;			// Dda_rate of the last block
+static FPTYPE	coalesce_feedrate;
+#endif
+
 
 bool isRunning() {
 	return is_running || is_homing;
@@ -359,6 +377,33 @@ bool eepromIsSane() {
 	return true;
 }
 
+//Sets the acceleration limits in steps/s^2 the planner plans with from
+//max_acceleration_units_per_sq_second.  An S-curve ramp takes as long as the
+//trapezoid it follows and peaks at 100 / (100 - scurve_percent) times its
+//acceleration, so with S-curves the planner is given (100 - scurve_percent)%
+//of each limit, and the peak keeps to the limit.
+
+static void calcAxisAccelerations() {
+	for (uint8_t i = 0; i < STEPPER_COUNT; i ++) {
+		float steps_per_sqr_second = (float)max_acceleration_units_per_sq_second[i] * stepperAxisStepsPerMM(i);
+	#ifdef STEP_SEGMENT_BUFFER
+		steps_per_sqr_second *= (float)(100 - scurve_percent) / 100.0;
+	#endif
+		axis_steps_per_sqr_second[i] = (uint32_t)steps_per_sqr_second;
+		axis_accel_step_cutoff[i] = (uint32_t)0xffffffff / axis_steps_per_sqr_second[i];
+	}
+}
+
+#ifdef STEP_SEGMENT_BUFFER
+
+void setSCurvePercent(uint8_t percent) {
+	if ( percent > 50 )	percent = 50;
+	scurve_percent = percent;
+	calcAxisAccelerations();
+}
+
+#endif
+
 void reset() {
 	if ( ! eepromIsSane() ) eeprom::setJettyFirmwareDefaults();
 
@@ -403,10 +448,14 @@ void reset() {
 		// can be performed without overflow issues
 		if (max_acceleration_units_per_sq_second[i] > (uint32_t)((float)0xFFFFF / stepperAxisStepsPerMM(i)))
 		     max_acceleration_units_per_sq_second[i] = (uint32_t)((float)0xFFFFF / stepperAxisStepsPerMM(i));
-		axis_steps_per_sqr_second[i] = (uint32_t)((float)max_acceleration_units_per_sq_second[i] * stepperAxisStepsPerMM(i));
-		axis_accel_step_cutoff[i] = (uint32_t)0xffffffff / axis_steps_per_sqr_second[i];
 	}
 
+	#ifdef STEP_SEGMENT_BUFFER
+		setSCurvePercent(eeprom::getEeprom8(eeprom::ACCEL_S_CURVE_PERCENT, EEPROM_DEFAULT_ACCEL_S_CURVE_PERCENT));
+	#else
+		calcAxisAccelerations();
+	#endif
+
 	//Set default acceleration for "Normal Moves (acceleration)" and "filament only moves (retraction)" in mm/sec^2
 
 #ifdef OLD_ACCEL_LIMITS
@@ -475,12 +524,20 @@ void reset() {
 	// if unwanted behavior is observed on a user's machine when running at very slow speeds.
 	minimumPlannerSpeed = FTOFP((float)ACCELERATION_MIN_PLANNER_SPEED);
 
+	#ifdef ACCELERATION_JUNCTION_DEVIATION
+		junction_deviation = FTOFP((float)ACCELERATION_JUNCTION_DEVIATION);
+	#endif
+
 	if ( eeprom::getEeprom8(eeprom::ACCEL_SLOWDOWN_FLAG, EEPROM_DEFAULT_ACCEL_SLOWDOWN_FLAG) ) {
 		slowdown_limit = (int)ACCELERATION_SLOWDOWN_LIMIT;
 		if ( slowdown_limit > (BLOCK_BUFFER_SIZE / 2))  slowdown_limit = 0;
 	}
 	else	slowdown_limit = 0;	
 
+	#ifdef ACCELERATION_COALESCE_ANGLE
+		setCoalesceAngle(ACCELERATION_COALESCE_ANGLE);
+	#endif
+
 	//Clockwise extruder
 	extrude_when_negative[0] = ACCELERATION_EXTRUDE_WHEN_NEGATIVE_A;
 	#if EXTRUDERS > 1
@@ -559,6 +616,10 @@ void abort() {
 
         is_running = false;
         is_homing = false;
+
+#ifdef ACCELERATION_COALESCE_ANGLE
+	coalesce_valid = false;
+#endif
 	
 	stepperAxisInit(false);
 
@@ -570,6 +631,10 @@ void abort() {
 void definePosition(const Point& position_in, bool home) {
 	Point position_offset = position_in;
 
+#ifdef ACCELERATION_COALESCE_ANGLE
+	coalesce_valid = false;
+#endif
+
 	for ( uint8_t i = 0; i < STEPPER_COUNT; i ++ ) {
 		stepperAxis[i].hasDefinePosition = true;
 
@@ -681,6 +746,10 @@ void setHoldZ(bool holdZ_in) {
 
 
 void setTarget(const Point& target, int32_t dda_interval) {
+#ifdef ACCELERATION_COALESCE_ANGLE
+	coalesce_valid = false;
+#endif
+
 	//Add on the tool offsets
 	for ( uint8_t i = 0; i < STEPPER_COUNT; i ++ )
 		planner_target[i] = target[i] + (*tool_offsets)[i];
@@ -721,6 +790,7 @@ void setTarget(const Point& target, int32_t dda_interval) {
 	uint32_t dda_rate = (uint32_t)(1000000 / dda_interval);
 
 	plan_buffer_line(0, dda_rate, toolIndex, false, toolIndex);
+	st_prep_buffer();
 
 	if ( movesplanned() >=  plannerMaxBufferSize) is_running = true;
 	else                                          is_running = false;
@@ -728,6 +798,10 @@ void setTarget(const Point& target, int32_t dda_interval) {
 
 
 void setTargetNew(const Point& target, int32_t us, uint8_t relative) {
+#ifdef ACCELERATION_COALESCE_ANGLE
+	coalesce_valid = false;
+#endif
+
 	//Add on the tool offsets and convert relative moves into absolute moves
 	for ( uint8_t i = 0; i < STEPPER_COUNT; i ++ ) {
 		planner_target[i] = target[i] + (*tool_offsets)[i];
@@ -775,34 +849,18 @@ void setTargetNew(const Point& target, int32_t us, uint8_t relative) {
 	uint32_t dda_rate	= (uint32_t)(1000000 / dda_interval);
 
 	plan_buffer_line(0, dda_rate, toolIndex, false, toolIndex);
+	st_prep_buffer();
 
 	if ( movesplanned() >=  plannerMaxBufferSize)      is_running = true;
 	else                                               is_running = false;
 }
 
 
-//Dda_rate is the number of dda steps per second for the master axis
-
-void setTargetNewExt(const Point& target, int32_t dda_rate, uint8_t relative, float distance, int16_t feedrateMult64) {
-
-	//Add on the tool offsets and convert relative moves into absolute moves
-	for ( uint8_t i = 0; i < STEPPER_COUNT; i ++ ) {
-		planner_target[i] = target[i] + (*tool_offsets)[i];
-
-		if ((relative & (1 << i)) != 0) {
-			planner_target[i] = planner_position[i] + planner_target[i];
-		}
-	}
+//Calculate the maximum steps of any axis and store in planner_master_steps
+//Also calculate the step deltas (planner_steps[i]) and delta_mm at the same time.
+//Returns the maximum steps.
 
-#ifdef CLIP_Z_AXIS
-	//Clip the Z axis so that it can't move outside the build area.
-	//Addresses a specific issue with old start.gcode for the replicator.
-	//It has a G1 Z155 command that was slamming the platform into the floor.  
-	planner_target[Z_AXIS] = stepperAxis_clip_to_max(Z_AXIS, planner_target[Z_AXIS]);
-#endif
-
-        //Calculate the maximum steps of any axis and store in planner_master_steps
-        //Also calculate the step deltas (planner_steps[i]) at the same time.
+static int32_t calcPlannerDeltas() {
         int32_t max_delta = 0;
         planner_master_steps_index = 0;
 	planner_axes = 0;
@@ -827,6 +885,134 @@ void setTargetNewExt(const Point& target, int32_t dda_rate, uint8_t relative, fl
         }
         planner_master_steps = (uint32_t)max_delta;
 
+	return max_delta;
+}
+
+
+//The length in mm of the move calcPlannerDeltas() set up: the length of its
+//X, Y and Z deltas or, for a move of the extruders alone, of the longer one
+
+static float calcPlannerDistance() {
+	float d = 0.0;
+	for ( uint8_t i = X_AXIS; i <= Z_AXIS; i ++ ) {
+		float mm = FPTOF(delta_mm[i]);
+		d += mm * mm;
+	}
+	if ( d > 0.0 )	return sqrt(d);
+
+	for ( uint8_t i = A_AXIS; i < STEPPER_COUNT; i ++ ) {
+		float mm = fabs(FPTOF(delta_mm[i]));
+		if ( mm > d )	d = mm;
+	}
+	return d;
+}
+
+
+#ifdef ACCELERATION_COALESCE_ANGLE
+
+void setCoalesceAngle(float degrees) {
+	if ( degrees > 0.0 ) {
+		float c = cos(degrees * (M_PI / 180.0));
+		coalesce_cos2 = FTOFP(c * c);
+	}
+	else	coalesce_cos2 = 0;
+	coalesce_valid = false;
+}
+
+
+//Sets per_mm to each axis's mm per mm of XYZ travel in the move calcPlannerDeltas() set up, so
+//that for X, Y and Z it's the move's unit vector.  Scaling by the longest delta first keeps
+//the sum of the squares within the range of FPTYPE.  Returns the XYZ length of the move in mm,
+//or 0 for a move of the extruders alone.
+
+static FPTYPE calcPlannerPerMM(FPTYPE *per_mm) {
+	FPTYPE longest = 0;
+	for ( uint8_t i = X_AXIS; i <= Z_AXIS; i ++ )
+		if ( FPABS(delta_mm[i]) > longest )	longest = FPABS(delta_mm[i]);
+	if ( longest == 0 )	return 0;
+
+	FPTYPE sum = 0;
+	for ( uint8_t i = X_AXIS; i <= Z_AXIS; i ++ ) {
+		FPTYPE d = FPDIV_TABLE(delta_mm[i], longest);
+		sum += FPMULT2(d, d);
+	}
+	FPTYPE length = FPMULT2(longest, FPSQRT(sum));
+
+	for ( uint8_t i = 0; i < STEPPER_COUNT; i ++ )
+		per_mm[i] = FPDIV_TABLE(delta_mm[i], length);
+	return length;
+}
+
+
+//Returns true if the move from planner_position to planner_target can be merged with the last
+//block, which runs from coalesce_start to planner_position:
+//	The XYZ directions are within the coalescing angle of each other
+//	The extrusion per mm matches, to within a step and 3%
+//	The feedrate matches
+//	The merged move stays within 0x7fff steps on every axis, like most moves do
+//
+//The move's delta_mm must have been calculated.  The tests are made on mm per mm of XYZ
+//travel (see calcPlannerPerMM), which stays well within the range of FPTYPE.
+
+static bool canCoalesce(FPTYPE feedrate) {
+	if ( ! coalesce_valid || feedrate != coalesce_feedrate )	return false;
+
+	FPTYPE per_mm[STEPPER_COUNT];
+	FPTYPE length = calcPlannerPerMM(per_mm);
+	if ( length == 0 )	return false;
+
+	//Both are unit vectors, so dot is the cosine of the angle between them
+	FPTYPE dot = 0;
+	for ( uint8_t i = X_AXIS; i <= Z_AXIS; i ++ )
+		dot += FPMULT2(coalesce_per_mm[i], per_mm[i]);
+	if (( dot <= 0 ) || ( FPMULT2(dot, dot) < coalesce_cos2 ))	return false;
+
+	//A step's worth of extrusion per mm is the step over the move's length
+	for ( uint8_t i = A_AXIS; i < STEPPER_COUNT; i ++ ) {
+		if (( planner_position[i] == coalesce_start[i] ) != ( planner_steps[i] == 0 ))	return false;
+		FPTYPE tolerance = FPDIV_TABLE(axis_steps_per_unit_inverse[i], length) +
+				   FPMULT2(FPABS(coalesce_per_mm[i]), KCONSTANT_0_03);
+		if ( FPABS(per_mm[i] - coalesce_per_mm[i]) > tolerance )	return false;
+	}
+
+	for ( uint8_t i = 0; i < STEPPER_COUNT; i ++ )
+		if ( labs(planner_target[i] - coalesce_start[i]) > 0x7fff )	return false;
+
+	return true;
+}
+
+#endif
+
+
+//Dda_rate is the number of dda steps per second for the master axis
+//
+//With ACCELERATION_COALESCE_ANGLE, a move that continues in the same direction as the last
+//block (see canCoalesce) replaces that block with one running from the start of the last block
+//to the end of this move, taking the same time as the two moves.  Only the newest block is
+//extended, and only until it's been started, so nothing is held back from the planner.
+
+void setTargetNewExt(const Point& target, int32_t dda_rate, uint8_t relative, float distance, int16_t feedrateMult64) {
+
+	//Add on the tool offsets and convert relative moves into absolute moves
+	for ( uint8_t i = 0; i < STEPPER_COUNT; i ++ ) {
+		planner_target[i] = target[i] + (*tool_offsets)[i];
+
+		if ((relative & (1 << i)) != 0) {
+			planner_target[i] = planner_position[i] + planner_target[i];
+		}
+	}
+
+#ifdef CLIP_Z_AXIS
+	//Clip the Z axis so that it can't move outside the build area.
+	//Addresses a specific issue with old start.gcode for the replicator.
+	//It has a G1 Z155 command that was slamming the platform into the floor.  
+	planner_target[Z_AXIS] = stepperAxis_clip_to_max(Z_AXIS, planner_target[Z_AXIS]);
+#endif
+
+	int32_t max_delta = calcPlannerDeltas();
+
+	if ( distance < 0.0 )	distance = calcPlannerDistance();
+
 	if (( planner_master_steps == 0 ) || ( distance == 0.0 )) {
 #ifdef DEBUG_BLOCK_BY_MOVE_INDEX
 		//To keep in sync with the simulator
@@ -859,7 +1045,38 @@ void setTargetNewExt(const Point& target, int32_t dda_rate, uint8_t relative, fl
 #endif
 	}
 
+#ifdef ACCELERATION_COALESCE_ANGLE
+	bool	use_accel = acceleration && segmentAccelState;
+	int32_t	start[STEPPER_COUNT];
+
+	for ( uint8_t i = 0; i < STEPPER_COUNT; i ++ )
+		start[i] = planner_position[i];
+
+	if ( use_accel && canCoalesce(feedrate) && plan_remove_last_block() ) {
+		//planner_position is now the start of the last block
+		for ( uint8_t i = 0; i < STEPPER_COUNT; i ++ )
+			start[i] = coalesce_start[i];
+		//Seconds the two moves take at their dda_rates
+		float time	= (float)coalesce_max_delta / (float)coalesce_dda_rate +
+				  (float)max_delta / (float)dda_rate;
+		max_delta	= calcPlannerDeltas();
+		planner_distance += coalesce_distance;
+		dda_rate	= (int32_t)((float)max_delta / time);
+	}
+#endif
+
 	plan_buffer_line(feedrate, dda_rate, toolIndex, acceleration && segmentAccelState, toolIndex);
+	st_prep_buffer();
+
+#ifdef ACCELERATION_COALESCE_ANGLE
+	coalesce_valid = use_accel && ( coalesce_cos2 != 0 ) && ( calcPlannerPerMM(coalesce_per_mm) != 0 );
+	for ( uint8_t i = 0; i < STEPPER_COUNT; i ++ )
+		coalesce_start[i] = start[i];
+	coalesce_distance = planner_distance;
+	coalesce_max_delta = max_delta;
+	coalesce_dda_rate  = dda_rate;
+	coalesce_feedrate = feedrate;
+#endif
 
 	if ( movesplanned() >=  plannerMaxBufferSize)      is_running = true;
 	else                                               is_running = false;
@@ -918,6 +1135,11 @@ void setSegmentAccelState(bool state) {
 void changeToolIndex(uint8_t tool) {
 	toolIndex = tool;
 
+#ifdef ACCELERATION_COALESCE_ANGLE
+	//The tool offsets change, so the next move can't extend the last block
+	coalesce_valid = false;
+#endif
+
 	//Just in case as toolIndex is used to index into arrays
 	//so we need a sane value here.
 	toolIndex %= 2;
@@ -952,6 +1174,9 @@ void deprimeEnable(bool enable) {
 
 
 void runSteppersSlice() {
+	//Keep the stepper interrupt supplied with segments
+	st_prep_buffer();
+
 #if 0
 #ifdef DEBUG_VALUE
 	uint8_t bufferUsed = movesplanned();
@@ -988,7 +1213,9 @@ void doStepperInterrupt() {
 	//is_running is determined when a buffer item is added, however
 	//if st_interrupt deletes a buffer item, then is_running must have changed
 	//and now be false, so we set it here
+	ISR_PROFILE_START(profile_start);
 	if ( st_interrupt() ) is_running = false;
+	ISR_PROFILE_END(PROFILE_ST_INTERRUPT, profile_start);
 
 	//If we're homing, there's a few possibilities:
 	//1. The homing is still running on one of the axis
@@ -1014,6 +1241,12 @@ void doStepperInterrupt() {
 		}
 	}
 
+#if defined(ISR_PROFILING) && ! defined(SIMULATOR)
+	//If the timer has already passed the interrupt st_interrupt scheduled, we've
+	//taken longer than the step period and the next interrupt is late
+	if ( STEPPER_TCNTn >= STEPPER_OCRnA )	ISR_PROFILE_OVERRUN;
+#endif
+
 #if defined(DEBUG_ONSCREEN) && defined(TIME_STEPPER_INTERRUPT)
         DEBUG_TIMER_FINISH;
         debugTimer = DEBUG_TIMER_TCTIMER_USI;
@@ -1022,7 +1255,9 @@ void doStepperInterrupt() {
 
 
 void doExtruderInterrupt() {
+	ISR_PROFILE_START(profile_start);
 	st_extruder_interrupt();
+	ISR_PROFILE_END(PROFILE_ST_EXTRUDER_INTERRUPT, profile_start);
 }
 
 }
@@ -111,7 +111,9 @@ namespace steppers {
     /// \param[in] relative Bitfield specifying whether each axis should
     ///                     interpret the new position as absolute or
     ///                     relative.
-    /// \param[in] distance of the move in mm's
+    /// \param[in] distance of the move in mm's, or negative to derive it
+    ///                     from the move: the length of its X, Y and Z
+    ///                     deltas or, if that's 0, of its longest A or B delta
     /// \param[in] feedrate of the move in mm's per second multiplied by 64
     void setTargetNewExt(const Point& target, int32_t dda_rate, uint8_t relative, float distance, int16_t feedrateMult64);
 
@@ -163,6 +165,19 @@ namespace steppers {
     /// Remove offsets from a position; used to determine distance to move when
     /// clearing the platform
     Point removeOffsets(const Point& position);
+
+#ifdef ACCELERATION_COALESCE_ANGLE
+    /// Set the max. angle in degrees between consecutive moves that setTargetNewExt
+    /// merges into one block.  0 disables coalescing.
+    void setCoalesceAngle(float degrees);
+#endif
+
+#ifdef STEP_SEGMENT_BUFFER
+    /// Set the S-curve jerk phase as a percentage of each ramp, at most 50, or 0
+    /// for trapezoids, and plan with accelerations whose S-curve peaks keep to
+    /// the max. accelerations.
+    void setSCurvePercent(uint8_t percent);
+#endif
 };
 
 #endif // STEPPERS_HH_
@@ -0,0 +1,144 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "Telemetry.hh"
+
+#ifdef HOST_TELEMETRY
+
+#include "Commands.hh"
+#include "Command.hh"
+#include "Host.hh"
+#include "Steppers.hh"
+#include "StepperAccel.hh"
+#include "ExtruderControl.hh"
+#include "Motherboard.hh"
+#include "Timeout.hh"
+#include "UART.hh"
+#include "EepromMap.hh"
+#include "Eeprom.hh"
+
+#ifndef HOST_TX_BUFFER
+#error HOST_TELEMETRY needs HOST_TX_BUFFER to send frames between responses
+#endif
+
+#define TELEMETRY_FIELDS (TELEMETRY_TEMPERATURES | TELEMETRY_POSITION | \
+			  TELEMETRY_BUFFER | TELEMETRY_MOVES | \
+			  TELEMETRY_BUILD | TELEMETRY_ERRORS)
+
+// Room a packet may take in the transmit buffer: start byte, sequence
+// number, length, payload and CRC
+#define PACKET_ROOM (MAX_PACKET_PAYLOAD + 4)
+
+namespace telemetry {
+
+static uint8_t fields = 0;
+static micros_t period_micros;
+static Timeout frame_timeout;
+
+// Extruder 0, extruder 1 and platform temperatures.  Only one is read from
+// the tools for each frame, so a frame waits on the slave bus for at most
+// one response.
+static uint16_t temperatures[3];
+static uint8_t next_temperature;
+
+uint8_t start(uint16_t period, uint8_t requested) {
+	fields = requested & TELEMETRY_FIELDS;
+	if (period == 0 || fields == 0) {
+		stop();
+		return 0;
+	}
+	if (period < TELEMETRY_MIN_PERIOD) period = TELEMETRY_MIN_PERIOD;
+	period_micros = 1000L * period;
+	for (uint8_t i = 0; i < 3; i++)
+		temperatures[i] = 0;
+	next_temperature = 0;
+	// The first frame follows the response
+	frame_timeout.start(0);
+	return fields;
+}
+
+void stop() {
+	fields = 0;
+	frame_timeout.abort();
+}
+
+/// Read a temperature from a tool, or 0 if it doesn't answer
+static uint16_t readTemperature(uint8_t tool, uint8_t command) {
+	OutPacket responsePacket;
+	if (extruderControl(tool, command, EXTDR_CMD_GET, responsePacket, 0))
+		return responsePacket.read16(1);
+	return 0;
+}
+
+/// Read the next temperature in turn, skipping extruder 1 if there's no
+/// second tool to ask
+static void readNextTemperature() {
+	uint8_t i = next_temperature;
+	if (i == 1 && eeprom::getEeprom8(eeprom::TOOL_COUNT, 1) != 2) {
+		temperatures[1] = 0;
+		i = 2;
+	}
+	if (i == 2)
+		temperatures[2] = readTemperature(0, SLAVE_CMD_GET_PLATFORM_TEMP);
+	else
+		temperatures[i] = readTemperature(i, SLAVE_CMD_GET_TEMP);
+	next_temperature = (i == 2) ? 0 : i + 1;
+}
+
+void runTelemetrySlice() {
+	if (fields == 0 || !frame_timeout.hasElapsed())
+		return;
+
+	// Wait until a response could still follow the frame
+	if (UART::getTxCapacity() < 2 * PACKET_ROOM)
+		return;
+
+	OutPacket frame;
+	frame.setTelemetry();
+
+	if (fields & TELEMETRY_TEMPERATURES) {
+		readNextTemperature();
+		for (uint8_t i = 0; i < 3; i++)
+			frame.append16(temperatures[i]);
+	}
+	if (fields & TELEMETRY_POSITION) {
+		const Point p = steppers::getPlannerPosition();
+		for (uint8_t i = 0; i < 5; i++)
+			frame.append32(i < STEPPER_COUNT ? p[i] : 0);
+	}
+	if (fields & TELEMETRY_BUFFER)
+		frame.append16(command::getRemainingCapacity());
+	if (fields & TELEMETRY_MOVES)
+		frame.append8(movesplanned());
+	if (fields & TELEMETRY_BUILD) {
+		frame.append8(command::getBuildPercentage());
+		frame.append8(host::getBuildState());
+	}
+	if (fields & TELEMETRY_ERRORS) {
+		uint8_t flags = Motherboard::getBoard().getCurrentError() & TELEMETRY_ERROR_CODE;
+		if (command::pauseState() == PAUSE_STATE_ERROR)
+			flags |= TELEMETRY_ERROR_PAUSED;
+		frame.append8(flags);
+	}
+
+	// Nothing but the main loop adds to the transmit buffer, so there's
+	// still room
+	UART::queuePacket(frame);
+	frame_timeout.start(period_micros);
+}
+
+}
+
+#endif // HOST_TELEMETRY
@@ -0,0 +1,54 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef TELEMETRY_HH_
+#define TELEMETRY_HH_
+
+#include <stdint.h>
+#include "Configuration.hh"
+
+#ifdef HOST_TELEMETRY
+
+// Shortest period between frames, in ms
+#ifndef TELEMETRY_MIN_PERIOD
+#define TELEMETRY_MIN_PERIOD 50
+#endif
+
+/// Telemetry frames sent to the host unasked, so that it needn't poll for the
+/// board's status.  The host subscribes with HOST_CMD_SET_TELEMETRY, giving a
+/// period and the fields it wants; see Commands.hh for the frame's layout.
+/// Frames are queued in the host UART's transmit buffer only when it has room
+/// for a response as well, so they never hold up a response.  A frame which
+/// can't be sent when it's due is sent once there's room.  Each frame reads
+/// only one of its temperatures from the tools, in turn, and sends the last
+/// readings of the others.
+namespace telemetry {
+
+    /// Start sending frames, or change their period or fields.
+    /// \param[in] period Milliseconds between frames, or 0 to stop them
+    /// \param[in] fields TELEMETRY_* bits for the fields to send
+    /// \return The fields which will be sent, or 0 if frames are stopped
+    uint8_t start(uint16_t period, uint8_t fields);
+
+    /// Stop sending frames; called when the host resets the board.
+    void stop();
+
+    /// Send a frame if one is due and there is room for it.
+    void runTelemetrySlice();
+}
+
+#endif // HOST_TELEMETRY
+
+#endif // TELEMETRY_HH_
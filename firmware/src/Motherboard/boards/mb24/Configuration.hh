@@ -53,6 +53,26 @@
 
 // --- Host UART configuration ---
 // The host UART is presumed to always be present on the RX/TX lines.
+// When HOST_WINDOW is defined, a host may open a receive window with
+// HOST_CMD_OPEN_WINDOW and then send up to HOST_WINDOW_SIZE sequenced packets
+// without waiting for their responses; see PacketWindow.hh.  Each packet in
+// the window costs about 40 bytes of RAM.  The size must be a power of 2.
+#define HOST_WINDOW
+#define HOST_WINDOW_SIZE        4
+// When HOST_TX_BUFFER is defined, responses are copied into a transmit buffer
+// of HOST_TX_BUFFER_SIZE bytes and sent from the data register empty
+// interrupt, so the next packet can be handled while one is sent.  A packet
+// takes at most 36 bytes.  The size must be a power of 2.
+#define HOST_TX_BUFFER
+#define HOST_TX_BUFFER_SIZE     128
+// When HOST_TELEMETRY is defined, a host may subscribe with
+// HOST_CMD_SET_TELEMETRY to status frames sent every so many ms, rather than
+// polling for temperatures, position and build status.  Needs HOST_TX_BUFFER.
+#define HOST_TELEMETRY
+// When PACKET_CRC_TABLE is defined, packet CRCs are looked up in a 256 byte
+// table in flash rather than computed bit by bit for each byte.  The
+// extruder boards, which have less flash to spare, leave it out.
+#define PACKET_CRC_TABLE
 
 
 // --- Piezo Buzzer configuration ---
@@ -213,6 +233,21 @@
 //there's no speeding up between blocks.
 //#define PLANNER_OFF
 
+//The number of blocks in the planner's lookahead buffer, must be a power of 2.
+//Deeper lookahead allows faster cornering through curves made of many small segments.
+//Each block takes about 91 bytes of RAM, so 32 blocks take about 1.4K more than 16.
+#ifndef BLOCK_BUFFER_SIZE
+	#define BLOCK_BUFFER_SIZE 32
+#endif
+
+//If defined, the main loop slices the planned blocks into short segments with the step timing
+//precomputed, and the stepper interrupt only steps the dda's, leaving more time for the main loop at
+//high step rates.  The value is the number of segments buffered (2.5ms to 10ms each), must be a power of 2.
+//If the main loop is held up for longer than the buffered segments last, the stepper interrupt slices
+//the next segment itself, so the axes don't stop mid move.
+//Comment out to calculate the step timing in the stepper interrupt.
+#define STEP_SEGMENT_BUFFER 16
+
 //If defined provides 2 debugging variables for on screen display during build
 //Variables are floats:  debug_onscreen1, debug_onscreen2 and can be found in Steppers.hh
 //#define DEBUG_ONSCREEN
@@ -222,6 +257,13 @@
 //which would lead to stack corruption.
 #define STACK_PAINT
 
+//If defined, Timer 5 runs free at the cpu clock and the time spent in st_interrupt,
+//st_extruder_interrupt, setup_next_block and plan_buffer_line is recorded in cycles (min / avg / max),
+//along with the number of times the stepper interrupt overran the next scheduled interrupt.
+//The counters are read with the host query HOST_CMD_GET_ISR_PROFILE.
+//The timing adds cycles to every stepper interrupt, so only enable it to take measurements.
+//#define ISR_PROFILING
+
 //Definitions for the timer / counter  to use for the stepper interrupt
 //Change this to a different 16 bit interrupt if you need to
 #define STEPPER_OCRnA			OCR3A
@@ -243,6 +285,11 @@
 
 #define JKN_ADVANCE
 
+//If defined, the stepper interrupt pulses the step pins of all the axes on the same port
+//with a single write per edge, and sets the direction pins once per block instead of on
+//every step.  On this board the X, Y and Z step pins are all on port A.
+#define BATCHED_STEP_PORTS
+
 //Minimum time in seconds that a movement needs to take if the planning pipeline command buffer is
 //emptied. Increase this number if you see blobs while printing high speed & high detail. It will
 //slowdown on the detailed stuff.
@@ -254,6 +301,22 @@
 //2mm/sec is the recommended value.
 #define ACCELERATION_MIN_PLANNER_SPEED 2
 
+//Junction deviation (mm).  If defined and not 0, the junction speeds between accelerated moves are
+//limited by the angle between the moves and the acceleration, rather than by the max speed changes
+//of each axis.  The speed is that at which a curve passing this close to the corner could be
+//followed.  Larger values corner faster, 0.01 to 0.1mm is typical, and it must not exceed 1mm.
+//0 uses the max speed changes.  Comment out to remove the junction deviation code.
+#define ACCELERATION_JUNCTION_DEVIATION 0.0
+
+//Collinear move coalescing (degrees).  If defined and not 0, an accelerated move whose direction is
+//within this angle of the newest block in the planner, and whose extrusion per mm and feed rate
+//match, is merged into that block if it hasn't been started and its entry speed can still change.
+//Slicers output long runs of tiny, almost collinear moves, merging them lets the lookahead cover
+//more distance.  The merged path cuts the corners by up to about a quarter of this angle (in
+//radians) times the merged length.
+//0 turns coalescing off.  Comment out to remove the coalescing code.
+#define ACCELERATION_COALESCE_ANGLE 0.0
+
 //Slowdown limit specifies what to do when the pipeline command buffer starts to empty.
 //The pipeline command buffer is 16 commands in length, and Slowdown Limit can be set
 //between 0 - 8 (half the buffer size).
@@ -334,6 +397,20 @@
 // Disabled SD card folder support owing to a broken SD card detect switch
 //#define BROKEN_SD
 
+// When defined, the LCD lists the files in each SD card folder sorted by name
+// rather than in the order they were written to the card.  The sorting is done
+// once, when the folder is opened.
+#define SORT_SD_FILES
+
+// When defined, SD card builds save a checkpoint to EEPROM every
+// RESUME_CHECKPOINT_INTERVAL seconds, and after a power failure the LCD's
+// "Resume Build" reheats, homes X and Y, and continues the build from the
+// last checkpoint.  Each checkpoint rewrites a few bytes of EEPROM, so
+// shorter intervals wear it sooner: with the 16 slots of Resume.hh, every
+// 120 seconds lasts over 25,000 hours of builds.
+#define RESUME_BUILD
+#define RESUME_CHECKPOINT_INTERVAL 120
+
 // Maximum temperature which temps can be set to (bypassed by gcode)
 #define MAX_TEMP 280
 
@@ -161,6 +161,14 @@
 //there's no speeding up between blocks.
 //#define PLANNER_OFF
 
+//The number of blocks in the planner's lookahead buffer, must be a power of 2.
+//Deeper lookahead allows faster cornering through curves made of many small segments.
+//The Mega 2560 has 8K of RAM, so this isn't constrained by SMALL_4K_RAM, but each
+//block takes about 91 bytes and this board's free RAM hasn't been measured at 32
+#ifndef BLOCK_BUFFER_SIZE
+	#define BLOCK_BUFFER_SIZE 16
+#endif
+
 //If defined provides 2 debugging variables for on screen display during build
 //Variables are floats:  debug_onscreen1, debug_onscreen2 and can be found in Steppers.hh
 //#define DEBUG_ONSCREEN
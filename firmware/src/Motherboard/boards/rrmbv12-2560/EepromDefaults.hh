@@ -56,6 +56,7 @@
 #define EEPROM_DEFAULT_DEPRIME_ON_TRAVEL                 1              // Okay to use deprime on travel
 
 #define EEPROM_DEFAULT_ACCEL_SLOWDOWN_FLAG		1
+#define EEPROM_DEFAULT_ACCEL_S_CURVE_PERCENT		0		// 0 = Trapezoidal acceleration
 
 #define EEPROM_DEFAULT_ACCEL_MAX_SPEED_CHANGE_X		300		// mm/s Multiplied by 10
 #define EEPROM_DEFAULT_ACCEL_MAX_SPEED_CHANGE_Y		300		// mm/s Multiplied by 10
@@ -170,6 +170,7 @@ struct fat_file_struct
     struct fat_dir_entry_struct dir_entry;
     offset_t pos;
     cluster_t pos_cluster;
+    cluster_t run_end;
 #ifdef FAT_DELAY_DIRENTRY_UPDATE
     uint8_t needs_write;
 #endif
@@ -181,6 +182,8 @@ struct fat_dir_struct
     struct fat_dir_entry_struct dir_entry;
     cluster_t entry_cluster;
     uint16_t entry_offset;
+    /* number of 32 byte entries from the start of the directory */
+    uint16_t entry_index;
 };
 
 struct fat_read_dir_callback_arg
@@ -207,6 +210,8 @@ static struct fat_dir_struct fat_dir_handles[FAT_DIR_COUNT];
 
 static uint8_t fat_read_header(struct fat_fs_struct* fs);
 static cluster_t fat_get_next_cluster(const struct fat_fs_struct* fs, cluster_t cluster_num);
+static cluster_t fat_get_cluster_run(const struct fat_fs_struct* fs, cluster_t cluster_num);
+static cluster_t fat_get_next_file_cluster(struct fat_file_struct* fd, cluster_t cluster_num);
 static offset_t fat_cluster_offset(const struct fat_fs_struct* fs, cluster_t cluster_num);
 static uint8_t fat_dir_entry_read_callback(uint8_t* buffer, offset_t offset, void* p);
 #if FAT_LFN_SUPPORT
@@ -532,6 +537,85 @@ cluster_t fat_get_next_cluster(const struct fat_fs_struct* fs, cluster_t cluster
     return cluster_num;
 }
 
+/**
+ * \ingroup fat_fs
+ * Finds the end of a run of contiguous clusters.
+ *
+ * Follows the cluster chain from the given cluster for as long as each
+ * cluster is followed by the next higher numbered one.  Only the FAT
+ * sector holding the given cluster's entry is examined, so the run
+ * costs at most one sector read from the card to find.
+ *
+ * \param[in] fs The filesystem on which to operate.
+ * \param[in] cluster_num The number of the cluster at which the run starts.
+ * \returns The number of the last cluster of the run, which is \c cluster_num
+ *          itself if it is not followed by the next higher cluster.
+ */
+cluster_t fat_get_cluster_run(const struct fat_fs_struct* fs, cluster_t cluster_num)
+{
+    if(!fs || cluster_num < 2)
+        return cluster_num;
+
+    uint8_t entry_size = sizeof(uint16_t);
+#if FAT_FAT32_SUPPORT
+    if(fs->partition->type == PARTITION_TYPE_FAT32)
+        entry_size = sizeof(uint32_t);
+#endif
+    cluster_t sector_last = cluster_num | (fs->header.sector_size / entry_size - 1);
+
+    while(cluster_num <= sector_last)
+    {
+        cluster_t cluster_next;
+#if FAT_FAT32_SUPPORT
+        if(fs->partition->type == PARTITION_TYPE_FAT32)
+        {
+            uint32_t fat_entry;
+            if(!fs->partition->device_read(fs->header.fat_offset + (offset_t) cluster_num * sizeof(fat_entry), (uint8_t*) &fat_entry, sizeof(fat_entry)))
+                break;
+            cluster_next = ltoh32(fat_entry) & 0x0fffffff;
+        }
+        else
+#endif
+        {
+            uint16_t fat_entry;
+            if(!fs->partition->device_read(fs->header.fat_offset + (offset_t) cluster_num * sizeof(fat_entry), (uint8_t*) &fat_entry, sizeof(fat_entry)))
+                break;
+            cluster_next = ltoh16(fat_entry);
+        }
+
+        if(cluster_next != cluster_num + 1)
+            break;
+
+        cluster_num = cluster_next;
+    }
+
+    return cluster_num;
+}
+
+/**
+ * \ingroup fat_file
+ * Retrieves the cluster following a given cluster of an open file.
+ *
+ * Clusters within the file's current run of contiguous clusters are
+ * found without reading the FAT.  When the run is exhausted, the next
+ * cluster is looked up in the FAT and the run starting there is found.
+ *
+ * \param[in] fd The file handle of the file.
+ * \param[in] cluster_num The number of the cluster for which to determine its successor.
+ * \returns The wanted cluster number, or 0 on error.
+ */
+cluster_t fat_get_next_file_cluster(struct fat_file_struct* fd, cluster_t cluster_num)
+{
+    if(cluster_num < fd->run_end)
+        return cluster_num + 1;
+
+    cluster_num = fat_get_next_cluster(fd->fs, cluster_num);
+    if(cluster_num)
+        fd->run_end = fat_get_cluster_run(fd->fs, cluster_num);
+
+    return cluster_num;
+}
+
 #if DOXYGEN || FAT_WRITE_SUPPORT
 /**
  * \ingroup fat_fs
@@ -1018,6 +1102,7 @@ struct fat_file_struct* fat_open_file(struct fat_fs_struct* fs, const struct fat
     fd->fs = fs;
     fd->pos = 0;
     fd->pos_cluster = dir_entry->cluster;
+    fd->run_end = fat_get_cluster_run(fs, dir_entry->cluster);
 
 #if FAT_DELAY_DIRENTRY_UPDATE
     fd->needs_write = 0;
@@ -1101,13 +1186,14 @@ intptr_t fat_read_file(struct fat_file_struct* fd, uint8_t* buffer, uintptr_t bu
 	    }
         }
 
+        fd->run_end = fat_get_cluster_run(fd->fs, cluster_num);
         if(fd->pos)
         {
             uint32_t pos = fd->pos;
             while(pos >= cluster_size)
             {
                 pos -= cluster_size;
-                cluster_num = fat_get_next_cluster(fd->fs, cluster_num);
+                cluster_num = fat_get_next_file_cluster(fd, cluster_num);
                 if(!cluster_num)
 		    // fd_errno handled by fat_get_next_cluster()
                     return -1;
@@ -1146,7 +1232,7 @@ intptr_t fat_read_file(struct fat_file_struct* fd, uint8_t* buffer, uintptr_t bu
         if(first_cluster_offset + copy_length >= cluster_size)
         {
             /* we are on a cluster boundary, so get the next cluster */
-            if((cluster_num = fat_get_next_cluster(fd->fs, cluster_num)))
+            if((cluster_num = fat_get_next_file_cluster(fd, cluster_num)))
             {
                 first_cluster_offset = 0;
             }
@@ -1191,6 +1277,9 @@ intptr_t fat_write_file(struct fat_file_struct* fd, const uint8_t* buffer, uintp
     uintptr_t buffer_left = buffer_len;
     uint16_t first_cluster_offset = (uint16_t) (fd->pos & (cluster_size - 1));
 
+    /* writing moves the file position without following the cluster run */
+    fd->run_end = 0;
+
     /* find cluster in which to start writing */
     if(!cluster_num)
     {
@@ -1470,6 +1559,9 @@ uint8_t fat_resize_file(struct fat_file_struct* fd, uint32_t size)
         fd->pos_cluster = 0;
     }
 
+    /* the clusters of the file may have changed */
+    fd->run_end = 0;
+
     return 1;
 }
 #endif
@@ -1510,6 +1602,7 @@ struct fat_dir_struct* fat_open_dir(struct fat_fs_struct* fs, const struct fat_d
     dd->fs = fs;
     dd->entry_cluster = dir_entry->cluster;
     dd->entry_offset = 0;
+    dd->entry_index = 0;
 
     return dd;
 }
@@ -1555,8 +1648,22 @@ uint8_t fat_read_dir(struct fat_dir_struct* dd, struct fat_dir_entry_struct* dir
     uint16_t cluster_size = header->cluster_size;
     cluster_t cluster_num = dd->entry_cluster;
     uint16_t cluster_offset = dd->entry_offset;
+    uint16_t entries_read = 0;
     struct fat_read_dir_callback_arg arg;
 
+    /* check if we read from the root directory, which on FAT16 is
+     * a single region rather than a chain of clusters
+     */
+    if(cluster_num == 0)
+    {
+#if FAT_FAT32_SUPPORT
+        if(fs->partition->type == PARTITION_TYPE_FAT32)
+            cluster_num = header->root_dir_cluster;
+        else
+#endif
+            cluster_size = header->cluster_zero_offset - header->root_dir_offset;
+    }
+
     if(cluster_offset >= cluster_size)
     {
         /* The latest call hit the border of the last cluster in
@@ -1573,17 +1680,6 @@ uint8_t fat_read_dir(struct fat_dir_struct* dd, struct fat_dir_entry_struct* dir
     memset(dir_entry, 0, sizeof(*dir_entry));
     arg.dir_entry = dir_entry;
 
-    /* check if we read from the root directory */
-    if(cluster_num == 0)
-    {
-#if FAT_FAT32_SUPPORT
-        if(fs->partition->type == PARTITION_TYPE_FAT32)
-            cluster_num = header->root_dir_cluster;
-        else
-#endif
-            cluster_size = header->cluster_zero_offset - header->root_dir_offset;
-    }
-
     /* read entries */
     uint8_t buffer[32];
     while(!arg.finished)
@@ -1607,6 +1703,7 @@ uint8_t fat_read_dir(struct fat_dir_struct* dd, struct fat_dir_entry_struct* dir
             return 0;
 
         cluster_offset += arg.bytes_read;
+        entries_read += arg.bytes_read / 32;
 
         if(cluster_offset >= cluster_size)
         {
@@ -1642,6 +1739,7 @@ uint8_t fat_read_dir(struct fat_dir_struct* dd, struct fat_dir_entry_struct* dir
 
     dd->entry_cluster = cluster_num;
     dd->entry_offset = cluster_offset;
+    dd->entry_index += entries_read;
 
     return arg.finished;
 }
@@ -1664,6 +1762,89 @@ uint8_t fat_reset_dir(struct fat_dir_struct* dd)
 
     dd->entry_cluster = dd->dir_entry.cluster;
     dd->entry_offset = 0;
+    dd->entry_index = 0;
+    return 1;
+}
+
+/**
+ * \ingroup fat_dir
+ * Returns the position of a directory handle.
+ *
+ * The position is the number of 32 byte directory entries,
+ * including deleted and lfn entries, from the start of the
+ * directory.  Reading from it with fat_read_dir() after a
+ * fat_seek_dir() returns the same entry as the next read
+ * from the current position.
+ *
+ * \param[in] dd The directory handle.
+ * \returns The position of the directory handle.
+ * \see fat_seek_dir
+ */
+uint16_t fat_tell_dir(const struct fat_dir_struct* dd)
+{
+    return dd ? dd->entry_index : 0;
+}
+
+/**
+ * \ingroup fat_dir
+ * Moves a directory handle to a position from fat_tell_dir().
+ *
+ * Positions at or after the start of the handle's current
+ * cluster are reached without reading the FAT; earlier ones
+ * follow the cluster chain from the start of the directory.
+ *
+ * \param[in] dd The directory handle.
+ * \param[in] entry_index The position to move to.
+ * \returns 0 on failure, 1 on success.
+ * \see fat_tell_dir
+ */
+uint8_t fat_seek_dir(struct fat_dir_struct* dd, uint16_t entry_index)
+{
+    if(!dd)
+        return 0;
+
+    struct fat_fs_struct* fs = dd->fs;
+    const struct fat_header_struct* header = &fs->header;
+    uint32_t offset = (uint32_t) entry_index * 32;
+    cluster_t cluster_num = dd->dir_entry.cluster;
+
+    if(cluster_num == 0)
+    {
+#if FAT_FAT32_SUPPORT
+        if(fs->partition->type == PARTITION_TYPE_FAT32)
+            cluster_num = header->root_dir_cluster;
+        else
+#endif
+        {
+            /* the FAT16 root directory is not made up of clusters */
+            if(offset >= (uint32_t) (header->cluster_zero_offset - header->root_dir_offset))
+                return 0;
+
+            dd->entry_offset = (uint16_t) offset;
+            dd->entry_index = entry_index;
+            return 1;
+        }
+    }
+
+    /* start from the current cluster if it is not past the position */
+    uint32_t current = (uint32_t) dd->entry_index * 32 - dd->entry_offset;
+    if(dd->entry_cluster != 0 && offset >= current)
+    {
+        cluster_num = dd->entry_cluster;
+        offset -= current;
+    }
+
+    /* follow the cluster chain to the cluster holding the position */
+    while(offset >= header->cluster_size)
+    {
+        if((cluster_num = fat_get_next_cluster(fs, cluster_num)) == 0)
+            return 0;
+        offset -= header->cluster_size;
+    }
+
+    dd->entry_cluster = cluster_num;
+    dd->entry_offset = (uint16_t) offset;
+    dd->entry_index = entry_index;
     return 1;
 }
 
@@ -165,6 +165,17 @@ static uint8_t raw_block_written;
 /* card type state */
 static uint8_t sd_raw_card_type;
 
+#if SD_RAW_STREAMING
+/* flag to remember if reads should use READ_MULTIPLE_BLOCK */
+static uint8_t raw_stream_enabled;
+/* flag to remember if the card is sending blocks and selected */
+static uint8_t raw_stream_active;
+/* offset of the next block the card will send */
+static offset_t raw_stream_address;
+
+static void sd_raw_stream_stop();
+#endif
+
 /* private helper functions */
 static void sd_raw_send_byte(uint8_t b);
 static uint8_t sd_raw_rec_byte();
@@ -211,6 +222,9 @@ uint8_t sd_raw_init(bool use_crc)
 
     /* initialization procedure */
     sd_raw_card_type = 0;
+#if SD_RAW_STREAMING
+    raw_stream_active = 0;
+#endif
 
     if(!sd_raw_available())
     {
@@ -468,6 +482,10 @@ uint8_t sd_raw_send_command(uint8_t command, uint32_t arg)
     }
 #endif
 
+    /* the byte following STOP_TRANSMISSION is a stuff byte, not the response */
+    if(command == CMD_STOP_TRANSMISSION)
+        sd_raw_rec_byte();
+
     /* receive response */
     for(uint8_t i = 0; i < 10; ++i)
     {
@@ -518,19 +536,41 @@ uint8_t sd_raw_read(offset_t offset, uint8_t* buffer, uintptr_t length)
 #endif
 
 	read_block:
-            /* address card */
-            select_card();
+#if SD_RAW_STREAMING
+            /* a block other than the next one the card is sending
+             * ends the transfer
+             */
+            if(raw_stream_active && block_address != raw_stream_address)
+                sd_raw_stream_stop();
+
+            if(!raw_stream_active)
+#endif
+            {
+                uint8_t command = CMD_READ_SINGLE_BLOCK;
+#if SD_RAW_STREAMING
+                if(raw_stream_enabled)
+                    command = CMD_READ_MULTIPLE_BLOCK;
+#endif
 
-            /* send single block request */
+                /* address card */
+                select_card();
+
+                /* send block request */
 #if SD_RAW_SDHC
-            if(sd_raw_send_command(CMD_READ_SINGLE_BLOCK, (sd_raw_card_type & (1 << SD_RAW_SPEC_SDHC) ? block_address / 512 : block_address)))
+                if(sd_raw_send_command(command, (sd_raw_card_type & (1 << SD_RAW_SPEC_SDHC) ? block_address / 512 : block_address)))
 #else
-            if(sd_raw_send_command(CMD_READ_SINGLE_BLOCK, block_address))
+                if(sd_raw_send_command(command, block_address))
+#endif
+                {
+                    unselect_card();
+                    sd_errno = SDR_ERR_BADRESPONSE;
+                    return 0;
+                }
+
+#if SD_RAW_STREAMING
+                /* the card now sends blocks until told to stop */
+                raw_stream_active = raw_stream_enabled;
 #endif
-            {
-                unselect_card();
-		sd_errno = SDR_ERR_BADRESPONSE;
-                return 0;
             }
 
             /* wait for data block (start byte 0xfe) */
@@ -539,6 +579,11 @@ uint8_t sd_raw_read(offset_t offset, uint8_t* buffer, uintptr_t length)
 	    {
 		if(tries >= 0x7FFF)
 		{
+#if SD_RAW_STREAMING
+		    if(raw_stream_active)
+			sd_raw_stream_stop();
+		    else
+#endif
 		    unselect_card();
 		    sd_errno = SDR_ERR_COMMS;
 		    return 0;
@@ -565,12 +610,22 @@ uint8_t sd_raw_read(offset_t offset, uint8_t* buffer, uintptr_t length)
             for(uint16_t i = 0; i < 512; ++i)
                 *cache++ = sd_raw_rec_byte();
             raw_block_address = block_address;
+#if SD_RAW_STREAMING
+            raw_stream_address = block_address + 512;
+#endif
 
             /* read crc16 */
 	    if ( sd_use_crc ) {
 		uint16_t crc = sd_raw_rec_byte() << 8;
 		crc |= sd_raw_rec_byte();
 		if ( crc != sd_crc16(raw_block, (uint16_t)512) ) {
+		    /* forget the bad block and request it again */
+		    raw_block_address = (offset_t) -1;
+#if SD_RAW_STREAMING
+		    if ( raw_stream_active )
+			sd_raw_stream_stop();
+		    else
+#endif
 		    unselect_card();
 		    if ( ++attempts < 5 ) {
 			sd_raw_rec_byte(); // pause a little
@@ -591,11 +646,17 @@ uint8_t sd_raw_read(offset_t offset, uint8_t* buffer, uintptr_t length)
             buffer += read_length;
 #endif
 
-            /* deaddress card */
-            unselect_card();
+#if SD_RAW_STREAMING
+            /* leave the card selected and sending */
+            if(!raw_stream_active)
+#endif
+            {
+                /* deaddress card */
+                unselect_card();
 
-            /* let card some time to finish */
-            sd_raw_rec_byte();
+                /* let card some time to finish */
+                sd_raw_rec_byte();
+            }
         }
 #if !SD_RAW_SAVE_RAM
         else
@@ -801,6 +862,11 @@ uint8_t sd_raw_write(offset_t offset, const uint8_t* buffer, uintptr_t length)
 #endif
         }
 
+#if SD_RAW_STREAMING
+        /* writing ends any transfer of blocks from the card */
+        sd_raw_stream_stop();
+#endif
+
         /* address card */
         select_card();
 
@@ -936,6 +1002,61 @@ uint8_t sd_raw_sync()
 }
 #endif
 
+#if DOXYGEN || SD_RAW_STREAMING
+/**
+ * \ingroup sd_raw
+ * Enables or disables streaming reads.
+ *
+ * While enabled, a block which is not cached is read with a
+ * READ_MULTIPLE_BLOCK command, and the card is left selected and
+ * sending blocks. Reads of the following blocks then take them from
+ * the card without issuing a command or waiting for the card to find
+ * the block. Reading any other block, writing, or disabling streaming
+ * stops the transfer.
+ *
+ * \note The card is kept selected while blocks are streamed, so
+ *       nothing else may use the SPI bus until streaming is disabled.
+ *
+ * \param[in] enable 1 to enable streaming reads, 0 to disable them.
+ * \returns 0 on failure, 1 on success.
+ */
+uint8_t sd_raw_set_streaming(uint8_t enable)
+{
+    raw_stream_enabled = enable;
+    if(!enable)
+        sd_raw_stream_stop();
+    return 1;
+}
+
+/**
+ * \ingroup sd_raw
+ * Stops a transfer started by READ_MULTIPLE_BLOCK and deselects the card.
+ */
+void sd_raw_stream_stop()
+{
+    if(!raw_stream_active)
+        return;
+    raw_stream_active = 0;
+
+    sd_raw_send_command(CMD_STOP_TRANSMISSION, 0);
+
+    /* wait while card is busy */
+    for(uint16_t tries = 0; sd_raw_rec_byte() != 0xff && tries < 0x7FFF; ++tries);
+
+    /* deaddress card */
+    unselect_card();
+
+    /* let card some time to finish */
+    sd_raw_rec_byte();
+}
+#else
+uint8_t sd_raw_set_streaming(uint8_t enable)
+{
+    (void)enable;
+    return 1;
+}
+#endif
+
 /**
  * \ingroup sd_raw
  * Reads informational data from the card.
@@ -956,6 +1077,10 @@ uint8_t sd_raw_get_info(struct sd_raw_info* info)
     if(!info || !sd_raw_available())
         return 0;
 
+#if SD_RAW_STREAMING
+    sd_raw_stream_stop();
+#endif
+
     memset(info, 0, sizeof(*info));
 
     select_card();
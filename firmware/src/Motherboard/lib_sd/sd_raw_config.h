@@ -12,8 +12,10 @@
 #define SD_RAW_CONFIG_H
 
 #include <stdint.h>
+#ifndef SIMULATOR
 #include "Configuration.hh"
 #include "Pin.hh"
+#endif
 
 #ifdef __cplusplus
 extern "C"
@@ -60,6 +62,18 @@ extern "C"
  */
 #define SD_RAW_SAVE_RAM 1
 
+/**
+ * \ingroup sd_raw_config
+ * Controls MMC/SD streaming reads.
+ *
+ * Set to 1 to let sd_raw_set_streaming() keep the card sending
+ * consecutive blocks with a single READ_MULTIPLE_BLOCK command,
+ * set to 0 to always read single blocks.
+ *
+ * \note This option has no effect when SD_RAW_SAVE_RAM is 1.
+ */
+#define SD_RAW_STREAMING 1
+
 /**
  * \ingroup sd_raw_config
  * Controls support for SDHC cards.
@@ -67,7 +81,7 @@ extern "C"
  * Set to 1 to support so-called SDHC memory cards, i.e. SD
  * cards with more than 2 gigabytes of memory.
  */
-#if defined(__AVR_ATmega2560__)
+#if defined(__AVR_ATmega2560__) || defined(SIMULATOR)
 #define SD_RAW_SDHC 1
 #else
 #define SD_RAW_SDHC 0
@@ -78,7 +92,9 @@ extern "C"
  */
 
 /* defines for customisation of sd/mmc port access */
-#if defined(__AVR_ATmega8__) || \
+#if defined(SIMULATOR)
+    /* the simulator's sd_raw_file.c reads and writes a disk image instead */
+#elif defined(__AVR_ATmega8__) || \
     defined(__AVR_ATmega48__) || \
     defined(__AVR_ATmega48P__) || \
     defined(__AVR_ATmega88__) || \
@@ -139,6 +155,10 @@ extern "C"
 #undef SD_RAW_WRITE_BUFFERING
 #define SD_RAW_WRITE_BUFFERING 0
 #endif
+#if SD_RAW_SAVE_RAM
+#undef SD_RAW_STREAMING
+#define SD_RAW_STREAMING 0
+#endif
 
 #ifdef __cplusplus
 }
@@ -20,31 +20,80 @@
 #define SHARED_CIRCULAR_BUFFER_HH_
 
 #include <stdint.h>
+#include <string.h>
 
 typedef uint16_t BufSizeType;
 
-/// A simple, reliable circular buffer implementation.
+/// Storage for a CircularBufferTempl: data supplied by the owner, of a size
+/// known only at run time.  Indices are wrapped with %.
+template<typename T>
+class CircularBufferStorage {
+private:
+	const BufSizeType size_; /// Size of this buffer
+	T* const data_; /// Pointer to buffer data
+protected:
+	CircularBufferStorage(BufSizeType size_in, T* data_in) :
+		size_(size_in), data_(data_in) {
+	}
+	inline BufSizeType size() const {
+		return size_;
+	}
+	inline T* data() {
+		return data_;
+	}
+	/// Wrap an index into the buffer
+	inline BufSizeType wrap(BufSizeType index) const {
+		return index % size_;
+	}
+};
+
+/// Storage for a FixedCircularBufferTempl: data held in the buffer, of a
+/// power of two size known at compile time.  Indices are wrapped by masking
+/// rather than with the software division % takes on AVR.
+template<typename T, BufSizeType SIZE>
+class FixedCircularBufferStorage {
+private:
+	// Fails to compile unless SIZE is a power of two
+	typedef char size_must_be_a_power_of_two[(SIZE > 0 && (SIZE & (SIZE - 1)) == 0) ? 1 : -1];
+
+	T data_[SIZE]; /// Buffer data
+protected:
+	inline BufSizeType size() const {
+		return SIZE;
+	}
+	inline T* data() {
+		return data_;
+	}
+	/// Wrap an index into the buffer
+	inline BufSizeType wrap(BufSizeType index) const {
+		return index & (SIZE - 1);
+	}
+};
+
+/// A simple, reliable circular buffer implementation, over the storage
+/// given by Storage; see CircularBufferTempl and FixedCircularBufferTempl.
 /// This implementation does not offer any protection from
 /// interrupts and code writing over each other!  You must
 /// disable interrupts before all accesses and writes to
 /// a circular buffer that is updated in an interrupt.
-template<typename T>
-class CircularBufferTempl {
+template<typename T, class Storage>
+class CircularBufferBase : protected Storage {
 public:
 	typedef T BufDataType;
 private:
-	const BufSizeType size; /// Size of this buffer
 	volatile BufSizeType length; /// Current length of valid buffer data
 	volatile BufSizeType start; /// Current start point of valid bufffer data
-	BufDataType* const data; /// Pointer to buffer data
 	volatile bool overflow; /// Overflow indicator
 	volatile bool underflow; /// Underflow indicator
-public:
-	CircularBufferTempl(BufSizeType size_in, BufDataType* data_in) :
-		size(size_in), length(0), start(0), data(data_in), overflow(false),
+protected:
+	CircularBufferBase() :
+		length(0), start(0), overflow(false), underflow(false) {
+	}
+	CircularBufferBase(BufSizeType size_in, BufDataType* data_in) :
+		Storage(size_in, data_in), length(0), start(0), overflow(false),
 				underflow(false) {
 	}
-
+public:
 	/// Reset the buffer to its empty state.  All data in
 	/// the buffer will be (effectively) lost.
 	inline void reset() {
@@ -55,21 +104,36 @@ public:
 	}
 	/// Append a byte to the tail of the buffer
 	inline void push(BufDataType b) {
-		if (length < size) {
+		if (length < this->size()) {
 			operator[](length) = b;
 			length++;
 		} else {
 			overflow = true;
 		}
 	}
+	/// Append a number of bytes to the tail of the buffer.  If there
+	/// is not enough room, push what we can and set the overflow flag.
+	inline void push(const BufDataType* src, BufSizeType sz) {
+		if (this->size() - length < sz) {
+			overflow = true;
+			sz = this->size() - length;
+		}
+		BufDataType* const data = this->data();
+		BufSizeType tail = this->wrap(start + length);
+		for (BufSizeType i = 0; i < sz; i++) {
+			data[tail] = src[i];
+			if (++tail == this->size()) tail = 0;
+		}
+		length += sz;
+	}
 	/// Pop a byte off the head of the buffer
 	inline BufDataType pop() {
 		if (isEmpty()) {
 			underflow = true;
 			return BufDataType();
 		}
-		const BufDataType& popped_byte = operator[](0);
-		start = (start + 1) % size;
+		const BufDataType& popped_byte = this->data()[start];
+		start = this->wrap(start + 1);
 		length--;
 		return popped_byte;
 	}
@@ -80,8 +144,7 @@ public:
 			underflow = true;
 			return BufDataType();
 		}
-		const BufDataType& popped_byte = operator[](0);
-		return popped_byte;
+		return this->data()[start];
 	}
 
 	/// Pop a number of bytes off the head of the buffer.  If there
@@ -92,10 +155,76 @@ public:
 			underflow = true;
 			sz = length;
 		}
-		start = (start + sz) % size;
+		start = this->wrap(start + sz);
 		length -= sz;
 	}
 
+	/// Pop a number of elements off the head of the buffer into dst.
+	/// If there are not enough elements, pop what we can and set the
+	/// underflow flag.
+	inline void pop(BufDataType* dst, BufSizeType sz) {
+		if (length < sz) {
+			underflow = true;
+			sz = length;
+		}
+		peek(dst, sz);
+		pop(sz);
+	}
+
+	/// Get a pointer to the data at the head of the buffer, and the
+	/// number of elements readable through it: the length of the
+	/// buffer, or the number of elements before the wrap point if
+	/// that's fewer.
+	inline BufDataType* getContiguous(BufSizeType& len) {
+		const BufSizeType to_end = this->size() - start;
+		len = (length < to_end) ? length : to_end;
+		return this->data() + start;
+	}
+
+	/// Copy a number of elements from the head of the buffer without
+	/// popping them.  The caller must check that the buffer holds them.
+	inline void peek(BufDataType* dst, BufSizeType sz) {
+		const BufDataType* data = this->data();
+		const BufSizeType to_end = this->size() - start;
+		if (sz <= to_end) {
+			memcpy(dst, data + start, sz * sizeof(BufDataType));
+		} else {
+			memcpy(dst, data + start, to_end * sizeof(BufDataType));
+			memcpy(dst + to_end, data, (sz - to_end) * sizeof(BufDataType));
+		}
+	}
+
+	/// View the head of a byte buffer as a V, such as a packed struct
+	/// laid out as a command.  The bytes are read in place unless they
+	/// wrap, in which case they're copied to scratch.  The caller must
+	/// check that the buffer holds sizeof(V) bytes, and pop them once
+	/// it's done with the view.
+	template<typename V>
+	inline const V* view(V& scratch) {
+		if ((BufSizeType)(this->size() - start) >= sizeof(V))
+			return (const V*)(this->data() + start);
+		peek((BufDataType*)&scratch, sizeof(V));
+		return &scratch;
+	}
+
+	/// Read a little-endian V, such as an int32_t, at an index into a
+	/// byte buffer.  The caller must check that the buffer holds it.
+	template<typename V>
+	inline V peekValue(BufSizeType index) {
+		union {
+			// AVR is little-endian
+			V value;
+			BufDataType bytes[sizeof(V)];
+		} shared;
+		const BufDataType* data = this->data();
+		BufSizeType i = this->wrap(index + start);
+		for (uint8_t j = 0; j < sizeof(V); j++) {
+			shared.bytes[j] = data[i];
+			if (++i == this->size()) i = 0;
+		}
+		return shared.value;
+	}
+
 	/// Get the length of the buffer
 	inline const BufSizeType getLength() const {
 		return length;
@@ -103,7 +232,7 @@ public:
 
 	/// Get the remaining capacity of this buffer
 	inline const BufSizeType getRemainingCapacity() const {
-		return size - length;
+		return this->size() - length;
 	}
 
 	/// Check if the buffer is empty
@@ -112,8 +241,7 @@ public:
 	}
 	/// Read the buffer directly
 	inline BufDataType& operator[](BufSizeType index) {
-		const BufSizeType actual_index = (index + start) % size;
-		return data[actual_index];
+		return this->data()[this->wrap(index + start)];
 	}
 	/// Check the overflow flag
 	inline const bool hasOverflow() const {
@@ -125,6 +253,21 @@ public:
 	}
 };
 
+/// A circular buffer over data supplied by its owner; see DEFINE_BUFFER.
+template<typename T>
+class CircularBufferTempl : public CircularBufferBase<T, CircularBufferStorage<T> > {
+public:
+	CircularBufferTempl(BufSizeType size_in, T* data_in) :
+		CircularBufferBase<T, CircularBufferStorage<T> >(size_in, data_in) {
+	}
+};
+
+/// A circular buffer of a power of two size known at compile time, which
+/// holds its own data and wraps its indices by masking.
+template<typename T, BufSizeType SIZE>
+class FixedCircularBufferTempl : public CircularBufferBase<T, FixedCircularBufferStorage<T, SIZE> > {
+};
+
 typedef CircularBufferTempl<uint8_t> CircularBuffer;
 
 #define DEFINE_BUFFER(name,dtype,size) \
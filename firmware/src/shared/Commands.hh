@@ -80,6 +80,39 @@
 #define HOST_CMD_BOARD_STATUS	   23
 #define HOST_CMD_GET_BUILD_STATS   24
 #define HOST_CMD_ADVANCED_VERSION  27
+// Open a receive window for sequenced packets (HOST_WINDOW); responds with
+// the window size
+#define HOST_CMD_OPEN_WINDOW       28
+// Subscribe to telemetry frames (HOST_TELEMETRY):
+//
+//   uint16  period in ms between frames, or 0 to stop them
+//   uint8   fields: TELEMETRY_* bits for the fields to send
+//
+// Responds with the fields which will be sent.  Each frame is a packet framed
+// with START_BYTE_TELEMETRY whose payload is the fields, in this order:
+//
+//   TELEMETRY_TEMPERATURES  uint16 extruder 0, extruder 1 and platform
+//                           temperatures, or 0 if one can't be read; one
+//                           is read per frame, so each is up to three
+//                           frames old
+//   TELEMETRY_POSITION      int32 X, Y, Z, A and B planner position in steps
+//   TELEMETRY_BUFFER        uint16 bytes free in the command buffer
+//   TELEMETRY_MOVES         uint8 moves in the planner's block buffer
+//   TELEMETRY_BUILD         uint8 build percentage, uint8 host::BuildState
+//   TELEMETRY_ERRORS        uint8 TELEMETRY_ERROR_CODE bits: the error the
+//                           debug LED blinks, or 0; TELEMETRY_ERROR_PAUSED
+//                           if the build has paused for an error
+#define HOST_CMD_SET_TELEMETRY     29
+#define TELEMETRY_TEMPERATURES     0x01
+#define TELEMETRY_POSITION         0x02
+#define TELEMETRY_BUFFER           0x04
+#define TELEMETRY_MOVES            0x08
+#define TELEMETRY_BUILD            0x10
+#define TELEMETRY_ERRORS           0x20
+#define TELEMETRY_ERROR_CODE       0x1F
+#define TELEMETRY_ERROR_PAUSED     0x80
+// Retrieve the interrupt and planner cycle counts (ISR_PROFILING)
+#define HOST_CMD_GET_ISR_PROFILE   30
 
 // These are our bufferable commands from the host
 
@@ -117,6 +150,29 @@
 #define HOST_CMD_STREAM_VERSION		157
 #define HOST_CMD_PAUSE_AT_ZPOS		158
 
+// Queue a move given as per axis deltas in steps: a compact form of
+// HOST_CMD_QUEUE_POINT_NEW_EXT with every axis relative.
+//
+//   uint8   axes: bits 0-4 are set for each of X, Y, Z, A and B with a delta,
+//                 QUEUE_POINT_DELTA_DISTANCE if the distance is sent, and
+//                 QUEUE_POINT_DELTA_DDA_32 if the DDA rate is 32 bits
+//   uint8   wide: bits 0-4 are set for each delta sent as an int16 rather
+//                 than an int8
+//   int8 or int16 for each axis with a delta, in axis order
+//   uint16 or uint32 DDA rate
+//   float   distance in mm, if sent.  Otherwise it's the length of the
+//           X, Y and Z deltas or, if that's 0, of the longer A or B delta.
+//   int16   feedrate in mm/s * 64
+#define HOST_CMD_QUEUE_POINT_DELTA	159
+#define QUEUE_POINT_DELTA_DISTANCE	0x20
+#define QUEUE_POINT_DELTA_DDA_32	0x40
+
+// Several movement and tool commands back to back in one packet, queued
+// together or not at all.  Only HOST_CMD_CHANGE_TOOL, HOST_CMD_TOOL_COMMAND,
+// HOST_CMD_QUEUE_POINT_EXT, HOST_CMD_SET_POSITION_EXT, HOST_CMD_QUEUE_POINT_NEW,
+// HOST_CMD_QUEUE_POINT_NEW_EXT and HOST_CMD_QUEUE_POINT_DELTA may be batched.
+#define HOST_CMD_BATCH			160
+
 #define HOST_CMD_DEBUG_ECHO        0x70
 
 
@@ -79,7 +79,9 @@ bool saveToSDFile(const char *filename) {
 		wdt_reset();
 	}
 
-	sdcard::finishCapture();
+	// The last of the data is only written out by finishCapture()
+	if ( sdcard::finishCapture() != EEPROM_SIZE )
+		ret = false;
 
 	return ret;
 }
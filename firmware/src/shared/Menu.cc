@@ -354,7 +354,7 @@ bool MessageScreen::screenWaiting(void){
 	return (timeout.isActive() || incomplete);
 }
 
-void MessageScreen::addMessage(CircularBuffer& buf) {
+void MessageScreen::addMessage(command::CommandBuffer& buf) {
 	char c = buf.pop();
 	while (c != '\0' && buf.getLength() > 0) {
 		if ( cursor < BUF_SIZE ) message[cursor++] = c;
@@ -1718,6 +1718,9 @@ MainMenu::MainMenu() {
 	itemCount = 20;
 #ifdef EEPROM_MENU_ENABLE
 	itemCount ++;
+#endif
+#ifdef RESUME_BUILD
+	resumeAvailable = false;
 #endif
 	reset();
 
@@ -1747,6 +1750,18 @@ void MainMenu::drawItem(uint8_t index, LiquidCrystal& lcd) {
 	const static PROGMEM prog_uchar main_versions[]		= "Version";
 #ifdef EEPROM_MENU_ENABLE
 	const static PROGMEM prog_uchar main_eeprom[]		= "Eeprom";
+#endif
+#ifdef RESUME_BUILD
+	const static PROGMEM prog_uchar main_resume[]		= "Resume Build";
+
+	// "Resume Build" goes after "Monitor" when offered
+	if ( resumeAvailable ) {
+		if ( index == 1 ) {
+			lcd.writeFromPgmspace(LOCALIZE(main_resume));
+			return;
+		}
+		if ( index > 1 ) index--;
+	}
 #endif
 	const static prog_uchar *messages[20
 #ifdef EEPROM_MENU_ENABLE
@@ -1788,6 +1803,17 @@ void MainMenu::drawItem(uint8_t index, LiquidCrystal& lcd) {
 
 
 void MainMenu::handleSelect(uint8_t index) {
+#ifdef RESUME_BUILD
+	if ( resumeAvailable ) {
+		if ( index == 1 ) {
+			if ( host::resumeBuildFromSD() != sdcard::SD_SUCCESS )
+				interface::pushScreen(&resumeFailedMenu);
+			return;
+		}
+		if ( index > 1 ) index--;
+	}
+#endif
+
 	switch (index) {
 	case 0:
 	    interface::pushScreen(&monitorMode);
@@ -1859,6 +1885,20 @@ void MainMenu::handleSelect(uint8_t index) {
 }
 
 void MainMenu::update(LiquidCrystal& lcd, bool forceRedraw) {
+#ifdef RESUME_BUILD
+	// Offer to resume a build when one was cut short by a power failure
+	if ( forceRedraw ) {
+		resume::checkpoint_t cp;
+		bool available = ( host::getHostState() == host::HOST_STATE_READY ) && resume::load(cp);
+		if ( available != resumeAvailable ) {
+			resumeAvailable = available;
+			if ( available )	itemCount ++;
+			else			itemCount --;
+			itemIndex = 0;
+		}
+	}
+#endif
+
 	Menu::update(lcd, forceRedraw);
 
 	if (interface::isButtonPressed(ButtonArray::XMINUS)) {
@@ -1893,64 +1933,27 @@ void SDMenu::resetState() {
 	drawItemLockout = false;
 }
 
-// Count the number of files on the SD card
+// Count the number of files on the SD card, indexing them so that
+// getFilename() need not read through the directory for each one
 static uint8_t fileCount;
 uint8_t SDMenu::countFiles() {
-        fileCount = 0;
-
-	// First, reset the directory index
-	if ( sdcard::directoryReset() != sdcard::SD_SUCCESS )
-		// TODO: Report 
-		return 0;
-
-	char fnbuf[3];
-
-	// Count the files
-	do {
-		bool isdir;
-		sdcard::directoryNextEntry(fnbuf,sizeof(fnbuf),&isdir);
-		if ( fnbuf[0] == 0 )
-			return fileCount;
-		// Count .. and anyfile which doesn't begin with .
-		else if ( (fnbuf[0] != '.') ||
-			  ( isdir && fnbuf[1] == '.' && fnbuf[2] == 0) )
-			fileCount++;
-	} while (true);
-
-	// Never reached
+#ifdef SORT_SD_FILES
+	fileCount = sdcard::directoryIndex(true);
+#else
+	fileCount = sdcard::directoryIndex(false);
+#endif
 	return fileCount;
 }
 
 bool SDMenu::getFilename(uint8_t index, char buffer[], uint8_t buffer_size, bool *isdir) {
 
-	*isdir = false;
-
-	// First, reset the directory list
-	if ( sdcard::directoryReset() != sdcard::SD_SUCCESS )
-                return false;
-
-	bool my_isdir;
-
 #ifdef REVERSE_SD_FILES
 	// Reverse order the files in hopes of listing the newer files first
 	// HOWEVER, with wrap around on the LCD menu, this isn't too useful
 	index = (fileCount - 1) - index;
 #endif
 
-	for(uint8_t i = 0; i < index+1; i++) {
-		do {
-			sdcard::directoryNextEntry(buffer, buffer_size, &my_isdir);
-			if ( buffer[0] == 0 )
-				// No more files
-				return false;
-			// Count only .. and any file not beginning with .
-			if ( (buffer[0] != '.' ) ||
-			     ( my_isdir && buffer[1] == '.' && buffer[2] == 0) )
-				break;
-		} while (true);
-	}
-	*isdir = my_isdir;
-        return true;
+	return sdcard::directoryIndexEntry(index, buffer, buffer_size, isdir);
 }
 
 void SDMenu::drawItem(uint8_t index, LiquidCrystal& lcd) {
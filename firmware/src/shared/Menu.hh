@@ -147,7 +147,7 @@ public:
 
 	void setXY(uint8_t xpos, uint8_t ypos) { x = xpos; y = ypos; }
 
-	void addMessage(CircularBuffer& buf);
+	void addMessage(command::CommandBuffer& buf);
 	void addMessage(const prog_uchar msg[]);
 	void clearMessage();
 	void setTimeout(uint8_t seconds);//, bool pop);
@@ -914,6 +914,12 @@ private:
 	CurrentPositionMode currentPositionMode;
 	TestEndStopsMode testEndStopsMode;
         VersionMode versionMode;
+#ifdef RESUME_BUILD
+	UnableToOpenFileMenu resumeFailedMenu;
+
+	/// True when the menu offers to resume a build
+	bool resumeAvailable;
+#endif
 	MoodLightMode	moodLightMode;
 	HomingFeedRatesMode homingFeedRatesMode;
 #ifdef EEPROM_MENU_ENABLE
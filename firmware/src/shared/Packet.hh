@@ -21,6 +21,10 @@
 #include <stdint.h>
 
 #define START_BYTE 0xD5
+/// Start byte of a packet whose start byte is followed by a sequence number
+#define START_BYTE_SEQ 0xD6
+/// Start byte of an unsolicited telemetry frame sent by the board
+#define START_BYTE_TELEMETRY 0xD7
 #define MAX_PACKET_PAYLOAD 32
 
 #define SLAVE_ID_BROADCAST 127
@@ -57,6 +61,11 @@ typedef enum {
         RC_PACKET_TIMEOUT	= 0x8C
 } ResponseCode;
 
+/// Update an iButton (Dallas 1-Wire) CRC with a byte, from a lookup table
+/// when PACKET_CRC_TABLE is defined and with _crc_ibutton_update() from
+/// util/crc16.h otherwise.
+uint8_t crcIButtonUpdate(uint8_t crc, uint8_t data);
+
 /// Convenience function to accept old response codes
 /// (missing the high bits) as well as the new forms.
 inline bool rcCompare(uint8_t data, ResponseCode code) {
@@ -72,7 +81,8 @@ protected:
 		PS_PAYLOAD,
 		PS_CRC,
 		PS_LAST,
-		PS_LAST_INCORRECT_CRC
+		PS_LAST_INCORRECT_CRC,
+		PS_SEQ
 	} PacketState;
 
     volatile uint8_t length; /// The current length of the payload (data[0] if raw packets)
@@ -80,10 +90,15 @@ protected:
     volatile uint8_t payload[MAX_PACKET_PAYLOAD]; /// Data payload (starts at data[2] of raw packet)
 	volatile uint8_t error_code; // Have any errors cropped up during processing?
 	volatile PacketState state;
+	volatile bool sequenced; /// True if the packet carries a sequence number
+	volatile uint8_t sequence; /// The sequence number, which is covered by the CRC
+	volatile bool telemetry; /// True if the packet is a telemetry frame
 
 
 	/// Append a byte and update the CRC
 	void appendByte(uint8_t data);
+	/// Append n bytes and update the CRC
+	void appendBytes(const uint8_t* data, uint8_t n);
 	/// Reset this packet to an empty state
 	void reset();
 
@@ -100,6 +115,10 @@ public:
 
 	uint8_t getErrorCode() const { return error_code; }
 
+	bool isSequenced() const { return sequenced; }
+
+	uint8_t getSequence() const { return sequence; }
+
 	// Reads an 8-bit byte from the specified index of the payload
 	uint8_t read8(uint8_t idx) const;
 	uint16_t read16(uint8_t idx) const;
@@ -114,12 +133,18 @@ public:
 class InPacket: public Packet {
 private:
 	volatile uint8_t expected_length;
+	bool accept_sequenced; /// True if START_BYTE_SEQ starts a packet
 public:
 	InPacket();
 
 	/// Reset the entire packet reception.
 	void reset();
 
+	/// Accept sequenced packets as well as plain ones.  Only the host
+	/// sends them, so a packet on the slave bus which starts with
+	/// START_BYTE_SEQ is noise.  Survives reset().
+	void acceptSequenced(bool accept) { accept_sequenced = accept; }
+
 	//process a byte for our packet.
 	void processByte(uint8_t b);
 
@@ -164,10 +189,19 @@ public:
 	// Prepare the output packet for resending with the current data
 	void prepareForResend();
 
+	// Frame the packet with START_BYTE_SEQ and the sequence number seq.
+	// Must be called before anything is appended.
+	void setSequence(uint8_t seq);
+
+	// Frame the packet with START_BYTE_TELEMETRY
+	void setTelemetry() { telemetry = true; }
+
 	// Add an 8-bit byte to the end of the payload
 	void append8(uint8_t value);
 	void append16(uint16_t value);
 	void append32(uint32_t value);
+	// Add n bytes to the end of the payload
+	void appendBytes(const uint8_t* data, uint8_t n);
 };
 
 #endif // SHARED_PACKET_HH_
@@ -0,0 +1,97 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include "PacketWindow.hh"
+
+#ifdef HOST_WINDOW
+
+PacketWindow::PacketWindow() {
+	open();
+	close();
+}
+
+void PacketWindow::open() {
+	// Called from the host slice; keep receive() out while we reset
+	is_open = false;
+	head = tail;
+	expected = 0;
+	processed = 0xff;
+	ack_owed = false;
+	nak_owed = false;
+	nak_sent = false;
+	is_open = true;
+}
+
+void PacketWindow::receive(InPacket& in) {
+	if (in.isFinished() != 1)
+		return;
+
+	// A host sending unsequenced packets is stopping and waiting; leave
+	// the packet for the host slice
+	if (!in.isSequenced()) {
+		is_open = false;
+		return;
+	}
+
+	if (is_open) {
+		uint8_t seq = in.getSequence();
+
+		if (seq == expected && (uint8_t)(tail - head) < HOST_WINDOW_SIZE) {
+			packets[tail & (HOST_WINDOW_SIZE - 1)] = in;
+			tail++;
+			expected++;
+			nak_sent = false;
+		} else if ((uint8_t)(expected - seq - 1) < 128) {
+			// Already have it; the ack for it may have been lost
+			ack_owed = true;
+		} else if (!nak_sent) {
+			// Something before it was lost, or the host overran the window
+			nak_owed = true;
+			nak_sent = true;
+		}
+	}
+	in.reset();
+}
+
+void PacketWindow::pop(bool answered) {
+	processed = front().getSequence();
+	head++;
+	ack_owed = !answered;
+}
+
+void PacketWindow::lost() {
+	if (is_open && !nak_sent) {
+		nak_owed = true;
+		nak_sent = true;
+	}
+}
+
+bool PacketWindow::respond(OutPacket& out) {
+	if (nak_owed) {
+		nak_owed = false;
+		out.setSequence(expected - 1);
+		out.append8(RC_PACKET_ERROR);
+		return true;
+	}
+	if (ack_owed) {
+		ack_owed = false;
+		out.setSequence(processed);
+		out.append8(RC_OK);
+		return true;
+	}
+	return false;
+}
+
+#endif // HOST_WINDOW
@@ -0,0 +1,94 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#ifndef SHARED_PACKET_WINDOW_HH_
+#define SHARED_PACKET_WINDOW_HH_
+
+#include "Configuration.hh"
+
+#ifdef HOST_WINDOW
+
+#include "Packet.hh"
+
+#if (HOST_WINDOW_SIZE & (HOST_WINDOW_SIZE - 1)) != 0
+	#error HOST_WINDOW_SIZE must be a power of 2
+#endif
+
+/// Receive window for sequenced packets.
+///
+/// Once a host has opened the window with HOST_CMD_OPEN_WINDOW, it may send
+/// up to HOST_WINDOW_SIZE packets framed with START_BYTE_SEQ before waiting
+/// for a response.  Sequence numbers start at 0 and wrap at 256.  The receive
+/// interrupt moves each packet that arrives in order into the window, where
+/// it waits for the host slice to process it.
+///
+/// Responses are framed with START_BYTE_SEQ too:
+/// - RC_OK, and the response to a query, acknowledge every packet up to and
+///   including their sequence number as processed, freeing those window slots.
+/// - An error code (a NAK) says that the packets after its sequence number
+///   were lost and must be resent.  Packets received after a lost one are
+///   dropped, and only one NAK is sent until the lost packet arrives.
+///
+/// A packet framed with START_BYTE closes the window, so a host which
+/// doesn't know about the window is answered as before.
+class PacketWindow {
+private:
+	InPacket packets[HOST_WINDOW_SIZE];
+	volatile uint8_t head;		///< Count of packets removed by pop()
+	volatile uint8_t tail;		///< Count of packets added by receive()
+	volatile uint8_t expected;	///< Sequence number of the next packet to accept
+	uint8_t processed;		///< Sequence number of the last packet processed
+	volatile bool is_open;
+	volatile bool ack_owed;		///< Acknowledge processed when next possible
+	volatile bool nak_owed;		///< Ask for the packets after expected - 1
+	volatile bool nak_sent;		///< No more NAKs until expected arrives
+
+public:
+	PacketWindow();
+
+	/// Start a new session, expecting sequence number 0
+	void open();
+
+	void close() { is_open = false; }
+
+	bool isOpen() const { return is_open; }
+
+	/// Called from the receive interrupt after each byte is processed.
+	/// Takes a finished sequenced packet from in, leaving in ready for the
+	/// next packet.
+	void receive(InPacket& in);
+
+	bool isEmpty() const { return head == tail; }
+
+	/// The oldest packet waiting to be processed
+	const InPacket& front() const { return packets[head & (HOST_WINDOW_SIZE - 1)]; }
+
+	/// Remove the front packet once it has been processed.  answered is true
+	/// if a response carrying its sequence number is being sent; otherwise a
+	/// cumulative ack is owed.
+	void pop(bool answered);
+
+	/// Call when a packet arrives with a bad CRC or times out, to owe the
+	/// host a NAK
+	void lost();
+
+	/// Build any NAK or cumulative ack that is owed into out.  Returns true if
+	/// there was one.
+	bool respond(OutPacket& out);
+};
+
+#endif // HOST_WINDOW
+
+#endif // SHARED_PACKET_WINDOW_HH_
@@ -59,6 +59,8 @@
 ///
 /// Every packet gets precisely one response packet.  Query commands must be sent in their own packet.  Only action or query commands can be sent in a single packet.  The first byte of the command payload will determine the nature of the entire packet.  Thus, you cannot mix query and action commands in a single packet!
 ///
+/// The one exception to one command per packet is action command 160 (batch), which is followed by several movement and tool commands back to back.  They are put in the command buffer together, without the batch command itself, or not at all: a batch gets RC_BUFFER_OVERFLOW unless there's room for every command in it.  A batch holding a command which may not be batched gets RC_CMD_UNSUPPORTED, and one whose last command is cut short gets RC_PACKET_LENGTH; neither is buffered.
+///
 /// <h2>Command Types</h2>
 /// <table>
 ///  <tr>
@@ -112,6 +114,14 @@
 /// </table>
 /// Command length is implicit in the command structure; no explicit separator is needed.
 ///
+/// <h2>Sequenced packets</h2>
+/// Waiting for each response limits a host to one packet per round trip.  A host may instead open a receive window with query 28 (open window), whose response is RC_OK and the number of packets the window holds.  The host may then send that many packets before waiting for a response.  Each is framed with the start byte 0xD6 followed by a sequence number, starting from 0 and wrapping at 255, and then the length, payload and CRC as above.  The CRC covers the sequence number and the payload.
+///
+/// Responses to sequenced packets carry a sequence number too.  RC_OK and query responses acknowledge every packet up to and including that number as processed, so one response may acknowledge several action commands.  RC_PACKET_ERROR asks for every packet after that number to be resent.  Packets arriving after a lost packet are dropped; packets which were already received are acknowledged again.  When the command buffer is full, packets wait in the window and are acknowledged once they have been buffered, rather than being answered with RC_BUFFER_OVERFLOW.  A packet framed with 0xD5 closes the window.
+///
+/// <h2>Telemetry</h2>
+/// Rather than polling for temperatures, position and build status, a host may subscribe with query 29 (set telemetry) to frames the board sends every so many milliseconds, choosing the fields it wants.  Frames are framed with the start byte 0xD7, followed by the length, payload and CRC as above, and are never a response: a host waiting for a response should set them aside.  They are sent only when there's room to send a response as well, so they never delay one.  Commands.hh describes the fields.  A reset stops them.
+///
 /// <h2>Command structure</h2>
 ///
 /// <h3>Host Commands</h3>
@@ -23,6 +23,7 @@
 #include <avr/interrupt.h>
 #include <avr/io.h>
 #include <util/delay.h>
+#include <util/atomic.h>
 #include <avr/io.h>
 
 
@@ -45,6 +46,11 @@ volatile uint8_t loopback_bytes = 0;
     #error UART not implemented on this processor type!
 #endif
 
+#if defined (HOST_TX_BUFFER) && \
+    (defined (__AVR_ATmega168__) || defined (__AVR_ATmega328__))
+    #error HOST_TX_BUFFER needs an RS232 host UART
+#endif
+
 #if defined (__AVR_ATmega168__) || defined (__AVR_ATmega328__)
 
     #define UBRR_VALUE 25
@@ -105,7 +111,14 @@ UCSR##uart_##B |= _BV(RXCIE##uart_) | _BV(TXCIE##uart_); \
 
 #define DISABLE_SERIAL_INTERRUPTS(uart_) \
 { \
-UCSR##uart_##B &= ~(_BV(RXCIE##uart_) | _BV(TXCIE##uart_)); \
+UCSR##uart_##B &= ~(_BV(RXCIE##uart_) | _BV(TXCIE##uart_) | _BV(UDRIE##uart_)); \
+}
+
+// With a transmit buffer, the host UART sends from the data register empty
+// interrupt, enabled only while the buffer holds something
+#define ENABLE_BUFFERED_INTERRUPTS(uart_) \
+{ \
+UCSR##uart_##B |= _BV(RXCIE##uart_); \
 }
 
 // TODO: Move these definitions to the board files, where they belong.
@@ -124,6 +137,14 @@ UCSR##uart_##B &= ~(_BV(RXCIE##uart_) | _BV(TXCIE##uart_)); \
         UART UART::slaveUART(1, RS485);
     #endif
 
+    #ifdef HOST_WINDOW
+        PacketWindow UART::hostWindow;
+    #endif
+
+    #ifdef HOST_TX_BUFFER
+        FixedCircularBufferTempl<uint8_t, HOST_TX_BUFFER_SIZE> UART::hostTxBuffer;
+    #endif
+
 #endif
 
 
@@ -163,9 +184,18 @@ inline void speak() {
 UART::UART(uint8_t index, communication_mode mode) :
     index_(index),
     mode_(mode),
-    enabled_(false) {
+    enabled_(false)
+#ifdef HOST_TX_BUFFER
+    , out_waiting_(false)
+#endif
+    {
 
         init_serial();
+#ifdef HOST_WINDOW
+        // Only the host opens a window and sends sequenced packets
+        if (index_ == 0)
+                in.acceptSequenced(true);
+#endif
 
 }
 
@@ -173,6 +203,13 @@ UART::UART(uint8_t index, communication_mode mode) :
 void UART::beginSend() {
         if (!enabled_) { return; }
 
+#ifdef HOST_TX_BUFFER
+        if (index_ == 0) {
+                out_waiting_ = !queuePacket(out);
+                return;
+        }
+#endif
+
         if (mode_ == RS485) {
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Winline"
@@ -185,11 +222,73 @@ void UART::beginSend() {
         send_byte(out.getNextByteToSend());
 }
 
+bool UART::isSending() {
+#ifdef HOST_TX_BUFFER
+        if (index_ == 0) {
+                if (out_waiting_) {
+                        out_waiting_ = !queuePacket(out);
+                }
+                return out_waiting_;
+        }
+#endif
+        return out.isSending();
+}
+
+#ifdef HOST_TX_BUFFER
+
+bool UART::queuePacket(OutPacket& packet) {
+        // start byte, sequence number, length, payload and CRC
+        uint8_t bytes[MAX_PACKET_PAYLOAD + 4];
+        uint8_t size = 0;
+
+        packet.prepareForResend();
+        while (!packet.isFinished()) {
+                bytes[size++] = packet.getNextByteToSend();
+        }
+
+        bool queued = false;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                if (hostTxBuffer.getRemainingCapacity() >= size) {
+                        hostTxBuffer.push(bytes, size);
+                        UCSR0B |= _BV(UDRIE0);
+                        queued = true;
+                }
+        }
+        if (!queued) {
+                packet.prepareForResend();
+        }
+        return queued;
+}
+
+void UART::sendBuffered() {
+        if (hostTxBuffer.isEmpty()) {
+                UCSR0B &= ~_BV(UDRIE0);
+        } else {
+                UDR0 = hostTxBuffer.pop();
+        }
+}
+
+#endif
+
 void UART::enable(bool enabled) {
         enabled_ = enabled;
         if (index_ == 0) {
+#ifdef HOST_TX_BUFFER
+                // Carry on sending what's buffered, such as the response
+                // to a reset, and drop it if the port is disabled
+                if (enabled) {
+                        ENABLE_BUFFERED_INTERRUPTS(0);
+                        if (!hostTxBuffer.isEmpty()) { UCSR0B |= _BV(UDRIE0); }
+                }
+                else {
+                        DISABLE_SERIAL_INTERRUPTS(0);
+                        hostTxBuffer.reset();
+                        out_waiting_ = false;
+                }
+#else
                 if (enabled) { ENABLE_SERIAL_INTERRUPTS(0); }
                 else { DISABLE_SERIAL_INTERRUPTS(0); }
+#endif
         }
 #if HAS_SLAVE_UART
         else if (index_ == 1) {
@@ -261,14 +360,24 @@ void UART::reset() {
     ISR(USART0_RX_vect)
     {
             UART::getHostUART().in.processByte( UDR0 );
+    #ifdef HOST_WINDOW
+            UART::getHostWindow().receive( UART::getHostUART().in );
+    #endif
     }
 
+    #ifdef HOST_TX_BUFFER
+    ISR(USART0_UDRE_vect)
+    {
+            UART::sendBuffered();
+    }
+    #else
     ISR(USART0_TX_vect)
     {
             if (UART::getHostUART().out.isSending()) {
                     UDR0 = UART::getHostUART().out.getNextByteToSend();
             }
     }
+    #endif
 
     #if HAS_SLAVE_UART
         ISR(USART1_RX_vect)
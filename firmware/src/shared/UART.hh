@@ -19,9 +19,14 @@
 #define UART_HH_
 
 #include "Packet.hh"
+#include "PacketWindow.hh"
 #include "Configuration.hh"
 #include <stdint.h>
 
+#ifdef HOST_TX_BUFFER
+#include "CircularBuffer.hh"
+#endif
+
 // TODO: Move to UART class
 /// Communication mode selection
 enum communication_mode {
@@ -51,6 +56,15 @@ private:
     static UART slaveUART;      ///< The controller can forward commands to the slave UART
 #endif
 
+#ifdef HOST_WINDOW
+    static PacketWindow hostWindow; ///< Sequenced packets received by the host UART
+#endif
+
+#ifdef HOST_TX_BUFFER
+    /// Serialized packets waiting to be sent by the host UART
+    static FixedCircularBufferTempl<uint8_t, HOST_TX_BUFFER_SIZE> hostTxBuffer;
+#endif
+
 public:
     /// Get a reference to the host UART
     /// \return hostUART instance, which should act as a slave to a computer (or motherboard)
@@ -62,6 +76,11 @@ public:
     static UART& getSlaveUART() { return slaveUART; }
 #endif
 
+#ifdef HOST_WINDOW
+    /// Get a reference to the host UART's receive window
+    static PacketWindow& getHostWindow() { return hostWindow; }
+#endif
+
 private:
         /// Create an instance of the given UART controller
         /// \param[in] index hardware index of the UART to initialize
@@ -78,14 +97,44 @@ private:
         const uint8_t index_;               ///< Hardware UART index
         const communication_mode mode_;     ///< Communication mode we are speaking
         volatile bool enabled_;             ///< True if the hardware is currently enabled
+#ifdef HOST_TX_BUFFER
+        bool out_waiting_;                  ///< True if #out waits for room in the transmit buffer
+#endif
 
 public:
         InPacket in;                        ///< Input packet
         OutPacket out;                      ///< Output packet
 
-        /// Begin sending the data located in the #out packet.
+        /// Begin sending the data located in the #out packet.  With
+        /// HOST_TX_BUFFER, the host UART copies it into the transmit
+        /// buffer, leaving #out free for the next response.
         void beginSend();
 
+        /// Check whether the #out packet is still being sent.  With
+        /// HOST_TX_BUFFER, the host UART's #out is only busy while it
+        /// waits for room in the transmit buffer, and this queues it
+        /// once there is room.
+        /// \return true if #out may not be reused yet
+        bool isSending();
+
+#ifdef HOST_TX_BUFFER
+        /// Serialize a packet into the host UART's transmit buffer, from
+        /// which it's sent by the data register empty interrupt.  Packets
+        /// other than #out, such as unsolicited status messages, may be
+        /// sent this way; they are sent whole, between responses.
+        /// \param[in] packet Packet to send
+        /// \return false, leaving the packet unsent, if there isn't room
+        static bool queuePacket(OutPacket& packet);
+
+        /// Get the room left in the host UART's transmit buffer
+        /// \return Bytes free in the transmit buffer
+        static uint16_t getTxCapacity() { return hostTxBuffer.getRemainingCapacity(); }
+
+        /// Send the next byte of the transmit buffer, from the data
+        /// register empty interrupt.
+        static void sendBuffered();
+#endif
+
         /// Enable or disable the serial port.
         /// \param[in] true to enable the serial port, false to disable it.
 	void enable(bool enabled);
@@ -125,6 +125,7 @@ const static PROGMEM prog_uchar main_endStops_en[] = "Test End Stops";
 const static PROGMEM prog_uchar main_homingRates_en[] = "Homing Rates";
 const static PROGMEM prog_uchar main_versions_en[] = "Version";
 const static PROGMEM prog_uchar main_eeprom_en[] = "Eeprom";
+const static PROGMEM prog_uchar main_resume_en[] = "Resume Build";
 
 // Value Set screen
 const static PROGMEM prog_uchar vs_message4_en[] = "Up/Dn/Ent to Set";
@@ -123,6 +123,7 @@ const static PROGMEM prog_uchar main_endStops_es[] = "Prueba sensores";
 const static PROGMEM prog_uchar main_homingRates_es[] = "Velocidades";
 const static PROGMEM prog_uchar main_versions_es[] = "Acerca de";
 const static PROGMEM prog_uchar main_eeprom_es[] = "EEPROM";
+const static PROGMEM prog_uchar main_resume_es[] = "Reanudar objeto";
 
 // Value Set screen
 const static PROGMEM prog_uchar vs_message4_es[] = "Arriba/Abajo  OK";
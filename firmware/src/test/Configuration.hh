@@ -3,5 +3,7 @@
 
 #define UART_COUNT 0
 #define HAS_COMMAND_QUEUE 0
+// Test the packet CRC table, as the motherboard uses it
+#define PACKET_CRC_TABLE
 
 #endif // MB_PLATFORM_POSIX_PLATFORM_HH_
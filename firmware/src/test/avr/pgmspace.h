@@ -0,0 +1,22 @@
+#ifndef MB_PLATFORM_POSIX_AVR_PGMSPACE_H_
+#define MB_PLATFORM_POSIX_AVR_PGMSPACE_H_
+
+/*
+ * pgmspace.h
+ *
+ * Program memory is ordinary memory on the host.
+ */
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+
+static inline uint32_t pgm_read_dword_near(const void *addr) {
+	uint32_t dword;
+	memcpy(&dword, addr, sizeof(dword));
+	return dword;
+}
+
+#endif // MB_PLATFORM_POSIX_AVR_PGMSPACE_H_
@@ -98,3 +98,126 @@ TEST(CircularBufferTest,UnderflowCheck) {
         ASSERT_FALSE(cb.hasUnderflow());
     }
 }
+
+TEST(CircularBufferTest,BulkPush) {
+    DEFINE_BUFFER(cb,uint8_t,buffer_size);
+    uint8_t chunk[buffer_size+1];
+    for (int i = 0; i < buffer_size+1; i++) {
+        chunk[i] = i;
+    }
+    // Push chunks of varying size across the end of the buffer and
+    // check that they come back out in order.
+    for (int offset = 0; offset < buffer_size*2; offset++) {
+        int chunk_size = offset%buffer_size + 1;
+        cb.push(chunk,chunk_size);
+        ASSERT_EQ(cb.getLength(),chunk_size);
+        for (int i = 0; i < chunk_size; i++) {
+            ASSERT_EQ(cb.pop(),i);
+        }
+        // advance buffer by one count
+        cb.push(0xff);
+        ASSERT_EQ(cb.pop(),0xff);
+        ASSERT_FALSE(cb.hasOverflow());
+        ASSERT_FALSE(cb.hasUnderflow());
+    }
+    // An oversized push keeps what fits and sets the overflow flag
+    cb.push(chunk,buffer_size+1);
+    ASSERT_TRUE(cb.hasOverflow());
+    ASSERT_EQ(cb.getLength(),buffer_size);
+    for (int i = 0; i < buffer_size; i++) {
+        ASSERT_EQ(cb.pop(),i);
+    }
+}
+
+TEST(CircularBufferTest,ContiguousView) {
+    DEFINE_BUFFER(cb,uint8_t,buffer_size);
+    struct __attribute__ ((packed)) Fields {
+        uint8_t code;
+        int32_t value;
+        int16_t small;
+    } scratch;
+    const uint8_t bytes[] = { 0x42, 0x78, 0x56, 0x34, 0x12, 0xfe, 0xff };
+    // Walk the fields across every position of the wrap point
+    for (int offset = 0; offset < buffer_size*2; offset++) {
+        cb.push(bytes,sizeof(bytes));
+        BufSizeType len;
+        const uint8_t* p = cb.getContiguous(len);
+        ASSERT_EQ(p[0],0x42);
+        ASSERT_LE(len,sizeof(bytes));
+        // each pass advances the start by sizeof(bytes)+1
+        int start = offset*(sizeof(bytes)+1) % buffer_size;
+        ASSERT_TRUE(len == sizeof(bytes) || len == buffer_size - start);
+        uint8_t copy[sizeof(bytes)];
+        cb.peek(copy,sizeof(bytes));
+        ASSERT_EQ(memcmp(copy,bytes,sizeof(bytes)),0);
+        ASSERT_EQ(cb.peekValue<int32_t>(1),0x12345678);
+        ASSERT_EQ(cb.peekValue<int16_t>(5),-2);
+        const Fields* f = cb.view(scratch);
+        ASSERT_EQ(f == &scratch,len < sizeof(Fields));
+        ASSERT_EQ(f->code,0x42);
+        ASSERT_EQ(f->value,0x12345678);
+        ASSERT_EQ(f->small,-2);
+        ASSERT_EQ(cb.getLength(),sizeof(bytes));
+        cb.pop(sizeof(bytes));
+        // advance buffer by one count
+        cb.push(0xff);
+        ASSERT_EQ(cb.pop(),0xff);
+        ASSERT_FALSE(cb.hasOverflow());
+        ASSERT_FALSE(cb.hasUnderflow());
+    }
+}
+
+const BufSizeType fixed_size = 32;
+
+TEST(CircularBufferTest,FixedWalkAround) {
+    FixedCircularBufferTempl<uint8_t,fixed_size> cb;
+    for (int offset = 0; offset < fixed_size*3; offset++) {
+        ASSERT_EQ(cb.getLength(),0);
+        cb.push(offset);
+        ASSERT_EQ(cb.getLength(),1);
+        ASSERT_EQ(cb[0],offset);
+        ASSERT_EQ(cb.peek(),offset);
+        ASSERT_EQ(cb.pop(),offset);
+    }
+    ASSERT_FALSE(cb.hasOverflow());
+    ASSERT_FALSE(cb.hasUnderflow());
+    cb.pop();
+    ASSERT_TRUE(cb.hasUnderflow());
+}
+
+TEST(CircularBufferTest,FixedBulkPushPop) {
+    FixedCircularBufferTempl<uint8_t,fixed_size> cb;
+    uint8_t chunk[fixed_size+1];
+    uint8_t out[fixed_size+1];
+    for (int i = 0; i < fixed_size+1; i++) {
+        chunk[i] = i;
+    }
+    // Push and pop chunks of varying size across the end of the buffer
+    for (int offset = 0; offset < fixed_size*2; offset++) {
+        int chunk_size = offset%fixed_size + 1;
+        cb.push(chunk,chunk_size);
+        ASSERT_EQ(cb.getLength(),chunk_size);
+        ASSERT_EQ(cb.getRemainingCapacity(),fixed_size - chunk_size);
+        ASSERT_EQ(cb[chunk_size-1],chunk_size-1);
+        if (chunk_size >= 4) {
+            ASSERT_EQ(cb.peekValue<int32_t>(0),0x03020100);
+        }
+        cb.pop(out,chunk_size);
+        ASSERT_EQ(memcmp(out,chunk,chunk_size),0);
+        ASSERT_EQ(cb.getLength(),0);
+        // advance buffer by one count
+        cb.push(0xff);
+        ASSERT_EQ(cb.pop(),0xff);
+        ASSERT_FALSE(cb.hasOverflow());
+        ASSERT_FALSE(cb.hasUnderflow());
+    }
+    // An oversized push keeps what fits and sets the overflow flag, and
+    // an oversized pop takes what there is and sets the underflow flag
+    cb.push(chunk,fixed_size+1);
+    ASSERT_TRUE(cb.hasOverflow());
+    ASSERT_EQ(cb.getLength(),fixed_size);
+    cb.pop(out,fixed_size+1);
+    ASSERT_TRUE(cb.hasUnderflow());
+    ASSERT_EQ(cb.getLength(),0);
+    ASSERT_EQ(memcmp(out,chunk,fixed_size),0);
+}
@@ -203,3 +203,103 @@ TEST(PacketTest, PacketSizes)
 	ASSERT_EQ(in_packet.read32(7),p32);
 	ASSERT_EQ(in_packet.read16(11),p16);
 }
+
+/// Check that the CRC table gives the same CRC as the bitwise update for
+/// every CRC and byte.
+TEST(PacketTest, CrcTable)
+{
+	for (int crc = 0; crc < 256; crc++) {
+		for (int data = 0; data < 256; data++) {
+			ASSERT_EQ(crcIButtonUpdate(crc, data), _crc_ibutton_update(crc, data))
+			<< "CRC " << crc << " data " << data;
+		}
+	}
+}
+
+/// Check that appending bytes in bulk gives the same payload and CRC as
+/// appending them one at a time.
+TEST(PacketTest, AppendBytes)
+{
+	OutPacket bulk_packet;
+	OutPacket byte_packet;
+	// Test all valid packet sizes, split in two appends
+	for (int packet_size = MAX_PACKET_PAYLOAD; packet_size >= 0; packet_size--) {
+		uint8_t payload[MAX_PACKET_PAYLOAD];
+		for (int i = 0; i < packet_size; i++) {
+			payload[i] = random(); // Randomize packet contents
+			byte_packet.append8(payload[i]);
+		}
+		const int split = packet_size / 3;
+		bulk_packet.appendBytes(payload, split);
+		bulk_packet.appendBytes(payload + split, packet_size - split);
+		ASSERT_FALSE(bulk_packet.hasError());
+		ASSERT_EQ(bulk_packet.getLength(), packet_size);
+		// the packets should be sent identically, CRC included
+		while (!byte_packet.isFinished()) {
+			ASSERT_EQ(bulk_packet.getNextByteToSend(), byte_packet.getNextByteToSend());
+		}
+		ASSERT_TRUE(bulk_packet.isFinished());
+		bulk_packet.reset();
+		byte_packet.reset();
+	}
+}
+
+/// Check that appending past the end of the payload is an error.
+TEST(PacketTest, AppendBytesOverflow)
+{
+	OutPacket packet;
+	uint8_t payload[MAX_PACKET_PAYLOAD];
+	packet.append8(0);
+	packet.appendBytes(payload, MAX_PACKET_PAYLOAD);
+	ASSERT_TRUE(packet.hasError());
+	ASSERT_EQ(packet.getErrorCode(), PacketError::APPEND_BUFFER_OVERFLOW);
+}
+
+/// Check that a telemetry frame is framed with its own start byte, and that
+/// its CRC covers only the payload.
+TEST(PacketTest, OutTelemetry)
+{
+	OutPacket packet;
+	uint8_t expected_crc = 0;
+	packet.setTelemetry();
+	for (int i = 0; i < 8; i++) {
+		uint8_t data = random();
+		packet.append8(data);
+		expected_crc = _crc_ibutton_update(expected_crc, data);
+	}
+	ASSERT_EQ(packet.getNextByteToSend(), START_BYTE_TELEMETRY);
+	ASSERT_EQ(packet.getNextByteToSend(), 8);
+	for (int i = 0; i < 8; i++) {
+		ASSERT_EQ(packet.getNextByteToSend(), packet.read8(i));
+	}
+	ASSERT_EQ(packet.getNextByteToSend(), expected_crc);
+	ASSERT_TRUE(packet.isFinished());
+	// a reset packet is an ordinary one again
+	packet.reset();
+	ASSERT_EQ(packet.getNextByteToSend(), START_BYTE);
+}
+
+/// Check that a sequenced packet is noise unless the packet accepts them,
+/// and that accepting them survives a reset.
+TEST(PacketTest, InSequenced)
+{
+	OutPacket out_packet;
+	InPacket in_packet;
+	out_packet.setSequence(0x42);
+	out_packet.append8(random());
+	ASSERT_EQ(out_packet.getNextByteToSend(), START_BYTE_SEQ);
+	in_packet.processByte(START_BYTE_SEQ);
+	ASSERT_TRUE(in_packet.hasError());
+	ASSERT_EQ(in_packet.getErrorCode(), PacketError::NOISE_BYTE);
+
+	in_packet.acceptSequenced(true);
+	in_packet.reset();
+	in_packet.processByte(START_BYTE_SEQ);
+	while (!out_packet.isFinished()) {
+		in_packet.processByte(out_packet.getNextByteToSend());
+	}
+	ASSERT_EQ(in_packet.isFinished(), 1);
+	ASSERT_TRUE(in_packet.isSequenced());
+	ASSERT_EQ(in_packet.getSequence(), 0x42);
+	ASSERT_EQ(in_packet.read8(0), out_packet.read8(0));
+}